@@ -110,6 +110,10 @@ MACRO(CHECK_REQUIREMENTS_EXIST)
     endif()
 
 
+    # Threads, for sqlasync() workers
+    find_package(Threads REQUIRED)
+    target_link_libraries(netmud Threads::Threads)
+
     # OPENSSL
     set(OPENSSL_USE_STATIC_LIBS TRUE)
     find_package(OpenSSL REQUIRED )
@@ -157,6 +161,17 @@ MACRO(CHECK_REQUIREMENTS_EXIST)
         message(FATAL_ERROR, "The LIBZ library must be installed to run PennMUSH.")
     endif()
 
+    # zstd, optional, for compressing dumps
+    find_path(ZSTD_INCLUDE_DIR zstd.h)
+    find_library(ZSTD_LIBRARY zstd)
+
+    if(ZSTD_INCLUDE_DIR AND ZSTD_LIBRARY)
+        target_include_directories(netmud PRIVATE ${ZSTD_INCLUDE_DIR})
+        target_link_libraries(netmud ${ZSTD_LIBRARY})
+
+        set(HAVE_ZSTD 1)
+    endif()
+
     # ## FileSystem
     if(EXISTS "/dev/urandom")
         set(HAVE_DEV_URANDOM 1)
@@ -175,7 +190,7 @@ MACRO(CHECK_REQUIREMENTS_EXIST)
 
     check_symbol_exists("fputc_unlocked" "stdio.h" HAVE_PUTC_UNLOCKED)
 
-    set(hdrs "sys/stat.h" "sys/time.h" "sys/types.h" "sys/eventfd.h" "sys/socket.h" "arpa/inet.h"
+    set(hdrs "sys/stat.h" "sys/time.h" "sys/types.h" "sys/eventfd.h" "sys/epoll.h" "sys/socket.h" "arpa/inet.h"
         "libintl.h" "netdb.h" "netinet/tcp.h" "netinet/in.h" "sys/un.h" "sys/resource.h" "sys/event.h" "sys/uio.h"
         "poll.h" "sys/select.h" "sys/inotify.h" "langinfo.h" "event2/event.h" "event2/dns.h"
         "fenv.h" "sys/param.h" "syslog.h" "sys/prctl.h" "byteswap.h" "endian.h" "sys/endian.h" "pthread.h"
@@ -193,7 +208,7 @@ MACRO(CHECK_REQUIREMENTS_EXIST)
     # ## Functions
     set(funs "getdate" "getpagesize" "getrlimit" "getrusage" "getservbyname" "gettext" "getpid" "getppid" "setitimer"
         "nl_langinfo" "setsid" "setpgid" "setpgrp" "log2" "imaxdiv" "hypot" "getuid" "geteuid" "seteuid" "getpriority"
-        "setpriority" "socketpair" "sigaction" "sigprocmask" "writev" "fcntl" "flock" "poll" "kqueue" "inotify_init1" "pread" "pwrite"
+        "setpriority" "socketpair" "sigaction" "sigprocmask" "writev" "fcntl" "flock" "poll" "kqueue" "epoll_create1" "inotify_init1" "pread" "pwrite"
         "eventfd" "pledge" "pipe2" "syslog" "fetestexcept" "feclearexcept" "fdatasync" "usleep" "fullfsync" "localtime_r" "localtime_s"
         "gmtime_r" "isnan" "malloc_usable_size" "fork" "snprintf" "strcasecmp" "strncasecmp" "isnormal" "vasprintf" "strchrnul" "strdup" "strcoll"
         "strxfrm" "sysconf" "textdomain" "vsnprintf" "waitpid" "wait3" "wait" "union_wait" "getpid" "getppid" "poll" "posix_memalign" "writev" "fcntl" "flock"
@@ -70,6 +70,9 @@ ATTR *atr_sub_branch(ATTR *branch);
 ATTR *atr_sub_branch_prev(ATTR *branch);
 void atr_new_add(dbref thing, char const *restrict atr, char const *restrict s,
                  dbref player, uint32_t flags, uint8_t derefs, bool makeroots);
+void atr_new_add_compressed(dbref thing, char const *restrict atr,
+                            char const *restrict data, uint32_t len,
+                            dbref player, uint32_t flags, uint8_t derefs);
 atr_err atr_add(dbref thing, char const *restrict atr, char const *restrict s,
                 dbref player, uint32_t flags);
 atr_err atr_clr(dbref thing, char const *atr, dbref player);
@@ -123,6 +126,10 @@ bool can_edit_attr(dbref player, dbref thing, const char *attrname);
 const char *atr_get_compressed_data(ATTR *atr);
 char *atr_value(ATTR *atr);
 char *safe_atr_value(ATTR *atr, char *check) __attribute_malloc__;
+void atr_cache_forget(chunk_reference_t ref);
+void atr_cache_moved(int count, chunk_reference_t *from,
+                     chunk_reference_t **to);
+void atr_cache_stats(dbref player);
 
 void unanchored_regexp_attr_check(dbref thing, ATTR *atr, dbref player);
 
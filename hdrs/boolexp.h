@@ -48,5 +48,6 @@ char *unparse_boolexp(dbref player, boolexp b, enum u_b_f flag);
 boolexp cleanup_boolexp(boolexp);
 
 bool is_eval_lock(boolexp b);
+bool is_cacheable_lock(boolexp b);
 
 #endif /* BOOLEXP_H */
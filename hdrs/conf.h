@@ -163,9 +163,11 @@ struct options_table {
   int use_ws;                   /**< True to enable websockets */
   char ws_url[FILE_PATH_LEN];   /**< path to recognize as websocket one in HTTP
                                    requests. */
+  int mccp_memory;              /**< Memory for MCCP compression, 0=off */
   char input_db[FILE_PATH_LEN]; /**< Name of the input database file */
   char output_db[FILE_PATH_LEN]; /**< Name of the output database file */
   char crash_db[FILE_PATH_LEN];  /**< Name of the panic database file */
+  char snapshot_db[FILE_PATH_LEN]; /**< Name of the snapshot file, or "" */
   char mail_db[FILE_PATH_LEN];   /**< Name of the mail database file */
   dbref player_start;     /**< The room in which new players are created */
   dbref master_room;      /**< The master room for global commands/exits */
@@ -209,6 +211,7 @@ struct options_table {
   char compressprog[256];     /**< Program to compress database dumps */
   char uncompressprog[256];   /**< Program to uncompress database dumps */
   char compresssuff[256];     /**< Suffix for compressed dump files */
+  int compress_level;         /**< Level for library compression, 0=default */
   char chatdb[FILE_PATH_LEN]; /**< Name of the chat database file */
   int max_player_chans;       /**< Number of channels a player can create */
   int max_channels;           /**< Total maximum allowed channels */
@@ -343,6 +346,8 @@ struct options_table {
                                  kibibytes */
   int chunk_cache_memory;     /**< Memory to use for the attribute cache */
   int chunk_migrate_amount;   /**< Number of attrs to migrate each second */
+  int attr_cache_size;        /**< Number of decompressed attrs to cache */
+  int regexp_cache_size;      /**< Number of compiled regexps to cache */
   char attr_compression[256]; /**< How to compress attribute text in-memory */
   int read_remote_desc; /**< Can players read DESCRIBE attribute remotely? */
   char ssl_private_key_file[FILE_PATH_LEN]; /**< File to load the server's key
@@ -367,6 +372,7 @@ struct options_table {
   char sql_username[256];          /**< Username for sql */
   char sql_password[256];          /**< Password for sql */
   char sql_database[256];          /**< Database for sql */
+  int sql_async_workers;           /**< Threads running sqlasync() queries */
   int log_max_size;                /**< Maximum size of log file */
   char log_size_policy[256];       /**< What to do when a log file is big. */
   char sendmail_prog[256];         /**< Program used to send email. */
@@ -374,6 +380,7 @@ struct options_table {
   int use_connlog;                 /**< Enable connlog record keeping. */
   char
     connlog_db[FILE_PATH_LEN]; /**< Sqlite3 file to use for connection logs. */
+  int connlog_flush_interval; /**< Milliseconds between connlog writes */
   char dict_file[FILE_PATH_LEN]; /**< List of words to load into suggest() db */
   char colors_file[FILE_PATH_LEN]; /**< JSON file holding the colors database */
 };
@@ -449,6 +456,7 @@ int can_view_config_option(dbref player, PENNCONF *opt);
 #define LOG_WIPE_PASSWD (options.log_wipe_passwd)
 #define SUPPORT_PUEBLO (options.support_pueblo)
 #define SUPPORT_WEBSOCKETS (options.use_ws)
+#define MCCP_MEMORY (options.mccp_memory)
 #define SUPPORT_HTML (SUPPORT_PUEBLO || SUPPORT_WEBSOCKETS)
 
 #define QUEUE_QUOTA (options.player_queue_limit)
@@ -545,10 +553,13 @@ int can_view_config_option(dbref player, PENNCONF *opt);
 #define SQL_DB (options.sql_database)
 #define SQL_USER (options.sql_username)
 #define SQL_PASS (options.sql_password)
+#define SQL_ASYNC_WORKERS (options.sql_async_workers)
 
 #define CHUNK_SWAP_FILE (options.chunk_swap_file)
 #define CHUNK_CACHE_MEMORY (options.chunk_cache_memory)
 #define CHUNK_MIGRATE_AMOUNT (options.chunk_migrate_amount)
+#define ATTR_CACHE_SIZE (options.attr_cache_size)
+#define REGEXP_CACHE_SIZE (options.regexp_cache_size)
 
 #define READ_REMOTE_DESC (options.read_remote_desc)
 
@@ -50,6 +50,7 @@ extern dbref first_free; /* pointer to free list */
 
 #define CreTime(x) (db[(x)].creation_time)
 #define ModTime(x) (db[(x)].modification_time)
+#define AttrVersion(x) (db[(x)].attr_version)
 
 #define AttrCount(x) (db[(x)].attrcount)
 #define AttrCap(x) (db[(x)].attrcap)
@@ -77,96 +78,100 @@ extern dbref first_free; /* pointer to free list */
 
 #define IS(thing, type, flag)                                                  \
   ((Typeof(thing) == type) && has_flag_by_name(thing, flag, type))
+/* Same as IS(), for flags in core_flags */
+#define IS_CORE(thing, type, id)                                               \
+  ((Typeof(thing) == type) && HasCoreFlag(thing, id, type))
 
 #define GoodObject(x) ((x >= 0) && (x < db_top))
 
 #define RealGoodObject(x) (GoodObject(x) && !IsGarbage(x))
 
 /******* Player toggles */
-#define Connected(x) (IS(x, TYPE_PLAYER, "CONNECTED"))
-#define Track_Money(x) (IS(x, TYPE_PLAYER, "TRACK_MONEY"))
-#define ZMaster(x) (IS(x, TYPE_PLAYER, "SHARED"))
-#define Unregistered(x) (IS(x, TYPE_PLAYER, "UNREGISTERED"))
-#define Fixed(x) (IS(Owner(x), TYPE_PLAYER, "FIXED"))
-#define Vacation(x) (IS(x, TYPE_PLAYER, "ON-VACATION"))
+#define Connected(x) (IS_CORE(x, TYPE_PLAYER, FH_CONNECTED))
+#define Track_Money(x) (IS_CORE(x, TYPE_PLAYER, FH_TRACK_MONEY))
+#define ZMaster(x) (IS_CORE(x, TYPE_PLAYER, FH_SHARED))
+#define Unregistered(x) (IS_CORE(x, TYPE_PLAYER, FH_UNREGISTERED))
+#define Fixed(x) (IS_CORE(Owner(x), TYPE_PLAYER, FH_FIXED))
+#define Vacation(x) (IS_CORE(x, TYPE_PLAYER, FH_ON_VACATION))
 
 /* Flags that apply to players, and all their stuff,
  * so check the Owner() of the object.
  */
 
 #define Terse(x)                                                               \
-  (IS(Owner(x), TYPE_PLAYER, "TERSE") || IS(x, TYPE_THING, "TERSE"))
-#define Myopic(x) (IS(Owner(x), TYPE_PLAYER, "MYOPIC"))
+  (IS_CORE(Owner(x), TYPE_PLAYER, FH_TERSE) ||                                 \
+   IS_CORE(x, TYPE_THING, FH_TERSE))
+#define Myopic(x) (IS_CORE(Owner(x), TYPE_PLAYER, FH_MYOPIC))
 #define Nospoof(x)                                                             \
-  (IS(Owner(x), TYPE_PLAYER, "NOSPOOF") ||                                     \
-   has_flag_by_name(x, "NOSPOOF", NOTYPE))
+  (IS_CORE(Owner(x), TYPE_PLAYER, FH_NOSPOOF) ||                               \
+   HasCoreFlag(x, FH_NOSPOOF, NOTYPE))
 #define Paranoid(x)                                                            \
-  (IS(Owner(x), TYPE_PLAYER, "PARANOID") ||                                    \
-   has_flag_by_name(x, "PARANOID", NOTYPE))
-#define Gagged(x) (IS(Owner(x), TYPE_PLAYER, "GAGGED"))
-#define ShowAnsi(x) (IS(Owner(x), TYPE_PLAYER, "ANSI"))
-#define ShowAnsiColor(x) (IS(Owner(x), TYPE_PLAYER, "COLOR"))
+  (IS_CORE(Owner(x), TYPE_PLAYER, FH_PARANOID) ||                              \
+   HasCoreFlag(x, FH_PARANOID, NOTYPE))
+#define Gagged(x) (IS_CORE(Owner(x), TYPE_PLAYER, FH_GAGGED))
+#define ShowAnsi(x) (IS_CORE(Owner(x), TYPE_PLAYER, FH_ANSI))
+#define ShowAnsiColor(x) (IS_CORE(Owner(x), TYPE_PLAYER, FH_COLOR))
 
 /******* Thing toggles */
-#define DestOk(x) (IS(x, TYPE_THING, "DESTROY_OK"))
-#define NoLeave(x) (IS(x, TYPE_THING, "NOLEAVE"))
-#define ThingListen(x) (IS(x, TYPE_THING, "MONITOR"))
-#define ThingInhearit(x) (IS(x, TYPE_THING, "LISTEN_PARENT")) /* 0x80 */
-#define ThingZTel(x) (IS(x, TYPE_THING, "Z_TEL"))
+#define DestOk(x) (IS_CORE(x, TYPE_THING, FH_DESTROY_OK))
+#define NoLeave(x) (IS_CORE(x, TYPE_THING, FH_NOLEAVE))
+#define ThingListen(x) (IS_CORE(x, TYPE_THING, FH_MONITOR))
+#define ThingInhearit(x) (IS_CORE(x, TYPE_THING, FH_LISTEN_PARENT)) /* 0x80 */
+#define ThingZTel(x) (IS_CORE(x, TYPE_THING, FH_Z_TEL))
 
 /******* Room toggles */
-#define Floating(x) (IS(x, TYPE_ROOM, "FLOATING"))          /* 0x8 */
-#define Abode(x) (IS(x, TYPE_ROOM, "ABODE"))                /* 0x10 */
-#define JumpOk(x) (IS(x, TYPE_ROOM, "JUMP_OK"))             /* 0x20 */
-#define NoTel(x) (IS(x, TYPE_ROOM, "NO_TEL"))               /* 0x40 */
-#define RoomListen(x) (IS(x, TYPE_ROOM, "LISTENER"))        /* 0x100 */
-#define RoomZTel(x) (IS(x, TYPE_ROOM, "Z_TEL"))             /* 0x200 */
-#define RoomInhearit(x) (IS(x, TYPE_ROOM, "LISTEN_PARENT")) /* 0x400 */
+#define Floating(x) (IS_CORE(x, TYPE_ROOM, FH_FLOATING))          /* 0x8 */
+#define Abode(x) (IS_CORE(x, TYPE_ROOM, FH_ABODE))                /* 0x10 */
+#define JumpOk(x) (IS_CORE(x, TYPE_ROOM, FH_JUMP_OK))             /* 0x20 */
+#define NoTel(x) (IS_CORE(x, TYPE_ROOM, FH_NO_TEL))               /* 0x40 */
+#define RoomListen(x) (IS_CORE(x, TYPE_ROOM, FH_LISTENER))        /* 0x100 */
+#define RoomZTel(x) (IS_CORE(x, TYPE_ROOM, FH_Z_TEL))             /* 0x200 */
+#define RoomInhearit(x) (IS_CORE(x, TYPE_ROOM, FH_LISTEN_PARENT)) /* 0x400 */
 
-#define Uninspected(x) (IS(x, TYPE_ROOM, "UNINSPECTED")) /* 0x1000 */
+#define Uninspected(x) (IS_CORE(x, TYPE_ROOM, FH_UNINSPECTED)) /* 0x1000 */
 
 #define ZTel(x) (ThingZTel(x) || RoomZTel(x))
 
 /******* Exit toggles */
-#define Cloudy(x) (IS(x, TYPE_EXIT, "CLOUDY")) /* 0x8 */
+#define Cloudy(x) (IS_CORE(x, TYPE_EXIT, FH_CLOUDY)) /* 0x8 */
 /* These must be passed exit dbrefs */
 #define HomeExit(x) (Destination(x) == HOME)
 #define VariableExit(x) (Destination(x) == AMBIGUOUS)
 
 /* Flags anything can have */
 
-#define Audible(x) (has_flag_by_name(x, "AUDIBLE", NOTYPE))
-#define ChanUseFirstMatch(x) (has_flag_by_name(x, "CHAN_USEFIRSTMATCH", NOTYPE))
-#define ChownOk(x) (has_flag_by_name(x, "CHOWN_OK", NOTYPE))
-#define Dark(x) (has_flag_by_name(x, "DARK", NOTYPE))
-#define Debug(x) (has_flag_by_name(x, "DEBUG", NOTYPE))
-#define EnterOk(x) (has_flag_by_name(x, "ENTER_OK", NOTYPE))
-#define Going(x) (has_flag_by_name(x, "GOING", NOTYPE))
-#define Going_Twice(x) (has_flag_by_name(x, "GOING_TWICE", NOTYPE))
-#define Halted(x) (has_flag_by_name(x, "HALT", NOTYPE))
-#define Haven(x) (has_flag_by_name(x, "HAVEN", TYPE_PLAYER))
-#define Heavy(x) (has_flag_by_name(x, "HEAVY", NOTYPE))
-#define Inherit(x) (has_flag_by_name(x, "TRUST", NOTYPE))
-#define Light(x) (has_flag_by_name(x, "LIGHT", NOTYPE))
-#define LinkOk(x) (has_flag_by_name(x, "LINK_OK", NOTYPE))
-#define OpenOk(x) (has_flag_by_name(x, "OPEN_OK", TYPE_ROOM))
-#define Loud(x) (has_flag_by_name(x, "LOUD", NOTYPE))
+#define Audible(x) (HasCoreFlag(x, FH_AUDIBLE, NOTYPE))
+#define ChanUseFirstMatch(x) (HasCoreFlag(x, FH_CHAN_USEFIRSTMATCH, NOTYPE))
+#define ChownOk(x) (HasCoreFlag(x, FH_CHOWN_OK, NOTYPE))
+#define Dark(x) (HasCoreFlag(x, FH_DARK, NOTYPE))
+#define Debug(x) (HasCoreFlag(x, FH_DEBUG, NOTYPE))
+#define EnterOk(x) (HasCoreFlag(x, FH_ENTER_OK, NOTYPE))
+#define Going(x) (HasCoreFlag(x, FH_GOING, NOTYPE))
+#define Going_Twice(x) (HasCoreFlag(x, FH_GOING_TWICE, NOTYPE))
+#define Halted(x) (HasCoreFlag(x, FH_HALT, NOTYPE))
+#define Haven(x) (HasCoreFlag(x, FH_HAVEN, TYPE_PLAYER))
+#define Heavy(x) (HasCoreFlag(x, FH_HEAVY, NOTYPE))
+#define Inherit(x) (HasCoreFlag(x, FH_TRUST, NOTYPE))
+#define Light(x) (HasCoreFlag(x, FH_LIGHT, NOTYPE))
+#define LinkOk(x) (HasCoreFlag(x, FH_LINK_OK, NOTYPE))
+#define OpenOk(x) (HasCoreFlag(x, FH_OPEN_OK, TYPE_ROOM))
+#define Loud(x) (HasCoreFlag(x, FH_LOUD, NOTYPE))
 #define Mistrust(x)                                                            \
-  (has_flag_by_name(x, "MISTRUST", TYPE_THING | TYPE_EXIT | TYPE_ROOM))
-#define NoCommand(x) (has_flag_by_name(x, "NO_COMMAND", NOTYPE))
-#define NoWarn(x) (has_flag_by_name(x, "NO_WARN", NOTYPE))
-#define Opaque(x) (has_flag_by_name(x, "OPAQUE", NOTYPE))
-#define Orphan(x) (has_flag_by_name(x, "ORPHAN", NOTYPE))
-#define Puppet(x) (has_flag_by_name(x, "PUPPET", TYPE_THING | TYPE_ROOM))
-#define Quiet(x) (has_flag_by_name(x, "QUIET", NOTYPE))
-#define Safe(x) (has_flag_by_name(x, "SAFE", NOTYPE))
-#define Sticky(x) (has_flag_by_name(x, "STICKY", NOTYPE))
-#define Suspect(x) (has_flag_by_name(x, "SUSPECT", NOTYPE))
-#define Transparented(x) (has_flag_by_name(x, "TRANSPARENT", NOTYPE))
-#define Unfind(x) (has_flag_by_name(x, "UNFINDABLE", NOTYPE))
-#define Verbose(x) (has_flag_by_name(x, "VERBOSE", NOTYPE))
-#define Visual(x) (has_flag_by_name(x, "VISUAL", NOTYPE))
-#define Can_Dark(x) (Wizard(x) || has_power_by_name(x, "Can_Dark", NOTYPE))
+  (HasCoreFlag(x, FH_MISTRUST, TYPE_THING | TYPE_EXIT | TYPE_ROOM))
+#define NoCommand(x) (HasCoreFlag(x, FH_NO_COMMAND, NOTYPE))
+#define NoWarn(x) (HasCoreFlag(x, FH_NO_WARN, NOTYPE))
+#define Opaque(x) (HasCoreFlag(x, FH_OPAQUE, NOTYPE))
+#define Orphan(x) (HasCoreFlag(x, FH_ORPHAN, NOTYPE))
+#define Puppet(x) (HasCoreFlag(x, FH_PUPPET, TYPE_THING | TYPE_ROOM))
+#define Quiet(x) (HasCoreFlag(x, FH_QUIET, NOTYPE))
+#define Safe(x) (HasCoreFlag(x, FH_SAFE, NOTYPE))
+#define Sticky(x) (HasCoreFlag(x, FH_STICKY, NOTYPE))
+#define Suspect(x) (HasCoreFlag(x, FH_SUSPECT, NOTYPE))
+#define Transparented(x) (HasCoreFlag(x, FH_TRANSPARENT, NOTYPE))
+#define Unfind(x) (HasCoreFlag(x, FH_UNFINDABLE, NOTYPE))
+#define Verbose(x) (HasCoreFlag(x, FH_VERBOSE, NOTYPE))
+#define Visual(x) (HasCoreFlag(x, FH_VISUAL, NOTYPE))
+#define Can_Dark(x) (Wizard(x) || HasCoreFlag(x, FH_CAN_DARK, NOTYPE))
 
 /* Attribute flags */
 #define AF_Internal(a) ((a)->flags & AF_INTERNAL)
@@ -196,8 +201,8 @@ extern dbref first_free; /* pointer to free list */
 
 /* Non-mortal checks */
 #define God(x) ((x) == GOD)
-#define Royalty(x) (has_flag_by_name(x, "ROYALTY", NOTYPE))
-#define Wizard(x) (God(x) || has_flag_by_name(x, "WIZARD", NOTYPE))
+#define Royalty(x) (HasCoreFlag(x, FH_ROYALTY, NOTYPE))
+#define Wizard(x) (God(x) || HasCoreFlag(x, FH_WIZARD, NOTYPE))
 #define Hasprivs(x) (God(x) || Royalty(x) || Wizard(x))
 
 #define IsQuiet(x) (Quiet(x) || Quiet(Owner(x)))
@@ -271,6 +276,7 @@ struct object {
    * For other objects, the time/date of last modification to its attributes.
    */
   time_t modification_time;
+  uint32_t attr_version;   /**< Bumped when attributes or their flags change */
   int attrcount;           /**< Number of attribs on the object */
   int attrcap;             /**< Size of the attribute array */
   int type;                /**< Object's type */
@@ -373,7 +379,7 @@ extern const char EOD[];
    (IsThing(x) && (options.monikers & AN_THING)) ||                            \
    (IsRoom(x) && (options.monikers & AN_ROOM)) ||                              \
    (IsExit(x) && (options.monikers & AN_EXIT)) ||                              \
-   has_flag_by_name(x, "MONIKER", NOTYPE))
+   HasCoreFlag(x, FH_MONIKER, NOTYPE))
 #define AnsiNameWrapper(x, accents, level, p, len)                             \
   ((moniker_type(x) && (options.monikers & level))                             \
      ? ansi_name(x, accents, p, len)                                           \
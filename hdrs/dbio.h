@@ -8,6 +8,7 @@
 #define __DBIO_H
 
 #include <setjmp.h>
+#include <stdarg.h>
 #include <stdio.h>
 #ifdef HAVE_LIBZ
 #include <zlib.h>
@@ -19,13 +20,16 @@
 
 extern jmp_buf db_err;
 
+struct dump_writer;
+
 typedef struct pennfile {
-  enum { PFT_FILE, PFT_PIPE, PFT_GZFILE } type;
+  enum { PFT_FILE, PFT_PIPE, PFT_GZFILE, PFT_ASYNC } type;
   union {
     FILE *f;
 #ifdef HAVE_LIBZ
     gzFile g;
 #endif
+    struct dump_writer *w;
   } handle;
 } PENNFILE;
 
@@ -69,6 +73,20 @@ void db_read_labeled_uint32(PENNFILE *f, char **label, uint32_t *val);
 void db_read_this_labeled_dbref(PENNFILE *f, const char *label, dbref *val);
 void db_read_labeled_dbref(PENNFILE *f, char **label, dbref *val);
 
+/* Writing dumps in the background, in dumpwriter.c */
+void dump_writer_begin(void);
+PENNFILE *dump_writer_open(const char *filename);
+void dump_writer_put(struct dump_writer *w, const char *s, size_t len);
+int dump_writer_vprintf(struct dump_writer *w, const char *fmt, va_list ap);
+void dump_writer_close(PENNFILE *pf, const char *rename_to);
+void dump_writer_poll(void);
+bool dump_writer_wait(void);
+struct timeval;
+void dump_writer_stall(struct timeval *start);
+void dump_writer_report(dbref player);
+
+void db_read_setup(void);
 dbref db_read(PENNFILE *f);
+dbref db_read_text(PENNFILE *f);
 
 #endif
@@ -64,6 +64,20 @@ struct chanuser {
   struct chanuser *next; /**< Pointer to next user in list */
 };
 
+/** One entry in a channel's member index.
+ * The index is an array sorted by dbref, so membership tests are a
+ * binary search. Each entry also remembers the results of the
+ * channel's locks for that member, for locks that depend only on the
+ * member's flags and powers.
+ */
+struct chanmember {
+  dbref who;             /**< Dbref of joined object */
+  struct chanuser *user; /**< The member's entry in the user list */
+  uint32_t lockgen;      /**< privs_generation() the lock bits are for */
+  uint8_t lockknown;     /**< Which CLOCK_* lock results are cached */
+  uint8_t lockpass;      /**< Cached lock results */
+};
+
 /* Flags and macros for channel users */
 #define CU_QUIET 0x1   /* Do not hear connection messages */
 #define CU_HIDE 0x2    /* Do not appear on the user list */
@@ -120,6 +134,11 @@ struct channel {
   int num_users;   /**< Number of connected users */
   int max_users;   /**< Maximum allocated users */
   struct chanuser *users; /**< Linked list of current users */
+  struct chanmember *members; /**< Users, sorted by dbref */
+  int num_members;            /**< Number of entries in members */
+  int max_members;            /**< Allocated size of members */
+  uint8_t lockchecked;        /**< Which locks lockcacheable is known for */
+  uint8_t lockcacheable;      /**< Which locks may be cached per member */
   unsigned long int
     num_messages;   /**< How many messages handled by this chan since startup */
   boolexp joinlock; /**< Who may join */
@@ -88,6 +88,9 @@ void send_oob(DESC *d, char *package, cJSON *data);
 
 /* sql.c */
 void sql_shutdown(void);
+extern int sql_async_fd;
+extern int sql_async_generation;
+void sql_async_reap(void);
 
 /* From command.c */
 void generic_command_failure(dbref executor, dbref enactor, char *string,
@@ -100,6 +103,8 @@ void generic_command_failure(dbref executor, dbref enactor, char *string,
 /* #define COMP_STATS /* */
 
 bool init_compress(PENNFILE *);
+bool compress_state(const void **state, size_t *len);
+bool init_compress_state(const void *state, size_t len);
 char *safe_uncompress(char const *) __attribute_malloc__;
 char *text_uncompress(char const *);
 char *text_compress(char const *) __attribute_malloc__;
@@ -545,6 +550,10 @@ bool quick_regexp_match(const char *restrict s, const char *restrict d, bool cs,
                         const char **report_err);
 bool qcomp_regexp_match(const pcre2_code *re, pcre2_match_data *md,
                         const char *s, PCRE2_SIZE);
+bool re_cache_get(struct cached_regexp *cre, const char *pattern,
+                  PCRE2_SIZE len, uint32_t flags, int *errcode);
+void re_cache_put(struct cached_regexp *cre);
+void regexp_cache_stats(dbref player);
 /** Default (case-insensitive) local wildcard match */
 #define local_wild_match(s, d, p) local_wild_match_case(s, d, 0, p)
 
@@ -591,6 +600,7 @@ int undestroy(dbref player, dbref thing);
 
 /* From db.c */
 
+extern unsigned int name_generation;
 const char *set_name(dbref obj, const char *newname);
 dbref new_object(void);
 
@@ -68,6 +68,100 @@ has_power_by_name(dbref thing, const char *flag, int type)
   return has_flag_in_space_by_name("POWER", thing, flag, type);
 }
 
+/** A flag or power name, looked up once and remembered.
+ * Checking an object with a handle tests its bit directly, instead of
+ * finding the flag by name every time. Handles look the name up again
+ * whenever \@flag adds, deletes or aliases a flag. Only full flag names
+ * and aliases are matched, not flag letters or type names.
+ */
+typedef struct flag_handle {
+  const char *ns;      /**< Name of the flagspace */
+  const char *name;    /**< Name of the flag */
+  FLAGSPACE *n;        /**< The flagspace, once looked up */
+  const FLAG *f;       /**< The flag, or NULL if there isn't one */
+  uint32_t generation; /**< flag_generation when it was looked up */
+} FLAG_HANDLE;
+
+/** Initializer for a FLAG_HANDLE */
+#define FLAG_HANDLE_INIT(ns, name)                                             \
+  {                                                                            \
+    (ns), (name), NULL, NULL, 0                                                \
+  }
+
+bool has_flag_handle(dbref thing, FLAG_HANDLE *h, int type);
+uint32_t privs_generation(void);
+
+/** Flags and powers tested by the macros in dbdefs.h */
+enum core_flag {
+  FH_ABODE,
+  FH_ANSI,
+  FH_AUDIBLE,
+  FH_CHAN_USEFIRSTMATCH,
+  FH_CHOWN_OK,
+  FH_CLOUDY,
+  FH_COLOR,
+  FH_CONNECTED,
+  FH_DARK,
+  FH_DEBUG,
+  FH_DESTROY_OK,
+  FH_ENTER_OK,
+  FH_FIXED,
+  FH_FLOATING,
+  FH_GAGGED,
+  FH_GOING,
+  FH_GOING_TWICE,
+  FH_HALT,
+  FH_HAVEN,
+  FH_HEAVY,
+  FH_JUMP_OK,
+  FH_LIGHT,
+  FH_LINK_OK,
+  FH_LISTENER,
+  FH_LISTEN_PARENT,
+  FH_LOUD,
+  FH_MISTRUST,
+  FH_MONIKER,
+  FH_MONITOR,
+  FH_MYOPIC,
+  FH_NOACCENTS,
+  FH_NOLEAVE,
+  FH_NOSPOOF,
+  FH_NO_COMMAND,
+  FH_NO_TEL,
+  FH_NO_WARN,
+  FH_ON_VACATION,
+  FH_OPAQUE,
+  FH_OPEN_OK,
+  FH_ORPHAN,
+  FH_PARANOID,
+  FH_PUPPET,
+  FH_QUIET,
+  FH_ROYALTY,
+  FH_SAFE,
+  FH_SHARED,
+  FH_STICKY,
+  FH_SUSPECT,
+  FH_TERSE,
+  FH_TRACK_MONEY,
+  FH_TRANSPARENT,
+  FH_TRUST,
+  FH_UNFINDABLE,
+  FH_UNINSPECTED,
+  FH_UNREGISTERED,
+  FH_VERBOSE,
+  FH_VISUAL,
+  FH_WIZARD,
+  FH_XTERM256,
+  FH_Z_TEL,
+  FH_CAN_DARK, /* Powers from here on */
+  FH_COUNT
+};
+extern FLAG_HANDLE core_flags[FH_COUNT];
+
+/** Does thing have one of the flags or powers in core_flags? */
+#define HasCoreFlag(thing, id, type)                                           \
+  has_flag_handle((thing), &core_flags[(id)], (type))
+
 const char *unparse_flags(dbref thing, dbref player);
 const char *flag_description(dbref player, dbref thing);
 bool sees_flag(const char *ns, dbref privs, dbref thing, const char *name);
@@ -88,6 +182,7 @@ void twiddle_flag_internal(const char *ns, dbref thing, const char *flag,
                            int negate);
 object_flag_type new_flag_bitmask_ns(FLAGSPACE *);
 object_flag_type new_flag_bitmask(const char *ns);
+uint32_t flag_bitmask_bytes(const char *ns);
 object_flag_type clone_flag_bitmask(const char *ns,
                                     const object_flag_type given);
 void destroy_flag_bitmask(const char *ns, const object_flag_type bitmask);
@@ -129,6 +224,7 @@ enum flag_res add_flag_generic(const char *ns, const char *name,
 int alias_flag_generic(const char *ns, const char *name, const char *alias);
 #define alias_flag(n, a) alias_flag_generic("FLAG", n, a);
 #define alias_power(n, a) alias_flag_generic("POWER", n, a);
+int delete_flag_alias_generic(const char *ns, const char *alias);
 void do_list_flags(const char *ns, dbref player, const char *arg, int style,
                    const char *label);
 #define FLAG_LIST_CHAR 0x01
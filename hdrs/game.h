@@ -204,6 +204,8 @@ extern void do_debug_examine(dbref player, const char *name);
 extern void do_enable(dbref player, const char *param, int state);
 extern void do_kick(dbref player, const char *num);
 extern void do_search(dbref player, const char *arg1, char **arg3);
+extern void search_index_touch(dbref thing);
+extern void search_index_reset(void);
 extern dbref do_pcreate(dbref creator, const char *player_name,
                         const char *player_password, char *try_dbref);
 extern void do_quota(dbref player, const char *arg1, const char *arg2,
@@ -0,0 +1,53 @@
+/**
+ * \file mccp.h
+ *
+ * \brief MUD Client Compression Protocol (MCCP2 and MCCP3) support, and
+ * the WebSocket permessage-deflate extension, which shares its zlib state.
+ */
+
+#ifndef __MCCP_H
+#define __MCCP_H
+
+#include "mushtype.h"
+
+struct z_stream_s;
+
+/** The compression state of a connection */
+struct mccp {
+  struct z_stream_s *out;    /**< Deflating output (MCCP2), or NULL */
+  struct z_stream_s *in;     /**< Inflating input (MCCP3), or NULL */
+  struct z_stream_s *ws_out; /**< Deflating WebSocket messages, or NULL */
+  struct z_stream_s *ws_in;  /**< Inflating WebSocket messages, or NULL */
+  struct text_queue wire;    /**< Compressed output waiting to be sent */
+  int wire_size;             /**< Bytes in wire */
+  uint64_t raw_out;          /**< Bytes of output compressed */
+  uint64_t zip_out;          /**< Bytes they were compressed to */
+  uint64_t raw_in;           /**< Bytes of input decompressed */
+  uint64_t zip_in;           /**< Bytes they were decompressed from */
+};
+
+/** Is output being compressed, or compressed output still waiting? */
+#define MCCPOutput(d)                                                          \
+  ((d)->mccp && ((d)->mccp->out || (d)->mccp->wire.head))
+/** Is there compressed output waiting to be sent? */
+#define MCCPPending(d) ((d)->mccp && (d)->mccp->wire.head)
+/** Is input being decompressed? */
+#define MCCPInput(d) ((d)->mccp && (d)->mccp->in)
+/** Are WebSocket messages being compressed? */
+#define WSDeflate(d) ((d)->mccp && (d)->mccp->ws_out)
+
+bool mccp_room(bool output);
+bool mccp_start_output(DESC *d);
+void mccp_end_output(DESC *d);
+bool mccp_start_input(DESC *d);
+void mccp_free(DESC *d);
+void mccp_compress(DESC *d);
+int mccp_inflate(DESC *d, const char **in, int *inlen, char *out, int outlen);
+bool mccp_start_websocket(DESC *d);
+int mccp_ws_deflate(DESC *d, char prefix, const char *in, int inlen, char *out,
+                    int outlen);
+int mccp_ws_inflate(DESC *d, const char **in, int *inlen, char *out,
+                    int outlen);
+void mccp_show(DESC *d, char *buff, char **bp, const char *nl);
+
+#endif /* __MCCP_H */
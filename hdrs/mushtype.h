@@ -168,7 +168,13 @@ struct mque {
 
   MQUE *inplace; /**< Queue entry to run, either via \@include or \@break,
                     \@foo/inplace, etc */
-  MQUE *next;    /**< The next queue entry in the linked list */
+  MQUE *inplace_last; /**< The last entry in the inplace list */
+  MQUE *next;         /**< The next queue entry in the linked list */
+  MQUE *prev;     /**< The previous entry, in the semaphore queue */
+  MQUE *sem_next; /**< The next entry waiting on the same semaphore */
+  MQUE *sem_prev; /**< The previous entry waiting on the same semaphore */
+  int wait_index; /**< Slot in the wait or semaphore timeout heap, or -1 */
+  uint64_t wait_seq; /**< Order added to the wait or semaphore queue */
 
   char
     *action_list; /**< The action list of commands to run in this queue entry */
@@ -187,13 +193,16 @@ struct mque {
 typedef struct attr ATTR;
 typedef ATTR ALIST;
 
+struct shared_text;
+
 /** A text block
  */
 struct text_block {
-  int nchars;             /**< Number of characters in the block */
-  struct text_block *nxt; /**< Pointer to next block in queue */
-  char *start;            /**< Start of text */
-  char *buf;              /**< Current position in text */
+  int nchars;                 /**< Number of characters in the block */
+  struct text_block *nxt;     /**< Pointer to next block in queue */
+  char *start;                /**< Start of text */
+  char *buf;                  /**< Current position in text */
+  struct shared_text *shared; /**< Shared text start points into, or NULL */
 };
 /** A queue of text blocks.
  */
@@ -262,6 +271,8 @@ struct text_queue {
 /* Flag for WebSocket client. */
 #define CONN_WEBSOCKETS_REQUEST 0x10000000
 #define CONN_WEBSOCKETS 0x20000000
+/* WebSocket client asked for permessage-deflate compression. */
+#define CONN_WEBSOCKETS_DEFLATE 0x40000000
 
 /** Maximum \@doing length */
 #define DOING_LEN 40
@@ -293,7 +304,7 @@ struct squeue {
   void *data;          /** Data to pass to function, or NULL */
   uint64_t when;       /** When to run the function, in milliseconds. */
   char *event;         /** Softcode Event name to trigger, or NULL if none */
-  struct squeue *next; /** Pointer to next squeue event in linked list */
+  uint64_t seq;        /** Order registered, to break ties in when */
 };
 
 /**< Have we used too much CPU? */
@@ -363,6 +374,8 @@ struct descriptor_data {
   const char *close_reason; /**< Why is this socket being closed? */
   dbref closer;             /**< Who closed this socket? */
   struct http_request *http_request;
+  uint32_t poll_events; /**< Events registered with the epoll backend */
+  struct mccp *mccp;    /**< MCCP compression state, or NULL */
 };
 
 enum json_type {
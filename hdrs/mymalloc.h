@@ -8,6 +8,8 @@
 #include "compile.h"
 #include "mushtype.h"
 
+extern uint64_t mush_allocations;
+
 void *mush_malloc(size_t bytes, const char *check) __attribute_malloc__;
 void *mush_malloc_zero(size_t bytes, const char *check) __attribute_malloc__;
 void *mush_calloc(size_t count, size_t size,
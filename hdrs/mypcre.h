@@ -18,4 +18,13 @@ extern pcre2_compile_context *re_compile_ctx;
 extern pcre2_match_context *re_match_ctx;
 extern pcre2_convert_context *glob_convert_ctx;
 
+struct re_cache_entry;
+
+/** A compiled regexp borrowed from the regexp cache with re_cache_get() */
+struct cached_regexp {
+  pcre2_code *re;               /**< The compiled pattern */
+  pcre2_match_data *md;         /**< Match data for re */
+  struct re_cache_entry *entry; /**< The cache entry it belongs to */
+};
+
 #endif /* End of mypcre.h */
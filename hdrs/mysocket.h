@@ -107,6 +107,8 @@ extern BOOL GetErrorMessage(const DWORD dwError, LPTSTR lpszError,
   70 /**< Send MSSP info (http://tintin.sourceforge.net/mssp/)                 \
       */
 #define TN_CHARSET 42            /**< Negotiate Character Set (RFC 2066) */
+#define TN_MCCP2 86              /**< MUD Client Compression Protocol v2 */
+#define TN_MCCP3 87              /**< MUD Client Compression Protocol v3 */
 #define MSSP_VAR 1               /**< MSSP option name */
 #define MSSP_VAL 2               /**< MSSP option value */
 #define TN_SB_CHARSET_REQUEST 1  /**< Charset subnegotiation REQUEST */
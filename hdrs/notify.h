@@ -110,7 +110,7 @@ struct format_msg {
   int numargs;    /**< Number of arguments in args to pass to the ufun */
   char *args[MAX_STACK_ARGS]; /**< Array of arguments to pass to ufun */
 };
-const char *render_string(const char *message, int output_type);
+size_t render_string(const char *message, int output_type, char *buff);
 void notify_list(dbref speaker, dbref thing, const char *atr, const char *msg,
                  int flags, dbref skip);
 
@@ -175,6 +175,7 @@ char *chat_mogrify(dbref mogrifier, const char *attrname, dbref player, int numa
               const char *argv[], const char *orig);
 
 int queue_newwrite(DESC *d, const char *b, int n);
+void notify_output_stats(dbref player);
 
 /* indicate permission denied, with an optional explanation */ 
 void notify_denied_why(dbref target, const char *message);
@@ -97,6 +97,7 @@ int ODBC_InsertQuery(SQLCHAR *query);
 extern int ODBC_MUSH_WriteObject(dbref objID);
 extern int
 ODBC_MUSH_LoadAllObjects(void);
+extern int ODBC_MUSH_CountObjects(void);
 
 extern void ODBC_MUSH_WriteObjAttributes(dbref objID);
 extern void ODBC_MUSH_WriteObjLocks(dbref objID, lock_list *l);
@@ -0,0 +1,41 @@
+/**
+ * \file profile.h
+ *
+ * \brief The softcode profiler.
+ */
+
+#ifndef __PROFILE_H
+#define __PROFILE_H
+
+#include "mushtype.h"
+
+/** What a profiled frame is charged to */
+enum profile_type {
+  PROFILE_COMMAND,   /**< A queue entry not run from an attribute */
+  PROFILE_ATTRIBUTE, /**< An attribute; a queue entry, ufun or \@function */
+  PROFILE_FUNCTION   /**< A function call */
+};
+
+extern bool profile_active;
+
+int profile_enter(enum profile_type type, dbref thing, const char *name);
+void profile_leave(int frame);
+void profile_limit_hit(void);
+
+/** Start a profiled frame, if the profiler is running. The result is
+ * passed to PROFILE_LEAVE() when the frame is done. */
+#define PROFILE_ENTER(type, thing, name)                                       \
+  (profile_active ? profile_enter((type), (thing), (name)) : 0)
+/** Finish a frame started with PROFILE_ENTER() */
+#define PROFILE_LEAVE(frame)                                                   \
+  do {                                                                         \
+    if (frame)                                                                 \
+      profile_leave(frame);                                                    \
+  } while (0)
+
+void profile_start(dbref player);
+void profile_stop(dbref player);
+void profile_report(dbref player, int count);
+void profile_status(dbref player);
+
+#endif /* __PROFILE_H */
@@ -0,0 +1,19 @@
+/**
+ * \file snapshot.h
+ *
+ * \brief Binary database snapshots and journals, for fast startup and
+ * checkpoints.
+ */
+
+#ifndef __SNAPSHOT_H
+#define __SNAPSHOT_H
+
+#include "mushtype.h"
+
+bool snapshot_write(const char *filename);
+dbref snapshot_read(const char *filename);
+bool snapshot_checkpoint(const char *filename);
+void snapshot_compacted(bool ok);
+void snapshot_touch(dbref thing);
+
+#endif /* __SNAPSHOT_H */
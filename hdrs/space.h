@@ -53,7 +53,10 @@
 
 /* ------------------------------------------------------------------------ */
 
-#define SpaceObj(x) (has_flag_by_name(x, "SPACE-OBJECT", TYPE_THING|TYPE_PLAYER))
+#define SpaceObj(x) (has_flag_handle(x, &space_object_flag, TYPE_THING|TYPE_PLAYER))
+#define SpaceJson(x) (has_flag_handle(x, &space_json_flag, TYPE_PLAYER))
+#define SdbOk(x) (has_flag_handle(x, &sdb_ok_power, NOTYPE))
+#define SdbRead(x) (has_flag_handle(x, &sdb_read_power, NOTYPE))
 
 #ifndef PI
 #define PI 3.1415926535898
@@ -318,6 +321,10 @@ struct spaceconfig {
 
 extern intmap *border_map;
 extern HASHTAB aspace_consoles;
+extern FLAG_HANDLE space_object_flag;
+extern FLAG_HANDLE space_json_flag;
+extern FLAG_HANDLE sdb_ok_power;
+extern FLAG_HANDLE sdb_read_power;
 
 
 typedef struct spaceconfig SPACETAB;
@@ -690,6 +697,7 @@ extern double cochrane;
 extern int n;
 extern int max_space_objects;
 extern int max_comms_objects;
+extern unsigned int space_tick;
 
 extern dbref console_security;
 extern dbref console_helm;
@@ -903,6 +911,26 @@ extern void damage_tract (int x, double damage);
 extern void damage_trans (int x, double damage);
 extern void damage_warp (int x, double damage);
 
+/* from space_grid.c */
+extern void grid_rebuild (void);
+extern void grid_move (int x);
+extern int grid_neighbours (int x, int *list);
+
+/* from space_index.c */
+extern void sdb_index_set (int x);
+extern void sdb_index_sync (void);
+extern int sdb_find_object (dbref obj);
+extern int sdb_find_loaded (dbref obj);
+extern int sdb_find_name (const char *name);
+
+/* from space_kernel.c */
+extern void kern_tick_move (const int *list, const int *velocity, int count);
+extern void kern_tick_sensors (const int *list, int count);
+extern void kern_one_velocity (int x);
+extern void kern_one_vectors (int x);
+extern void kern_one_resolution (int x);
+extern void kern_one_signature (int x, double speed);
+
 /* from space_iterate.c */
 extern void up_alloc_balance (void);
 extern void up_main_io (void);
@@ -932,7 +960,6 @@ extern void up_yaw_io (void);
 extern void up_pitch_io (void);
 extern void up_roll_io (void);
 extern void up_vectors (void);
-extern void up_position (void);
 extern void up_resolution (void);
 extern void up_signature (int x);
 extern void up_sensor_message (int contacts);
@@ -1108,6 +1135,7 @@ extern cJSON *get_ship_power(int shipSDB);
 extern cJSON *get_sensor_report(int shipSDB);
 extern cJSON *get_space_status(char *system, char *subsystem, int shipSDB, char *buff,
                         char **bp);
+extern void space_json_iterate(void);
 
 /* ------------------------------------------------------------------------ */
 
@@ -141,59 +141,62 @@
 #define SWITCH_REMIT 137
 #define SWITCH_REMOVE 138
 #define SWITCH_RENAME 139
-#define SWITCH_RESTART 140
-#define SWITCH_RESTORE 141
-#define SWITCH_RESTRICT 142
-#define SWITCH_RETRACT 143
-#define SWITCH_RETROACTIVE 144
-#define SWITCH_REVIEW 145
-#define SWITCH_ROOM 146
-#define SWITCH_ROOMS 147
-#define SWITCH_ROTATE 148
-#define SWITCH_RSARGS 149
-#define SWITCH_RSNOPARSE 150
-#define SWITCH_SAVE 151
-#define SWITCH_SEARCH 152
-#define SWITCH_SEE 153
-#define SWITCH_SEEFLAG 154
-#define SWITCH_SELF 155
-#define SWITCH_SEND 156
-#define SWITCH_SET 157
-#define SWITCH_SETQ 158
-#define SWITCH_SILENT 159
-#define SWITCH_SKIPDEFAULTS 160
-#define SWITCH_SPEAK 161
-#define SWITCH_SPOOF 162
-#define SWITCH_STATS 163
-#define SWITCH_STATUS 164
-#define SWITCH_SUMMARY 165
-#define SWITCH_TABLES 166
-#define SWITCH_TAG 167
-#define SWITCH_TELEPORT 168
-#define SWITCH_TF 169
-#define SWITCH_THINGS 170
-#define SWITCH_TITLE 171
-#define SWITCH_TRACE 172
-#define SWITCH_TRIM 173
-#define SWITCH_TYPE 174
-#define SWITCH_UNCLEAR 175
-#define SWITCH_UNCOMBINE 176
-#define SWITCH_UNFOLDER 177
-#define SWITCH_UNGAG 178
-#define SWITCH_UNHIDE 179
-#define SWITCH_UNMUTE 180
-#define SWITCH_UNREAD 181
-#define SWITCH_UNTAG 182
-#define SWITCH_UNTIL 183
-#define SWITCH_URGENT 184
-#define SWITCH_USEFLAG 185
-#define SWITCH_WHAT 186
-#define SWITCH_WHO 187
-#define SWITCH_WILD 188
-#define SWITCH_WIPE 189
-#define SWITCH_WIZ 190
-#define SWITCH_WIZARD 191
-#define SWITCH_YES 192
-#define SWITCH_ZONE 193
+#define SWITCH_REPORT 140
+#define SWITCH_RESTART 141
+#define SWITCH_RESTORE 142
+#define SWITCH_RESTRICT 143
+#define SWITCH_RETRACT 144
+#define SWITCH_RETROACTIVE 145
+#define SWITCH_REVIEW 146
+#define SWITCH_ROOM 147
+#define SWITCH_ROOMS 148
+#define SWITCH_ROTATE 149
+#define SWITCH_RSARGS 150
+#define SWITCH_RSNOPARSE 151
+#define SWITCH_SAVE 152
+#define SWITCH_SEARCH 153
+#define SWITCH_SEE 154
+#define SWITCH_SEEFLAG 155
+#define SWITCH_SELF 156
+#define SWITCH_SEND 157
+#define SWITCH_SET 158
+#define SWITCH_SETQ 159
+#define SWITCH_SILENT 160
+#define SWITCH_SKIPDEFAULTS 161
+#define SWITCH_SPEAK 162
+#define SWITCH_SPOOF 163
+#define SWITCH_START 164
+#define SWITCH_STATS 165
+#define SWITCH_STATUS 166
+#define SWITCH_STOP 167
+#define SWITCH_SUMMARY 168
+#define SWITCH_TABLES 169
+#define SWITCH_TAG 170
+#define SWITCH_TELEPORT 171
+#define SWITCH_TF 172
+#define SWITCH_THINGS 173
+#define SWITCH_TITLE 174
+#define SWITCH_TRACE 175
+#define SWITCH_TRIM 176
+#define SWITCH_TYPE 177
+#define SWITCH_UNCLEAR 178
+#define SWITCH_UNCOMBINE 179
+#define SWITCH_UNFOLDER 180
+#define SWITCH_UNGAG 181
+#define SWITCH_UNHIDE 182
+#define SWITCH_UNMUTE 183
+#define SWITCH_UNREAD 184
+#define SWITCH_UNTAG 185
+#define SWITCH_UNTIL 186
+#define SWITCH_URGENT 187
+#define SWITCH_USEFLAG 188
+#define SWITCH_WHAT 189
+#define SWITCH_WHO 190
+#define SWITCH_WILD 191
+#define SWITCH_WIPE 192
+#define SWITCH_WIZ 193
+#define SWITCH_WIZARD 194
+#define SWITCH_YES 195
+#define SWITCH_ZONE 196
 
 #endif
@@ -4,6 +4,8 @@
  */
 #pragma once
 
+#include <stddef.h>
+
 #include "log.h"
 
 #define TEST_GROUP(name) void test_##name (int *success, int *failure)
@@ -18,4 +20,10 @@
         } \
     } while (0)
 
+#define BENCHMARK(name) void bench_##name (void)
+
 bool run_tests(void);
+void run_benchmarks(void);
+bool run_in_child(void (*fn)(void *arg, void *result), void *arg,
+                  void *result, size_t size);
+bool test_scratch_dir(char *dir, size_t len, const char *prefix);
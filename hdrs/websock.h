@@ -16,16 +16,29 @@
 #define WEBSOCKET_CHANNEL_PUEBLO ('p')
 #define WEBSOCKET_CHANNEL_PROMPT ('>')
 
+/* Most bytes of queued frames to join into one write. */
+#define WEBSOCKET_COALESCE_MAX 16384
+
+/* Close status for output that can't be sent (RFC 6455, section 7.4.1). */
+#define WEBSOCKET_CLOSE_TOO_BIG 1009
+
 /* notify.c */
 int queue_newwrite_channel(DESC *d, const char *b, int n, char ch);
 int queue_newwrite(DESC *d, const char *b, int n);
 int process_output(DESC *d);
+void coalesce_queue(struct text_queue *q, int max);
+void add_to_queue(struct text_queue *q, const char *b, int n);
+void freeqs(DESC *d);
+
+/* bsd.c */
+void process_input_text(DESC *d, char *tbuf1, int got);
 
 /* websock.c */
 int is_websocket(const char *command);
 int process_websocket_request(DESC *d, const char *command);
 int process_websocket_frame(DESC *d, char *tbuf1, int got);
-void to_websocket_frame(const char **bp, int *np, char channel);
+void to_websocket_frame(DESC *d, const char **bp, int *np, char channel);
+void queue_websocket_close(DESC *d, int status);
 
 int markup_websocket(char *buff, char **bp, char *data, int datalen, char *alt,
                      int altlen, char channel);
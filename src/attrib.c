@@ -13,12 +13,15 @@
 #include <ctype.h>
 
 #include "odbc.h"
+#include "ansi.h"
+#include "case.h"
 #include "chunk.h"
 #include "conf.h"
 #include "dbdefs.h"
 #include "externs.h"
 #include "flags.h"
 #include "htab.h"
+#include "intmap.h"
 #include "lock.h"
 #include "log.h"
 #include "match.h"
@@ -64,6 +67,7 @@ static bool can_debug(dbref player, dbref victim);
 static int atr_count_helper(dbref player, dbref thing, dbref parent,
                             char const *pattern, ATTR *atr, void *args);
 static void set_cmd_flags(ATTR *a);
+static void comm_index_forget(dbref obj);
 
 /*======================================================================*/
 
@@ -763,6 +767,8 @@ atr_new_add(dbref thing, const char *restrict atr, const char *restrict s,
   if (!EMPTY_ATTRS && !*s && !(flags & AF_ROOT))
     return;
 
+  AttrVersion(thing)++;
+
   /* Don't fail on a bad name, but do log it */
   if (!good_atr_name(atr))
     do_rawlog(LT_ERR, "Bad attribute name %s on object %s", atr,
@@ -837,6 +843,41 @@ atr_new_add(dbref thing, const char *restrict atr, const char *restrict s,
   }
 }
 
+/** Add an attribute whose value is already compressed, dangerously.
+ * Like atr_new_add(), but for database loaders that already hold the
+ * value exactly as compress() would give it, along with the AF_COMMAND
+ * and AF_LISTEN bits that go with it. It doesn't check for duplicates
+ * or missing roots, so attributes must be added in list order.
+ * \param thing object to set the attribute on.
+ * \param atr name of the attribute to set.
+ * \param data the compressed value.
+ * \param len length of the compressed value.
+ * \param player the attribute creator.
+ * \param flags bitmask of attribute flags for this attribute.
+ * \param derefs the initial deref count to use for the attribute value.
+ */
+void
+atr_new_add_compressed(dbref thing, const char *restrict atr,
+                       const char *restrict data, uint32_t len, dbref player,
+                       uint32_t flags, uint8_t derefs)
+{
+  ATTR *ptr;
+
+  if (!EMPTY_ATTRS && !len && !(flags & AF_ROOT))
+    return;
+
+  AttrVersion(thing)++;
+
+  ptr = create_atr(thing, atr);
+  if (!ptr)
+    return;
+
+  AL_FLAGS(ptr) = flags;
+  AL_CREATOR(ptr) = player;
+  if (len)
+    ptr->data = chunk_create(data, len, derefs);
+}
+
 static void
 set_cmd_flags(ATTR *a)
 {
@@ -963,6 +1004,7 @@ atr_add(dbref thing, const char *restrict atr, const char *restrict s,
          * we modify even if we fail */
         if (!IsPlayer(thing) && !AF_Nodump(root))
           ModTime(thing) = mudtime;
+        AttrVersion(thing)++;
 
         set_default_flags(root, flags);
         AL_FLAGS(root) &= ~AF_COMMAND & ~AF_LISTEN;
@@ -991,6 +1033,7 @@ atr_add(dbref thing, const char *restrict atr, const char *restrict s,
    * we modify even if we fail */
   if (!IsPlayer(thing) && !AF_Nodump(ptr))
     ModTime(thing) = mudtime;
+  AttrVersion(thing)++;
 
   /* change owner */
   AL_CREATOR(ptr) = Owner(player);
@@ -1120,6 +1163,7 @@ real_atr_clr(dbref thing, char const *atr, dbref player, int we_are_wiping)
 
     if (!IsPlayer(thing) && !AF_Nodump(ptr))
       ModTime(thing) = mudtime;
+    AttrVersion(thing)++;
 
     atr_free_one(thing, ptr);
 
@@ -1673,6 +1717,8 @@ atr_free_all(dbref thing)
   if (!IsPlayer(thing) && AttrCount(thing)) {
     ModTime(thing) = mudtime;
   }
+  AttrVersion(thing)++;
+  comm_index_forget(thing);
 
   ATTR_FOR_EACH (thing, ptr) {
     if (ptr->data)
@@ -1900,6 +1946,219 @@ cmdatr_lock_check(dbref player, dbref thing, const char *atrname,
   return parse_number(buff);
 }
 
+/* Index of the $-commands and ^-listens on each object.
+ *
+ * atr_comm_match() runs against every object in the room, the enactor's
+ * inventory and the master room for each command that isn't built in, and
+ * used to decompress and pattern match every $-attribute every time. Each
+ * object now gets a lazily built list of its own $ and ^ patterns, along
+ * with the literal text any glob match has to start with, so most objects
+ * can be turned away without touching an attribute value. A list is
+ * rebuilt when AttrVersion() shows that an attribute or attribute flag on
+ * its object has changed. Parents each have their own list and the parent
+ * chain is followed afresh on every call, so @parent needs no special
+ * handling.
+ */
+
+/** One $ or ^ pattern on an object. */
+struct comm_pattern {
+  int pos;           /**< Position of the attribute in List(obj) */
+  uint32_t flags;    /**< The attribute's flags */
+  char *pattern;     /**< Pattern as atr_single_match_r() would use it */
+  char *prefix;      /**< Literal text a glob match has to start with */
+  size_t prefix_len; /**< Length of prefix */
+};
+
+/** All the patterns on an object. */
+struct comm_index {
+  uint32_t version;              /**< AttrVersion() when it was built */
+  bool built;                    /**< False if it needs (re)building */
+  int count;                     /**< Number of patterns */
+  struct comm_pattern *patterns; /**< Patterns, in attribute order */
+  bool any[2];        /**< Some $ (0) or ^ (1) pattern can match anything */
+  uint8_t first[2][32]; /**< Upcased first characters of prefixes */
+};
+
+static intmap *comm_indexes = NULL;
+
+static void
+comm_index_clear(struct comm_index *ci)
+{
+  int n;
+
+  for (n = 0; n < ci->count; n++) {
+    mush_free(ci->patterns[n].pattern, "comm_index.pattern");
+    mush_free(ci->patterns[n].prefix, "comm_index.pattern");
+  }
+  if (ci->patterns)
+    mush_free(ci->patterns, "comm_index.patterns");
+  ci->patterns = NULL;
+  ci->count = 0;
+  ci->built = 0;
+  memset(ci->any, 0, sizeof ci->any);
+  memset(ci->first, 0, sizeof ci->first);
+}
+
+/* Pull the pattern out of a $ or ^ attribute value the same way
+ * atr_single_match_r() does. Returns false if it isn't one. */
+static bool
+comm_extract_pattern(const char *atrval, int end, char *buff)
+{
+  int i, j;
+
+  if (!atrval || !atrval[0] || !atrval[1])
+    return 0;
+  if (atrval[0] != '^' && atrval[0] != '$')
+    return 0;
+  for (i = 1, j = 0; atrval[i] && atrval[i] != end; i++) {
+    if (atrval[i] == '\\' && atrval[i + 1]) {
+      if (atrval[i + 1] == end) {
+        i++;
+      } else {
+        buff[j++] = atrval[i++];
+      }
+    }
+    buff[j++] = atrval[i];
+  }
+  buff[j] = '\0';
+  return atrval[i] != '\0';
+}
+
+static void
+comm_index_build(dbref obj, struct comm_index *ci)
+{
+  char buff[BUFFER_LEN];
+  char prefix[BUFFER_LEN];
+  struct comm_pattern *cp;
+  const char *p;
+  ATTR *ptr;
+  int n = 0, kind;
+  size_t len;
+
+  comm_index_clear(ci);
+  ci->version = AttrVersion(obj);
+  ci->built = 1;
+
+  ATTR_FOR_EACH (obj, ptr) {
+    if (AL_FLAGS(ptr) & (AF_COMMAND | AF_LISTEN))
+      n++;
+  }
+  if (!n)
+    return;
+  ci->patterns =
+    mush_calloc(n, sizeof(struct comm_pattern), "comm_index.patterns");
+
+  ATTR_FOR_EACH (obj, ptr) {
+    if (!(AL_FLAGS(ptr) & (AF_COMMAND | AF_LISTEN)))
+      continue;
+    if (!comm_extract_pattern(atr_value(ptr), ':', buff))
+      continue; /* Can never match */
+
+    len = 0;
+    if (!AF_Regexp(ptr)) {
+      /* Everything up to the first wildcard must match literally. */
+      for (p = remove_markup(buff, NULL); *p && *p != '*' && *p != '?';
+           p++) {
+        if (*p == '\\' && !*++p)
+          break;
+        prefix[len++] = *p;
+      }
+    }
+    prefix[len] = '\0';
+
+    cp = &ci->patterns[ci->count++];
+    cp->pos = ptr - List(obj);
+    cp->flags = AL_FLAGS(ptr);
+    cp->pattern = mush_strdup(buff, "comm_index.pattern");
+    cp->prefix = mush_strdup(prefix, "comm_index.pattern");
+    cp->prefix_len = len;
+
+    for (kind = 0; kind < 2; kind++) {
+      if (!(cp->flags & (kind ? AF_LISTEN : AF_COMMAND)))
+        continue;
+      if (!len) {
+        ci->any[kind] = 1;
+      } else {
+        unsigned char c = UPCASE((unsigned char) prefix[0]);
+        ci->first[kind][c >> 3] |= 1 << (c & 7);
+      }
+    }
+  }
+}
+
+/* Return obj's index, building it if it's missing or out of date. The
+ * struct itself is never freed, so callers can hold on to it across code
+ * that might rebuild it, as long as they check the version again. */
+static struct comm_index *
+comm_index_get(dbref obj)
+{
+  struct comm_index *ci;
+
+  if (!comm_indexes)
+    comm_indexes = im_new();
+  ci = im_find(comm_indexes, obj);
+  if (!ci) {
+    ci = mush_calloc(1, sizeof(struct comm_index), "comm_index");
+    im_insert(comm_indexes, obj, ci);
+  }
+  if (!ci->built || ci->version != AttrVersion(obj))
+    comm_index_build(obj, ci);
+  return ci;
+}
+
+/** Throw away the $-command index of an object whose attributes are being
+ * freed.
+ * \param obj the object.
+ */
+static void
+comm_index_forget(dbref obj)
+{
+  struct comm_index *ci;
+
+  if (comm_indexes && (ci = im_find(comm_indexes, obj)))
+    comm_index_clear(ci);
+}
+
+/* Could input, already stripped of markup, match this pattern? */
+static bool
+comm_pattern_may_match(const struct comm_pattern *cp, const char *input,
+                       size_t len)
+{
+  size_t n;
+
+  if (cp->flags & AF_REGEXP)
+    return 1;
+  if (cp->prefix_len > len)
+    return 0;
+  if (cp->flags & AF_CASE)
+    return !memcmp(cp->prefix, input, cp->prefix_len);
+  for (n = 0; n < cp->prefix_len; n++)
+    if (UPCASE((unsigned char) cp->prefix[n]) !=
+        UPCASE((unsigned char) input[n]))
+      return 0;
+  return 1;
+}
+
+/* Could input match any of obj's own $ (kind 0) or ^ (kind 1) patterns? */
+static bool
+comm_index_may_match(dbref obj, int kind, const char *input, size_t len)
+{
+  struct comm_index *ci = comm_index_get(obj);
+  uint32_t flag = kind ? AF_LISTEN : AF_COMMAND;
+  unsigned char c = UPCASE((unsigned char) *input);
+  int n;
+
+  if (ci->any[kind])
+    return 1;
+  if (!(ci->first[kind][c >> 3] & (1 << (c & 7))))
+    return 0;
+  for (n = 0; n < ci->count; n++)
+    if ((ci->patterns[n].flags & flag) &&
+        comm_pattern_may_match(&ci->patterns[n], input, len))
+      return 1;
+  return 0;
+}
+
 /** Match input against a $command or ^listen attribute.
  * This function attempts to match a string against either the $commands
  * or ^listens on an object. Matches may be glob or regex matches,
@@ -1948,6 +2207,13 @@ atr_comm_match(dbref thing, dbref player, int type, int end, char const *str,
   dbref current = thing, next = NOTHING;
   int parent_count = 0;
   StrTree seen, nocmd_roots, private_attrs;
+  char stripped[BUFFER_LEN];
+  const char *input = str;
+  size_t input_len = 0;
+  struct comm_index *ci = NULL;
+  uint32_t ci_version = 0;
+  int ci_pos = 0;
+  bool use_index = (end == ':');
 
   /* check for lots of easy ways out */
   if (type != '$' && type != '^')
@@ -1961,8 +2227,8 @@ atr_comm_match(dbref thing, dbref player, int type, int end, char const *str,
     parent_depth = GoodObject(Parent(thing));
   } else {
     flag_mask = AF_LISTEN;
-    if (has_flag_by_name(thing, "LISTEN_PARENT",
-                         TYPE_PLAYER | TYPE_THING | TYPE_ROOM)) {
+    if (HasCoreFlag(thing, FH_LISTEN_PARENT,
+                    TYPE_PLAYER | TYPE_THING | TYPE_ROOM)) {
       parent_depth = GoodObject(Parent(thing));
     } else {
       parent_depth = 0;
@@ -1970,6 +2236,26 @@ atr_comm_match(dbref thing, dbref player, int type, int end, char const *str,
   }
   match = 0;
 
+  if (use_index) {
+    /* Skip the whole thing if nothing on thing or its parents could
+     * possibly match. */
+    if (has_markup(str))
+      input = mush_strncpy(stripped, remove_markup(str, NULL), sizeof stripped);
+    input_len = strlen(input);
+    do {
+      next = parent_depth ? next_parent(thing, current, &parent_count, NULL)
+                          : NOTHING;
+      if (!GoodObject(current) ||
+          comm_index_may_match(current, type == '^', input, input_len))
+        break;
+    } while ((current = next) != NOTHING);
+    if (current == NOTHING)
+      return 0;
+    current = thing;
+    next = NOTHING;
+    parent_count = 0;
+  }
+
   pe_info = make_pe_info("pe_info-atr_comm_match");
   if (from_queue && from_queue->pe_info && *from_queue->pe_info->cmd_raw) {
     pe_info->cmd_raw = mush_strdup(from_queue->pe_info->cmd_raw, "string");
@@ -1999,6 +2285,13 @@ atr_comm_match(dbref thing, dbref player, int type, int end, char const *str,
 
     st_flush(&private_attrs);
 
+    if (use_index && GoodObject(current)) {
+      ci = comm_index_get(current);
+      ci_version = ci->version;
+      ci_pos = 0;
+    } else
+      ci = NULL;
+
     ATTR_FOR_EACH (current, ptr) {
       if (cpu_time_limit_hit)
         break;
@@ -2088,6 +2381,29 @@ atr_comm_match(dbref thing, dbref player, int type, int end, char const *str,
           continue;
       }
 
+      if (ci) {
+        /* Locks and matched commands can run softcode that changes the
+         * attributes under us; stop trusting the index if they do. */
+        if (ci->version != ci_version || ci->version != AttrVersion(current)) {
+          ci = NULL;
+        } else {
+          struct comm_pattern *cp;
+
+          while (ci_pos < ci->count &&
+                 ci->patterns[ci_pos].pos < ptr - List(current))
+            ci_pos++;
+          if (ci_pos >= ci->count ||
+              ci->patterns[ci_pos].pos != ptr - List(current))
+            continue; /* Not a valid pattern */
+          cp = &ci->patterns[ci_pos];
+          if (!comm_pattern_may_match(cp, input, input_len))
+            continue;
+          if (!(cp->flags & AF_REGEXP) &&
+              !quick_wild_new(cp->pattern, str, cp->flags & AF_CASE))
+            continue;
+        }
+      }
+
       match_found =
         atr_single_match_r(ptr, flag_mask, end, str, args, match_space,
                            match_space_len, cmd_buff, pe_regs);
@@ -2330,7 +2646,7 @@ int
 do_set_atr(dbref thing, const char *restrict atr, const char *restrict s,
            dbref player, uint32_t flags)
 {
-  ATTR *old;
+  ATTR *old, *a;
   char name[BUFFER_LEN];
   char tbuf1[BUFFER_LEN];
   atr_err res;
@@ -2472,7 +2788,8 @@ do_set_atr(dbref thing, const char *restrict atr, const char *restrict s,
   query->fields[3].iValue = player;
   query->fields[3].type = ODBC_INT;
   query->fields[4].name = "flags";
-  query->fields[4].sValue = bits_to_string("FLAG", (flags > 1) ? flags : 0, GOD,thing);
+  a = atr_get_noparent(thing, name);
+  query->fields[4].sValue = (SQLCHAR *) (a ? atrflag_to_string(AL_FLAGS(a)) : "");
   query->fields[4].type = ODBC_CHAR;
   query->fields[5].name = "derefs";
   query->fields[5].iValue = 0;
@@ -2654,9 +2971,11 @@ do_atrlock(dbref player, const char *src, const char *action)
     if (status == ATRLOCK_LOCK) {
       AL_FLAGS(ptr) |= AF_LOCKED;
       AL_CREATOR(ptr) = Owner(player);
+      AttrVersion(thing)++;
       notify(player, T("Attribute locked."));
     } else if (status == ATRLOCK_UNLOCK) {
       AL_FLAGS(ptr) &= ~AF_LOCKED;
+      AttrVersion(thing)++;
       notify(player, T("Attribute unlocked."));
     } else {
       notify(player, T("Invalid status."));
@@ -2727,6 +3046,7 @@ do_atrchown(dbref player, const char *xarg1, const char *arg2)
         goto cleanup;
       }
       AL_CREATOR(ptr) = Owner(new_owner);
+      AttrVersion(thing)++;
       notify(player, T("Attribute owner changed."));
       retval = 1;
       goto cleanup;
@@ -2767,6 +3087,271 @@ atr_free_one(dbref thing, ATTR *a)
   AttrCount(thing) -= 1;
 }
 
+/* Cache of decompressed attribute values, keyed by chunk reference.
+ *
+ * A chunk's contents never change while its reference is live, so an
+ * entry only goes stale when the chunk is freed or moved. chunk_delete()
+ * and chunk_migration() tell us about both through atr_cache_forget() and
+ * atr_cache_moved(); atr_add() and atr_clr() always replace or free the
+ * old chunk, so they're covered too.
+ */
+struct atr_cache_entry {
+  chunk_reference_t ref; /**< Chunk holding the compressed value */
+  char *value;           /**< Decompressed value */
+  size_t len;            /**< Length of value */
+  int hash_next;         /**< Next entry in the same bucket, -1 if none */
+  int lru_prev;          /**< More recently used entry, -1 if none */
+  int lru_next;          /**< Less recently used entry, -1 if none */
+};
+
+static struct atr_cache_entry *atr_cache = NULL;
+static int *atr_cache_buckets = NULL;
+static int atr_cache_alloced = 0; /**< Entries allocated */
+static unsigned int atr_cache_mask = 0;
+static int atr_cache_used = 0;
+static int atr_cache_free = -1; /**< Unused entries, chained by hash_next */
+static int atr_cache_head = -1; /**< Most recently used */
+static int atr_cache_tail = -1; /**< Least recently used */
+static size_t atr_cache_bytes = 0;
+static unsigned long atr_cache_hits = 0;
+static unsigned long atr_cache_misses = 0;
+static unsigned long atr_cache_evictions = 0;
+static unsigned long atr_cache_forgets = 0;
+
+static unsigned int
+atr_cache_hash(chunk_reference_t ref)
+{
+  uint64_t h = (uint64_t) ref * UINT64_C(0x9E3779B97F4A7C15);
+  return (unsigned int) (h >> 32) & atr_cache_mask;
+}
+
+static void
+atr_cache_lru_unlink(int i)
+{
+  if (atr_cache[i].lru_prev >= 0)
+    atr_cache[atr_cache[i].lru_prev].lru_next = atr_cache[i].lru_next;
+  else
+    atr_cache_head = atr_cache[i].lru_next;
+  if (atr_cache[i].lru_next >= 0)
+    atr_cache[atr_cache[i].lru_next].lru_prev = atr_cache[i].lru_prev;
+  else
+    atr_cache_tail = atr_cache[i].lru_prev;
+}
+
+static void
+atr_cache_lru_push(int i)
+{
+  atr_cache[i].lru_prev = -1;
+  atr_cache[i].lru_next = atr_cache_head;
+  if (atr_cache_head >= 0)
+    atr_cache[atr_cache_head].lru_prev = i;
+  else
+    atr_cache_tail = i;
+  atr_cache_head = i;
+}
+
+/* Find the entry for ref, or -1. If prev isn't NULL, it's set to the
+ * entry before it on the bucket chain, or -1 if it's first. */
+static int
+atr_cache_find(chunk_reference_t ref, int *prev)
+{
+  int i, p = -1;
+
+  for (i = atr_cache_buckets[atr_cache_hash(ref)]; i >= 0;
+       p = i, i = atr_cache[i].hash_next)
+    if (atr_cache[i].ref == ref)
+      break;
+  if (prev)
+    *prev = p;
+  return i;
+}
+
+/* Take entry i off its bucket chain and out of the LRU list. The caller
+ * decides what happens to its value. */
+static void
+atr_cache_unlink(int i, int prev)
+{
+  if (prev >= 0)
+    atr_cache[prev].hash_next = atr_cache[i].hash_next;
+  else
+    atr_cache_buckets[atr_cache_hash(atr_cache[i].ref)] =
+      atr_cache[i].hash_next;
+  atr_cache_lru_unlink(i);
+}
+
+static void
+atr_cache_release(int i)
+{
+  atr_cache_bytes -= atr_cache[i].len + 1;
+  mush_free(atr_cache[i].value, "atr_cache.value");
+  atr_cache[i].value = NULL;
+  atr_cache[i].hash_next = atr_cache_free;
+  atr_cache_free = i;
+  atr_cache_used--;
+}
+
+/* Throw everything away and size the table for ATTR_CACHE_SIZE entries. */
+static void
+atr_cache_resize(void)
+{
+  int i;
+  unsigned int buckets;
+
+  for (i = atr_cache_head; i >= 0; i = atr_cache[i].lru_next)
+    mush_free(atr_cache[i].value, "atr_cache.value");
+  if (atr_cache) {
+    mush_free(atr_cache, "atr_cache");
+    mush_free(atr_cache_buckets, "atr_cache.buckets");
+  }
+  atr_cache = NULL;
+  atr_cache_buckets = NULL;
+  atr_cache_alloced = atr_cache_used = 0;
+  atr_cache_free = atr_cache_head = atr_cache_tail = -1;
+  atr_cache_bytes = 0;
+
+  if (ATTR_CACHE_SIZE <= 0)
+    return;
+
+  for (buckets = 16; buckets < (unsigned int) ATTR_CACHE_SIZE * 2;
+       buckets <<= 1)
+    ;
+  atr_cache = mush_calloc(ATTR_CACHE_SIZE, sizeof(struct atr_cache_entry),
+                          "atr_cache");
+  atr_cache_buckets = mush_calloc(buckets, sizeof(int), "atr_cache.buckets");
+  if (!atr_cache || !atr_cache_buckets)
+    mush_panic("Unable to allocate attribute value cache");
+  for (i = 0; i < (int) buckets; i++)
+    atr_cache_buckets[i] = -1;
+  for (i = ATTR_CACHE_SIZE - 1; i >= 0; i--) {
+    atr_cache[i].hash_next = atr_cache_free;
+    atr_cache_free = i;
+  }
+  atr_cache_mask = buckets - 1;
+  atr_cache_alloced = ATTR_CACHE_SIZE;
+}
+
+/* Return the cache entry holding atr's decompressed value, filling it in
+ * if needed, or -1 if the cache is turned off. */
+static int
+atr_cache_lookup(ATTR *atr)
+{
+  char *value;
+  int i, prev;
+
+  if (atr_cache_alloced != ATTR_CACHE_SIZE)
+    atr_cache_resize();
+  if (!atr_cache || !atr->data)
+    return -1;
+
+  i = atr_cache_find(atr->data, NULL);
+  if (i >= 0) {
+    atr_cache_hits++;
+    if (i != atr_cache_head) {
+      atr_cache_lru_unlink(i);
+      atr_cache_lru_push(i);
+    }
+    return i;
+  }
+
+  atr_cache_misses++;
+  value = uncompress(atr_get_compressed_data(atr));
+  if (atr_cache_free < 0) {
+    i = atr_cache_find(atr_cache[atr_cache_tail].ref, &prev);
+    atr_cache_unlink(i, prev);
+    atr_cache_release(i);
+    atr_cache_evictions++;
+  }
+  i = atr_cache_free;
+  atr_cache_free = atr_cache[i].hash_next;
+  atr_cache[i].ref = atr->data;
+  atr_cache[i].len = strlen(value);
+  atr_cache[i].value = mush_strdup(value, "atr_cache.value");
+  atr_cache_bytes += atr_cache[i].len + 1;
+  atr_cache_used++;
+  atr_cache[i].hash_next = atr_cache_buckets[atr_cache_hash(atr->data)];
+  atr_cache_buckets[atr_cache_hash(atr->data)] = i;
+  atr_cache_lru_push(i);
+  return i;
+}
+
+/** Drop the cached value of a chunk that's about to be freed.
+ * \param ref the chunk reference.
+ */
+void
+atr_cache_forget(chunk_reference_t ref)
+{
+  int i, prev;
+
+  if (!atr_cache || !ref)
+    return;
+  i = atr_cache_find(ref, &prev);
+  if (i < 0)
+    return;
+  atr_cache_unlink(i, prev);
+  atr_cache_release(i);
+  atr_cache_forgets++;
+}
+
+/** Refile the cached values of chunks that have been migrated.
+ * One migration can move a chunk into a reference another chunk in
+ * the same batch just left, so everything is taken out of the table
+ * before anything is put back.
+ * \param count the number of chunks.
+ * \param from the chunks' old references.
+ * \param to the chunks' new references.
+ */
+void
+atr_cache_moved(int count, chunk_reference_t *from,
+                chunk_reference_t **to)
+{
+  int i, j, prev, moved = -1;
+  unsigned int h;
+
+  if (!atr_cache)
+    return;
+  for (j = 0; j < count; j++) {
+    if (from[j] == *to[j])
+      continue;
+    i = atr_cache_find(from[j], &prev);
+    if (i < 0)
+      continue;
+    if (prev >= 0)
+      atr_cache[prev].hash_next = atr_cache[i].hash_next;
+    else
+      atr_cache_buckets[atr_cache_hash(from[j])] = atr_cache[i].hash_next;
+    atr_cache[i].ref = *to[j];
+    atr_cache[i].hash_next = moved;
+    moved = i;
+  }
+  while (moved >= 0) {
+    i = moved;
+    moved = atr_cache[i].hash_next;
+    h = atr_cache_hash(atr_cache[i].ref);
+    atr_cache[i].hash_next = atr_cache_buckets[h];
+    atr_cache_buckets[h] = i;
+  }
+}
+
+/** Report attribute value cache statistics.
+ * \param player the player to display it to.
+ */
+void
+atr_cache_stats(dbref player)
+{
+  unsigned long lookups = atr_cache_hits + atr_cache_misses;
+
+  notify_format(player, "Attr cache:%10d cached    (%10lu bytes, %10d max)",
+                atr_cache_used, (unsigned long) atr_cache_bytes,
+                ATTR_CACHE_SIZE);
+  notify_format(player,
+                "           %10lu hits      (%10lu misses, %3lu%% hit rate)",
+                atr_cache_hits, atr_cache_misses,
+                lookups ? atr_cache_hits * 100 / lookups : 0);
+  notify_format(player,
+                "           %10lu evicted   (%10lu freed or rewritten)",
+                atr_cache_evictions, atr_cache_forgets);
+}
+
 /** Return the compressed data for an attribute.
  * This is a chokepoint function for accessing the chunk data.
  * \param atr the attribute struct from which to get the data reference.
@@ -2796,7 +3381,14 @@ atr_get_compressed_data(ATTR *atr)
 char *
 atr_value(ATTR *atr)
 {
-  return uncompress(atr_get_compressed_data(atr));
+  static char value[BUFFER_LEN];
+  int i = atr_cache_lookup(atr);
+
+  if (i < 0)
+    return uncompress(atr_get_compressed_data(atr));
+  /* Callers are allowed to scribble on the result, so hand out a copy. */
+  memcpy(value, atr_cache[i].value, atr_cache[i].len + 1);
+  return value;
 }
 
 /** Return the uncompressed data for an attribute in a dynamic buffer.
@@ -2809,6 +3401,11 @@ atr_value(ATTR *atr)
 char *
 safe_atr_value(ATTR *atr, char *check)
 {
+  int i;
+
   add_check(check);
-  return safe_uncompress(atr_get_compressed_data(atr));
+  i = atr_cache_lookup(atr);
+  if (i < 0)
+    return safe_uncompress(atr_get_compressed_data(atr));
+  return strdup(atr_cache[i].value);
 }
@@ -2013,6 +2013,43 @@ is_eval_lock(boolexp b)
   }
 }
 
+/* Does this lock depend only on the player's dbref, type, flags and
+ * powers? If so, its result for a given player stays the same until
+ * privs_generation() changes, and callers may cache it.
+ */
+bool
+is_cacheable_lock(boolexp b)
+{
+  bvm_opcode op;
+  uint8_t *pc;
+
+  if (b == TRUE_BOOLEXP)
+    return 1;
+
+  pc = get_bytecode(b, NULL);
+  while (1) {
+    op = (bvm_opcode) *pc;
+    pc += INSN_LEN;
+    switch (op) {
+    case OP_RET:
+      return 1;
+    case OP_JMPT:
+    case OP_JMPF:
+    case OP_LABEL:
+    case OP_PAREN:
+    case OP_LOADR:
+    case OP_NEGR:
+    case OP_TIS:
+    case OP_TFLAG:
+    case OP_TTYPE:
+    case OP_TPOWER:
+      break;
+    default:
+      return 0;
+    }
+  }
+}
+
 #ifdef DEBUG_BYTECODE
 
 /** Find the size of a parse tree node, recursively to count all child nodes.
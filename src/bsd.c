@@ -73,6 +73,9 @@
 #ifdef HAVE_POLL_H
 #include <poll.h>
 #endif
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#endif
 #ifdef HAVE_LIBCURL
 #include <curl/curl.h>
 #endif
@@ -96,6 +99,7 @@
 #include "lock.h"
 #include "log.h"
 #include "match.h"
+#include "mccp.h"
 #include "mushdb.h"
 #include "mymalloc.h"
 #include "mypcre.h"
@@ -105,6 +109,7 @@
 #include "parse.h"
 #include "pueblo.h"
 #include "sig.h"
+#include "snapshot.h"
 #include "strtree.h"
 #include "strutil.h"
 #include "version.h"
@@ -133,6 +138,11 @@
 #define LOCAL_SOCKET 1
 #endif
 
+#if defined(HAVE_SYS_EPOLL_H) && defined(HAVE_EPOLL_CREATE1)
+/** Wait for network activity with epoll() instead of poll() */
+#define USE_EPOLL 1
+#endif
+
 #ifdef HAVE_GETRLIMIT
 void init_rlimit(void);
 #endif
@@ -462,6 +472,7 @@ extern bool ssl_slave_halted;
 WAIT_TYPE error_code = 0;
 #endif
 extern pid_t forked_dump_pid; /**< Process id of forking dump process */
+extern pid_t snapshot_dump_pid; /**< The same, if it's writing a snapshot */
 static void dump_users(DESC *call_by, char *match);
 static char *onfor_time_fmt(time_t at, int len);
 static char *idle_time_fmt(time_t last, int len);
@@ -506,7 +517,7 @@ main(int argc, char **argv)
 {
   FILE *newerr;
   bool detach_session __attribute__((__unused__)) = 1;
-  bool enable_tests = 0, only_test = 0;
+  bool enable_tests = 0, only_test = 0, enable_benchmarks = 0;
 
 /* disallow running as root on unix.
  * This is done as early as possible, before translation is initialized.
@@ -597,6 +608,9 @@ main(int argc, char **argv)
           enable_tests = 1;
           only_test = 1;
           detach_session = 0;
+        } else if (strcmp(argv[n], "--benchmarks") == 0) {
+          enable_benchmarks = 1;
+          detach_session = 0;
         } else {
           fprintf(stderr, "%s: unknown option \"%s\"\n", argv[0], argv[n]);
         }
@@ -768,6 +782,11 @@ main(int argc, char **argv)
   pcre2_set_character_tables(re_compile_ctx, pcre2_maketables(NULL));
   pcre2_set_match_limit(re_match_ctx, PENN_MATCH_LIMIT);
   pcre2_set_heap_limit(re_match_ctx, 10 * 1024); // 10MB max heap memory
+  /* Cached regexps are JIT compiled; give them room to backtrack like
+   * the interpreter has, instead of the default 32K machine stack. */
+  pcre2_jit_stack_assign(re_match_ctx, NULL,
+                         pcre2_jit_stack_create(32 * 1024, 10 * 1024 * 1024,
+                                                NULL));
   pcre2_set_glob_escape(glob_convert_ctx, '\\');
   pcre2_set_glob_separator(glob_convert_ctx, '`');
 
@@ -817,6 +836,11 @@ main(int argc, char **argv)
     }
   }
 
+  if (enable_benchmarks) {
+    run_benchmarks();
+    exit(0);
+  }
+
 #ifdef INFO_SLAVE
   init_info_slave();
 #endif
@@ -1230,6 +1254,11 @@ check_status()
 /* Check signal handler flags */
 #ifndef WIN32
   if (dump_error) {
+    if (dump_error == snapshot_dump_pid) {
+      snapshot_compacted(WIFEXITED(dump_status) &&
+                         WEXITSTATUS(dump_status) == 0);
+      snapshot_dump_pid = -1;
+    }
     if (WIFSIGNALED(dump_status)) {
       do_rawlog(LT_ERR, "ERROR! forking dump exited with signal %d",
                 WTERMSIG(dump_status));
@@ -1275,6 +1304,9 @@ check_status()
 #endif /* SSL_SLAVE */
 #endif /* !WIN32 */
 
+  /* A nonforking dump's files may have finished in the background */
+  dump_writer_poll();
+
   if (signal_shutdown_flag) {
     flag_broadcast(0, 0, T("GAME: Shutdown by external signal"));
     do_rawlog(LT_ERR, "SHUTDOWN by external signal");
@@ -1386,6 +1418,144 @@ static nfds_t fd_size = 0, fds_used = 0;
 #define PENN_POLLOUT POLLOUT
 #endif
 
+/** How many non-descriptor fds check_sockets() can poll: the main, SSL
+ * and local listening sockets, info_slave, notify_fd, sigrecv_fd and
+ * sql_async_fd. */
+#define FIXED_POLL_FDS 7
+
+#ifdef USE_EPOLL
+/* The epoll backend keeps every socket in a kernel interest set and
+ * only calls epoll_ctl() when the events wanted for a socket change,
+ * so a pass through check_sockets() costs the kernel time proportional
+ * to the number of ready sockets rather than the number connected.
+ *
+ * The set is level-triggered: process_input() reads one buffer per
+ * pass, and throttled descriptors deliberately leave input unread, so
+ * edge-triggered notification would lose wakeups.
+ */
+static int epoll_fd = -1;
+static struct epoll_event *epoll_events = NULL;
+static int epoll_events_size = 0;
+
+/** Sockets other than player descriptors watched by the epoll backend */
+enum epoll_watch_slot {
+  EW_SOCK,       /**< Main port */
+  EW_SSLSOCK,    /**< SSL port */
+  EW_LOCALSOCK,  /**< Unix socket for ssl_slave */
+  EW_INFO_SLAVE, /**< info_slave connection */
+  EW_NOTIFY,     /**< File change notifications */
+  EW_SIGRECV,    /**< Signal notifications */
+  EW_SQL,        /**< Finished sqlasync() queries */
+  EW_COUNT
+};
+
+/** epoll_event tag bit marking a watch slot rather than a descriptor */
+#define EPOLL_TAG_WATCH ((uint64_t) 1 << 32)
+
+/** A non-descriptor socket registered with the epoll backend */
+static struct epoll_watch {
+  int fd;          /**< Registered file descriptor, or -1 */
+  int generation;  /**< Changes when fd is reopened with the same number */
+  uint32_t events; /**< Registered events, 0 if not in the set */
+} epoll_watches[EW_COUNT];
+
+/** Change the events a file descriptor is registered for.
+ * A descriptor with no wanted events is removed from the set entirely,
+ * since epoll always reports hangups and errors for members.
+ * \param fd the file descriptor.
+ * \param tag the value epoll_wait() reports for this fd.
+ * \param current the currently registered events, updated.
+ * \param events the wanted events.
+ */
+static void
+epoll_set_events(int fd, uint64_t tag, uint32_t *current, uint32_t events)
+{
+  struct epoll_event ev;
+  int op;
+
+  if (epoll_fd < 0 || fd < 0 || *current == events)
+    return;
+
+  if (!events)
+    op = EPOLL_CTL_DEL;
+  else if (!*current)
+    op = EPOLL_CTL_ADD;
+  else
+    op = EPOLL_CTL_MOD;
+
+  memset(&ev, 0, sizeof ev);
+  ev.events = events;
+  ev.data.u64 = tag;
+  if (epoll_ctl(epoll_fd, op, fd, &ev) < 0) {
+    /* Recover if the kernel's idea of the set disagrees with ours. */
+    if (op == EPOLL_CTL_ADD && errno == EEXIST)
+      op = EPOLL_CTL_MOD;
+    else if (op == EPOLL_CTL_MOD && errno == ENOENT)
+      op = EPOLL_CTL_ADD;
+    else
+      op = -1;
+    if ((op < 0 || epoll_ctl(epoll_fd, op, fd, &ev) < 0) && events)
+      penn_perror("epoll_ctl");
+  }
+  *current = events;
+}
+
+/** Watch a non-descriptor socket.
+ * \param slot which socket this is.
+ * \param fd its current file descriptor, or -1 if closed.
+ * \param generation a value that changes whenever fd is reopened.
+ * \param events the wanted events, 0 to stop watching it for now.
+ */
+static void
+epoll_watch(enum epoll_watch_slot slot, int fd, int generation,
+            uint32_t events)
+{
+  struct epoll_watch *w = &epoll_watches[slot];
+
+  if (w->fd != fd || w->generation != generation) {
+    /* Don't unregister a number that's since been reused by a player. */
+    if (w->fd != fd && !im_exists(descs_by_fd, w->fd))
+      epoll_set_events(w->fd, EPOLL_TAG_WATCH | slot, &w->events, 0);
+    w->fd = fd;
+    w->generation = generation;
+    w->events = 0;
+  }
+  epoll_set_events(fd, EPOLL_TAG_WATCH | slot, &w->events, events);
+}
+
+/** Register a descriptor for the events it currently wants.
+ * Descriptors being throttled aren't read from, and only those with
+ * queued output wait to become writable.
+ * \param d the descriptor.
+ */
+static void
+desc_poll_update(DESC *d)
+{
+  uint32_t events = 0;
+
+  if (!d->input.head)
+    events |= EPOLLIN;
+  if (d->output.head || MCCPPending(d))
+    events |= EPOLLOUT;
+  epoll_set_events(d->descriptor, (uint64_t) d->descriptor, &d->poll_events,
+                   events);
+}
+
+/** Remove a descriptor about to be closed from the epoll set.
+ * Closing it isn't enough if a forked dump process shares the socket.
+ * \param d the descriptor.
+ */
+static void
+desc_poll_forget(DESC *d)
+{
+  epoll_set_events(d->descriptor, (uint64_t) d->descriptor, &d->poll_events,
+                   0);
+}
+#else
+#define desc_poll_update(d)
+#define desc_poll_forget(d)
+#endif /* USE_EPOLL */
+
 void
 ext_startup()
 {
@@ -1404,6 +1574,23 @@ ext_startup()
   avail_descriptors -= 2; /* reserve some more for setting up the slave */
 #endif
 
+#ifdef USE_EPOLL
+  {
+    int n;
+
+    for (n = 0; n < EW_COUNT; n++) {
+      epoll_watches[n].fd = -1;
+      epoll_watches[n].generation = 0;
+      epoll_watches[n].events = 0;
+    }
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0) {
+      penn_perror("epoll_create1");
+      do_rawlog(LT_ERR, "Falling back to poll() for network i/o.");
+    }
+  }
+#endif
+
   /* done. print message to the log */
   do_rawlog(LT_ERR, "%d file descriptors available.", avail_descriptors);
   do_rawlog(LT_ERR, "RESTART FINISHED.");
@@ -1417,11 +1604,242 @@ ext_shutdown()
   if (fds)
     mush_free(fds, "pollfds");
 
+#ifdef USE_EPOLL
+  if (epoll_events)
+    mush_free(epoll_events, "epoll.events");
+  if (epoll_fd >= 0)
+    close(epoll_fd);
+  epoll_fd = -1;
+#endif
+
 #ifdef HAVE_LIBCURL
   curl_multi_cleanup(curl_handle);
 #endif
 }
 
+#ifdef HAVE_LIBCURL
+/** Let libcurl make progress on pending queries.
+ * \return the number of finished transfers handled.
+ */
+static int
+run_curl_queries(void)
+{
+  int handled = 0;
+
+  if (ncurl_queries > 0) {
+    int running = 0;
+    curl_status = curl_multi_perform(curl_handle, &running);
+    if (curl_status == CURLM_OK) {
+      CURLMsg *msg;
+      while ((msg = curl_multi_info_read(curl_handle, &running)) != NULL) {
+        handle_curl_msg(msg);
+        handled += 1;
+      }
+    }
+  }
+  return handled;
+}
+#endif
+
+/** Handle network events on a single descriptor.
+ * \param d the descriptor.
+ * \param input_ready true if it can be read from.
+ * \param output_ready true if it can be written to.
+ * \param errors true if the socket has an error.
+ * \param hangup true if the other end has hung up.
+ */
+static void
+handle_desc_events(DESC *d, bool input_ready, bool output_ready, bool errors,
+                   bool hangup)
+{
+  if (errors) {
+    /* Socket error; kill this connection. */
+    shutdownsock(d, "socket error", d->player >= 0 ? d->player : GOD,
+                 CONN_NOWRITE);
+  } else {
+    if (input_ready) {
+      if (!process_input(d, output_ready)) {
+        shutdownsock(d, "disconnect", d->player, CONN_NOWRITE);
+        return;
+      }
+    }
+    if (output_ready) {
+      if (!process_output(d)) {
+        shutdownsock(d, "disconnect", d->player, CONN_NOWRITE);
+      }
+    }
+  }
+  if (hangup) {
+    http_command_ready(d);
+  }
+}
+
+#ifdef USE_EPOLL
+/* epoll() version of check_sockets(); see below. */
+static int
+check_sockets_epoll(uint32_t msec_timeout)
+{
+  int found, n;
+  bool accepting = ndescriptors < avail_descriptors;
+  DESC *d;
+#ifdef INFO_SLAVE
+  bool slave_replied = 0;
+#endif
+
+  /* Don't check for new connections if we're full up on players
+   * we can't accept, anyway! */
+  epoll_watch(EW_SOCK, sock, 0, accepting ? EPOLLIN : 0);
+  epoll_watch(EW_SSLSOCK, sslsock ? sslsock : -1, 0,
+              accepting ? EPOLLIN : 0);
+#ifdef LOCAL_SOCKET
+  epoll_watch(EW_LOCALSOCK, localsock, 0, accepting ? EPOLLIN : 0);
+#endif
+
+#ifdef INFO_SLAVE
+  /* Only check info_slave socket if we're waiting for something
+   * from it. It's reopened under the same number when restarted. */
+  epoll_watch(EW_INFO_SLAVE, info_slave, info_slave_pid,
+              info_slave_state == INFO_SLAVE_PENDING ? EPOLLIN : 0);
+#endif
+
+  epoll_watch(EW_NOTIFY, notify_fd, 0, EPOLLIN);
+#ifndef WIN32
+  epoll_watch(EW_SIGRECV, sigrecv_fd, 0, EPOLLIN);
+#endif
+  /* The query pool's descriptor is reopened when it restarts. */
+  epoll_watch(EW_SQL, sql_async_fd, sql_async_generation, EPOLLIN);
+
+  /* Only descriptors whose wanted events changed since the last pass
+   * touch the kernel's interest set. */
+  DESC_ITER (d) {
+    if (d->input.head) {
+      /* They're throttled, be nice and reduce timeout to when we think
+       * they'll be unthrottled. */
+      uint64_t curr = MS_PER_SEC - d->quota;
+      if (msec_timeout > curr)
+        msec_timeout = curr;
+    }
+    desc_poll_update(d);
+  }
+
+  if (epoll_events_size < (int) im_count(descs_by_fd) + EW_COUNT) {
+    epoll_events_size = im_count(descs_by_fd) + EW_COUNT + 16;
+    epoll_events = mush_realloc(epoll_events,
+                                sizeof *epoll_events * epoll_events_size,
+                                "epoll.events");
+  }
+
+#ifdef HAVE_LIBCURL
+  {
+    /* Let libcurl wait on its own sockets and ours together. */
+    struct curl_waitfd epfd;
+
+    epfd.fd = epoll_fd;
+    epfd.events = CURL_WAIT_POLLIN;
+    epfd.revents = 0;
+    curl_status =
+      curl_multi_wait(curl_handle, &epfd, 1, msec_timeout, &found);
+    if (curl_status != CURLM_OK) {
+      do_rawlog(LT_ERR, "curl_multi_wait: %s",
+                curl_multi_strerror(curl_status));
+      return 0;
+    }
+    run_curl_queries();
+    msec_timeout = 0;
+  }
+#endif
+
+  found = epoll_wait(epoll_fd, epoll_events, epoll_events_size, msec_timeout);
+  if (found < 0) {
+    if (errno != EINTR) {
+      penn_perror("epoll_wait");
+      return 0;
+    }
+    found = 0;
+  }
+
+#ifdef INFO_SLAVE
+  if (info_slave_state == INFO_SLAVE_PENDING) {
+    update_pending_info_slaves();
+  }
+#endif
+
+  for (n = 0; n < found; n++) {
+    uint32_t revents = epoll_events[n].events;
+    uint64_t tag = epoll_events[n].data.u64;
+
+    if (!(tag & EPOLL_TAG_WATCH)) {
+      /* Network activity from a player */
+      d = im_find(descs_by_fd, (int) tag);
+      if (d)
+        handle_desc_events(d, revents & EPOLLIN, revents & EPOLLOUT,
+                           revents & EPOLLERR, revents & EPOLLHUP);
+      continue;
+    }
+
+    if (!(revents & EPOLLIN))
+      continue;
+
+    switch ((enum epoll_watch_slot)(tag & ~EPOLL_TAG_WATCH)) {
+#ifdef INFO_SLAVE
+    /* New connections from port or SSL? */
+    case EW_SOCK:
+      got_new_connection(sock, CS_IP_SOCKET);
+      break;
+    case EW_SSLSOCK:
+      got_new_connection(sslsock, CS_OPENSSL_SOCKET);
+      break;
+    case EW_INFO_SLAVE:
+      /* any update from info_slave? */
+      if (info_slave_state == INFO_SLAVE_PENDING) {
+        slave_replied = 1;
+        reap_info_slave();
+      }
+      break;
+#else
+    case EW_SOCK:
+      setup_desc(sock, CS_IP_SOCKET);
+      break;
+    case EW_SSLSOCK:
+      setup_desc(sslsock, CS_OPENSSL_SOCKET);
+      break;
+    case EW_INFO_SLAVE:
+      break;
+#endif /* INFO_SLAVE */
+    case EW_LOCALSOCK:
+#ifdef LOCAL_SOCKET
+      setup_desc(localsock, CS_LOCAL_SOCKET);
+#endif
+      break;
+    case EW_NOTIFY:
+      /* Any updates to the game/txt/??? files? */
+      file_watch_event(notify_fd);
+      break;
+    case EW_SIGRECV:
+#ifndef WIN32
+      sigrecv_ack();
+#endif
+      break;
+    case EW_SQL:
+      sql_async_reap();
+      break;
+    case EW_COUNT:
+      break;
+    }
+  }
+
+#ifdef INFO_SLAVE
+  if (found > 0 && !slave_replied && info_slave_state == INFO_SLAVE_PENDING &&
+      mudtime > info_queue_time + 30) {
+    /* rerun any pending queries that got lost */
+    update_pending_info_slaves();
+  }
+#endif
+
+  return 1;
+}
+#endif /* USE_EPOLL */
+
 /* What previously used to be the largest chunk of gameloop(). This routine
  * handles all the network input, output, and checking, but never runs a
  * command, or interacts with softcode.
@@ -1429,6 +1847,9 @@ ext_shutdown()
  * It will wait for up to msec_timeout milliseconds. The only times it will
  * return in less than msec_timeout, will be because of network input, errors,
  * or a spamming user who's at their quota.
+ *
+ * Where available, epoll() is used to wait; otherwise the set of sockets to
+ * check is rebuilt for poll() on every call.
  * \param msec_timeout milliseconds to wait
  * \return 1 things are okay
  * \return 0 gotta shutdown
@@ -1442,7 +1863,12 @@ check_sockets(uint32_t msec_timeout)
   int found;
   DESC *d;
 
-  if (((int) fd_size) < ((int) im_count(descs_by_fd) + 6)) {
+#ifdef USE_EPOLL
+  if (epoll_fd >= 0)
+    return check_sockets_epoll(msec_timeout);
+#endif
+
+  if (((int) fd_size) < ((int) im_count(descs_by_fd) + FIXED_POLL_FDS)) {
     fd_size = im_count(descs_by_fd) + 16;
     fds = mush_realloc(fds, sizeof *fds * fd_size, "pollfds");
   }
@@ -1489,6 +1915,11 @@ check_sockets(uint32_t msec_timeout)
   }
 #endif
 
+  if (sql_async_fd >= 0) {
+    fds[fds_used].fd = sql_async_fd;
+    fds[fds_used++].events = PENN_POLLIN;
+  }
+
   /** Now add all the active descriptors */
   DESC_ITER (d) {
     /* If d->input.head is non-null, the descriptor is being throttled.
@@ -1507,7 +1938,7 @@ check_sockets(uint32_t msec_timeout)
       events |= PENN_POLLIN;
     }
 
-    if (d->output.head) {
+    if (d->output.head || MCCPPending(d)) {
       events |= PENN_POLLOUT;
     }
 
@@ -1526,17 +1957,7 @@ check_sockets(uint32_t msec_timeout)
     return 0;
   }
 
-  if (ncurl_queries > 0) {
-    int running = 0;
-    curl_status = curl_multi_perform(curl_handle, &running);
-    if (curl_status == CURLM_OK) {
-      CURLMsg *msg;
-      while ((msg = curl_multi_info_read(curl_handle, &running)) != NULL) {
-        handle_curl_msg(msg);
-        found -= 1;
-      }
-    }
-  }
+  found -= run_curl_queries();
 
 #else
 
@@ -1635,6 +2056,13 @@ check_sockets(uint32_t msec_timeout)
     }
 #endif
 
+    /* Any sqlasync() queries finished? */
+    if (found > 0 && sql_async_fd >= 0 &&
+        fds[fds_used++].revents & PENN_POLLIN) {
+      found -= 1;
+      sql_async_reap();
+    }
+
     /* Check all the users for input */
     DESC_ITER (d) {
       unsigned int input_ready, output_ready, errors, full_events;
@@ -1654,26 +2082,8 @@ check_sockets(uint32_t msec_timeout)
       output_ready = fds[fds_used++].revents & PENN_POLLOUT;
       if (input_ready || errors || output_ready)
         found -= 1;
-      if (errors) {
-        /* Socket error; kill this connection. */
-        shutdownsock(d, "socket error", d->player >= 0 ? d->player : GOD,
-                     CONN_NOWRITE);
-      } else {
-        if (input_ready) {
-          if (!process_input(d, output_ready)) {
-            shutdownsock(d, "disconnect", d->player, CONN_NOWRITE);
-            continue;
-          }
-        }
-        if (output_ready) {
-          if (!process_output(d)) {
-            shutdownsock(d, "disconnect", d->player, CONN_NOWRITE);
-          }
-        }
-      }
-      if (full_events & POLLHUP) {
-        http_command_ready(d);
-      }
+      handle_desc_events(d, input_ready, output_ready, errors,
+                         full_events & POLLHUP);
     }
   }
   return 1;
@@ -2297,6 +2707,7 @@ disconnect_desc(DESC *d)
 static void
 cleanup_desc(DESC *d)
 {
+  desc_poll_forget(d);
   shutdown(d->descriptor, 2);
   closesocket(d->descriptor);
 
@@ -2313,6 +2724,7 @@ cleanup_desc(DESC *d)
 
   {
     freeqs(d);
+    mccp_free(d);
     if (d->ttype && d->ttype != default_ttype)
       mush_free(d->ttype, "terminal description");
     memset(d, 0xFF, sizeof *d);
@@ -2363,6 +2775,7 @@ initializesock(int s, char *addr, char *ip, conn_source source)
   d->checksum[0] = '\0';
   d->ssl = NULL;
   d->ssl_state = 0;
+  d->mccp = NULL;
   d->source = source;
   d->next = descriptor_list;
   descriptor_list = d;
@@ -2376,6 +2789,8 @@ initializesock(int s, char *addr, char *ip, conn_source source)
     }
   }
   im_insert(descs_by_fd, d->descriptor, d);
+  d->poll_events = 0;
+  desc_poll_update(d);
   d->connlog_id = connlog_connection(ip, addr, is_ssl_desc(d));
   d->conn_timer = sq_register_in(1, test_telnet_wrapper, (void *) d, NULL);
   queue_event(SYSEVENT, "SOCKET`CONNECT", "%d,%s", d->descriptor, d->ip);
@@ -2383,7 +2798,7 @@ initializesock(int s, char *addr, char *ip, conn_source source)
 }
 
 static int
-network_send_ssl(DESC *d)
+network_send_ssl(DESC *d, struct text_queue *q, int *size)
 {
   int input_ready, written = 0;
   bool need_write = 0;
@@ -2452,7 +2867,7 @@ network_send_ssl(DESC *d)
     input_ready = 0;
   }
 
-  while ((cur = d->output.head) != NULL) {
+  while ((cur = q->head) != NULL) {
     int cnt = 0;
     need_write = 0;
     d->ssl_state = ssl_write(d->ssl, d->ssl_state, input_ready, 1, cur->start,
@@ -2464,7 +2879,7 @@ network_send_ssl(DESC *d)
     written += cnt;
     if (cnt == cur->nchars) {
       /* Wrote a complete block */
-      d->output.head = cur->nxt;
+      q->head = cur->nxt;
       free_text_block(cur);
     } else {
       cur->start += cnt;
@@ -2473,26 +2888,30 @@ network_send_ssl(DESC *d)
     }
   }
 
-  if (!d->output.head)
-    d->output.tail = NULL;
-  d->output_size -= written;
+  if (!q->head)
+    q->tail = NULL;
+  *size -= written;
   d->output_chars += written;
 
   return written + need_write;
 }
 
 #ifdef HAVE_WRITEV
+/** Most queued blocks to send with one writev(). Shared output means a
+ * line is usually a few blocks: prefix, message and line ending. */
+#define WRITEV_BLOCKS 64
+
 static int
-network_send_writev(DESC *d)
+network_send_writev(DESC *d, struct text_queue *q, int *size)
 {
   int written = 0;
 
-  while (d->output.head) {
+  while (q->head) {
     int cnt, n;
-    struct iovec lines[10];
-    struct text_block *cur = d->output.head;
+    struct iovec lines[WRITEV_BLOCKS];
+    struct text_block *cur = q->head;
 
-    for (n = 0; cur && n < 10; cur = cur->nxt) {
+    for (n = 0; cur && n < WRITEV_BLOCKS; cur = cur->nxt) {
       lines[n].iov_base = cur->start;
       lines[n].iov_len = cur->nchars;
       n += 1;
@@ -2509,11 +2928,11 @@ network_send_writev(DESC *d)
     }
     written += cnt;
     while (cnt > 0) {
-      cur = d->output.head;
+      cur = q->head;
       if (cur->nchars <= cnt) {
         /* Wrote a full block */
         cnt -= cur->nchars;
-        d->output.head = cur->nxt;
+        q->head = cur->nxt;
         free_text_block(cur);
       } else {
         /* Wrote a partial block */
@@ -2525,9 +2944,9 @@ network_send_writev(DESC *d)
   }
 
 output_done:
-  if (!d->output.head)
-    d->output.tail = NULL;
-  d->output_size -= written;
+  if (!q->head)
+    q->tail = NULL;
+  *size -= written;
   d->output_chars += written;
 
   return written;
@@ -2535,22 +2954,22 @@ output_done:
 #endif
 
 static int
-network_send(DESC *d)
+network_send(DESC *d, struct text_queue *q, int *size)
 {
   int written = 0;
   struct text_block *cur;
 
-  if (!d || !d->output.head)
+  if (!d || !q->head)
     return 1;
 
 #ifdef HAVE_WRITEV
   /* If there's multiple pending blocks of text to send, use writev() if
      possible. */
-  if (d->output.head->nxt)
-    return network_send_writev(d);
+  if (q->head->nxt)
+    return network_send_writev(d, q, size);
 #endif
 
-  while ((cur = d->output.head) != NULL) {
+  while ((cur = q->head) != NULL) {
     int cnt = send(d->descriptor, cur->start, cur->nchars, 0);
 
     if (cnt < 0) {
@@ -2565,7 +2984,7 @@ network_send(DESC *d)
 
     if (cnt == cur->nchars) {
       /* Wrote a complete block */
-      d->output.head = cur->nxt;
+      q->head = cur->nxt;
       free_text_block(cur);
     } else {
       /* Partial */
@@ -2575,13 +2994,46 @@ network_send(DESC *d)
     }
   }
 
-  if (!d->output.head)
-    d->output.tail = NULL;
-  d->output_size -= written;
+  if (!q->head)
+    q->tail = NULL;
+  *size -= written;
   d->output_chars += written;
   return written;
 }
 
+/** Send as much of a queue of output as the socket will take.
+ * \param d the descriptor.
+ * \param q the queue.
+ * \param size the count of bytes in the queue to update.
+ * \return as process_output().
+ */
+static int
+network_send_queue(DESC *d, struct text_queue *q, int *size)
+{
+  if (d->ssl)
+    return network_send_ssl(d, q, size);
+  else
+    return network_send(d, q, size);
+}
+
+/** Stop compressing a descriptor's output and input, so that what's
+ * sent after can be read as plain text.
+ * \param d the descriptor.
+ */
+static void
+stop_compression(DESC *d)
+{
+  static const char stop[3] = {IAC, WONT, TN_MCCP3};
+
+  if (!d->mccp)
+    return;
+  mccp_end_output(d);
+  if (MCCPInput(d))
+    queue_newwrite(d, stop, 3);
+  process_output(d);
+  mccp_free(d);
+}
+
 /** Flush pending output for a descriptor.
  * This function actually sends the queued output over the descriptor's
  * socket.
@@ -2592,10 +3044,27 @@ network_send(DESC *d)
 int
 process_output(DESC *d)
 {
-  if (d->ssl)
-    return network_send_ssl(d);
-  else
-    return network_send(d);
+  struct mccp *m = d->mccp;
+  int r = 1;
+
+  if (m) {
+    /* Compressed output goes first. While the stream's running, more
+     * is only compressed once the socket has taken what's there. */
+    for (;;) {
+      if (!m->wire.head && m->out && d->output.head)
+        mccp_compress(d);
+      if (!m->wire.head)
+        break;
+      r = network_send_queue(d, &m->wire, &m->wire_size);
+      if (!r || m->wire.head)
+        return r;
+    }
+    if (m->out || !d->output.head)
+      return r;
+  }
+  if (d->conn_flags & CONN_WEBSOCKETS)
+    coalesce_queue(&d->output, WEBSOCKET_COALESCE_MAX);
+  return network_send_queue(d, &d->output, &d->output_size);
 }
 
 /** A wrapper around test_telnet(), which is called via the
@@ -2941,6 +3410,43 @@ TELNET_HANDLER(telnet_mssp)
 
 TELNET_HANDLER(telnet_gmcp) { d->conn_flags |= CONN_GMCP; }
 
+/* Start compressing output */
+TELNET_HANDLER(telnet_mccp2)
+{
+  static const char start[5] = {IAC, SB, TN_MCCP2, IAC, SE};
+  static const char refuse[3] = {IAC, WONT, TN_MCCP2};
+
+  if (*cmd != DO || MCCPOutput(d))
+    return;
+  if (!mccp_room(1)) {
+    queue_newwrite(d, refuse, 3);
+    return;
+  }
+  /* The subnegotiation is the last thing sent uncompressed. */
+  queue_newwrite(d, start, 5);
+  if (!mccp_start_output(d))
+    do_rawlog_lvl(LT_CONN, MLOG_WARNING,
+                  "Descriptor %d: unable to start MCCP2 compression.",
+                  d->descriptor);
+  process_output(d);
+}
+
+/* Agree to compressed input, if there's room for it */
+TELNET_HANDLER(telnet_mccp3)
+{
+  static const char refuse[3] = {IAC, WONT, TN_MCCP3};
+
+  if (*cmd == DO && !mccp_room(0))
+    queue_newwrite(d, refuse, 3);
+}
+
+/* The client's input is compressed from here on */
+TELNET_HANDLER(telnet_mccp3_sb)
+{
+  if (!mccp_start_input(d))
+    shutdownsock(d, "compression error", NOTHING, 0);
+}
+
 TELNET_HANDLER(telnet_gmcp_sb)
 {
   struct gmcp_handler *g;
@@ -3271,6 +3777,20 @@ init_telnet_opts(void)
   telopt->sb = telnet_gmcp_sb;
   telnet_options[i] = telopt;
 
+  telopt = mush_malloc(sizeof(struct telnet_opt), "telopt");
+  telopt->optcode = i = TN_MCCP2;
+  telopt->offer = MCCP_MEMORY > 0 ? WILL : 0;
+  telopt->handler = telnet_mccp2;
+  telopt->sb = NULL;
+  telnet_options[i] = telopt;
+
+  telopt = mush_malloc(sizeof(struct telnet_opt), "telopt");
+  telopt->optcode = i = TN_MCCP3;
+  telopt->offer = MCCP_MEMORY > 0 ? WILL : 0;
+  telopt->handler = telnet_mccp3;
+  telopt->sb = telnet_mccp3_sb;
+  telnet_options[i] = telopt;
+
   /* Store the telnet options we negotiate for new connections,
    * to avoid looking them up every time someone connects */
   len = 0;
@@ -3394,14 +3914,11 @@ handle_telnet(DESC *d, char **q, char *qend)
   }
 }
 
+static void process_input_compressed(DESC *d, const char *in, int len);
+
 static void
 process_input_helper(DESC *d, char *tbuf1, int got)
 {
-  char *p, *pend, *q, *qend;
-  int is_first;
-
-  is_first = d->conn_flags & CONN_AWAITING_FIRST_DATA;
-
   /* Is it an HTTP connection? */
   if (d->conn_flags & CONN_HTTP_REQUEST) {
     process_http_input(d, tbuf1, got);
@@ -3411,8 +3928,30 @@ process_input_helper(DESC *d, char *tbuf1, int got)
   if ((d->conn_flags & CONN_WEBSOCKETS)) {
     /* Process using WebSockets framing. */
     got = process_websocket_frame(d, tbuf1, got);
+    if (got < 0) {
+      shutdownsock(d, "compression error", NOTHING, CONN_NOWRITE);
+      return;
+    }
   }
 
+  process_input_text(d, tbuf1, got);
+}
+
+/** Split input text into commands and telnet codes.
+ * \param d the descriptor.
+ * \param tbuf1 the text, after any WebSocket framing is taken off.
+ * \param got its length.
+ */
+void
+process_input_text(DESC *d, char *tbuf1, int got)
+{
+  char *p, *pend, *q, *qend;
+  int is_first;
+  bool inflating = MCCPInput(d);
+  const char *rest = NULL;
+
+  is_first = d->conn_flags & CONN_AWAITING_FIRST_DATA;
+
   if (!d->raw_input) {
     d->raw_input = mush_malloc(MAX_COMMAND_LEN, "descriptor_raw_input");
     if (!d->raw_input)
@@ -3461,6 +4000,10 @@ process_input_helper(DESC *d, char *tbuf1, int got)
       if (!MAYBE_TELNET_ABLE(d) || handle_telnet(d, &q, qend) == 0) {
         if (p < pend)
           *p++ = *q;
+      } else if (!inflating && MCCPInput(d)) {
+        /* MCCP3 started; everything after this is compressed */
+        rest = q + 1;
+        break;
       }
     } else if (p < pend) {
       *p++ = *q;
@@ -3475,6 +4018,38 @@ process_input_helper(DESC *d, char *tbuf1, int got)
   }
 
   d->conn_flags &= ~CONN_AWAITING_FIRST_DATA;
+
+  if (rest && rest < qend)
+    process_input_compressed(d, rest, qend - rest);
+}
+
+/** Decompress MCCP3 input and process it. If the client ends the
+ * stream, whatever follows is processed as it is.
+ * \param d the descriptor.
+ * \param in the compressed input.
+ * \param len its length.
+ */
+static void
+process_input_compressed(DESC *d, const char *in, int len)
+{
+  char buff[BUFFER_LEN];
+  int got;
+
+  while (len > 0 && MCCPInput(d)) {
+    got = mccp_inflate(d, &in, &len, buff, sizeof buff);
+    if (got < 0) {
+      shutdownsock(d, "compression error", NOTHING, CONN_NOWRITE);
+      return;
+    }
+    if (got > 0)
+      process_input_helper(d, buff, got);
+    else if (!MCCPInput(d))
+      break;
+  }
+  if (len > 0 && !(d->conn_flags & CONN_SHUTDOWN)) {
+    memcpy(buff, in, len);
+    process_input_helper(d, buff, len);
+  }
 }
 
 /* ARGSUSED */
@@ -3541,7 +4116,10 @@ process_input(DESC *d, int output_ready __attribute__((__unused__)))
     }
   }
 
-  process_input_helper(d, tbuf1, got);
+  if (MCCPInput(d))
+    process_input_compressed(d, tbuf1, got);
+  else
+    process_input_helper(d, tbuf1, got);
 
   return 1;
 }
@@ -4675,6 +5253,7 @@ close_sockets(void)
 
   for (d = descriptor_list; d; d = dnext) {
     dnext = d->next;
+    stop_compression(d);
     if (!d->ssl) {
 #ifdef HAVE_WRITEV
       struct iovec byebye[2];
@@ -4887,6 +5466,7 @@ sockset_show(DESC *d, char *nl)
   safe_strl(nl, nllen, buff, &bp);
   safe_format(buff, &bp, "%-15s:  %s", "Prompt Newlines",
               (d->conn_flags & CONN_PROMPT_NEWLINES ? "Yes" : "No"));
+  mccp_show(d, buff, &bp, nl);
 
   *bp = '\0';
   return buff;
@@ -7454,6 +8034,8 @@ dump_reboot_db(void)
 #endif
     putref(f, maxd);
     DESC_ITER (d) {
+      /* Compression state doesn't survive the exec */
+      stop_compression(d);
       putref(f, d->descriptor);
       putref(f, d->connected_at);
       putref(f, d->hide);
@@ -7622,7 +8204,13 @@ load_reboot_db(void)
       d->quota = QUOTA_MAX;
       d->ssl = NULL;
       d->ssl_state = 0;
+      d->poll_events = 0;
+      d->mccp = NULL;
       d->next = NULL;
+      /* Compression starts afresh. Clients were told not to carry
+       * context between messages, so their input still inflates. */
+      if ((d->conn_flags & CONN_WEBSOCKETS_DEFLATE) && !mccp_start_websocket(d))
+        d->conn_flags &= ~CONN_WEBSOCKETS_DEFLATE;
 
       if (d->conn_flags & CONN_CLOSE_READY) {
         d->close_reason = "ssl shutdown";
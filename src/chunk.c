@@ -240,6 +240,7 @@
 #include <sys/stat.h>
 #endif
 
+#include "attrib.h"
 #include "command.h"
 #include "conf.h"
 #include "dbdefs.h"
@@ -2809,6 +2810,7 @@ chunk_create(char const *data, uint32_t len, uint8_t derefs)
 void
 chunk_delete(chunk_reference_t reference)
 {
+  atr_cache_forget(reference);
   chunker->chunk_delete(reference);
 }
 
@@ -2862,7 +2864,31 @@ chunk_derefs(chunk_reference_t reference)
 void
 chunk_migration(int count, chunk_reference_t **references)
 {
+  static chunk_reference_t *before = NULL;
+  static chunk_reference_t **where = NULL;
+  static int before_size = 0;
+  int j;
+
+  /* Remember where everything was, so the attribute value cache can follow
+   * anything that moves. The migration sorts references, so keep our own
+   * copy of the pointers too. */
+  if (count > before_size) {
+    before = mush_realloc(before, count * sizeof(chunk_reference_t),
+                          "migration old references");
+    where = mush_realloc(where, count * sizeof(chunk_reference_t *),
+                         "migration old references");
+    if (!before || !where)
+      mush_panic("Could not allocate migration reference array");
+    before_size = count;
+  }
+  for (j = 0; j < count; j++) {
+    where[j] = references[j];
+    before[j] = *references[j];
+  }
+
   chunker->migration(count, references);
+
+  atr_cache_moved(count, before, where);
 }
 
 /** Get the number of paged regions.
@@ -50,6 +50,7 @@
 #include "mymalloc.h"
 #include "mysocket.h"
 #include "parse.h"
+#include "profile.h"
 #include "ssl_slave.h"
 #include "strutil.h"
 #include "version.h"
@@ -1309,6 +1310,18 @@ COMMAND(cmd_power)
     do_power(executor, arg_left, args_right[1]);
 }
 
+COMMAND(cmd_profile)
+{
+  if (SW_ISSET(sw, SWITCH_START))
+    profile_start(executor);
+  else if (SW_ISSET(sw, SWITCH_STOP))
+    profile_stop(executor);
+  else if (SW_ISSET(sw, SWITCH_REPORT))
+    profile_report(executor, parse_integer(arg_left));
+  else
+    profile_status(executor);
+}
+
 COMMAND(cmd_ps)
 {
   if (SW_ISSET(sw, SWITCH_ALL))
@@ -1476,8 +1489,11 @@ COMMAND(cmd_stats)
   else if (SW_ISSET(sw, SWITCH_CHUNKS)) {
     if (SW_ISSET(sw, SWITCH_REGIONS))
       chunk_stats(executor, CSTATS_REGION);
-    else
+    else {
       chunk_stats(executor, CSTATS_SUMMARY);
+      atr_cache_stats(executor);
+      regexp_cache_stats(executor);
+    }
   } else if (SW_ISSET(sw, SWITCH_REGIONS))
     chunk_stats(executor, CSTATS_REGIONG);
   else if (SW_ISSET(sw, SWITCH_PAGING))
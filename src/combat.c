@@ -29,6 +29,9 @@ CATRTAB cattr = {.health = "COMBAT`STATS`HEALTH",
                  .unequip = "COMBAT`MESSAGES`UNEQUIP",
                  .ounequip = "COMBAT`MESSAGES`OUNEQUIP"};
 
+static FLAG_HANDLE armor_flag = FLAG_HANDLE_INIT("FLAG", CF_ARMOR);
+static FLAG_HANDLE weapon_flag = FLAG_HANDLE_INIT("FLAG", CF_WEAPON);
+
 char *oAction[4];
 char *action[4];
 char *vAction[4];
@@ -434,8 +437,8 @@ getAtrValue(dbref obj, char *name)
 bool
 isCombatItem(dbref obj)
 {
-  return (has_flag_by_name(obj, CF_ARMOR, NOTYPE) ||
-          has_flag_by_name(obj, CF_WEAPON, NOTYPE)) &&
+  return (has_flag_handle(obj, &armor_flag, NOTYPE) ||
+          has_flag_handle(obj, &weapon_flag, NOTYPE)) &&
          IsThing(obj);
 }
 
@@ -452,7 +455,7 @@ equippedWeapon(dbref player)
 {
   dbref invItem;
   DOLIST (invItem, Contents(player)) {
-    if (has_flag_by_name(invItem, CF_WEAPON, NOTYPE) &&
+    if (has_flag_handle(invItem, &weapon_flag, NOTYPE) &&
         equippedBy(invItem) == player) {
       return invItem;
     }
@@ -263,6 +263,7 @@ COMLIST commands[] = {
   {"@POWER",
    "ADD TYPE LETTER LIST RESTRICT DELETE ALIAS DISABLE ENABLE DECOMPILE",
    cmd_power, CMD_T_ANY | CMD_T_EQSPLIT | CMD_T_RS_ARGS, 0, 0},
+  {"@PROFILE", "START STOP REPORT", cmd_profile, CMD_T_ANY, "WIZARD", 0},
   {"@PROMPT", "SILENT NOISY NOEVAL SPOOF", cmd_prompt,
    CMD_T_ANY | CMD_T_EQSPLIT | CMD_T_NOGAGGED, 0, 0},
   {"@PS", "ALL SUMMARY COUNT QUICK DEBUG", cmd_ps, CMD_T_ANY, 0, 0},
@@ -44,12 +44,14 @@ typedef struct cnode {
 static CNode *ctop;
 static CType ctable[TABLE_SIZE];
 static char ltable[TABLE_SIZE];
+static int64_t huff_freq[TABLE_SIZE]; /**< Character frequencies for the tree */
 
 slab *huffman_slab = NULL;
 
 static int fix_tree_depth(CNode *node, int height, int zeros);
 static void add_ones(CNode *node);
 static void build_ctable(CNode *root, CType code, int numbits);
+static bool huff_build_tree(void);
 
 /** Huffman-compress a string.
  * Compress a string: this is pretty easy. For each char in the string,
@@ -293,34 +295,14 @@ huff_init_compress(PENNFILE *f)
 {
   int total;
   char c;
-  struct {
-    long freq;
-    CNode *node;
-  } table[TABLE_SIZE];
-  int indx, count;
-  long temp;
-  CNode *node;
 
 #ifdef STANDALONE
   printf("init_compress: Part 1\n");
 #endif
 
-  huffman_slab = slab_create("huffman attribute compression", sizeof(CNode));
-  slab_set_opt(huffman_slab, SLAB_ALLOC_BEST_FIT, 1);
-
   /* Part 1: initialize */
-  for (total = 0; total < TABLE_SIZE; total++) {
-    table[total].freq = 0;
-    table[total].node = slab_malloc(huffman_slab, NULL);
-    if (!table[total].node) {
-      do_rawlog(LT_ERR,
-                "Cannot allocate memory for compression tree. Aborting.");
-      exit(1);
-    }
-    table[total].node->c = total;
-    table[total].node->left = (CNode *) NULL;
-    table[total].node->right = (CNode *) NULL;
-  }
+  for (total = 0; total < TABLE_SIZE; total++)
+    huff_freq[total] = 0;
 
 #ifdef STANDALONE
   printf("init_compress: Part 2\n");
@@ -331,13 +313,13 @@ huff_init_compress(PENNFILE *f)
     total = 0;
     while (!penn_feof(f) && (!SAMPLE_SIZE || (total++ < SAMPLE_SIZE))) {
       c = penn_fgetc(f);
-      table[c].freq++;
+      huff_freq[c]++;
     }
   }
 #ifdef STANDALONE
-  for (indx = 0; indx < TABLE_SIZE; indx++) {
-    printf(isprint(indx) ? "Frequency for '%c': %d\n"
-           : "Frequency for %d: %d\n", indx, table[indx].freq);
+  for (total = 0; total < TABLE_SIZE; total++) {
+    printf(isprint(total) ? "Frequency for '%c': %ld\n"
+           : "Frequency for %d: %ld\n", total, (long) huff_freq[total]);
   }
 #endif
 
@@ -354,18 +336,55 @@ huff_init_compress(PENNFILE *f)
    * start-of-attribute marker in indb.  Set it back to '[',
    * which it should be balancing...
    */
-  table[']'].freq = table['['].freq;
+  huff_freq[']'] = huff_freq['['];
 
   /* The DEL character is returned once for no apparent reason (I think
    * it is returned at EOF), so remove that one count...
    */
-  if (table[255].freq)
-    table[255].freq--;
+  if (huff_freq[255])
+    huff_freq[255]--;
 
   /* Newlines really aren't all that common in the attributes, so
    * chop the value substantially.
    */
-  table['\n'].freq /= 16;
+  huff_freq['\n'] /= 16;
+
+  return huff_build_tree();
+}
+
+/** Build the compression tree and table from huff_freq.
+ * This is steps 4 and 5 of huff_init_compress(); the tree depends on
+ * nothing but the frequency table, so a table saved with a database
+ * rebuilds exactly the tree its attribute values were compressed with.
+ */
+static bool
+huff_build_tree(void)
+{
+  struct {
+    long freq;
+    CNode *node;
+  } table[TABLE_SIZE];
+  int indx, count;
+  long temp;
+  CNode *node;
+
+  if (!huffman_slab) {
+    huffman_slab = slab_create("huffman attribute compression", sizeof(CNode));
+    slab_set_opt(huffman_slab, SLAB_ALLOC_BEST_FIT, 1);
+  }
+
+  for (indx = 0; indx < TABLE_SIZE; indx++) {
+    table[indx].freq = huff_freq[indx];
+    table[indx].node = slab_malloc(huffman_slab, NULL);
+    if (!table[indx].node) {
+      do_rawlog(LT_ERR,
+                "Cannot allocate memory for compression tree. Aborting.");
+      exit(1);
+    }
+    table[indx].node->c = indx;
+    table[indx].node->left = (CNode *) NULL;
+    table[indx].node->right = (CNode *) NULL;
+  }
 
 #ifdef STANDALONE
   printf("init_compress: Part 4(a)\n");
@@ -513,10 +532,39 @@ huff_init_compress(PENNFILE *f)
   return 1;
 }
 
+/** Hand out the frequency table the tree was built from.
+ * \param state set to the table.
+ * \param len set to the table's size in bytes.
+ * \return true.
+ */
+static bool
+huff_save_state(const void **state, size_t *len)
+{
+  *state = huff_freq;
+  *len = sizeof huff_freq;
+  return 1;
+}
+
+/** Rebuild the tree from a frequency table given by huff_save_state().
+ * \param state the saved table.
+ * \param len its size in bytes.
+ * \return true if the tree was built.
+ */
+static bool
+huff_load_state(const void *state, size_t len)
+{
+  if (len != sizeof huff_freq)
+    return 0;
+  memcpy(huff_freq, state, sizeof huff_freq);
+  return huff_build_tree();
+}
+
 struct compression_ops huffman_ops = {
   huff_init_compress,
   huff_text_compress,
-  huff_text_uncompress
+  huff_text_uncompress,
+  huff_save_state,
+  huff_load_state
 };
 
 #ifdef STANDALONE
@@ -26,11 +26,18 @@
 
 typedef bool (*init_fn)(PENNFILE *);
 typedef char *(*comp_fn)(char const *);
+typedef bool (*save_fn)(const void **, size_t *);
+typedef bool (*load_fn)(const void *, size_t);
 
+/** The routines for one kind of attribute compression. save and load
+ * are NULL if compressed values can't outlive the process that made
+ * them (Word compression builds its dictionary as it goes). */
 struct compression_ops {
-  init_fn init;
-  comp_fn comp;
-  comp_fn decomp;
+  init_fn init;    /**< Set up from a database file */
+  comp_fn comp;    /**< Compress a string */
+  comp_fn decomp;  /**< Uncompress a string */
+  save_fn save;    /**< Get the state compressed values depend on */
+  load_fn load;    /**< Set up from state given by save */
 };
 
 #include "comp_h.c"
@@ -42,6 +49,21 @@ dummy_init(PENNFILE *f __attribute__((__unused__)))
   return 1;
 }
 
+static bool
+dummy_save(const void **state, size_t *len)
+{
+  *state = NULL;
+  *len = 0;
+  return 1;
+}
+
+static bool
+dummy_load(const void *state __attribute__((__unused__)),
+           size_t len __attribute__((__unused__)))
+{
+  return 1;
+}
+
 static char dummy_buff[BUFFER_LEN];
 
 static char *
@@ -57,13 +79,13 @@ dummy_decompress(char const *s)
   return dummy_buff;
 }
 
-struct compression_ops nocompression_ops = {dummy_init, dummy_compress,
-                                            dummy_decompress};
+struct compression_ops nocompression_ops = {
+  dummy_init, dummy_compress, dummy_decompress, dummy_save, dummy_load};
 
 struct compression_ops *comp_ops = NULL;
 
-bool
-init_compress(PENNFILE *f)
+static void
+pick_compression(void)
 {
   if (comp_ops == NULL) {
     if (strcmp(options.attr_compression, "none") == 0)
@@ -80,10 +102,45 @@ init_compress(PENNFILE *f)
       strcpy(options.attr_compression, "none");
     }
   }
+}
 
+bool
+init_compress(PENNFILE *f)
+{
+  pick_compression();
   return comp_ops->init(f);
 }
 
+/** Get the state that compressed attribute values depend on, for
+ * saving alongside them.
+ * \param state set to the state.
+ * \param len set to the length of the state in bytes.
+ * \return false if compressed values can't be saved as they are.
+ */
+bool
+compress_state(const void **state, size_t *len)
+{
+  pick_compression();
+  if (!comp_ops->save)
+    return 0;
+  return comp_ops->save(state, len);
+}
+
+/** Set up compression from state given by compress_state(), instead
+ * of from a database file.
+ * \param state the saved state.
+ * \param len the length of the state in bytes.
+ * \return false if the state can't be used.
+ */
+bool
+init_compress_state(const void *state, size_t len)
+{
+  pick_compression();
+  if (!comp_ops->load)
+    return 0;
+  return comp_ops->load(state, len);
+}
+
 __attribute_malloc__ char *
 text_compress(char const *s)
 {
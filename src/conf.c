@@ -65,6 +65,8 @@ PENNCONF conftable[] = {
    "files"},
   {"crash_database", cf_str, options.crash_db, sizeof options.crash_db, 0,
    "files"},
+  {"snapshot_database", cf_str, options.snapshot_db,
+   sizeof options.snapshot_db, 0, "files"},
   {"mail_database", cf_str, options.mail_db, sizeof options.mail_db, 0,
    "files"},
   {"chat_database", cf_str, options.chatdb, sizeof options.chatdb, 0, "files"},
@@ -74,6 +76,7 @@ PENNCONF conftable[] = {
    sizeof options.compressprog, 0, "files"},
   {"uncompress_program", cf_str, options.uncompressprog,
    sizeof options.uncompressprog, 0, "files"},
+  {"compress_level", cf_int, &options.compress_level, 22, 0, "files"},
   {"access_file", cf_str, options.access_file, sizeof options.access_file, 0,
    "files"},
   {"names_file", cf_str, options.names_file, sizeof options.access_file, 0,
@@ -150,6 +153,7 @@ PENNCONF conftable[] = {
    "net"},
   {"use_ws", cf_bool, &options.use_ws, sizeof options.use_ws, 0, "net"},
   {"ws_url", cf_str, options.ws_url, sizeof options.ws_url, 0, "net"},
+  {"mccp_memory", cf_int, &options.mccp_memory, 1000000000, 0, "net"},
   {"use_dns", cf_bool, &options.use_dns, 2, 0, "net"},
   {"logins", cf_bool, &options.login_allow, 2, 0, "net"},
   {"player_creation", cf_bool, &options.create_allow, 2, 0, "net"},
@@ -164,6 +168,7 @@ PENNCONF conftable[] = {
    CP_GODONLY, "net"},
   {"sql_database", cf_str, options.sql_database, sizeof options.sql_database,
    CP_GODONLY, "net"},
+  {"sql_async_workers", cf_int, &options.sql_async_workers, 32, 0, "net"},
   {"forking_dump", cf_bool, &options.forking_dump, 2, 0, "dump"},
   {"dump_message", cf_str, options.dump_message, sizeof options.dump_message,
    CP_OPTIONAL, "dump"},
@@ -323,6 +328,9 @@ PENNCONF conftable[] = {
   {"chunk_cache_memory", cf_int, &options.chunk_cache_memory, 1000000000, 0,
    "files"},
   {"chunk_migrate", cf_int, &options.chunk_migrate_amount, 100000, 0, "limits"},
+  {"attr_cache_size", cf_int, &options.attr_cache_size, 1000000, 0, "limits"},
+  {"regexp_cache_size", cf_int, &options.regexp_cache_size, 100000, 0,
+   "limits"},
 
   {"attr_compression", cf_str, options.attr_compression,
    sizeof options.attr_compression, 0, NULL},
@@ -349,6 +357,8 @@ PENNCONF conftable[] = {
   {"use_connlog", cf_bool, &options.use_connlog, sizeof options.use_connlog, 0,
    "log"},
   {"connlog_db", cf_str, options.connlog_db, sizeof options.help_db, 0, NULL},
+  {"connlog_flush_interval", cf_int, &options.connlog_flush_interval, 60000, 0,
+   "log"},
   {"dict_file", cf_str, options.dict_file, sizeof options.dict_file, 0,
    "files"},
   {"colors_file", cf_str, options.colors_file, sizeof options.colors_file, 0,
@@ -1175,10 +1185,12 @@ conf_default_set(void)
   options.ssl_port = 0;
   strcpy(options.socket_file, "data/netmush.sock");
   options.use_ws = 1;
+  options.mccp_memory = 16000000;
   strcpy(options.ws_url, "/wsclient");
   strcpy(options.input_db, "data/indb");
   strcpy(options.output_db, "data/outdb");
   strcpy(options.crash_db, "data/PANIC.db");
+  strcpy(options.snapshot_db, "");
   strcpy(options.chatdb, "data/chatdb");
   options.chan_cost = 1000;
   options.noisy_cemit = 0;
@@ -1237,6 +1249,7 @@ conf_default_set(void)
   strcpy(options.uncompressprog, "uncompress");
   strcpy(options.compresssuff, ".Z");
 #endif /* WIN32 */
+  options.compress_level = 0;
   strcpy(options.connect_file[0], "txt/connect.txt");
   strcpy(options.motd_file[0], "txt/motd.txt");
   strcpy(options.wizmotd_file[0], "txt/wizmotd.txt");
@@ -1344,6 +1357,8 @@ conf_default_set(void)
   options.chunk_swap_initial = 2048;
   options.chunk_cache_memory = 1000000;
   options.chunk_migrate_amount = 50;
+  options.attr_cache_size = 4096;
+  options.regexp_cache_size = 256;
   strcpy(options.attr_compression, "none");
   options.read_remote_desc = 0;
 #ifdef HAVE_SSL
@@ -1361,12 +1376,14 @@ conf_default_set(void)
   strcpy(options.sql_username, "");
   strcpy(options.sql_password, "");
   strcpy(options.sql_host, "127.0.0.1");
+  options.sql_async_workers = 2;
   options.log_max_size = 100;
   strcpy(options.log_size_policy, "trim");
   strcpy(options.sendmail_prog, "sendmail");
   strcpy(options.help_db, "data/help.db");
   options.use_connlog = 1;
   strcpy(options.connlog_db, "log/connlog.db");
+  options.connlog_flush_interval = 500;
   strcpy(options.dict_file, "");
   strcpy(options.colors_file, "txt/colors.json");
 }
@@ -10,9 +10,19 @@
 #include <limits.h>
 #include <time.h>
 #include <string.h>
+#include <errno.h>
+#ifdef HAVE_SYS_TIME_H
+#include <sys/time.h>
+#endif
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
 #ifdef HAVE_PTHREAD_H
 #include <pthread.h>
 #endif
+#if defined(HAVE_PTHREAD_H) && !defined(WIN32)
+#define CONNLOG_THREADS
+#endif
 
 #include "mushtype.h"
 #include "dbdefs.h"
@@ -27,36 +37,544 @@
 #include "strutil.h"
 #include "mymalloc.h"
 #include "charconv.h"
+#include "connlog.h"
+#include "tests.h"
 
 #define CONNLOG_APPID 0x42010FF2
 #define CONNLOG_VERSION 4
 #define CONNLOG_VERSIONS "4"
 
+#define CONNLOG_RING 4096 /**< Events that can wait for the writer */
+
 sqlite3 *connlog_db;
 
-/** Update the current timestamp used to update disconnection times
- *  when coming back from a crash.
+/* Changes to the connlog are queued as events, in the order they
+ * happen. With connlog_flush_interval set, a writer thread with its own
+ * connection to the database takes them off a ring buffer and writes
+ * each batch in one transaction, so the game never waits for the disk.
+ * Connection ids are handed out by the main thread from the next unused
+ * rowid, which works because nothing else writes to the database.
+ * Otherwise, each event is written as soon as it's queued.
  */
+
+/** The kinds of connlog event */
+enum connlog_event_type {
+  CLE_CONNECT,    /**< A new connection */
+  CLE_LOGIN,      /**< A connection logged in */
+  CLE_WEBSOCKET,  /**< A connection switched to websockets */
+  CLE_DISCONNECT, /**< A connection closed */
+  CLE_CHECKPOINT  /**< The game is still up */
+};
+
+/** A change to the connlog, waiting to be written */
+struct connlog_event {
+  enum connlog_event_type type; /**< What happened */
+  int64_t id;                   /**< Connection id */
+  time_t when;                  /**< When it happened */
+  dbref player;                 /**< Who logged in */
+  bool ssl;                     /**< Is the connection SSL? */
+  char *ip;                     /**< IP address of a new connection */
+  char *host;                   /**< Its hostname */
+  char *text;                   /**< Login name or disconnection reason */
+};
+
+/** Statements used to write events, prepared on one connection */
+struct connlog_stmts {
+  sqlite3_stmt *savepoint;  /**< Start writing a connection */
+  sqlite3_stmt *release;    /**< Finish writing a connection */
+  sqlite3_stmt *rollback;   /**< Give up on a connection */
+  sqlite3_stmt *timestamp;  /**< Add a connection time */
+  sqlite3_stmt *addr;       /**< Add or update an address */
+  sqlite3_stmt *connection; /**< Add a connection */
+  sqlite3_stmt *login;      /**< Record a login */
+  sqlite3_stmt *websocket;  /**< Record a websocket */
+  sqlite3_stmt *disconn;    /**< Record a disconnection */
+  sqlite3_stmt *checkpoint; /**< Update the checkpoint */
+};
+
+static int64_t connlog_next_id = 1;
+static struct connlog_stmts connlog_inline;
+static bool connlog_inline_ready = 0;
+
+#ifdef CONNLOG_THREADS
+static struct connlog_event connlog_ring[CONNLOG_RING];
+static struct connlog_event *connlog_batch = NULL; /**< The writer's batch */
+static int connlog_head = 0;    /**< Oldest queued event */
+static int connlog_count = 0;   /**< Events queued */
+static int connlog_writing = 0; /**< Events taken but not yet committed */
+static int connlog_interval = 0; /**< Milliseconds to gather a batch */
+static bool connlog_threaded = 0;
+static bool connlog_stopping = 0;
+static bool connlog_flushing = 0;
+static sqlite3 *connlog_wdb = NULL; /**< The writer's connection */
+static struct connlog_stmts connlog_wstmts;
+static pthread_t connlog_thread;
+static pthread_mutex_t connlog_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t connlog_work = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t connlog_idle = PTHREAD_COND_INITIALIZER;
+static char connlog_error[BUFFER_LEN]; /**< Last write error, for the log */
+static int connlog_errors = 0;          /**< Errors since it was logged */
+static uint64_t connlog_batches = 0;    /**< Transactions committed */
+#endif
+
+static const char *
+connlog_prepare_one(sqlite3 *db, const char *query, sqlite3_stmt **stmt)
+{
+  if (sqlite3_prepare_v3(db, query, -1, SQLITE_PREPARE_PERSISTENT, stmt,
+                         NULL) != SQLITE_OK) {
+    *stmt = NULL;
+    return sqlite3_errmsg(db);
+  }
+  return NULL;
+}
+
 static void
-update_checkpoint(void)
+connlog_finalize(struct connlog_stmts *st)
+{
+  sqlite3_finalize(st->savepoint);
+  sqlite3_finalize(st->release);
+  sqlite3_finalize(st->rollback);
+  sqlite3_finalize(st->timestamp);
+  sqlite3_finalize(st->addr);
+  sqlite3_finalize(st->connection);
+  sqlite3_finalize(st->login);
+  sqlite3_finalize(st->websocket);
+  sqlite3_finalize(st->disconn);
+  sqlite3_finalize(st->checkpoint);
+  memset(st, 0, sizeof *st);
+}
+
+/** Prepare the statements that write events on a connection.
+ * \return true on success.
+ */
+static bool
+connlog_prepare(sqlite3 *db, struct connlog_stmts *st)
+{
+  const char *err = NULL;
+
+  memset(st, 0, sizeof *st);
+  if (!err)
+    err = connlog_prepare_one(db, "SAVEPOINT connlog_event", &st->savepoint);
+  if (!err)
+    err = connlog_prepare_one(db, "RELEASE connlog_event", &st->release);
+  if (!err)
+    err = connlog_prepare_one(db, "ROLLBACK TO connlog_event", &st->rollback);
+  if (!err)
+    err = connlog_prepare_one(db,
+                              "INSERT INTO timestamps(id, conn, disconn) "
+                              "VALUES (?, ?, 2147483647)",
+                              &st->timestamp);
+  if (!err)
+    err = connlog_prepare_one(
+      db,
+      "INSERT INTO addrs(ipaddr, hostname) VALUES (?, ?) ON CONFLICT (ipaddr) "
+      "DO UPDATE SET hostname=excluded.hostname",
+      &st->addr);
+  if (!err)
+    err = connlog_prepare_one(
+      db,
+      "INSERT INTO connections(id, addrid, ssl, websocket) VALUES (?, "
+      "(SELECT id FROM addrs WHERE ipaddr = ?), ?, 0)",
+      &st->connection);
+  if (!err)
+    err = connlog_prepare_one(
+      db, "UPDATE connections SET dbref = ?, name = ? WHERE id = ?",
+      &st->login);
+  if (!err)
+    err = connlog_prepare_one(
+      db, "UPDATE connections SET websocket = 1 WHERE id = ?", &st->websocket);
+  if (!err)
+    err = connlog_prepare_one(
+      db, "UPDATE connlog SET disconn = ?, reason = ? WHERE id = ?",
+      &st->disconn);
+  if (!err)
+    err = connlog_prepare_one(
+      db, "UPDATE checkpoint SET timestamp = ? WHERE id = 1", &st->checkpoint);
+  if (err) {
+    do_rawlog(LT_ERR, "Unable to prepare connlog statements: %s", err);
+    connlog_finalize(st);
+    return 0;
+  }
+  return 1;
+}
+
+/* Run a prepared statement to completion and reset it. */
+static int
+connlog_step(sqlite3_stmt *stmt)
 {
-  sqlite3_stmt *ts;
   int status;
 
-  ts = prepare_statement(
-    connlog_db,
-    "UPDATE checkpoint SET timestamp = strftime('%s', 'now') WHERE id = 1",
-    "connlog.timestamp");
   do {
-    status = sqlite3_step(ts);
+    status = sqlite3_step(stmt);
   } while (is_busy_status(status));
-  sqlite3_reset(ts);
+  sqlite3_reset(stmt);
+  sqlite3_clear_bindings(stmt);
+  return status;
+}
+
+static void
+connlog_free_event(struct connlog_event *ev)
+{
+  free(ev->ip);
+  free(ev->host);
+  free(ev->text);
+}
+
+/** Write one event.
+ * \param db the connection to write with.
+ * \param st statements prepared on db.
+ * \param ev the event.
+ * \param err where to describe a failure.
+ * \param errlen size of err.
+ * \return true on success.
+ */
+static bool
+connlog_write_event(sqlite3 *db, struct connlog_stmts *st,
+                    struct connlog_event *ev, char *err, size_t errlen)
+{
+  sqlite3_stmt *stmt;
+
+  switch (ev->type) {
+  case CLE_CONNECT:
+    /* All three rows or none of them */
+    connlog_step(st->savepoint);
+    sqlite3_bind_int64(st->timestamp, 1, ev->id);
+    sqlite3_bind_int64(st->timestamp, 2, ev->when);
+    if (connlog_step(st->timestamp) != SQLITE_DONE) {
+      snprintf(err, errlen, "Failed to record connection timestamp from %s: %s",
+               ev->ip, sqlite3_errmsg(db));
+      connlog_step(st->rollback);
+      connlog_step(st->release);
+      return 0;
+    }
+    sqlite3_bind_text(st->addr, 1, ev->ip, -1, SQLITE_STATIC);
+    sqlite3_bind_text(st->addr, 2, ev->host, -1, SQLITE_STATIC);
+    connlog_step(st->addr);
+    sqlite3_bind_int64(st->connection, 1, ev->id);
+    sqlite3_bind_text(st->connection, 2, ev->ip, -1, SQLITE_STATIC);
+    sqlite3_bind_int(st->connection, 3, ev->ssl);
+    if (connlog_step(st->connection) != SQLITE_DONE) {
+      snprintf(err, errlen, "Failed to record connection from %s: %s", ev->ip,
+               sqlite3_errmsg(db));
+      connlog_step(st->rollback);
+      connlog_step(st->release);
+      return 0;
+    }
+    connlog_step(st->release);
+    return 1;
+  case CLE_LOGIN:
+    stmt = st->login;
+    sqlite3_bind_int(stmt, 1, ev->player);
+    sqlite3_bind_text(stmt, 2, ev->text, -1, SQLITE_STATIC);
+    sqlite3_bind_int64(stmt, 3, ev->id);
+    if (connlog_step(stmt) != SQLITE_DONE) {
+      snprintf(err, errlen, "Failed to record login to #%d: %s", ev->player,
+               sqlite3_errmsg(db));
+      return 0;
+    }
+    return 1;
+  case CLE_WEBSOCKET:
+    stmt = st->websocket;
+    sqlite3_bind_int64(stmt, 1, ev->id);
+    if (connlog_step(stmt) != SQLITE_DONE) {
+      snprintf(err, errlen,
+               "Failed to record websocket for connlog id %lld: %s",
+               (long long) ev->id, sqlite3_errmsg(db));
+      return 0;
+    }
+    return 1;
+  case CLE_DISCONNECT:
+    stmt = st->disconn;
+    sqlite3_bind_int64(stmt, 1, ev->when);
+    sqlite3_bind_text(stmt, 2, ev->text, -1, SQLITE_STATIC);
+    sqlite3_bind_int64(stmt, 3, ev->id);
+    if (connlog_step(stmt) != SQLITE_DONE) {
+      snprintf(err, errlen,
+               "Failed to record disconnection for connlog id %lld: %s",
+               (long long) ev->id, sqlite3_errmsg(db));
+      return 0;
+    }
+    return 1;
+  case CLE_CHECKPOINT:
+    stmt = st->checkpoint;
+    sqlite3_bind_int64(stmt, 1, ev->when);
+    if (connlog_step(stmt) != SQLITE_DONE) {
+      snprintf(err, errlen, "Failed to update connlog checkpoint: %s",
+               sqlite3_errmsg(db));
+      return 0;
+    }
+    return 1;
+  }
+  return 1;
+}
+
+#ifdef CONNLOG_THREADS
+/* Write a batch of events in one transaction, and free them. Runs in
+ * the writer thread. */
+static void
+connlog_write_batch(struct connlog_event *evs, int n)
+{
+  char err[BUFFER_LEN];
+  int i, errors = 0;
+
+  err[0] = '\0';
+  if (sqlite3_exec(connlog_wdb, "BEGIN IMMEDIATE TRANSACTION", NULL, NULL,
+                   NULL) != SQLITE_OK) {
+    snprintf(err, sizeof err, "Unable to start connlog transaction: %s",
+             sqlite3_errmsg(connlog_wdb));
+    errors++;
+  }
+  for (i = 0; i < n; i++) {
+    if (!connlog_write_event(connlog_wdb, &connlog_wstmts, &evs[i], err,
+                             sizeof err))
+      errors++;
+    connlog_free_event(&evs[i]);
+  }
+  if (sqlite3_exec(connlog_wdb, "COMMIT TRANSACTION", NULL, NULL, NULL) !=
+      SQLITE_OK) {
+    snprintf(err, sizeof err, "Unable to commit connlog transaction: %s",
+             sqlite3_errmsg(connlog_wdb));
+    sqlite3_exec(connlog_wdb, "ROLLBACK TRANSACTION", NULL, NULL, NULL);
+    errors++;
+  }
+
+  pthread_mutex_lock(&connlog_lock);
+  if (errors) {
+    connlog_errors += errors;
+    mush_strncpy(connlog_error, err, sizeof connlog_error);
+  }
+  connlog_batches++;
+  pthread_mutex_unlock(&connlog_lock);
+}
+
+static void *
+connlog_writer(void *arg __attribute__((__unused__)))
+{
+  struct connlog_event *batch = connlog_batch;
+  struct timespec deadline;
+  struct timeval now;
+  int i, n;
+
+  pthread_mutex_lock(&connlog_lock);
+  for (;;) {
+    while (!connlog_count && !connlog_stopping)
+      pthread_cond_wait(&connlog_work, &connlog_lock);
+    if (!connlog_count)
+      break;
+
+    /* Give a batch time to build up, unless someone's waiting for it */
+    if (!connlog_stopping && !connlog_flushing &&
+        connlog_count < CONNLOG_RING / 2) {
+      penn_gettimeofday(&now);
+      deadline.tv_sec = now.tv_sec + connlog_interval / 1000;
+      deadline.tv_nsec =
+        now.tv_usec * 1000L + (connlog_interval % 1000) * 1000000L;
+      if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+      }
+      while (!connlog_stopping && !connlog_flushing &&
+             connlog_count < CONNLOG_RING / 2 &&
+             pthread_cond_timedwait(&connlog_work, &connlog_lock, &deadline) !=
+               ETIMEDOUT)
+        ;
+    }
+
+    n = connlog_count;
+    for (i = 0; i < n; i++)
+      batch[i] = connlog_ring[(connlog_head + i) % CONNLOG_RING];
+    connlog_head = (connlog_head + n) % CONNLOG_RING;
+    connlog_count = 0;
+    connlog_writing = n;
+    pthread_cond_broadcast(&connlog_idle);
+    pthread_mutex_unlock(&connlog_lock);
+
+    connlog_write_batch(batch, n);
+
+    pthread_mutex_lock(&connlog_lock);
+    connlog_writing = 0;
+    if (!connlog_count)
+      connlog_flushing = 0;
+    pthread_cond_broadcast(&connlog_idle);
+  }
+  pthread_mutex_unlock(&connlog_lock);
+  return NULL;
+}
+
+/* Log any errors the writer has had. */
+static void
+connlog_reap(void)
+{
+  char err[BUFFER_LEN];
+  int errors;
+
+  if (!connlog_threaded)
+    return;
+  pthread_mutex_lock(&connlog_lock);
+  errors = connlog_errors;
+  mush_strncpy(err, connlog_error, sizeof err);
+  connlog_errors = 0;
+  pthread_mutex_unlock(&connlog_lock);
+  if (errors == 1)
+    do_rawlog(LT_ERR, "%s", err);
+  else if (errors > 1)
+    do_rawlog(LT_ERR, "%d connlog write errors, the last: %s", errors, err);
+}
+
+static void
+connlog_free_batch(void)
+{
+  mush_free(connlog_batch, "connlog.batch");
+  connlog_batch = NULL;
+}
+
+/* Start the writer thread, with its own connection to the database. */
+static bool
+connlog_start_writer(void)
+{
+  connlog_batch =
+    mush_calloc(CONNLOG_RING, sizeof *connlog_batch, "connlog.batch");
+  if (!connlog_batch)
+    return 0;
+  connlog_wdb = open_sql_db(options.connlog_db, 1);
+  if (!connlog_wdb) {
+    connlog_free_batch();
+    return 0;
+  }
+  /* In WAL mode, NORMAL only syncs when the log is checkpointed */
+  sqlite3_exec(connlog_wdb, "PRAGMA synchronous = NORMAL", NULL, NULL, NULL);
+  sqlite3_busy_timeout(connlog_wdb, 5000);
+  if (!connlog_prepare(connlog_wdb, &connlog_wstmts)) {
+    close_sql_db(connlog_wdb);
+    connlog_wdb = NULL;
+    connlog_free_batch();
+    return 0;
+  }
+  connlog_head = connlog_count = connlog_writing = 0;
+  connlog_stopping = connlog_flushing = 0;
+  connlog_interval = options.connlog_flush_interval;
+  if (pthread_create(&connlog_thread, NULL, connlog_writer, NULL)) {
+    do_rawlog(LT_ERR, "Unable to start connlog writer: %s", strerror(errno));
+    connlog_finalize(&connlog_wstmts);
+    close_sql_db(connlog_wdb);
+    connlog_wdb = NULL;
+    connlog_free_batch();
+    return 0;
+  }
+  connlog_threaded = 1;
+  return 1;
+}
+
+/* Stop the writer thread once it's written everything queued. */
+static void
+connlog_stop_writer(void)
+{
+  pthread_mutex_lock(&connlog_lock);
+  connlog_stopping = 1;
+  pthread_cond_signal(&connlog_work);
+  pthread_mutex_unlock(&connlog_lock);
+  pthread_join(connlog_thread, NULL);
+  connlog_threaded = 0;
+  connlog_reap();
+  connlog_finalize(&connlog_wstmts);
+  close_sql_db(connlog_wdb);
+  connlog_wdb = NULL;
+  connlog_free_batch();
+}
+#endif
+
+/* Start writing events, in the background if connlog_flush_interval
+ * asks for it and that's possible, and otherwise as they happen. */
+static void
+connlog_start(void)
+{
+#ifdef CONNLOG_THREADS
+  if (options.connlog_flush_interval > 0 && connlog_start_writer())
+    return;
+#endif
+  connlog_inline_ready = connlog_prepare(connlog_db, &connlog_inline);
+}
+
+/* Finish writing events. */
+static void
+connlog_stop(void)
+{
+#ifdef CONNLOG_THREADS
+  if (connlog_threaded)
+    connlog_stop_writer();
+#endif
+  if (connlog_inline_ready)
+    connlog_finalize(&connlog_inline);
+  connlog_inline_ready = 0;
+}
+
+/* Wait until every event queued so far is in the database, so queries
+ * on connlog_db see them. */
+static void
+connlog_flush(void)
+{
+#ifdef CONNLOG_THREADS
+  if (!connlog_threaded)
+    return;
+  pthread_mutex_lock(&connlog_lock);
+  while (connlog_count || connlog_writing) {
+    connlog_flushing = 1;
+    pthread_cond_signal(&connlog_work);
+    pthread_cond_wait(&connlog_idle, &connlog_lock);
+  }
+  pthread_mutex_unlock(&connlog_lock);
+#endif
+}
+
+/* Queue an event to be written. The event's strings must come from
+ * malloc(), and belong to the queue afterwards. */
+static void
+connlog_push(struct connlog_event *ev)
+{
+  char err[BUFFER_LEN];
+
+#ifdef CONNLOG_THREADS
+  if (connlog_threaded) {
+    pthread_mutex_lock(&connlog_lock);
+    while (connlog_count == CONNLOG_RING) {
+      /* The writer's fallen behind; wait for it */
+      connlog_flushing = 1;
+      pthread_cond_signal(&connlog_work);
+      pthread_cond_wait(&connlog_idle, &connlog_lock);
+    }
+    connlog_ring[(connlog_head + connlog_count) % CONNLOG_RING] = *ev;
+    connlog_count++;
+    connlog_interval = options.connlog_flush_interval;
+    if (connlog_count == 1 || connlog_count == CONNLOG_RING / 2)
+      pthread_cond_signal(&connlog_work);
+    pthread_mutex_unlock(&connlog_lock);
+    return;
+  }
+#endif
+  if (connlog_inline_ready &&
+      !connlog_write_event(connlog_db, &connlog_inline, ev, err, sizeof err))
+    do_rawlog(LT_ERR, "%s", err);
+  connlog_free_event(ev);
+}
+
+static char *
+connlog_strdup(const char *s)
+{
+  return strdup(s ? s : "");
 }
 
 static bool
 checkpoint_event(void *arg __attribute__((__unused__)))
 {
-  update_checkpoint();
+  struct connlog_event ev;
+
+  memset(&ev, 0, sizeof ev);
+  ev.type = CLE_CHECKPOINT;
+  ev.when = time(NULL);
+  connlog_push(&ev);
+#ifdef CONNLOG_THREADS
+  connlog_reap();
+#endif
   return 1;
 }
 
@@ -66,6 +584,7 @@ static void
 conndb_prefork(void)
 {
   if (connlog_db) {
+    connlog_stop();
     close_sql_db(connlog_db);
     connlog_db = NULL;
     relaunch = 1;
@@ -79,6 +598,8 @@ conndb_postfork_parent(void)
 {
   if (relaunch) {
     connlog_db = open_sql_db(options.connlog_db, 1);
+    if (connlog_db)
+      connlog_start();
   }
 }
 
@@ -104,6 +625,7 @@ init_conndb(bool rebooting)
 {
   int app_id, version;
   char *err;
+  sqlite3_stmt *next_id;
 
   connlog_db = open_sql_db(options.connlog_db, 1);
 
@@ -291,6 +813,17 @@ init_conndb(bool rebooting)
     }
   }
 
+  /* Databases built by older versions might not be using WAL yet */
+  sqlite3_exec(connlog_db, "PRAGMA journal_mode = WAL", NULL, NULL, NULL);
+  if (sqlite3_prepare_v2(connlog_db,
+                         "SELECT ifnull(max(id), 0) + 1 FROM timestamps", -1,
+                         &next_id, NULL) == SQLITE_OK) {
+    if (sqlite3_step(next_id) == SQLITE_ROW)
+      connlog_next_id = sqlite3_column_int64(next_id, 0);
+    sqlite3_finalize(next_id);
+  }
+  connlog_start();
+
   sq_register_loop(90, checkpoint_event, NULL, NULL);
   sq_register_loop(25 * 60 * 60 + 300, connlog_optimize, NULL, NULL);
 
@@ -319,6 +852,7 @@ shutdown_conndb(bool rebooting)
     return;
   }
 
+  connlog_stop();
   if (!rebooting) {
     if (sqlite3_exec(connlog_db,
                      "BEGIN TRANSACTION;"
@@ -345,68 +879,21 @@ shutdown_conndb(bool rebooting)
 int64_t
 connlog_connection(const char *ip, const char *host, bool ssl)
 {
-  sqlite3_stmt *adder;
-  int status;
-  int64_t id = -1;
-
-  if (!options.use_connlog) {
-    return -1;
-  }
+  struct connlog_event ev;
 
-  if (sqlite3_exec(connlog_db, "BEGIN TRANSACTION", NULL, NULL, NULL) !=
-      SQLITE_OK) {
-    return -1;
-  }
-  adder = prepare_statement(connlog_db,
-                            "INSERT INTO timestamps(conn, disconn) VALUES "
-                            "(strftime('%s', 'now'), 2147483647)",
-                            "connlog.connection.time");
-  do {
-    status = sqlite3_step(adder);
-  } while (is_busy_status(status));
-  sqlite3_reset(adder);
-  if (status == SQLITE_DONE) {
-    id = sqlite3_last_insert_rowid(connlog_db);
-  } else {
-    do_rawlog(LT_ERR, "Failed to record connection timestamp from %s: %s", ip,
-              sqlite3_errmsg(connlog_db));
-    sqlite3_exec(connlog_db, "ROLLBACK TRANSACTION", NULL, NULL, NULL);
+  if (!options.use_connlog || !connlog_db) {
     return -1;
   }
 
-  adder = prepare_statement(
-    connlog_db,
-    "INSERT INTO addrs(ipaddr, hostname) VALUES (?, ?) ON CONFLICT (ipaddr) DO "
-    "UPDATE SET hostname=excluded.hostname",
-    "connlog.connection.addr");
-  sqlite3_bind_text(adder, 1, ip, strlen(ip), SQLITE_TRANSIENT);
-  sqlite3_bind_text(adder, 2, host, strlen(host), SQLITE_TRANSIENT);
-  do {
-    status = sqlite3_step(adder);
-  } while (is_busy_status(status));
-  sqlite3_reset(adder);
-
-  adder = prepare_statement(
-    connlog_db,
-    "INSERT INTO connections(id, addrid, ssl, websocket) VALUES (?, "
-    "(SELECT id FROM addrs WHERE ipaddr = ?), ?, 0)",
-    "connlog.connection.connection");
-  sqlite3_bind_int64(adder, 1, id);
-  sqlite3_bind_text(adder, 2, ip, strlen(ip), SQLITE_TRANSIENT);
-  sqlite3_bind_int(adder, 3, ssl);
-
-  do {
-    status = sqlite3_step(adder);
-  } while (is_busy_status(status));
-  sqlite3_reset(adder);
-  if (status != SQLITE_DONE) {
-    do_rawlog(LT_ERR, "Failed to record connection from %s: %s", ip,
-              sqlite3_errmsg(connlog_db));
-    sqlite3_exec(connlog_db, "ROLLBACK TRANSACTION", NULL, NULL, NULL);
-    return -1;
-  }
-  sqlite3_exec(connlog_db, "COMMIT TRANSACTION", NULL, NULL, NULL);
-  return id;
+  memset(&ev, 0, sizeof ev);
+  ev.type = CLE_CONNECT;
+  ev.id = connlog_next_id++;
+  ev.when = time(NULL);
+  ev.ssl = ssl;
+  ev.ip = connlog_strdup(ip);
+  ev.host = connlog_strdup(host);
+  connlog_push(&ev);
+  return ev.id;
 }
 
 /** Register a login for a connlog record.
@@ -417,53 +904,34 @@ connlog_connection(const char *ip, const char *host, bool ssl)
 void
 connlog_login(int64_t id, dbref player)
 {
-  sqlite3_stmt *login;
-  int status;
+  struct connlog_event ev;
 
-  if (id == -1) {
+  if (id == -1 || !connlog_db) {
     return;
   }
 
-  login = prepare_statement(
-    connlog_db, "UPDATE connections SET dbref = ?, name = ? WHERE id = ?",
-    "connlog.login");
-  sqlite3_bind_int(login, 1, player);
-  sqlite3_bind_text(login, 2, Name(player), strlen(Name(player)),
-                    SQLITE_TRANSIENT);
-  sqlite3_bind_int64(login, 3, id);
-  do {
-    status = sqlite3_step(login);
-  } while (is_busy_status(status));
-  sqlite3_reset(login);
-  if (status != SQLITE_DONE) {
-    do_rawlog(LT_ERR, "Failed to record login to #%d: %s", player,
-              sqlite3_errmsg(connlog_db));
-  }
+  memset(&ev, 0, sizeof ev);
+  ev.type = CLE_LOGIN;
+  ev.id = id;
+  ev.player = player;
+  ev.text = connlog_strdup(Name(player));
+  connlog_push(&ev);
 }
 
 /** Mark that a connection is using websockets */
 void
 connlog_set_websocket(int64_t id)
 {
-  sqlite3_stmt *ws;
-  int status;
+  struct connlog_event ev;
 
-  if (id == -1) {
+  if (id == -1 || !connlog_db) {
     return;
   }
 
-  ws = prepare_statement(connlog_db,
-                         "UPDATE connections SET websocket = 1 WHERE id = ?",
-                         "connlog.websocket");
-  sqlite3_bind_int64(ws, 1, id);
-  do {
-    status = sqlite3_step(ws);
-  } while (is_busy_status(status));
-  sqlite3_reset(ws);
-  if (status != SQLITE_DONE) {
-    do_rawlog(LT_ERR, "Failed to record websocket for connlog id %lld: %s",
-              (long long) id, sqlite3_errmsg(connlog_db));
-  }
+  memset(&ev, 0, sizeof ev);
+  ev.type = CLE_WEBSOCKET;
+  ev.id = id;
+  connlog_push(&ev);
 }
 
 /** Record a disconnection in the connlog
@@ -474,24 +942,18 @@ connlog_set_websocket(int64_t id)
 void
 connlog_disconnection(int64_t id, const char *reason)
 {
-  sqlite3_stmt *disco;
-  int status;
+  struct connlog_event ev;
 
-  if (id == -1) {
+  if (id == -1 || !connlog_db) {
     return;
   }
 
-  disco = prepare_statement(connlog_db,
-                            "UPDATE connlog SET disconn = strftime('%s', "
-                            "'now'), reason = ? WHERE id = ?",
-                            "connlog.disconn");
-  sqlite3_bind_text(disco, 1, reason, -1, SQLITE_TRANSIENT);
-  sqlite3_bind_int64(disco, 2, id);
-
-  do {
-    status = sqlite3_step(disco);
-  } while (is_busy_status(status));
-  sqlite3_reset(disco);
+  memset(&ev, 0, sizeof ev);
+  ev.type = CLE_DISCONNECT;
+  ev.id = id;
+  ev.when = time(NULL);
+  ev.text = connlog_strdup(reason);
+  connlog_push(&ev);
 }
 
 FUNCTION(fun_connlog)
@@ -532,6 +994,8 @@ FUNCTION(fun_connlog)
     }
   }
 
+  connlog_flush();
+
   for (idx = 1; idx < nargs; idx += 1) {
     if (sqlite3_stricmp(args[idx], "count") == 0) {
       count_only = 1;
@@ -807,6 +1271,8 @@ FUNCTION(fun_connrecord)
     return;
   }
 
+  connlog_flush();
+
   id = parse_int64(args[0], NULL, 10);
 
   if (nargs == 2) {
@@ -892,6 +1358,8 @@ FUNCTION(fun_addrlog)
     return;
   }
 
+  connlog_flush();
+
   query = sqlite3_str_new(connlog_db);
   sqlite3_str_appendall(query, "SELECT");
   if (count_only) {
@@ -969,3 +1437,171 @@ FUNCTION(fun_addrlog)
     mush_free(sep, "utf8.string");
   }
 }
+
+#ifndef WIN32
+#define CONNLOG_TEST_CONNS 20
+#define CONNLOG_BENCH_CONNS 500
+
+/* Size of a connlog test run, and the scratch database it uses */
+struct connlog_bench_spec {
+  int conns;
+  char db[FILE_PATH_LEN];
+};
+
+/* Results of the connlog tests, sent back from the child running them. */
+struct connlog_bench {
+  int inline_ok;
+  int async_ok;
+  int ids_ok;
+  int batched;
+  double inline_us;
+  double async_us;
+};
+
+/* Remove the database and the files SQLite keeps alongside it. */
+static void
+connlog_bench_unlink(const char *db)
+{
+  char file[FILE_PATH_LEN + 4];
+
+  unlink(db);
+  snprintf(file, sizeof file, "%s-wal", db);
+  unlink(file);
+  snprintf(file, sizeof file, "%s-shm", db);
+  unlink(file);
+}
+
+/* Log a batch of connections with the given flush interval, returning
+ * how long each took in microseconds. */
+static double
+connlog_bench_pass(int conns, int interval, int *ok, int *ids,
+                   uint64_t *batches)
+{
+  sqlite3_stmt *count;
+  struct timeval start, end;
+  FILE *f;
+  int64_t first = -1, id;
+  int i;
+
+  connlog_bench_unlink(options.connlog_db);
+  if (!(f = fopen(options.connlog_db, "w")))
+    return 0;
+  fclose(f);
+  options.connlog_flush_interval = interval;
+  if (!init_conndb(0))
+    return 0;
+
+#ifdef CONNLOG_THREADS
+  if (batches)
+    *batches = connlog_batches;
+#endif
+  penn_gettimeofday(&start);
+  for (i = 0; i < conns; i++) {
+    id = connlog_connection("10.0.0.1", "bench.example.com", 0);
+    if (i == 0)
+      first = id;
+    else if (id != first + i)
+      *ids = 0;
+    connlog_login(id, GOD);
+    connlog_set_websocket(id);
+    connlog_disconnection(id, "bench");
+  }
+  penn_gettimeofday(&end);
+#ifdef CONNLOG_THREADS
+  if (batches) {
+    pthread_mutex_lock(&connlog_lock);
+    *batches = connlog_batches - *batches;
+    pthread_mutex_unlock(&connlog_lock);
+  }
+#endif
+
+  connlog_flush();
+  if (sqlite3_prepare_v2(connlog_db,
+                         "SELECT count(*) FROM connlog WHERE dbref = ? AND "
+                         "name = ? AND ipaddr = '10.0.0.1' AND websocket = 1 "
+                         "AND reason = 'bench' AND disconn != 2147483647",
+                         -1, &count, NULL) == SQLITE_OK) {
+    sqlite3_bind_int(count, 1, GOD);
+    sqlite3_bind_text(count, 2, Name(GOD), -1, SQLITE_STATIC);
+    *ok = sqlite3_step(count) == SQLITE_ROW &&
+          sqlite3_column_int(count, 0) == conns;
+    sqlite3_finalize(count);
+  }
+  shutdown_conndb(1);
+  connlog_bench_unlink(options.connlog_db);
+  return ((end.tv_sec - start.tv_sec) * 1000000.0 +
+          (end.tv_usec - start.tv_usec)) /
+         conns;
+}
+
+static void
+connlog_bench_run(void *arg, void *result)
+{
+  const struct connlog_bench_spec *spec = arg;
+  struct connlog_bench *r = result;
+  int conns = spec->conns;
+  uint64_t batches = conns;
+
+  options.use_connlog = 1;
+  mush_strncpy(options.connlog_db, spec->db, sizeof options.connlog_db);
+  r->ids_ok = 1;
+  r->inline_us = connlog_bench_pass(conns, 0, &r->inline_ok, &r->ids_ok, NULL);
+  r->async_us =
+    connlog_bench_pass(conns, 250, &r->async_ok, &r->ids_ok, &batches);
+  r->batched = batches < (uint64_t) conns;
+}
+
+/* Run the connlog tests in a child, with a database of its own in a
+ * scratch directory. */
+static bool
+connlog_bench_fork(struct connlog_bench *r, int conns)
+{
+  struct connlog_bench_spec spec;
+  char dir[FILE_PATH_LEN];
+  bool ok;
+
+  memset(r, 0, sizeof *r);
+  if (!test_scratch_dir(dir, sizeof dir, "connlogbench"))
+    return 0;
+  spec.conns = conns;
+  if (snprintf(spec.db, sizeof spec.db, "%s/connlog.db", dir) >=
+      (int) sizeof spec.db) {
+    rmdir(dir);
+    return 0;
+  }
+  ok = run_in_child(connlog_bench_run, &spec, r, sizeof *r);
+  connlog_bench_unlink(spec.db);
+  rmdir(dir);
+  return ok;
+}
+#endif
+
+TEST_GROUP(connlog_writer)
+{
+#ifndef WIN32
+  struct connlog_bench r;
+  bool ok;
+
+  ok = connlog_bench_fork(&r, CONNLOG_TEST_CONNS);
+  TEST("connlog_writer.1", ok && r.inline_ok);
+  TEST("connlog_writer.2", r.async_ok);
+  TEST("connlog_writer.3", r.ids_ok);
+#ifdef CONNLOG_THREADS
+  TEST("connlog_writer.4", r.batched);
+#endif
+#endif
+}
+
+BENCHMARK(connlog_writer)
+{
+#ifndef WIN32
+  struct connlog_bench r;
+
+  if (!connlog_bench_fork(&r, CONNLOG_BENCH_CONNS))
+    return;
+  do_rawlog(LT_TRACE,
+            "connlog_writer: logged a connection in %.1fus written as it "
+            "happened, and %.1fus queued for the writer.",
+            r.inline_us, r.async_us);
+#endif
+}
@@ -50,6 +50,7 @@
 #include "mushdb.h"
 #include "mymalloc.h"
 #include "parse.h"
+#include "profile.h"
 #include "ptab.h"
 #include "strtree.h"
 #include "strutil.h"
@@ -59,7 +60,7 @@ intmap *queue_map = NULL; /**< Intmap for looking up queue entries by pid */
 static uint32_t top_pid = 1;
 #define MAX_PID (1U << 15)
 
-static MQUE *qfirst = NULL, *qlast = NULL, *qwait = NULL;
+static MQUE *qfirst = NULL, *qlast = NULL;
 static MQUE *qsemfirst = NULL, *qsemlast = NULL;
 
 static int add_to_generic(dbref player, int am, const char *name,
@@ -74,7 +75,8 @@ void wait_que(dbref executor, int waittill, char *command, dbref enactor,
 int que_next(void);
 
 static void show_queue(dbref player, dbref victim, int q_type, int q_quiet,
-                       int q_all, MQUE *q_ptr, int *tot, int *self, int *del);
+                       int q_all, MQUE *q_ptr, MQUE **q_arr, int *tot,
+                       int *self, int *del);
 static void show_queue_single(dbref player, MQUE *q, int q_type);
 static void show_queue_env(dbref player, MQUE *q);
 static void do_raw_restart(dbref victim);
@@ -110,6 +112,299 @@ init_queue(void)
   queue_map = im_new();
 }
 
+/* The wait queue, and semaphore entries with a timeout, are binary heaps
+ * ordered by wait_until, with ties going to whichever entry was queued
+ * first. Each entry remembers its slot in wait_index so it can be moved
+ * or removed without a search.
+ *
+ * Semaphore entries are also kept in qsemfirst/qsemlast in the order
+ * they were queued, and chained per object and attribute so @notify and
+ * @drain only look at entries actually waiting on what they name.
+ */
+
+/** A heap of waiting queue entries */
+struct wait_heap {
+  MQUE **entries; /**< The heap */
+  int count;      /**< Number of entries */
+  int size;       /**< Allocated size */
+};
+
+/** Queue entries waiting on one object/attribute semaphore */
+struct sem_chain {
+  char *attr;             /**< Semaphore attribute */
+  MQUE *first;            /**< First entry waiting */
+  MQUE *last;             /**< Last entry waiting */
+  struct sem_chain *next; /**< Next chain on the same object */
+};
+
+static struct wait_heap qwait = {NULL, 0, 0};
+static struct wait_heap qsemwait = {NULL, 0, 0};
+static intmap *sem_chains = NULL; /**< Object to its first sem_chain */
+static uint64_t wait_seq = 0;
+
+static inline bool
+wait_before(const MQUE *a, const MQUE *b)
+{
+  return a->wait_until < b->wait_until ||
+         (a->wait_until == b->wait_until && a->wait_seq < b->wait_seq);
+}
+
+static void
+wait_heap_up(struct wait_heap *h, int i)
+{
+  MQUE *entry = h->entries[i];
+  int parent;
+
+  while (i > 0) {
+    parent = (i - 1) / 2;
+    if (!wait_before(entry, h->entries[parent]))
+      break;
+    h->entries[i] = h->entries[parent];
+    h->entries[i]->wait_index = i;
+    i = parent;
+  }
+  h->entries[i] = entry;
+  entry->wait_index = i;
+}
+
+static void
+wait_heap_down(struct wait_heap *h, int i)
+{
+  MQUE *entry = h->entries[i];
+  int child;
+
+  while ((child = 2 * i + 1) < h->count) {
+    if (child + 1 < h->count &&
+        wait_before(h->entries[child + 1], h->entries[child]))
+      child++;
+    if (!wait_before(h->entries[child], entry))
+      break;
+    h->entries[i] = h->entries[child];
+    h->entries[i]->wait_index = i;
+    i = child;
+  }
+  h->entries[i] = entry;
+  entry->wait_index = i;
+}
+
+static void
+wait_heap_push(struct wait_heap *h, MQUE *entry)
+{
+  if (h->count == h->size) {
+    h->size = h->size ? h->size * 2 : 64;
+    h->entries =
+      mush_realloc(h->entries, sizeof(MQUE *) * h->size, "mque.wait_heap");
+  }
+  h->entries[h->count] = entry;
+  wait_heap_up(h, h->count++);
+}
+
+static void
+wait_heap_remove(struct wait_heap *h, MQUE *entry)
+{
+  MQUE *moved;
+  int i = entry->wait_index;
+
+  if (i < 0)
+    return;
+  entry->wait_index = -1;
+  if (i == --h->count)
+    return;
+  moved = h->entries[h->count];
+  h->entries[i] = moved;
+  moved->wait_index = i;
+  wait_heap_up(h, i);
+  wait_heap_down(h, moved->wait_index);
+}
+
+/* Put an entry back in order after its wait_until has changed. */
+static void
+wait_heap_fix(struct wait_heap *h, MQUE *entry)
+{
+  wait_heap_up(h, entry->wait_index);
+  wait_heap_down(h, entry->wait_index);
+}
+
+static int
+wait_cmp(const void *a, const void *b)
+{
+  const MQUE *qa = *(const MQUE *const *) a;
+  const MQUE *qb = *(const MQUE *const *) b;
+
+  return wait_before(qa, qb) ? -1 : (wait_before(qb, qa) ? 1 : 0);
+}
+
+static int
+wait_seq_cmp(const void *a, const void *b)
+{
+  const MQUE *qa = *(const MQUE *const *) a;
+  const MQUE *qb = *(const MQUE *const *) b;
+
+  return qa->wait_seq < qb->wait_seq ? -1 : (qa->wait_seq > qb->wait_seq);
+}
+
+/* Return a copy of the wait queue in the order it'll run, for @ps and
+ * friends. Free with mush_free(..., "mque.wait_sorted"). */
+static MQUE **
+wait_queue_sorted(void)
+{
+  MQUE **sorted;
+
+  sorted = mush_calloc(qwait.count + 1, sizeof(MQUE *), "mque.wait_sorted");
+  if (qwait.count) {
+    memcpy(sorted, qwait.entries, sizeof(MQUE *) * qwait.count);
+    qsort(sorted, qwait.count, sizeof(MQUE *), wait_cmp);
+  }
+  return sorted;
+}
+
+static struct sem_chain *
+sem_chain_find(dbref thing, const char *aname, bool create)
+{
+  struct sem_chain *chain, *head;
+
+  if (!sem_chains)
+    sem_chains = im_new();
+  head = im_find(sem_chains, thing);
+  for (chain = head; chain; chain = chain->next)
+    if (!strcmp(chain->attr, aname))
+      return chain;
+  if (!create)
+    return NULL;
+  chain = mush_malloc(sizeof *chain, "mque.sem_chain");
+  chain->attr = mush_strdup(aname, "mque.sem_chain");
+  chain->first = chain->last = NULL;
+  chain->next = head;
+  if (head)
+    im_delete(sem_chains, thing);
+  im_insert(sem_chains, thing, chain);
+  return chain;
+}
+
+static void
+sem_chain_free(dbref thing, struct sem_chain *chain)
+{
+  struct sem_chain *head, *prev;
+
+  head = im_find(sem_chains, thing);
+  if (head == chain) {
+    im_delete(sem_chains, thing);
+    if (chain->next)
+      im_insert(sem_chains, thing, chain->next);
+  } else {
+    for (prev = head; prev && prev->next != chain; prev = prev->next)
+      ;
+    if (prev)
+      prev->next = chain->next;
+  }
+  mush_free(chain->attr, "mque.sem_chain");
+  mush_free(chain, "mque.sem_chain");
+}
+
+/* Add a new semaphore entry to the back of the semaphore queue. */
+static void
+sem_link(MQUE *entry)
+{
+  struct sem_chain *chain;
+
+  entry->wait_seq = wait_seq++;
+  entry->next = NULL;
+  entry->prev = qsemlast;
+  if (qsemlast)
+    qsemlast->next = entry;
+  else
+    qsemfirst = entry;
+  qsemlast = entry;
+
+  chain = sem_chain_find(entry->semaphore_obj, entry->semaphore_attr, 1);
+  entry->sem_next = NULL;
+  entry->sem_prev = chain->last;
+  if (chain->last)
+    chain->last->sem_next = entry;
+  else
+    chain->first = entry;
+  chain->last = entry;
+
+  if (entry->wait_until)
+    wait_heap_push(&qsemwait, entry);
+}
+
+/* Is an entry still waiting in the semaphore queue? Entries that have
+ * been notified or timed out keep their semaphore_attr. */
+static inline bool
+sem_queued(MQUE *entry)
+{
+  return entry->prev || qsemfirst == entry;
+}
+
+/* Take an entry out of the semaphore queue. The caller handles the
+ * semaphore count and what happens to the entry next. */
+static void
+sem_unlink(MQUE *entry)
+{
+  struct sem_chain *chain;
+
+  if (entry->prev)
+    entry->prev->next = entry->next;
+  else
+    qsemfirst = entry->next;
+  if (entry->next)
+    entry->next->prev = entry->prev;
+  else
+    qsemlast = entry->prev;
+  entry->next = entry->prev = NULL;
+
+  chain = sem_chain_find(entry->semaphore_obj, entry->semaphore_attr, 0);
+  if (chain) {
+    if (entry->sem_prev)
+      entry->sem_prev->sem_next = entry->sem_next;
+    else
+      chain->first = entry->sem_next;
+    if (entry->sem_next)
+      entry->sem_next->sem_prev = entry->sem_prev;
+    else
+      chain->last = entry->sem_prev;
+    if (!chain->first)
+      sem_chain_free(entry->semaphore_obj, chain);
+  }
+  entry->sem_next = entry->sem_prev = NULL;
+
+  wait_heap_remove(&qsemwait, entry);
+}
+
+/* The first entry waiting on thing/aname, or on any attribute of thing
+ * if aname is NULL. */
+static MQUE *
+sem_first(dbref thing, const char *aname)
+{
+  struct sem_chain *chain;
+  MQUE *first = NULL;
+
+  if (!sem_chains)
+    return NULL;
+  if (aname) {
+    chain = sem_chain_find(thing, aname, 0);
+    return chain ? chain->first : NULL;
+  }
+  for (chain = im_find(sem_chains, thing); chain; chain = chain->next)
+    if (!first || chain->first->wait_seq < first->wait_seq)
+      first = chain->first;
+  return first;
+}
+
+/* Move an entry to the end of the player/object queue. */
+static void
+append_que(MQUE *entry)
+{
+  entry->next = NULL;
+  if (qlast) {
+    qlast->next = entry;
+    qlast = entry;
+  } else {
+    qlast = qfirst = entry;
+  }
+}
+
 /** Returns true if the attribute on thing can be used as a semaphore.
  * atr should be given in UPPERCASE.
  */
@@ -363,7 +658,13 @@ new_queue_entry(NEW_PE_INFO *pe_info)
     entry->pe_info = make_pe_info("pe_info-new_queue_entry");
 
   entry->inplace = NULL;
+  entry->inplace_last = NULL;
   entry->next = NULL;
+  entry->prev = NULL;
+  entry->sem_next = NULL;
+  entry->sem_prev = NULL;
+  entry->wait_index = -1;
+  entry->wait_seq = 0;
 
   entry->semaphore_obj = NOTHING;
   entry->semaphore_attr = NULL;
@@ -573,15 +874,11 @@ insert_que(MQUE *queue_entry, MQUE *parent_queue)
     }
     break;
   case QUEUE_INPLACE:
-    if (parent_queue->inplace) {
-      MQUE *tmp;
-      tmp = parent_queue->inplace;
-      while (tmp->next)
-        tmp = tmp->next;
-      tmp->next = queue_entry;
-    } else {
+    if (parent_queue->inplace)
+      parent_queue->inplace_last->next = queue_entry;
+    else
       parent_queue->inplace = queue_entry;
-    }
+    parent_queue->inplace_last = queue_entry;
     break;
   default:
     /* Oops. This shouldn't happen; make sure we don't leave
@@ -935,28 +1232,13 @@ wait_que(dbref executor, int waittill, char *command, dbref enactor, dbref sem,
   tmp->semaphore_obj = sem;
   if (sem == NOTHING) {
     /* No semaphore, put on normal wait queue, sorted by time */
-    MQUE *point, *trail = NULL;
-
-    for (point = qwait; point && (point->wait_until <= tmp->wait_until);
-         point = point->next)
-      trail = point;
-
-    tmp->next = point;
-    if (trail != NULL)
-      trail->next = tmp;
-    else
-      qwait = tmp;
+    tmp->wait_seq = wait_seq++;
+    wait_heap_push(&qwait, tmp);
   } else {
-
     /* Put it on the end of the semaphore queue */
     tmp->semaphore_attr =
       mush_strdup(semattr ? semattr : "SEMAPHORE", "mque.semaphore_attr");
-    if (qsemlast != NULL) {
-      qsemlast->next = tmp;
-      qsemlast = tmp;
-    } else {
-      qsemfirst = qsemlast = tmp;
-    }
+    sem_link(tmp);
   }
   im_insert(queue_map, tmp->pid, tmp);
 }
@@ -1002,7 +1284,9 @@ void
 queue_update(void)
 {
   static time_t last_mudtime = 0;
-  MQUE *trail = NULL, *point, *next;
+  MQUE *point;
+  MQUE **due;
+  int ndue = 0, i;
 
   if (mudtime == last_mudtime) {
     /* Only run once per second at most. */
@@ -1011,41 +1295,31 @@ queue_update(void)
   last_mudtime = mudtime;
 
   /* check regular @wait queue */
-  while (qwait && qwait->wait_until <= mudtime) {
-    point = qwait;
-    qwait = point->next;
-    point->next = NULL;
+  while (qwait.count && qwait.entries[0]->wait_until <= mudtime) {
+    point = qwait.entries[0];
+    wait_heap_remove(&qwait, point);
     point->wait_until = 0;
-    if (qlast) {
-      qlast->next = point;
-      qlast = point;
-    } else {
-      qlast = qfirst = point;
-    }
+    append_que(point);
   }
 
-  /* check for semaphore Zwait timeouts */
-  for (point = qsemfirst, trail = NULL; point; point = next) {
-    if (point->wait_until == 0 || point->wait_until > mudtime) {
-      next = (trail = point)->next;
-      continue; /* skip non-timed and those that haven't gone off yet */
-    }
-    if (trail != NULL)
-      trail->next = next = point->next;
-    else
-      qsemfirst = next = point->next;
-    if (point == qsemlast)
-      qsemlast = trail;
+  /* check for semaphore @wait timeouts. These run in the order they were
+   * queued, like the rest of the semaphore queue. */
+  if (!qsemwait.count || qsemwait.entries[0]->wait_until > mudtime)
+    return;
+  due = mush_calloc(qsemwait.count, sizeof(MQUE *), "mque.wait_sorted");
+  while (qsemwait.count && qsemwait.entries[0]->wait_until <= mudtime) {
+    due[ndue] = qsemwait.entries[0];
+    wait_heap_remove(&qsemwait, due[ndue++]);
+  }
+  qsort(due, ndue, sizeof(MQUE *), wait_seq_cmp);
+  for (i = 0; i < ndue; i++) {
+    point = due[i];
+    sem_unlink(point);
     add_to_sem(point->semaphore_obj, -1, point->semaphore_attr);
     point->semaphore_obj = NOTHING;
-    point->next = NULL;
-    if (qlast) {
-      qlast->next = point;
-      qlast = point;
-    } else {
-      qlast = qfirst = point;
-    }
+    append_que(point);
   }
+  mush_free(due, "mque.wait_sorted");
 }
 
 /** Execute some commands from the top of the queue.
@@ -1124,6 +1398,7 @@ do_entry(MQUE *entry, int include_recurses)
   MQUE *tmp;
   int pt_flag = PT_SEMI;
   PE_REGS *pe_regs;
+  int prof;
 
   if (entry->queue_type & QUEUE_NOLIST)
     pt_flag = PT_NOTHING;
@@ -1142,6 +1417,10 @@ do_entry(MQUE *entry, int include_recurses)
 
   queue_load_record[0] += 1;
 
+  prof = PROFILE_ENTER(entry->pe_info->attrname ? PROFILE_ATTRIBUTE
+                                                : PROFILE_COMMAND,
+                       entry->pe_info->attrname ? NOTHING : executor,
+                       entry->pe_info->attrname);
   s = entry->action_list;
   if (!include_recurses) {
     start_cpu_timer();
@@ -1249,6 +1528,7 @@ do_entry(MQUE *entry, int include_recurses)
     }
   }
 
+  PROFILE_LEAVE(prof);
   if (!include_recurses)
     reset_cpu_timer();
 
@@ -1267,7 +1547,6 @@ uint64_t
 queue_msecs_till_next(void)
 {
   uint64_t min, curr;
-  MQUE *point;
   /* If there are commands in the player queue, they should be run
    * immediately.
    */
@@ -1282,21 +1561,18 @@ queue_msecs_till_next(void)
    * queue when they have one second to go.
    */
 
-  /* Wait queue is in sorted order so we only have to look at the first
-     item on it. Anything else is wasted time. */
-  if (qwait) {
-    curr = SECS_TO_MSECS(difftime(qwait->wait_until, mudtime));
+  /* Both heaps have their soonest entry on top, so that's all we need
+     to look at. */
+  if (qwait.count) {
+    curr = SECS_TO_MSECS(difftime(qwait.entries[0]->wait_until, mudtime));
     if (curr < min)
       min = curr;
   }
 
-  for (point = qsemfirst; point; point = point->next) {
-    if (point->wait_until == 0) /* no timeout */
-      continue;
-    curr = SECS_TO_MSECS(difftime(point->wait_until, mudtime));
-    if (curr < min) {
+  if (qsemwait.count) {
+    curr = SECS_TO_MSECS(difftime(qsemwait.entries[0]->wait_until, mudtime));
+    if (curr < min)
       min = curr;
-    }
   }
 
   return min;
@@ -1325,49 +1601,28 @@ drain_helper(dbref player __attribute__((__unused__)), dbref thing,
 int
 execute_one_semaphore(dbref thing, char const *aname, PE_REGS *pe_regs)
 {
-  MQUE **point;
   MQUE *entry;
 
-  /* Go through the semaphore queue and do it */
-  point = &qsemfirst;
-  while (*point) {
-    entry = *point;
-    if (entry->semaphore_obj != thing ||
-        (aname && strcmp(entry->semaphore_attr, aname))) {
-      point = &(entry->next);
-      continue;
-    }
-
-    /* Remove the queue entry from the semaphore list */
-    *point = entry->next;
-    entry->next = NULL;
-    if (qsemlast == entry) {
-      qsemlast = qsemfirst;
-      if (qsemlast)
-        while (qsemlast->next)
-          qsemlast = qsemlast->next;
-    }
+  entry = sem_first(thing, aname);
+  if (!entry)
+    return 0;
 
-    /* Update bookkeeping */
-    add_to_sem(entry->semaphore_obj, -1, entry->semaphore_attr);
+  /* Remove the queue entry from the semaphore list */
+  sem_unlink(entry);
 
-    if (pe_regs) {
-      if (entry->pe_info == NULL) {
-        entry->pe_info = make_pe_info("pe_info-execute_one_semaphore");
-      }
-      pe_regs_copystack(entry->pe_info->regvals, pe_regs, PE_REGS_QUEUE, 1);
-    }
+  /* Update bookkeeping */
+  add_to_sem(entry->semaphore_obj, -1, entry->semaphore_attr);
 
-    /* And enqueue */
-    if (qlast) {
-      qlast->next = entry;
-      qlast = entry;
-    } else {
-      qlast = qfirst = entry;
+  if (pe_regs) {
+    if (entry->pe_info == NULL) {
+      entry->pe_info = make_pe_info("pe_info-execute_one_semaphore");
     }
-    return 1;
+    pe_regs_copystack(entry->pe_info->regvals, pe_regs, PE_REGS_QUEUE, 1);
   }
-  return 0;
+
+  /* And enqueue */
+  append_que(entry);
+  return 1;
 }
 
 /** Drain or notify a semaphore.
@@ -1384,31 +1639,15 @@ dequeue_semaphores(dbref thing, char const *aname, int count, int all,
                    int drain)
 {
 
-  MQUE **point;
   MQUE *entry;
 
   if (all)
     count = INT_MAX;
 
-  /* Go through the semaphore queue and do it */
-  point = &qsemfirst;
-  while (*point && count > 0) {
-    entry = *point;
-    if (entry->semaphore_obj != thing ||
-        (aname && strcmp(entry->semaphore_attr, aname))) {
-      point = &(entry->next);
-      continue;
-    }
-
+  /* Go through the entries waiting on this semaphore and do it */
+  while (count > 0 && (entry = sem_first(thing, aname))) {
     /* Remove the queue entry from the semaphore list */
-    *point = entry->next;
-    entry->next = NULL;
-    if (qsemlast == entry) {
-      qsemlast = qsemfirst;
-      if (qsemlast)
-        while (qsemlast->next)
-          qsemlast = qsemlast->next;
-    }
+    sem_unlink(entry);
 
     /* Update bookkeeping */
     count--;
@@ -1421,12 +1660,7 @@ dequeue_semaphores(dbref thing, char const *aname, int count, int all,
       add_to(entry->executor, -1);
       free_qentry(entry);
     } else {
-      if (qlast) {
-        qlast->next = entry;
-        qlast = entry;
-      } else {
-        qlast = qfirst = entry;
-      }
+      append_que(entry);
     }
   }
 
@@ -1641,8 +1875,7 @@ void
 do_waitpid(dbref player, const char *pidstr, const char *timestr, bool until)
 {
   uint32_t pid;
-  MQUE *q, *tmp, *last;
-  bool found;
+  MQUE *q;
 
   if (!is_strict_uinteger(pidstr)) {
     notify(player, T("That is not a valid pid!"));
@@ -1698,41 +1931,19 @@ do_waitpid(dbref player, const char *pidstr, const char *timestr, bool until)
       q->wait_until = 0;
   }
 
-  /* Now adjust it in the wait queue. Not a clever approach, but I
-     wrote it at 3 am and clever was not an option. */
-  found = false;
-  for (tmp = qwait, last = NULL; tmp; last = tmp, tmp = tmp->next) {
-    if (tmp == q) {
-      if (last)
-        last->next = q->next;
-      else
-        qwait = qwait->next;
-      found = true;
-      break;
-    }
-  }
-  if (found) {
-    found = false;
-    for (tmp = qwait, last = NULL; tmp; last = tmp, tmp = tmp->next) {
-      if (tmp->wait_until > q->wait_until) {
-        if (last) {
-          last->next = q;
-          q->next = tmp;
-        } else {
-          q->next = qwait;
-          qwait = q;
-        }
-        found = true;
-        break;
-      }
-    }
-    if (!found) {
-      if (last)
-        last->next = q;
+  /* Now adjust it in the wait queue, behind anything else due at the same
+     time, or in the semaphore timeouts. */
+  if (q->semaphore_attr) {
+    if (q->wait_index >= 0) {
+      if (q->wait_until)
+        wait_heap_fix(&qsemwait, q);
       else
-        qwait = q;
-      q->next = NULL;
+        wait_heap_remove(&qsemwait, q);
     }
+  } else if (q->wait_index >= 0) {
+    wait_heap_remove(&qwait, q);
+    q->wait_seq = wait_seq++;
+    wait_heap_push(&qwait, q);
   }
 
   notify_format(player, T("Queue entry with pid %u updated."),
@@ -1831,6 +2042,7 @@ FUNCTION(fun_lpids)
   /* Can be called as LPIDS or GETPIDS */
   MQUE *tmp;
   int qmask = 0;
+  int i;
   dbref thing = NOTHING;
   dbref player = NOTHING;
   char *attrib = NULL;
@@ -1896,7 +2108,8 @@ FUNCTION(fun_lpids)
     }
   }
   if (qmask & LPIDS_WAIT) {
-    for (tmp = qwait; tmp; tmp = tmp->next) {
+    MQUE **waits = wait_queue_sorted();
+    for (i = 0; (tmp = waits[i]); i++) {
       if (GoodObject(player) && GoodObject(tmp->executor) &&
           ((qmask & LPIDS_INDEPENDENT) ? (tmp->executor != player)
                                        : !Owns(tmp->executor, player))) {
@@ -1907,6 +2120,7 @@ FUNCTION(fun_lpids)
       safe_integer(tmp->pid, buff, bp);
       first = false;
     }
+    mush_free(waits, "mque.wait_sorted");
   }
   if (qmask & LPIDS_SEMAPHORE) {
     for (tmp = qsemfirst; tmp; tmp = tmp->next) {
@@ -1928,10 +2142,12 @@ FUNCTION(fun_lpids)
 
 static void
 show_queue(dbref player, dbref victim, int q_type, int q_quiet, int q_all,
-           MQUE *q_ptr, int *tot, int *self, int *del)
+           MQUE *q_ptr, MQUE **q_arr, int *tot, int *self, int *del)
 {
   MQUE *tmp;
-  for (tmp = q_ptr; tmp; tmp = tmp->next) {
+  int i = 0;
+  for (tmp = q_arr ? q_arr[0] : q_ptr; tmp;
+       tmp = q_arr ? q_arr[++i] : tmp->next) {
     (*tot)++;
     if (!GoodObject(tmp->executor))
       (*del)++;
@@ -2064,6 +2280,7 @@ do_queue(dbref player, const char *what, enum queue_type flag)
   int dpq = 0, dwq = 0, dsq = 0;
   int pq = 0, wq = 0, sq = 0;
   int tpq = 0, twq = 0, tsq = 0;
+  MQUE **waits;
   if (flag == QUEUE_SUMMARY || flag == QUEUE_QUICK)
     quick = 1;
   if (flag == QUEUE_ALL || flag == QUEUE_SUMMARY) {
@@ -2098,13 +2315,16 @@ do_queue(dbref player, const char *what, enum queue_type flag)
     victim = Owner(victim);
     if (!quick)
       notify(player, T("Command Queue:"));
-    show_queue(player, victim, 0, quick, all, qfirst, &tpq, &pq, &dpq);
+    show_queue(player, victim, 0, quick, all, qfirst, NULL, &tpq, &pq, &dpq);
     if (!quick)
       notify(player, T("Wait Queue:"));
-    show_queue(player, victim, 1, quick, all, qwait, &twq, &wq, &dwq);
+    waits = wait_queue_sorted();
+    show_queue(player, victim, 1, quick, all, NULL, waits, &twq, &wq, &dwq);
+    mush_free(waits, "mque.wait_sorted");
     if (!quick)
       notify(player, T("Semaphore Queue:"));
-    show_queue(player, victim, 2, quick, all, qsemfirst, &tsq, &sq, &dsq);
+    show_queue(player, victim, 2, quick, all, qsemfirst, NULL, &tsq, &sq,
+               &dsq);
     if (!quick)
       notify(player, T("------------  Queue Done  ------------"));
     notify_format(player,
@@ -2170,8 +2390,8 @@ do_queue_single(dbref player, char *pidstr, bool debug)
 void
 do_halt(dbref owner, const char *ncom, dbref victim)
 {
-  MQUE *tmp, *trail = NULL, *point, *next;
-  int num = 0;
+  MQUE *tmp, *point, *next;
+  int num = 0, i, kept;
   dbref player;
   if (victim == NOTHING)
     player = owner;
@@ -2188,37 +2408,36 @@ do_halt(dbref owner, const char *ncom, dbref victim)
       tmp->executor = NOTHING;
     }
   }
-  /* remove wait q stuff */
-  for (point = qwait; point; point = next) {
+  /* remove wait q stuff, then put what's left back in order */
+  for (i = kept = 0; i < qwait.count; i++) {
+    point = qwait.entries[i];
     if (((point->executor == player) || (Owner(point->executor) == player))) {
       num--;
       giveto(player, QUEUE_COST);
-      if (trail)
-        trail->next = next = point->next;
-      else
-        qwait = next = point->next;
+      point->wait_index = -1;
       free_qentry(point);
     } else {
-      next = (trail = point)->next;
+      qwait.entries[kept] = point;
+      point->wait_index = kept++;
     }
   }
+  if (kept < qwait.count) {
+    qwait.count = kept;
+    for (i = kept / 2 - 1; i >= 0; i--)
+      wait_heap_down(&qwait, i);
+  }
 
   /* clear semaphore queue */
 
-  for (point = qsemfirst, trail = NULL; point; point = next) {
+  for (point = qsemfirst; point; point = next) {
+    next = point->next;
     if (((point->executor == player) || (Owner(point->executor) == player))) {
       num--;
       giveto(player, QUEUE_COST);
-      if (trail)
-        trail->next = next = point->next;
-      else
-        qsemfirst = next = point->next;
-      if (point == qsemlast)
-        qsemlast = trail;
+      sem_unlink(point);
       add_to_sem(point->semaphore_obj, -1, point->semaphore_attr);
       free_qentry(point);
-    } else
-      next = (trail = point)->next;
+    }
   }
 
   add_to(player, num);
@@ -2317,20 +2536,8 @@ do_haltpid(dbref player, const char *arg1)
      turn comes up (Or show it in @ps, etc.).  Exception is for
      semaphores, which otherwise might wait forever. */
   q->executor = NOTHING;
-  if (q->semaphore_attr) {
-    MQUE *last = NULL, *tmp;
-    for (tmp = qsemfirst; tmp; last = tmp, tmp = tmp->next) {
-      if (tmp == q) {
-        if (last)
-          last->next = tmp->next;
-        else
-          qsemfirst = tmp->next;
-        if (qsemlast == tmp)
-          qsemlast = last;
-        break;
-      }
-    }
-
+  if (sem_queued(q)) {
+    sem_unlink(q);
     giveto(victim, QUEUE_COST);
     add_to_sem(q->semaphore_obj, -1, q->semaphore_attr);
     free_qentry(q);
@@ -2460,9 +2667,24 @@ do_restart_com(dbref player, const char *arg1)
 void
 shutdown_queues(void)
 {
+  MQUE *entry;
+  int i;
+
   shutdown_a_queue(&qfirst, &qlast);
-  shutdown_a_queue(&qsemfirst, &qsemlast);
-  shutdown_a_queue(&qwait, NULL);
+  while (qsemfirst) {
+    entry = qsemfirst;
+    sem_unlink(entry);
+    entry->next = NULL;
+    shutdown_a_queue(&entry, NULL);
+  }
+  /* The wait queue's entries aren't linked, so chain them up first */
+  for (i = 0; i < qwait.count; i++) {
+    qwait.entries[i]->wait_index = -1;
+    qwait.entries[i]->next = i + 1 < qwait.count ? qwait.entries[i + 1] : NULL;
+  }
+  entry = qwait.count ? qwait.entries[0] : NULL;
+  qwait.count = 0;
+  shutdown_a_queue(&entry, NULL);
 }
 
 static void
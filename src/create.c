@@ -377,6 +377,7 @@ do_link(dbref player, const char *name, const char *room_name, int preserve,
       if (!preserve) {
         Owner(thing) = Owner(player);
         Zone(thing) = Zone(player);
+        search_index_touch(thing);
       }
       delete_link_from(thing);
       Location(thing) = room;
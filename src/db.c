@@ -49,6 +49,7 @@
 #include "mymalloc.h"
 #include "parse.h"
 #include "privtab.h"
+#include "snapshot.h"
 #include "strtree.h"
 #include "strutil.h"
 #include "mushsql.h"
@@ -96,6 +97,7 @@ void db_read_attrs(PENNFILE *f, dbref i, int c);
 int get_list(PENNFILE *f, dbref i);
 void db_free(void);
 static void init_objdata();
+static dbref db_read_labeled(PENNFILE *f);
 static void db_write_flags(PENNFILE *f);
 static void db_write_attrs(PENNFILE *f);
 static dbref db_read_oldstyle(PENNFILE *f);
@@ -118,6 +120,8 @@ init_names(void)
   st_init(&object_names, "ObjectNameTree");
 }
 
+unsigned int name_generation = 0; /**< Bumped whenever a name changes */
+
 /** Set an object's name through the name strtree.
  * We maintain object names in a strtree because many objects have
  * the same name (cardinal exits, weapons and armor, etc.)
@@ -131,6 +135,7 @@ init_names(void)
 const char *
 set_name(dbref obj, const char *newname)
 {
+  name_generation++;
   /* if pointer not null unalloc it */
   if (Name(obj))
     st_delete(Name(obj), &object_names);
@@ -141,6 +146,7 @@ set_name(dbref obj, const char *newname)
   // On the string tree.
   Name(obj) = strdup(newname);
   st_insert(Name(obj), &object_names);
+  snapshot_touch(obj);
   return Name(obj);
 }
 
@@ -198,6 +204,7 @@ db_grow(dbref newtop)
       o->powers = NULL;
       o->warnings = 0;
       o->modification_time = o->creation_time = mudtime;
+      o->attr_version = 0;
       o->attrcount = 0;
       o->attrcap = 0;
       o->list = NULL;
@@ -247,6 +254,8 @@ new_object(void)
   }
 
   add_object_table(newobj);
+  search_index_touch(newobj);
+  snapshot_touch(newobj);
 
   return newobj;
 }
@@ -1211,6 +1220,7 @@ db_free(void)
 {
   dbref i;
 
+  search_index_reset();
   if (db) {
 
     for (i = 0; i < db_top; i++) {
@@ -1570,13 +1580,13 @@ db_read_oldstyle(PENNFILE *f)
         /* If it has the MONITOR flag and the db predates HEAR_CONNECT, swap
          * them over */
         if (!(globals.indb_flags & DBF_HEAR_CONNECT) &&
-            has_flag_by_name(i, "MONITOR", NOTYPE)) {
+            HasCoreFlag(i, FH_MONITOR, NOTYPE)) {
           clear_flag_internal(i, "MONITOR");
           set_flag_internal(i, "HEAR_CONNECT");
         }
       }
 
-      if (IsRoom(i) && has_flag_by_name(i, "HAVEN", TYPE_ROOM)) {
+      if (IsRoom(i) && HasCoreFlag(i, FH_HAVEN, TYPE_ROOM)) {
         /* HAVEN flag is no longer settable on rooms. */
         clear_flag_internal(i, "HAVEN");
       }
@@ -1609,6 +1619,23 @@ db_read_oldstyle(PENNFILE *f)
   }
 }
 
+/** Throw away the current database before reading in a new one.
+ * Every database reader calls this first.
+ */
+void
+db_read_setup(void)
+{
+  log_mem_check();
+
+  loading_db = 1;
+
+  (void) get_shared_db();
+  init_objdata();
+  clear_players();
+  db_free();
+  globals.indb_flags = 1;
+}
+
 /** Read the object database from a file.
  * This function reads the entire database from a file. See db_write()
  * for some notes about the expected format.
@@ -1619,6 +1646,38 @@ dbref
 db_read(PENNFILE *f)
 {
   ODBC_Init();
+
+  db_read_setup();
+
+  if(ODBC_MUSH_LoadAllObjects() > 0)
+  {
+
+    loading_db = 0;
+    return db_top;
+  }
+
+  return db_read_labeled(f);
+}
+
+/** Read the object database from a text dump, ignoring any database
+ * kept in ODBC.
+ * \param f file pointer to read from.
+ * \return number of objects in the database.
+ */
+dbref
+db_read_text(PENNFILE *f)
+{
+  db_read_setup();
+  return db_read_labeled(f);
+}
+
+/** Read a text dump into an empty database.
+ * \param f file pointer to read from.
+ * \return number of objects in the database.
+ */
+static dbref
+db_read_labeled(PENNFILE *f)
+{
   sqlite3 *sqldb;
   sqlite3_stmt *adder;
   int status;
@@ -1629,23 +1688,7 @@ db_read(PENNFILE *f)
   int minimum_flags = DBF_NEW_STRINGS | DBF_TYPE_GARBAGE | DBF_SPLIT_IMMORTAL |
                       DBF_NO_TEMPLE | DBF_SPIFFY_LOCKS;
 
-  log_mem_check();
-
-  loading_db = 1;
-
   sqldb = get_shared_db();
-  init_objdata();
-  clear_players();
-  db_free();
-  globals.indb_flags = 1;
-
-
-  if(ODBC_MUSH_LoadAllObjects() > 0)
-  {
-
-    loading_db = 0;
-    return db_top;
-  }
 
   c = penn_fgetc(f);
   if (c != '+') {
@@ -1904,14 +1947,14 @@ db_read(PENNFILE *f)
           /* If it has the MONITOR flag and the db predates HEAR_CONNECT, swap
            * them over */
           if (!(globals.indb_flags & DBF_HEAR_CONNECT) &&
-              has_flag_by_name(i, "MONITOR", NOTYPE)) {
+              HasCoreFlag(i, FH_MONITOR, NOTYPE)) {
             clear_flag_internal(i, "MONITOR");
             set_flag_internal(i, "HEAR_CONNECT");
           }
         }
 
         if (globals.new_indb_version < 4 && IsRoom(i) &&
-            has_flag_by_name(i, "HAVEN", TYPE_ROOM)) {
+            HasCoreFlag(i, FH_HAVEN, TYPE_ROOM)) {
           /* HAVEN flag is no longer settable on rooms. */
           clear_flag_internal(i, "HAVEN");
         }
@@ -2864,6 +2907,9 @@ penn_fclose(PENNFILE *pf)
     gzclose(pf->handle.g);
 #endif
     break;
+  case PFT_ASYNC:
+    dump_writer_close(pf, NULL);
+    return;
   }
   mush_free(pf, "pennfile");
 }
@@ -2885,6 +2931,8 @@ penn_fgetc(PENNFILE *f)
     return gzgetc(f->handle.g);
 #endif
     break;
+  case PFT_ASYNC:
+    break;
   }
   return 0;
 }
@@ -2905,6 +2953,8 @@ penn_fgets(char *buf, int len, PENNFILE *pf)
     return gzgets(pf->handle.g, buf, len);
 #endif
     break;
+  case PFT_ASYNC:
+    break;
   }
   return NULL;
 }
@@ -2928,6 +2978,10 @@ penn_fputc(int c, PENNFILE *f)
     OUTPUT(gzputc(f->handle.g, c));
 #endif
     break;
+  case PFT_ASYNC: {
+    char ch = c;
+    dump_writer_put(f->handle.w, &ch, 1);
+  } break;
   }
   return 0;
 }
@@ -2949,6 +3003,9 @@ penn_fputs(const char *s, PENNFILE *f)
     OUTPUT(gzputs(f->handle.g, s));
 #endif
     break;
+  case PFT_ASYNC:
+    dump_writer_put(f->handle.w, s, strlen(s));
+    break;
   }
   return 0;
 }
@@ -3004,6 +3061,11 @@ penn_fprintf(PENNFILE *f, const char *fmt, ...)
 #endif
 #endif
     break;
+  case PFT_ASYNC:
+    va_start(ap, fmt);
+    r = dump_writer_vprintf(f->handle.w, fmt, ap);
+    va_end(ap);
+    break;
   }
   return r;
 }
@@ -3021,6 +3083,8 @@ penn_ungetc(int c, PENNFILE *f)
     OUTPUT(gzungetc(c, f->handle.g));
 #endif
     break;
+  case PFT_ASYNC:
+    break;
   }
   return c;
 }
@@ -3037,6 +3101,8 @@ penn_feof(PENNFILE *pf)
     return gzeof(pf->handle.g);
 #endif
     break;
+  case PFT_ASYNC:
+    break;
   }
   return 0;
 }
@@ -656,9 +656,11 @@ free_object(dbref thing)
   for (i = 0; i < db_top; i++) {
     if (Zone(i) == thing) {
       Zone(i) = NOTHING;
+      search_index_touch(i);
     }
     if (Parent(i) == thing) {
       Parent(i) = NOTHING;
+      search_index_touch(i);
     }
     if (Home(i) == thing) {
       switch (Typeof(i)) {
@@ -754,6 +756,7 @@ free_object(dbref thing)
   }
 
   Type(thing) = TYPE_GARBAGE;
+  search_index_touch(thing);
   destroy_flag_bitmask("FLAG", Flags(thing));
   Flags(thing) = NULL;
   destroy_flag_bitmask("POWER", Powers(thing));
@@ -1118,17 +1121,22 @@ check_fields(void)
       /* Do sanity checks on non-destroyed objects */
       dbref zone, loc, parent, home, owner, next;
       zone = Zone(thing);
-      if (GoodObject(zone) && IsGarbage(zone))
+      if (GoodObject(zone) && IsGarbage(zone)) {
         Zone(thing) = NOTHING;
+        search_index_touch(thing);
+      }
       parent = Parent(thing);
-      if (GoodObject(parent) && IsGarbage(parent))
+      if (GoodObject(parent) && IsGarbage(parent)) {
         Parent(thing) = NOTHING;
+        search_index_touch(thing);
+      }
       owner = Owner(thing);
       if (!GoodObject(owner) || IsGarbage(owner) || !IsPlayer(owner)) {
         do_rawlog(LT_ERR, "ERROR: Invalid object owner on %s(%d)", Name(thing),
                   thing);
         report();
         Owner(thing) = GOD;
+        search_index_touch(thing);
       }
       next = Next(thing);
       if ((!GoodObject(next) || IsGarbage(next)) && (next != NOTHING)) {
@@ -1212,14 +1220,15 @@ check_fields(void)
 }
 
 static int
-attribute_owner_helper(dbref player __attribute__((__unused__)),
-                       dbref thing __attribute__((__unused__)),
+attribute_owner_helper(dbref player __attribute__((__unused__)), dbref thing,
                        dbref parent __attribute__((__unused__)),
                        char const *pattern __attribute__((__unused__)),
                        ATTR *atr, void *args __attribute__((__unused__)))
 {
-  if (!GoodObject(AL_CREATOR(atr)))
+  if (!GoodObject(AL_CREATOR(atr))) {
     AL_CREATOR(atr) = GOD;
+    AttrVersion(thing)++;
+  }
   return 0;
 }
 
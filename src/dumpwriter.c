@@ -0,0 +1,906 @@
+/**
+ * \file dumpwriter.c
+ *
+ * \brief Writing database dumps in the background.
+ *
+ * A dump is still serialized by the main thread, since that's the only
+ * one that can look at the database, but only into memory. Each file is
+ * cut into blocks, and worker threads compress the blocks in parallel,
+ * write them out in order, sync the file and move it into place. A
+ * dump that can't fork only holds the game up for as long as it takes
+ * to serialize it, and one that can gets its compression done on every
+ * core.
+ *
+ * Compressed blocks are independent gzip members or zstd frames, which
+ * gunzip, zstd and the server all read back as one stream.
+ */
+
+#include "copyrite.h"
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef HAVE_SYS_TIME_H
+#include <sys/time.h>
+#endif
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#ifndef WIN32
+#include <sys/mman.h>
+#endif
+#if defined(HAVE_PTHREAD_H) && !defined(WIN32)
+#include <pthread.h>
+#define DUMP_THREADS
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#include <zstd_errors.h>
+#endif
+
+#include "conf.h"
+#include "dbio.h"
+#include "externs.h"
+#include "flags.h"
+#include "log.h"
+#include "mymalloc.h"
+#include "notify.h"
+#include "strutil.h"
+#include "tests.h"
+
+#define DUMP_BLOCK (1024 * 1024) /**< Bytes serialized per block */
+#define DUMP_MAX_THREADS 8       /**< Most workers for one file */
+#define DUMP_MAX_QUEUED 4        /**< Blocks waiting per worker */
+
+/** How a dump file is compressed */
+enum dump_codec {
+  DUMP_RAW, /**< Not, or by a compress_program pipe */
+  DUMP_GZIP, /**< gzip, with zlib */
+  DUMP_ZSTD /**< zstd, with libzstd */
+};
+
+/** A block of a dump file */
+struct dump_block {
+  char *data;              /**< Serialized text */
+  size_t len;              /**< Bytes used */
+  size_t cap;              /**< Bytes allocated */
+  unsigned char *out;      /**< Compressed data, or NULL */
+  size_t outlen;           /**< Length of the compressed data */
+  uint64_t seq;            /**< Position in the file */
+  struct dump_block *next; /**< Next block waiting */
+};
+
+/** A dump file being written */
+struct dump_writer {
+  char filename[FILE_PATH_LEN];  /**< The file being written */
+  char rename_to[FILE_PATH_LEN]; /**< Where it goes when it's done */
+  FILE *out;                     /**< The file, or a pipe */
+  bool pipe;                     /**< Is out a pipe? */
+  enum dump_codec codec;         /**< How it's compressed */
+  int level;                     /**< Compression level */
+  struct dump_block *cur;        /**< Block being filled */
+  struct dump_block *head;       /**< Blocks waiting for a worker */
+  struct dump_block *tail;       /**< Last of them */
+  int queued;                    /**< Blocks not yet written */
+  uint64_t next_seq;             /**< Number for the next block */
+  uint64_t write_seq;            /**< Number of the next block to write */
+  uint64_t bytes_in;             /**< Bytes serialized */
+  uint64_t bytes_out;            /**< Bytes written */
+  bool closing;                  /**< No more blocks are coming */
+  bool done;                     /**< Finished, one way or another */
+  bool failed;                   /**< Something went wrong */
+  int err;                       /**< errno of what went wrong */
+  int nthreads;                  /**< Workers, or 0 to write inline */
+  int running;                   /**< Workers still going */
+#ifdef DUMP_THREADS
+  pthread_t tids[DUMP_MAX_THREADS];
+  pthread_mutex_t lock; /**< Protects everything the workers touch */
+  pthread_cond_t work;  /**< A block is waiting, or the file's closing */
+  pthread_cond_t turn;  /**< A block has been written */
+  pthread_cond_t room;  /**< There's room for another block */
+#endif
+  struct dump_writer *next; /**< Next file of the dump */
+};
+
+/** How the last dump went. Shared with forked dumps. */
+struct dump_stats {
+  time_t when;        /**< When it finished */
+  bool ok;            /**< Was it all written? */
+  int files;          /**< Files written */
+  int threads;        /**< Most workers used on a file */
+  uint64_t bytes_in;  /**< Bytes serialized */
+  uint64_t bytes_out; /**< Bytes written */
+  double write_ms;    /**< From starting the dump to the last file synced */
+  double stall_ms;    /**< How long the game was held up */
+};
+
+static struct dump_writer *dump_files = NULL;
+static struct timeval dump_started;
+static struct dump_stats *dump_stats = NULL;
+
+static double
+dump_ms_since(struct timeval *start)
+{
+  struct timeval now;
+
+  penn_gettimeofday(&now);
+  return (now.tv_sec - start->tv_sec) * 1000.0 +
+         (now.tv_usec - start->tv_usec) / 1000.0;
+}
+
+/** The stats of the last dump. They're kept in shared memory where
+ * possible, so a forked dump can fill them in; this has to be called
+ * before forking. */
+static struct dump_stats *
+dump_get_stats(void)
+{
+  if (dump_stats)
+    return dump_stats;
+#if !defined(WIN32) && defined(MAP_ANONYMOUS)
+  dump_stats = mmap(NULL, sizeof *dump_stats, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (dump_stats == MAP_FAILED)
+    dump_stats = NULL;
+  else
+    memset(dump_stats, 0, sizeof *dump_stats);
+#endif
+  if (!dump_stats)
+    dump_stats = mush_calloc(1, sizeof *dump_stats, "dump.stats");
+  return dump_stats;
+}
+
+static struct dump_block *
+dump_new_block(size_t len)
+{
+  struct dump_block *b;
+
+  b = calloc(1, sizeof *b);
+  if (!b)
+    longjmp(db_err, 1);
+  b->cap = len > DUMP_BLOCK ? len : DUMP_BLOCK;
+  b->data = malloc(b->cap);
+  if (!b->data) {
+    free(b);
+    longjmp(db_err, 1);
+  }
+  return b;
+}
+
+static void
+dump_free_block(struct dump_block *b)
+{
+  free(b->data);
+  free(b->out);
+  free(b);
+}
+
+#ifdef HAVE_LIBZ
+/** The errno that best describes a zlib error. */
+static int
+dump_zlib_errno(int r)
+{
+  switch (r) {
+  case Z_MEM_ERROR:
+    return ENOMEM;
+  case Z_STREAM_ERROR:
+  case Z_VERSION_ERROR:
+    return EINVAL;
+  default:
+    return EIO;
+  }
+}
+#endif
+
+#ifdef HAVE_ZSTD
+/** The errno that best describes a zstd error. */
+static int
+dump_zstd_errno(size_t r)
+{
+  switch (ZSTD_getErrorCode(r)) {
+  case ZSTD_error_memory_allocation:
+    return ENOMEM;
+  case ZSTD_error_parameter_unsupported:
+  case ZSTD_error_parameter_outOfBound:
+    return EINVAL;
+  default:
+    return EIO;
+  }
+}
+#endif
+
+/** Compress a block, if the file is compressed.
+ * \return 0 on success, or an errno describing the failure.
+ */
+static int
+dump_compress(struct dump_writer *w, struct dump_block *b)
+{
+  switch (w->codec) {
+  case DUMP_RAW:
+    return 0;
+  case DUMP_GZIP:
+#ifdef HAVE_LIBZ
+  {
+    z_stream z;
+    uLong cap;
+    int r;
+
+    memset(&z, 0, sizeof z);
+    /* 15 + 16: a gzip header and trailer around each block */
+    r = deflateInit2(&z, w->level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY);
+    if (r != Z_OK)
+      return dump_zlib_errno(r);
+    cap = deflateBound(&z, b->len);
+    b->out = malloc(cap);
+    if (!b->out) {
+      deflateEnd(&z);
+      return ENOMEM;
+    }
+    z.next_in = (Bytef *) b->data;
+    z.avail_in = b->len;
+    z.next_out = b->out;
+    z.avail_out = cap;
+    r = deflate(&z, Z_FINISH);
+    b->outlen = cap - z.avail_out;
+    deflateEnd(&z);
+    return r == Z_STREAM_END ? 0 : dump_zlib_errno(r);
+  }
+#else
+    break;
+#endif
+  case DUMP_ZSTD:
+#ifdef HAVE_ZSTD
+  {
+    size_t cap = ZSTD_compressBound(b->len), r;
+
+    b->out = malloc(cap);
+    if (!b->out)
+      return ENOMEM;
+    r = ZSTD_compress(b->out, cap, b->data, b->len, w->level);
+    if (ZSTD_isError(r))
+      return dump_zstd_errno(r);
+    b->outlen = r;
+    return 0;
+  }
+#else
+    break;
+#endif
+  }
+  return ENOSYS;
+}
+
+/** Write a block out. Only one thread does this at a time, in order.
+ * \return true on success.
+ */
+static bool
+dump_output(struct dump_writer *w, struct dump_block *b)
+{
+  const void *p = b->out ? (const void *) b->out : (const void *) b->data;
+  size_t n = b->out ? b->outlen : b->len;
+
+  if (fwrite(p, 1, n, w->out) != n)
+    return 0;
+  w->bytes_out += n;
+  return 1;
+}
+
+/** Flush, sync and close a file that's been written, and move it into
+ * place if it all went well. */
+static void
+dump_finish(struct dump_writer *w)
+{
+  int r;
+
+  if (!w->failed && fflush(w->out) != 0) {
+    w->failed = 1;
+    w->err = errno;
+  }
+#ifdef HAVE_FDATASYNC
+  if (!w->failed && !w->pipe && fdatasync(fileno(w->out)) != 0) {
+    w->failed = 1;
+    w->err = errno;
+  }
+#endif
+#ifndef WIN32
+  if (w->pipe)
+    r = pclose(w->out);
+  else
+#endif
+    r = fclose(w->out);
+  w->out = NULL;
+  if (r != 0 && !w->failed) {
+    w->failed = 1;
+    w->err = errno;
+  }
+  if (!w->failed && *w->rename_to &&
+      rename_file(w->filename, w->rename_to) < 0) {
+    w->failed = 1;
+    w->err = errno;
+  }
+}
+
+#ifdef DUMP_THREADS
+static void *
+dump_worker(void *arg)
+{
+  struct dump_writer *w = arg;
+  struct dump_block *b;
+  bool ok, last;
+  int err = 0;
+
+  pthread_mutex_lock(&w->lock);
+  for (;;) {
+    while (!w->head && !w->closing)
+      pthread_cond_wait(&w->work, &w->lock);
+    b = w->head;
+    if (!b)
+      break;
+    w->head = b->next;
+    if (!w->head)
+      w->tail = NULL;
+    ok = !w->failed;
+    pthread_mutex_unlock(&w->lock);
+
+    if (ok && (err = dump_compress(w, b)))
+      ok = 0;
+
+    pthread_mutex_lock(&w->lock);
+    while (b->seq != w->write_seq)
+      pthread_cond_wait(&w->turn, &w->lock);
+    ok = ok && !w->failed;
+    pthread_mutex_unlock(&w->lock);
+
+    /* It's this block's turn; nobody else writes until it's done */
+    if (ok && !dump_output(w, b)) {
+      ok = 0;
+      err = errno;
+    }
+    dump_free_block(b);
+
+    pthread_mutex_lock(&w->lock);
+    if (!ok && !w->failed) {
+      w->failed = 1;
+      w->err = err;
+    }
+    w->write_seq++;
+    w->queued--;
+    pthread_cond_broadcast(&w->turn);
+    pthread_cond_signal(&w->room);
+  }
+  last = --w->running == 0;
+  pthread_mutex_unlock(&w->lock);
+
+  if (last) {
+    dump_finish(w);
+    pthread_mutex_lock(&w->lock);
+    w->done = 1;
+    pthread_mutex_unlock(&w->lock);
+  }
+  return NULL;
+}
+#endif
+
+/** Hand the block being filled to the workers, waiting for room if they're
+ * too far behind.
+ * \return false if the file has failed.
+ */
+static bool
+dump_submit(struct dump_writer *w)
+{
+  struct dump_block *b = w->cur;
+  bool failed;
+
+  w->cur = NULL;
+  if (!b)
+    return 1;
+  if (!b->len) {
+    dump_free_block(b);
+    return 1;
+  }
+  b->seq = w->next_seq++;
+  w->bytes_in += b->len;
+
+  if (!w->nthreads) {
+    int err;
+
+    if (!w->failed && (err = dump_compress(w, b))) {
+      w->failed = 1;
+      w->err = err;
+    } else if (!w->failed && !dump_output(w, b)) {
+      w->failed = 1;
+      w->err = errno;
+    }
+    dump_free_block(b);
+    failed = w->failed;
+  } else {
+#ifdef DUMP_THREADS
+    pthread_mutex_lock(&w->lock);
+    while (w->queued >= w->nthreads * DUMP_MAX_QUEUED && !w->failed)
+      pthread_cond_wait(&w->room, &w->lock);
+    b->next = NULL;
+    if (w->tail)
+      w->tail->next = b;
+    else
+      w->head = b;
+    w->tail = b;
+    w->queued++;
+    failed = w->failed;
+    pthread_cond_signal(&w->work);
+    pthread_mutex_unlock(&w->lock);
+#else
+    failed = 1;
+#endif
+  }
+  if (failed)
+    errno = w->err;
+  return !failed;
+}
+
+/** Start a dump. Waits for the files of the last one to be finished.
+ */
+void
+dump_writer_begin(void)
+{
+  dump_writer_wait();
+  penn_gettimeofday(&dump_started);
+}
+
+/** Open a dump file for writing in the background. It's compressed
+ * according to compress_program: gzip and zstd are done by the workers
+ * when the server has the libraries, and anything else is piped through.
+ * \param filename the file to write.
+ * \return a PENNFILE for it, or NULL on failure.
+ */
+PENNFILE *
+dump_writer_open(const char *filename)
+{
+  struct dump_writer *w;
+  PENNFILE *pf;
+  int nthreads = 1;
+#ifdef DUMP_THREADS
+  long ncpu;
+#endif
+
+  w = mush_calloc(1, sizeof *w, "dump.writer");
+  mush_strncpy(w->filename, filename, sizeof w->filename);
+  w->codec = DUMP_RAW;
+#ifdef HAVE_LIBZ
+  if (!strcmp(options.compressprog, "gzip")) {
+    w->codec = DUMP_GZIP;
+    w->level = options.compress_level > 0
+                 ? (options.compress_level > 9 ? 9 : options.compress_level)
+                 : Z_DEFAULT_COMPRESSION;
+  }
+#endif
+#ifdef HAVE_ZSTD
+  if (!strcmp(options.compressprog, "zstd")) {
+    w->codec = DUMP_ZSTD;
+    w->level = options.compress_level > 0 ? options.compress_level : 3;
+    if (w->level > ZSTD_maxCLevel())
+      w->level = ZSTD_maxCLevel();
+  }
+#endif
+
+#ifndef WIN32
+  if (w->codec == DUMP_RAW && *options.compressprog) {
+    char prog[FILE_PATH_LEN * 2];
+    snprintf(prog, sizeof prog, "%s > '%s'", options.compressprog, filename);
+    w->pipe = 1;
+    w->out = popen(prog, "w");
+    if (!w->out)
+      do_rawlog(LT_ERR, "Unable to run '%s': %s", prog, strerror(errno));
+  } else
+#endif
+  {
+    w->out = fopen(filename, "wb");
+    if (!w->out)
+      do_rawlog(LT_ERR, "Unable to open %s: %s", filename, strerror(errno));
+  }
+  if (!w->out) {
+    mush_free(w, "dump.writer");
+    return NULL;
+  }
+
+#ifdef DUMP_THREADS
+  if (w->codec != DUMP_RAW) {
+    ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    nthreads = ncpu > 1 ? ncpu : 1;
+    if (nthreads > DUMP_MAX_THREADS)
+      nthreads = DUMP_MAX_THREADS;
+  }
+  pthread_mutex_init(&w->lock, NULL);
+  pthread_cond_init(&w->work, NULL);
+  pthread_cond_init(&w->turn, NULL);
+  pthread_cond_init(&w->room, NULL);
+  for (w->nthreads = 0; w->nthreads < nthreads; w->nthreads++) {
+    w->running = w->nthreads + 1;
+    if (pthread_create(&w->tids[w->nthreads], NULL, dump_worker, w)) {
+      w->running--;
+      break;
+    }
+  }
+#else
+  (void) nthreads;
+#endif
+  /* With no workers, blocks are written as they're filled. */
+
+  w->next = dump_files;
+  dump_files = w;
+  pf = mush_malloc(sizeof *pf, "pennfile");
+  pf->type = PFT_ASYNC;
+  pf->handle.w = w;
+  return pf;
+}
+
+/** Add text to a dump file. */
+void
+dump_writer_put(struct dump_writer *w, const char *s, size_t len)
+{
+  if (w->cur && w->cur->len + len > w->cur->cap && !dump_submit(w))
+    longjmp(db_err, 1);
+  if (!w->cur)
+    w->cur = dump_new_block(len);
+  memcpy(w->cur->data + w->cur->len, s, len);
+  w->cur->len += len;
+  if (w->cur->len >= DUMP_BLOCK && !dump_submit(w))
+    longjmp(db_err, 1);
+}
+
+/** Add formatted text to a dump file.
+ * \return the number of bytes added.
+ */
+int
+dump_writer_vprintf(struct dump_writer *w, const char *fmt, va_list ap)
+{
+  char buff[BUFFER_LEN * 2], *big;
+  va_list copy;
+  int r;
+
+  va_copy(copy, ap);
+  r = vsnprintf(buff, sizeof buff, fmt, ap);
+  if (r < 0) {
+    va_end(copy);
+    longjmp(db_err, 1);
+  }
+  if ((size_t) r < sizeof buff) {
+    dump_writer_put(w, buff, r);
+  } else {
+    big = malloc(r + 1);
+    if (!big) {
+      va_end(copy);
+      longjmp(db_err, 1);
+    }
+    vsnprintf(big, r + 1, fmt, copy);
+    dump_writer_put(w, big, r);
+    free(big);
+  }
+  va_end(copy);
+  return r;
+}
+
+/** Finish writing a dump file. The workers write whatever's left, and move
+ * it into place, in the background.
+ * \param pf the file.
+ * \param rename_to where to move it once it's written, or NULL to leave
+ * it where it is.
+ */
+void
+dump_writer_close(PENNFILE *pf, const char *rename_to)
+{
+  struct dump_writer *w = pf->handle.w;
+
+  mush_free(pf, "pennfile");
+  if (rename_to)
+    mush_strncpy(w->rename_to, rename_to, sizeof w->rename_to);
+  /* A failure here is reported when the dump is reaped. */
+  (void) dump_submit(w);
+  if (!w->nthreads) {
+    dump_finish(w);
+    w->done = 1;
+    return;
+  }
+#ifdef DUMP_THREADS
+  pthread_mutex_lock(&w->lock);
+  w->closing = 1;
+  pthread_cond_broadcast(&w->work);
+  pthread_mutex_unlock(&w->lock);
+#endif
+}
+
+/** Have all the files of the last dump been finished? */
+static bool
+dump_writers_done(void)
+{
+  struct dump_writer *w;
+  bool done = 1;
+
+  for (w = dump_files; w && done; w = w->next) {
+#ifdef DUMP_THREADS
+    if (w->nthreads) {
+      pthread_mutex_lock(&w->lock);
+      done = w->done;
+      pthread_mutex_unlock(&w->lock);
+      continue;
+    }
+#endif
+    done = w->done;
+  }
+  return done;
+}
+
+/** Clean up after a dump whose files are all finished, and report on it.
+ * \return true if every file was written.
+ */
+static bool
+dump_writers_reap(void)
+{
+  struct dump_stats *st = dump_get_stats();
+  struct dump_writer *w;
+  const char *error = NULL;
+  double mb;
+  int n;
+
+  if (!dump_files)
+    return 1;
+  st->ok = 1;
+  st->files = st->threads = 0;
+  st->bytes_in = st->bytes_out = 0;
+  while ((w = dump_files)) {
+    dump_files = w->next;
+#ifdef DUMP_THREADS
+    for (n = 0; n < w->nthreads; n++)
+      pthread_join(w->tids[n], NULL);
+    if (w->nthreads) {
+      pthread_mutex_destroy(&w->lock);
+      pthread_cond_destroy(&w->work);
+      pthread_cond_destroy(&w->turn);
+      pthread_cond_destroy(&w->room);
+    }
+#endif
+    if (w->out) {
+      /* Abandoned without being closed */
+#ifndef WIN32
+      if (w->pipe)
+        pclose(w->out);
+      else
+#endif
+        fclose(w->out);
+      w->failed = 1;
+    }
+    if (w->failed && st->ok) {
+      st->ok = 0;
+      error = w->err ? strerror(w->err) : "unknown error";
+    }
+    st->files++;
+    if (w->nthreads > st->threads)
+      st->threads = w->nthreads;
+    st->bytes_in += w->bytes_in;
+    st->bytes_out += w->bytes_out;
+    mush_free(w, "dump.writer");
+  }
+  st->write_ms = dump_ms_since(&dump_started);
+  st->when = time(NULL);
+
+  mb = st->bytes_in / (1024.0 * 1024.0);
+  do_rawlog_lvl(LT_CHECK, MLOG_INFO,
+                "DUMPING: %d file%s, %.1f MB (%.1f MB written) in %.0fms, "
+                "%.1f MB/s, %d thread%s",
+                st->files, st->files == 1 ? "" : "s", mb,
+                st->bytes_out / (1024.0 * 1024.0), st->write_ms,
+                st->write_ms > 0 ? mb * 1000.0 / st->write_ms : 0.0,
+                st->threads, st->threads == 1 ? "" : "s");
+  if (!st->ok) {
+    do_rawlog(LT_ERR, "ERROR! Database save failed: %s", error);
+    queue_event(SYSEVENT, "DUMP`ERROR", "%s,%d,PERROR %s",
+                T("GAME: ERROR! Database save failed!"), 0, error);
+    flag_broadcast("WIZARD ROYALTY", 0,
+                   T("GAME: ERROR! Database save failed!"));
+  }
+  return st->ok;
+}
+
+/** Check on a dump being written in the background, and report on it if
+ * it's finished. Called from the main loop.
+ */
+void
+dump_writer_poll(void)
+{
+  if (dump_files && dump_writers_done())
+    (void) dump_writers_reap();
+}
+
+/** Wait for a dump being written in the background to finish.
+ * \return true if it was all written, or there wasn't one.
+ */
+bool
+dump_writer_wait(void)
+{
+  struct dump_writer *w;
+
+  dump_get_stats();
+  for (w = dump_files; w; w = w->next) {
+    if (!w->nthreads)
+      continue;
+#ifdef DUMP_THREADS
+    /* Make sure nobody waits for a block that isn't coming */
+    pthread_mutex_lock(&w->lock);
+    w->closing = 1;
+    pthread_cond_broadcast(&w->work);
+    pthread_mutex_unlock(&w->lock);
+#endif
+  }
+  return dump_writers_reap();
+}
+
+/** Record how long the game was held up by a dump.
+ * \param start when the game stopped for it.
+ */
+void
+dump_writer_stall(struct timeval *start)
+{
+  dump_get_stats()->stall_ms = dump_ms_since(start);
+}
+
+/** Show how the last dump went, for \@uptime.
+ * \param player who to tell.
+ */
+void
+dump_writer_report(dbref player)
+{
+  struct dump_stats *st = dump_stats;
+  double mb;
+
+  if (!st || !st->when)
+    return;
+  mb = st->bytes_in / (1024.0 * 1024.0);
+  notify_format(player, T("%29s: %.1f MB in %.2f seconds (%.1f MB/s)%s"),
+                T("Last database save wrote"), mb, st->write_ms / 1000.0,
+                st->write_ms > 0 ? mb * 1000.0 / st->write_ms : 0.0,
+                st->ok ? "" : T(", and failed"));
+  notify_format(player, T("%29s: %.0f ms"), T("Game held up by it for"),
+                st->stall_ms);
+}
+
+#ifndef WIN32
+/** Write a test file through the workers and read it back. */
+static bool
+dump_test_file(const char *codec, const char *file, int lines, double *ms,
+               uint64_t *bytes)
+{
+  char tmp[FILE_PATH_LEN], prog[256], line[BUFFER_LEN];
+  struct timeval start;
+  PENNFILE *pf;
+  FILE *fp;
+  volatile bool written = 1;
+  bool ok;
+  int k, n;
+
+  snprintf(tmp, sizeof tmp, "%s.tmp", file);
+  mush_strncpy(prog, options.compressprog, sizeof prog);
+  mush_strncpy(options.compressprog, codec, sizeof options.compressprog);
+  dump_writer_begin();
+  penn_gettimeofday(&start);
+  pf = dump_writer_open(tmp);
+  mush_strncpy(options.compressprog, prog, sizeof options.compressprog);
+  if (!pf)
+    return 0;
+  if (setjmp(db_err)) {
+    written = 0;
+  } else {
+    for (k = 0; k < lines; k++) {
+      penn_fprintf(pf, "&LINE_%d #%d=The quick brown fox, number %d.\n", k,
+                   k % 1000, k);
+      penn_fputc('!', pf);
+      penn_fputs("jumps\n", pf);
+    }
+  }
+  dump_writer_close(pf, file);
+  *bytes = dump_files ? dump_files->bytes_in : 0;
+  ok = dump_writer_wait() && written;
+  *ms = dump_ms_since(&start);
+  if (!ok)
+    return 0;
+
+  /* Read it back */
+#ifdef HAVE_LIBZ
+  if (!strcmp(codec, "gzip")) {
+    gzFile g = gzopen(file, "rb");
+    if (!g)
+      return 0;
+    for (k = 0; ok && k < lines; k++) {
+      snprintf(prog, sizeof prog,
+               "&LINE_%d #%d=The quick brown fox, number %d.\n", k, k % 1000,
+               k);
+      ok = gzgets(g, line, sizeof line) && !strcmp(line, prog) &&
+           gzgets(g, line, sizeof line) && !strcmp(line, "!jumps\n");
+    }
+    ok = ok && gzgetc(g) == -1;
+    gzclose(g);
+    return ok;
+  }
+#endif
+  fp = fopen(file, "rb");
+  if (!fp)
+    return 0;
+  for (k = 0; ok && k < lines; k++) {
+    n = snprintf(prog, sizeof prog,
+                 "&LINE_%d #%d=The quick brown fox, number %d.\n", k, k % 1000,
+                 k);
+    ok = n > 0 && fgets(line, sizeof line, fp) && !strcmp(line, prog) &&
+         fgets(line, sizeof line, fp) && !strcmp(line, "!jumps\n");
+  }
+  ok = ok && fgetc(fp) == EOF;
+  fclose(fp);
+  return ok;
+}
+
+/** Write one test file in a scratch directory, then remove it.
+ * \return true if it was written and read back correctly.
+ */
+static bool
+dump_test_scratch(const char *codec, const char *name, int lines, double *ms,
+                  uint64_t *bytes, bool *leftover)
+{
+  char dir[FILE_PATH_LEN], file[FILE_PATH_LEN], tmp[FILE_PATH_LEN];
+  bool ok;
+
+  if (!test_scratch_dir(dir, sizeof dir, "dumptest"))
+    return 0;
+  if (snprintf(file, sizeof file, "%s/%s", dir, name) >= (int) sizeof file ||
+      snprintf(tmp, sizeof tmp, "%s.tmp", file) >= (int) sizeof tmp) {
+    rmdir(dir);
+    return 0;
+  }
+  ok = dump_test_file(codec, file, lines, ms, bytes);
+  unlink(file);
+  if (leftover)
+    *leftover = access(tmp, F_OK) == 0;
+  unlink(tmp);
+  rmdir(dir);
+  return ok;
+}
+#endif
+
+/* A few blocks' worth, so they have to come back in order. */
+#define DUMP_TEST_LINES 40000
+
+TEST_GROUP(dump_writer)
+{
+#ifndef WIN32
+  double ms = 0;
+  uint64_t bytes = 0;
+  bool ok, leftover = 1;
+
+  ok = dump_test_scratch("", "dumptest.txt", DUMP_TEST_LINES, &ms, &bytes,
+                         &leftover);
+  TEST("dump_writer.1", ok);
+  TEST("dump_writer.2", !leftover);
+#ifdef HAVE_LIBZ
+  ok = dump_test_scratch("gzip", "dumptest.gz", DUMP_TEST_LINES, &ms, &bytes,
+                         NULL);
+  TEST("dump_writer.3", ok);
+#endif
+  TEST("dump_writer.4", dump_stats && dump_stats->ok && dump_stats->files == 1);
+#endif
+}
+
+BENCHMARK(dump_writer)
+{
+#ifndef WIN32
+  double ms = 0;
+  uint64_t bytes = 0;
+  bool ok;
+
+  ok = dump_test_scratch("", "dumptest.txt", 1000000, &ms, &bytes, NULL);
+  do_rawlog(LT_TRACE, "dump_writer: %.1f MB uncompressed in %.1fms%s",
+            bytes / (1024.0 * 1024.0), ms, ok ? "" : " (failed)");
+#ifdef HAVE_LIBZ
+  ok = dump_test_scratch("gzip", "dumptest.gz", 1000000, &ms, &bytes, NULL);
+  do_rawlog(LT_TRACE, "dump_writer: %.1f MB gzipped in %.1fms (%.1f MB/s)%s",
+            bytes / (1024.0 * 1024.0), ms,
+            ms > 0 ? bytes / (1024.0 * 1024.0) * 1000.0 / ms : 0.0,
+            ok ? "" : " (failed)");
+#endif
+#endif
+}
@@ -17,6 +17,9 @@
 #include <sys/types.h>
 #endif
 #include <stdarg.h>
+#ifdef HAVE_SYS_TIME_H
+#include <sys/time.h>
+#endif
 
 #include "ansi.h"
 #include "attrib.h"
@@ -41,6 +44,7 @@
 #include "pueblo.h"
 #include "strutil.h"
 #include "charclass.h"
+#include "tests.h"
 
 static CHAN *new_channel(void);
 static CHANLIST *new_chanlist(const void *hint);
@@ -63,6 +67,11 @@ static void chan_chown(CHAN *c, dbref victim);
 void chan_chownall(dbref old, dbref newowner);
 static int insert_user(CHANUSER *user, CHAN *ch);
 static int remove_user(CHANUSER *u, CHAN *ch);
+static int member_slot(CHAN *ch, dbref who, bool *found);
+static struct chanmember *find_member(CHAN *ch, dbref who);
+static void add_member(CHAN *ch, CHANUSER *user, int slot);
+static void remove_member(CHAN *ch, dbref who);
+static void chan_locks_changed(CHAN *ch);
 static int save_channel(PENNFILE *fp, CHAN *ch);
 static int save_chanuser(PENNFILE *fp, CHANUSER *user);
 static void channel_wipe(dbref player, CHAN *chan);
@@ -147,13 +156,91 @@ static PRIV chanuser_priv[] = {{"Quiet", 'Q', CU_QUIET, CU_QUIET},
 CHANUSER *
 onchannel(dbref who, CHAN *ch)
 {
-  static CHANUSER *u;
-  for (u = ChanUsers(ch); u; u = u->next) {
-    if (CUdbref(u) == who) {
-      return u;
-    }
+  struct chanmember *m = find_member(ch, who);
+
+  return m ? m->user : NULL;
+}
+
+/* Binary search the channel's member index for who. Returns the
+ * position of who's entry, or where it would be inserted if it's not
+ * there, and sets found accordingly. */
+static int
+member_slot(CHAN *ch, dbref who, bool *found)
+{
+  int lo = 0, hi = ch->num_members - 1;
+
+  while (lo <= hi) {
+    int mid = lo + (hi - lo) / 2;
+    dbref m = ch->members[mid].who;
+    if (m == who) {
+      *found = 1;
+      return mid;
+    } else if (m < who)
+      lo = mid + 1;
+    else
+      hi = mid - 1;
   }
-  return NULL;
+  *found = 0;
+  return lo;
+}
+
+/* Return who's entry in the channel's member index, or NULL */
+static struct chanmember *
+find_member(CHAN *ch, dbref who)
+{
+  bool found;
+  int slot = member_slot(ch, who, &found);
+
+  return found ? &ch->members[slot] : NULL;
+}
+
+/* Add a user to the channel's member index at the given position */
+static void
+add_member(CHAN *ch, CHANUSER *user, int slot)
+{
+  struct chanmember *m;
+
+  if (ch->num_members == ch->max_members) {
+    ch->max_members = ch->max_members ? ch->max_members * 2 : 8;
+    ch->members =
+      mush_realloc(ch->members, ch->max_members * sizeof *ch->members,
+                   "channel.members");
+  }
+  memmove(ch->members + slot + 1, ch->members + slot,
+          (ch->num_members - slot) * sizeof *ch->members);
+  ch->num_members++;
+  m = &ch->members[slot];
+  m->who = CUdbref(user);
+  m->user = user;
+  m->lockgen = 0;
+  m->lockknown = 0;
+  m->lockpass = 0;
+}
+
+/* Remove a user from the channel's member index */
+static void
+remove_member(CHAN *ch, dbref who)
+{
+  bool found;
+  int slot = member_slot(ch, who, &found);
+
+  if (!found)
+    return;
+  ch->num_members--;
+  memmove(ch->members + slot, ch->members + slot + 1,
+          (ch->num_members - slot) * sizeof *ch->members);
+}
+
+/* Forget which of a channel's locks can be cached, and every cached
+ * lock result for its members. Called whenever a lock is changed. */
+static void
+chan_locks_changed(CHAN *ch)
+{
+  int i;
+
+  ch->lockchecked = 0;
+  for (i = 0; i < ch->num_members; i++)
+    ch->members[i].lockknown = 0;
 }
 
 /** A macro to test if a channel exists and, if not, to notify. */
@@ -367,6 +454,11 @@ new_channel(void)
   ChanNumUsers(ch) = 0;
   ChanMaxUsers(ch) = 0;
   ChanUsers(ch) = NULL;
+  ch->members = NULL;
+  ch->num_members = 0;
+  ch->max_members = 0;
+  ch->lockchecked = 0;
+  ch->lockcacheable = 0;
   ChanBufferQ(ch) = NULL;
   return ch;
 }
@@ -406,6 +498,8 @@ free_channel(CHAN *c)
     free_user(u);
     u = unext;
   }
+  if (c->members)
+    mush_free(c->members, "channel.members");
   mush_free(c, "channel");
   return;
 }
@@ -756,10 +850,19 @@ static int
 insert_user(CHANUSER *user, CHAN *ch)
 {
   CHANUSER *p;
+  bool found;
+  int slot;
 
   if (!user || !ch)
     return 0;
 
+  slot = member_slot(ch, CUdbref(user), &found);
+  if (found) {
+    /* Don't add the same user twice! */
+    slab_free(chanuser_slab, user);
+    return 0;
+  }
+
   /* If there's no users on the list, or if the first user is already
    * alphabetically greater, user should be the first entry on the list */
   p = ChanUsers(ch);
@@ -772,15 +875,10 @@ insert_user(CHANUSER *user, CHAN *ch)
            (strcasecoll(Name(CUdbref(p->next)), Name(CUdbref(user))) <= 0);
          p = p->next)
       ;
-    if (CUdbref(p) == CUdbref(user)) {
-      /* Don't add the same user twice! */
-      slab_free(chanuser_slab, user);
-      return 0;
-    } else {
-      user->next = p->next;
-      p->next = user;
-    }
+    user->next = p->next;
+    p->next = user;
   }
+  add_member(ch, user, slot);
   insert_obj_chan(CUdbref(user), &ch);
   return 1;
 }
@@ -814,6 +912,8 @@ remove_user(CHANUSER *u, CHAN *ch)
       return 0;
   }
 
+  remove_member(ch, who);
+
   /* Now remove the channel from the user's chanlist */
   remove_obj_chan(who, ch);
   ChanNumUsers(ch)--;
@@ -2813,6 +2913,7 @@ do_chan_lock(dbref player, const char *name, const char *lockstr,
                   ChanName(c));
     break;
   }
+  chan_locks_changed(c);
   return;
 }
 
@@ -3705,6 +3806,7 @@ channel_send(CHAN *channel, dbref player, int flags, const char *origmessage)
   CHANUSER *u;
   CHANUSER *speaker;
   dbref current;
+  int i;
   int na_flags = NA_INTER_LOCK;
 
   int skip_buffer = format_chat_nobuffer(player, channel);
@@ -3786,20 +3888,23 @@ channel_send(CHAN *channel, dbref player, int flags, const char *origmessage)
   snprintf(buff, BUFFER_LEN, "%s", message);
   }
 
-  for (u = ChanUsers(channel); u; u = u->next) {
+  /* Walk the member index rather than the name-sorted user list; it's
+   * contiguous, and re-reading the count each time keeps us safe if a
+   * recipient's interact lock changes the membership. */
+  for (i = 0; i < channel->num_members; i++) {
+    u = channel->members[i].user;
     current = CUdbref(u);
 
-    if ((flags & CB_NOCOMBINE) && Chanuser_Combine(u)) {
+    if (Chanuser_Gag(u) || ((flags & CB_CHECKQUIET) && Chanuser_Quiet(u)) ||
+        ((flags & CB_NOCOMBINE) && Chanuser_Combine(u)))
+      continue;
+    if (IsPlayer(current) && !Connected(current))
       continue;
-    }
     if ((flags & CB_SEEALL) && !See_All(current) && (current != player))
       continue;
 
-    if (!(((flags & CB_CHECKQUIET) && Chanuser_Quiet(u)) || Chanuser_Gag(u) ||
-          (IsPlayer(current) && !Connected(current)))) {
-      notify_anything(player, player, na_one, &current, NULL, na_flags, buff,
-                      NULL, AMBIGUOUS, NULL);
-    }
+    notify_anything(player, player, na_one, &current, NULL, na_flags, buff,
+                    NULL, AMBIGUOUS, NULL);
   }
 
   if (ChanBufferQ(channel) && !skip_buffer)
@@ -4137,6 +4242,8 @@ int
 eval_chan_lock(CHAN *c, dbref p, enum clock_type type)
 {
   NEW_PE_INFO *pe_info;
+  struct chanmember *m;
+  uint8_t bit;
 
   boolexp b = TRUE_BOOLEXP;
   int retval;
@@ -4159,6 +4266,35 @@ eval_chan_lock(CHAN *c, dbref p, enum clock_type type)
     b = ChanModLock(c);
   }
 
+  if (b == TRUE_BOOLEXP)
+    return 1;
+
+  /* Locks that only look at the player's flags and powers give the same
+   * answer until those change, so remember their results per member. */
+  bit = 1 << type;
+  if (!(c->lockchecked & bit)) {
+    if (is_cacheable_lock(b))
+      c->lockcacheable |= bit;
+    else
+      c->lockcacheable &= ~bit;
+    c->lockchecked |= bit;
+  }
+  if ((c->lockcacheable & bit) && (m = find_member(c, p))) {
+    uint32_t gen = privs_generation();
+    if (m->lockgen != gen) {
+      m->lockgen = gen;
+      m->lockknown = 0;
+    }
+    if (!(m->lockknown & bit)) {
+      if (eval_boolexp(p, b, p, NULL))
+        m->lockpass |= bit;
+      else
+        m->lockpass &= ~bit;
+      m->lockknown |= bit;
+    }
+    return !!(m->lockpass & bit);
+  }
+
   pe_info = make_pe_info("pe_info-eval_chan_lock");
   pe_regs_setenv_nocopy(pe_info->regvals, 0, ChanName(c));
   retval = eval_boolexp(p, b, p, pe_info);
@@ -4437,3 +4573,192 @@ COMMAND(cmd_comtitle)
   mush_strncpy(buff, atr_value(a), BUFFER_LEN);
   do_chan_title(executor, buff, arg_right);
 }
+
+#ifndef WIN32
+#define CHAN_TEST_MEMBERS 8
+#define CHAN_BENCH_MEMBERS 1000
+#define CHAN_BENCH_SENDS 50
+#define CHAN_BENCH_LOOKUPS 100000
+
+/* Size of a channel test run */
+struct chan_bench_spec {
+  int size;
+  int sends;
+  int lookups;
+};
+
+/* Results of the channel tests, sent back from the child running them. */
+struct chan_bench {
+  int joined;
+  int left;
+  int locked;
+  int relocked;
+  int evallocked;
+  double send_us;
+  double lookup_ns;
+  double lock_ns;
+};
+
+static dbref
+chan_bench_player(const char *name)
+{
+  dbref p = new_object();
+
+  set_name(p, name);
+  db[p].type = TYPE_PLAYER;
+  db[p].flags = string_to_bits("FLAG", "CONNECTED");
+  db[p].powers = string_to_bits("POWER", "");
+  db[p].owner = p;
+  return p;
+}
+
+static double
+chan_bench_us(struct timeval *start)
+{
+  struct timeval end;
+
+  penn_gettimeofday(&end);
+  return (end.tv_sec - start->tv_sec) * 1000000.0 +
+         (end.tv_usec - start->tv_usec);
+}
+
+static void
+chan_bench_lock(CHAN *c, boolexp *lock, const char *key)
+{
+  free_boolexp(*lock);
+  *lock = parse_boolexp(GOD, key, chan_speak_lock);
+  chan_locks_changed(c);
+}
+
+static void
+chan_bench_run(void *arg, void *result)
+{
+  const struct chan_bench_spec *spec = arg;
+  struct chan_bench *r = result;
+  int size = spec->size, sends = spec->sends, lookups = spec->lookups;
+  CHAN *c;
+  dbref *members, outsider;
+  struct timeval start;
+  int i, found = 0;
+
+  c = new_channel();
+  if (!c)
+    return;
+  ChanName(c) = mush_strdup("Chan_Bench", "channel.name");
+  ChanCreator(c) = GOD;
+
+  /* Join in reverse dbref order, so the index has to sort them */
+  members = mush_calloc(size, sizeof(dbref), "chan_bench");
+  for (i = 0; i < size; i++)
+    members[i] = chan_bench_player(tprintf("Chan_Bench_%d", i));
+  outsider = chan_bench_player("Chan_Bench_Out");
+  for (i = size - 1; i >= 0; i--) {
+    if (insert_user_by_dbref(members[i], c))
+      ChanNumUsers(c)++;
+  }
+  r->joined = ChanNumUsers(c) == size &&
+              !insert_user_by_dbref(members[0], c) &&
+              !onchannel(outsider, c);
+  for (i = 0; i < size; i++) {
+    CHANUSER *u = onchannel(members[i], c);
+    if (!u || CUdbref(u) != members[i])
+      r->joined = 0;
+  }
+
+  /* Speaklocks on flags are cached per member, but still see changes */
+  chan_bench_lock(c, &ChanSpeakLock(c), "FLAG^ROYALTY");
+  r->locked = !Chan_Can_Speak(c, members[1]) && !Chan_Can_Speak(c, outsider);
+  set_flag_internal(members[1], "ROYALTY");
+  set_flag_internal(outsider, "ROYALTY");
+  r->locked = r->locked && Chan_Can_Speak(c, members[1]) &&
+              Chan_Can_Speak(c, outsider) && !Chan_Can_Speak(c, members[2]);
+  chan_bench_lock(c, &ChanSpeakLock(c), "!FLAG^ROYALTY");
+  r->relocked = !Chan_Can_Speak(c, members[1]) &&
+                Chan_Can_Speak(c, members[2]) && !Chan_Can_Speak(c, outsider);
+  clear_flag_internal(members[1], "ROYALTY");
+  r->relocked = r->relocked && Chan_Can_Speak(c, members[1]);
+
+  /* Attribute locks are never cached */
+  chan_bench_lock(c, &ChanSpeakLock(c), "CHAN_BENCH:yes");
+  r->evallocked = !Chan_Can_Speak(c, members[3]);
+  atr_add(members[3], "CHAN_BENCH", "yes", GOD, 0);
+  r->evallocked = r->evallocked && Chan_Can_Speak(c, members[3]);
+  atr_clr(members[3], "CHAN_BENCH", GOD);
+  r->evallocked = r->evallocked && !Chan_Can_Speak(c, members[3]);
+
+  chan_bench_lock(c, &ChanSpeakLock(c), "FLAG^WIZARD|!FLAG^GUEST");
+  penn_gettimeofday(&start);
+  for (i = 0; i < lookups; i++) {
+    if (!Chan_Can_Speak(c, members[(i * 7) % size]))
+      r->locked = 0;
+  }
+  r->lock_ns = chan_bench_us(&start) * 1000.0 / lookups;
+  chan_bench_lock(c, &ChanSpeakLock(c), "");
+
+  penn_gettimeofday(&start);
+  for (i = 0; i < sends; i++)
+    channel_send(c, GOD, CB_SPEECH, "Hello, everyone.");
+  r->send_us = chan_bench_us(&start) / sends;
+
+  penn_gettimeofday(&start);
+  for (i = 0; i < lookups; i++) {
+    if (onchannel(members[(i * 7) % size], c))
+      found++;
+  }
+  r->lookup_ns = chan_bench_us(&start) * 1000.0 / lookups;
+  r->joined = r->joined && found == lookups;
+
+  /* Leaving keeps everyone else findable */
+  for (i = 0; i < size; i += 2)
+    remove_user_by_dbref(members[i], c);
+  r->left = ChanNumUsers(c) == size / 2;
+  for (i = 0; i < size; i++) {
+    if (!onchannel(members[i], c) != !(i % 2))
+      r->left = 0;
+  }
+}
+
+/* Run the channel tests in a child, so the players and channel they
+ * make go away. */
+static bool
+chan_bench_fork(struct chan_bench *r, int size, int sends, int lookups)
+{
+  struct chan_bench_spec spec;
+
+  spec.size = size;
+  spec.sends = sends;
+  spec.lookups = lookups;
+  memset(r, 0, sizeof *r);
+  return run_in_child(chan_bench_run, &spec, r, sizeof *r);
+}
+#endif
+
+TEST_GROUP(chan_broadcast)
+{
+#ifndef WIN32
+  struct chan_bench r;
+  bool ok;
+
+  ok = chan_bench_fork(&r, CHAN_TEST_MEMBERS, 1, CHAN_TEST_MEMBERS);
+  TEST("chan_broadcast.1", ok && r.joined);
+  TEST("chan_broadcast.2", r.left);
+  TEST("chan_broadcast.3", r.locked);
+  TEST("chan_broadcast.4", r.relocked);
+  TEST("chan_broadcast.5", r.evallocked);
+#endif
+}
+
+BENCHMARK(chan_broadcast)
+{
+#ifndef WIN32
+  struct chan_bench r;
+
+  if (!chan_bench_fork(&r, CHAN_BENCH_MEMBERS, CHAN_BENCH_SENDS,
+                       CHAN_BENCH_LOOKUPS))
+    return;
+  do_rawlog(LT_TRACE,
+            "chan_broadcast: sent to %d members in %.1fus. Looked up a "
+            "member in %.1fns, and checked a speaklock in %.1fns.",
+            CHAN_BENCH_MEMBERS, r.send_us, r.lookup_ns, r.lock_ns);
+#endif
+}
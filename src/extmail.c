@@ -77,6 +77,9 @@
 #ifdef HAVE_STDINT_H
 #include <stdint.h>
 #endif
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
 
 #include "ansi.h"
 #include "attrib.h"
@@ -98,6 +101,7 @@
 #include "pueblo.h"
 #include "strutil.h"
 #include "charclass.h"
+#include "tests.h"
 
 extern int do_convtime(const char *str, struct tm *ttm); /* funtime.c */
 
@@ -109,17 +113,27 @@ static MAIL *real_mail_fetch(dbref player, int num, int folder);
 static MAIL *mailfun_fetch(dbref player, int nargs, char *arg1, char *arg2);
 static void count_mail(dbref player, int folder, int *rcount, int *ucount,
                        int *ccount);
+static char *mail_body(dbref player, char *message, int nosig);
 static int real_send_mail(dbref player, dbref target, char *subject,
-                          char *message, mail_flag flags, int silent,
-                          int nosig);
+                          char *message, const char *body, mail_flag flags,
+                          int silent, int nosig);
 static void send_mail(dbref player, dbref target, char *subject, char *message,
-                      mail_flag flags, int silent, int nosig);
+                      const char *body, mail_flag flags, int silent,
+                      int nosig);
 static int send_mail_alias(dbref player, char *aname, char *subject,
-                           char *message, mail_flag flags, int silent,
-                           int nosig);
+                           char *message, const char *body, mail_flag flags,
+                           int silent, int nosig);
 static void filter_mail(dbref from, dbref player, char *subject, char *message,
                         int mailnumber, mail_flag flags);
 static MAIL *find_insertion_point(dbref player);
+static void mail_link(MAIL *newp, MAIL *mp);
+static void mail_delete(MAIL *mp);
+static void set_mail_flags(MAIL *mp, mail_flag flags);
+static struct mailbox *find_mailbox(dbref player);
+static int mail_owner_slot(dbref player);
+static struct mailbox *get_mailbox(dbref player);
+static void free_mailbox(dbref player);
+static void reindex_mailbox(struct mailbox *mb);
 static int get_folder_number(dbref player, char *name);
 static char *get_folder_name(dbref player, int fld);
 static int player_folder(dbref player);
@@ -148,6 +162,36 @@ slab *mail_slab; /**< slab for 'struct mail' allocations */
 #define HEAD maildb   /**< The head of the mail list */
 #define TAIL tail_ptr /**< The end of the mail list */
 
+/** The messages in one folder of a mailbox, in mail list order. */
+struct mail_folder {
+  MAIL **msgs; /**< Array of messages */
+  int count;   /**< Number of messages in the array */
+  int size;    /**< Allocated size of the array */
+};
+
+/** A player's mailbox.
+ * Every player with mail has one. It points to the player's stretch of
+ * the mail list, counts their messages by folder and status, and indexes
+ * each folder, so counting mail or fetching message N doesn't need to
+ * walk the list.
+ */
+struct mailbox {
+  MAIL *first;                  /**< First message to the player */
+  MAIL *last;                   /**< Last message to the player */
+  int count;                    /**< Number of messages */
+  int read[MAX_FOLDERS + 1];    /**< Read messages, by folder */
+  int unread[MAX_FOLDERS + 1];  /**< Unread messages, by folder */
+  int cleared[MAX_FOLDERS + 1]; /**< Cleared messages, by folder */
+  bool stale;                   /**< Folder indexes need rebuilding */
+  struct mail_folder folders[MAX_FOLDERS + 1]; /**< Folder indexes */
+};
+
+static struct mailbox **mailboxes = NULL; /**< Mailboxes, indexed by dbref */
+static int mailboxes_size = 0;            /**< Allocated size of mailboxes */
+static dbref *mail_owners = NULL; /**< Players with mailboxes, in order */
+static int mail_owners_count = 0; /**< Number of players in mail_owners */
+static int mail_owners_size = 0;  /**< Allocated size of mail_owners */
+
 /** A line of...dashes! */
 #define DASH_LINE                                                              \
   "--------------------------------------------------------------------------" \
@@ -496,9 +540,9 @@ do_mail_flags(dbref player, const char *msglist, mail_flag flag, bool negate)
         }
         twiddled++;
         if (negate) {
-          mp->read &= ~flag;
+          set_mail_flags(mp, mp->read & ~flag);
         } else {
-          mp->read |= flag;
+          set_mail_flags(mp, mp->read | flag);
         }
         switch (flag) {
         case M_TAG:
@@ -641,9 +685,9 @@ do_mail_file(dbref player, char *msglist, char *folder)
       i[Folder(mp)]++;
       if (mail_match(player, mp, ms, i[Folder(mp)])) {
         j++;
-        mp->read &= M_FMASK;    /* Clear the folder */
-        mp->read &= ~M_CLEARED; /* Unclear it if it was marked cleared */
-        mp->read |= FolderBit(foldernum);
+        /* Clear the folder, and unclear it if it was marked cleared */
+        set_mail_flags(mp, (mp->read & M_FMASK & ~M_CLEARED) |
+                             FolderBit(foldernum));
         if (All(ms)) {
           if (!notified) {
             notify_format(player,
@@ -727,7 +771,7 @@ do_mail_read(dbref player, char *msglist)
         else
           notify(player, DASH_LINE);
         if (Unread(mp))
-          mp->read |= M_MSGREAD; /* mark message as read */
+          set_mail_flags(mp, mp->read | M_MSGREAD); /* mark message as read */
       }
     }
   }
@@ -1108,24 +1152,8 @@ do_mail_retract(dbref player, const char *name, const char *msglist)
           notify_format(player, T("MAIL: Message %d has been read."), i);
         } else {
           /* Delete this one */
-          /* head and tail of the list are special */
-          if (mp == HEAD)
-            HEAD = mp->next;
-          else if (mp == TAIL)
-            TAIL = mp->prev;
-          /* relink the list */
-          if (mp->prev != NULL)
-            mp->prev->next = mp->next;
-          if (mp->next != NULL)
-            mp->next->prev = mp->prev;
-          /* save the pointer */
-          nextp = mp->next;
-          /* then wipe */
           notify_format(player, T("MAIL: Message %d has been retracted."), i);
-          mdb_top--;
-          free(mp->subject);
-          chunk_delete(mp->msgid);
-          slab_free(mail_slab, mp);
+          mail_delete(mp);
         }
       }
     }
@@ -1182,30 +1210,12 @@ do_mail_purge(dbref player)
   /* Go through player's mail, and remove anything marked cleared */
   for (mp = find_exact_starting_point(player); mp && (mp->to == player);
        mp = nextp) {
+    nextp = mp->next;
     if ((mp->to == player) && Cleared(mp)) {
       /* Delete this one */
-      /* head and tail of the list are special */
-      if (mp == HEAD)
-        HEAD = mp->next;
-      else if (mp == TAIL)
-        TAIL = mp->prev;
-      /* relink the list */
-      if (mp->prev != NULL)
-        mp->prev->next = mp->next;
-      if (mp->next != NULL)
-        mp->next->prev = mp->prev;
-      /* save the pointer */
-      nextp = mp->next;
-      /* then wipe */
-      mdb_top--;
-      free(mp->subject);
-      chunk_delete(mp->msgid);
-      slab_free(mail_slab, mp);
-    } else {
-      nextp = mp->next;
+      mail_delete(mp);
     }
   }
-  delete_objdata(player, "MAIL");
   if (command_check_byname(player, "@MAIL", NULL))
     notify(player, T("MAIL: Mailbox purged."));
   return;
@@ -1277,8 +1287,8 @@ do_mail_fwd(dbref player, char *msglist, char *tolist)
               char tbuf2[BUFFER_LEN];
               mush_strncpy(tbuf1, uncompress(mp->subject), BUFFER_LEN);
               mush_strncpy(tbuf2, get_compressed_message(mp), BUFFER_LEN);
-              send_mail(player, temp->from, tbuf1, tbuf2, M_FORWARD | M_REPLY,
-                        1, 0);
+              send_mail(player, temp->from, tbuf1, tbuf2, NULL,
+                        M_FORWARD | M_REPLY, 1, 0);
               num_recpts++;
             }
           } else {
@@ -1293,7 +1303,7 @@ do_mail_fwd(dbref player, char *msglist, char *tolist)
               char tbuf2[BUFFER_LEN];
               mush_strncpy(tbuf1, uncompress(mp->subject), BUFFER_LEN);
               mush_strncpy(tbuf2, get_compressed_message(mp), BUFFER_LEN);
-              send_mail(player, target, tbuf1, tbuf2, M_FORWARD, 1, 0);
+              send_mail(player, target, tbuf1, tbuf2, NULL, M_FORWARD, 1, 0);
               num_recpts++;
             }
           }
@@ -1321,7 +1331,7 @@ do_mail_send(dbref player, char *tolist, char *message, mail_flag flags,
   int num;
   dbref target;
   mail_flag mail_flags;
-  char sbuf[SUBJECT_LEN + 1], *sb, *mb;
+  char sbuf[SUBJECT_LEN + 1], *sb, *mb, *body;
   int i = 0, subject_given = 0;
   const char **start;
   char *current;
@@ -1356,6 +1366,8 @@ do_mail_send(dbref player, char *tolist, char *message, mail_flag flags,
     subject_given = 1;
   } else
     message = mb; /* Rewind the pointer to the beginning */
+  /* Every recipient gets the same text, so only compress it once */
+  body = mail_body(player, message, nosig);
   /* Parse the player list */
   head = tolist;
   while (head && *head) {
@@ -1371,12 +1383,14 @@ do_mail_send(dbref player, char *tolist, char *message, mail_flag flags,
       temp = mail_fetch(player, num);
       if (!temp) {
         notify(player, T("MAIL: You can't reply to nonexistent mail."));
+        free(body);
         return;
       }
       if (subject_given)
-        send_mail(player, temp->from, sbuf, message, mail_flags, silent, nosig);
+        send_mail(player, temp->from, sbuf, message, body, mail_flags, silent,
+                  nosig);
       else
-        send_mail(player, temp->from, uncompress(temp->subject), message,
+        send_mail(player, temp->from, uncompress(temp->subject), message, body,
                   mail_flags | M_REPLY, silent, nosig);
     } else {
       /* send a new mail message */
@@ -1387,13 +1401,15 @@ do_mail_send(dbref player, char *tolist, char *message, mail_flag flags,
       if (!GoodObject(target))
         target = short_page(current);
       if (!GoodObject(target) || !IsPlayer(target)) {
-        if (!send_mail_alias(player, current, sbuf, message, mail_flags, silent,
-                             nosig))
+        if (!send_mail_alias(player, current, sbuf, message, body, mail_flags,
+                             silent, nosig))
           notify_format(player, T("No such unique player: %s."), current);
       } else
-        send_mail(player, target, sbuf, message, mail_flags, silent, nosig);
+        send_mail(player, target, sbuf, message, body, mail_flags, silent,
+                  nosig);
     }
   }
+  free(body);
 }
 
 /*-------------------------------------------------------------------------*
@@ -1417,19 +1433,23 @@ mail_fetch(dbref player, int num)
 static MAIL *
 real_mail_fetch(dbref player, int num, int folder)
 {
+  struct mailbox *mb;
   MAIL *mp;
-  int i = 0;
 
-  for (mp = find_exact_starting_point(player); mp != NULL; mp = mp->next) {
-    if (mp->to > player)
-      break;
-    if ((mp->to == player) &&
-        ((folder < 0) || (Folder(mp) == (mail_flag) folder)))
-      i++;
-    if (i == num)
-      return mp;
+  mb = get_mailbox(player);
+  if (!mb || num < 1)
+    return NULL;
+  if (folder < 0) {
+    /* Any folder */
+    if (num > mb->count)
+      return NULL;
+    for (mp = mb->first; --num > 0; mp = mp->next)
+      ;
+    return mp;
   }
-  return NULL;
+  if (folder > MAX_FOLDERS || num > mb->folders[folder].count)
+    return NULL;
+  return mb->folders[folder].msgs[num - 1];
 }
 
 static void
@@ -1438,20 +1458,18 @@ count_mail(dbref player, int folder, int *rcount, int *ucount, int *ccount)
   /* returns count of read, unread, & cleared messages as rcount, ucount,
    * ccount. folder=-1 returns for all folders */
 
-  MAIL *mp;
-  int rc, uc, cc;
+  struct mailbox *mb;
+  int rc, uc, cc, f;
 
   cc = rc = uc = 0;
-  for (mp = find_exact_starting_point(player); mp && (mp->to == player);
-       mp = mp->next) {
-    if ((mp->to == player) &&
-        ((folder == -1) || (Folder(mp) == (mail_flag) folder))) {
-      if (Cleared(mp))
-        cc++;
-      else if (Read(mp))
-        rc++;
-      else
-        uc++;
+  mb = find_mailbox(player);
+  if (mb) {
+    for (f = 0; f <= MAX_FOLDERS; f++) {
+      if ((folder == -1) || (folder == f)) {
+        cc += mb->cleared[f];
+        rc += mb->read[f];
+        uc += mb->unread[f];
+      }
     }
   }
   *rcount = rc;
@@ -1474,7 +1492,7 @@ FUNCTION(fun_mailsend)
 
 static void
 send_mail(dbref player, dbref target, char *subject, char *message,
-          mail_flag flags, int silent, int nosig)
+          const char *body, mail_flag flags, int silent, int nosig)
 {
   /* send a message to a target, consulting the target's mailforward.
    * If mailforward isn't set, just deliver to targt.
@@ -1487,7 +1505,8 @@ send_mail(dbref player, dbref target, char *subject, char *message,
   a = atr_get_noparent(target, "MAILFORWARDLIST");
   if (!a) {
     /* Easy, no forwarding */
-    real_send_mail(player, target, subject, message, flags, silent, nosig);
+    real_send_mail(player, target, subject, message, body, flags, silent,
+                   nosig);
     return;
   } else {
     /* We have a forward list. Run through it. */
@@ -1499,8 +1518,8 @@ send_mail(dbref player, dbref target, char *subject, char *message,
       if (is_objid(curr)) {
         fwd = parse_objid(curr);
         if (GoodObject(fwd) && Can_MailForward(target, fwd)) {
-          good +=
-            real_send_mail(player, fwd, subject, message, flags, 1, nosig);
+          good += real_send_mail(player, fwd, subject, message, body, flags,
+                                 1, nosig);
         } else
           notify_format(target, T("Failed attempt to forward @mail to #%d"),
                         fwd);
@@ -1557,11 +1576,29 @@ mail_limit(dbref target)
     return quota;
 }
 
+/* Compress a message for sending, adding the sender's MAILSIGNATURE.
+ * The result must be free()d.
+ */
+static char *
+mail_body(dbref player, char *message, int nosig)
+{
+  char buff[BUFFER_LEN], newmsg[BUFFER_LEN], *nm = newmsg;
+
+  safe_str(message, newmsg, &nm);
+  if (!nosig && call_attrib(player, "MAILSIGNATURE", buff, player, NULL, NULL))
+    safe_str(buff, newmsg, &nm);
+  *nm = '\0';
+  return compress(newmsg);
+}
+
+/* Deliver a mail message to a target, period.
+ * body is the message as returned by mail_body(), when the caller is
+ * sending the same message to several people, or NULL to make it here.
+ */
 static int
 real_send_mail(dbref player, dbref target, char *subject, char *message,
-               mail_flag flags, int silent, int nosig)
+               const char *body, mail_flag flags, int silent, int nosig)
 {
-  /* deliver a mail message to a target, period */
 
   MAIL *newp, *mp;
   int rc, uc, cc;
@@ -1638,50 +1675,18 @@ real_send_mail(dbref player, dbref target, char *subject, char *message,
     /* Forwarding passes the message already compressed */
     size_t len = strlen(message) + 1;
     newp->msgid = chunk_create(message, len, 1);
+  } else if (body) {
+    newp->msgid = chunk_create(body, strlen(body) + 1, 1);
   } else {
-    uint32_t len;
-    char *text;
-    char buff[BUFFER_LEN], newmsg[BUFFER_LEN], *nm = newmsg;
-
-    safe_str(message, newmsg, &nm);
-    if (!nosig &&
-        call_attrib(player, "MAILSIGNATURE", buff, player, NULL, NULL))
-      safe_str(buff, newmsg, &nm);
-    *nm = '\0';
-    text = compress(newmsg);
-    len = strlen(text) + 1;
-    newp->msgid = chunk_create(text, len, 1);
+    char *text = mail_body(player, message, nosig);
+    newp->msgid = chunk_create(text, strlen(text) + 1, 1);
     free(text);
   }
 
   newp->time = mudtime;
   newp->read = flags & M_FMASK; /* Send to folder 0 */
 
-  if (mp) {
-    newp->prev = mp;
-    newp->next = mp->next;
-    if (mp == TAIL)
-      TAIL = newp;
-    else
-      mp->next->prev = newp;
-    mp->next = newp;
-  } else {
-    if (HEAD) {
-      /* Insert at the front */
-      newp->next = HEAD;
-      newp->prev = NULL;
-      HEAD->prev = newp;
-      HEAD = newp;
-    } else {
-      /* This is the first message in the maildb */
-      HEAD = newp;
-      TAIL = newp;
-      newp->prev = NULL;
-      newp->next = NULL;
-    }
-  }
-
-  mdb_top++;
+  mail_link(newp, mp);
 
   /* notify people */
   if (!silent) {
@@ -1723,6 +1728,7 @@ do_mail_nuke(dbref player)
   /* walk the list */
   for (mp = HEAD; mp != NULL; mp = nextp) {
     nextp = mp->next;
+    free_mailbox(mp->to);
     if (mp->subject)
       free(mp->subject);
     chunk_delete(mp->msgid);
@@ -1787,24 +1793,8 @@ do_mail_debug(dbref player, const char *action, const char *victim)
       if (!GoodObject(mp->to) || !IsPlayer(mp->to)) {
         notify_format(player, T("Fixing mail for #%d."), mp->to);
         /* Delete this one */
-        /* head and tail of the list are special */
-        if (mp == HEAD)
-          HEAD = mp->next;
-        else if (mp == TAIL)
-          TAIL = mp->prev;
-        /* relink the list */
-        if (mp->prev != NULL)
-          mp->prev->next = mp->next;
-        if (mp->next != NULL)
-          mp->next->prev = mp->prev;
-        /* save the pointer */
         nextp = mp->next;
-        /* then wipe */
-        mdb_top--;
-        if (mp->subject)
-          free(mp->subject);
-        chunk_delete(mp->msgid);
-        slab_free(mail_slab, mp);
+        mail_delete(mp);
       } else if (!GoodObject(mp->from)) {
         /* Oops, it's from a player whose dbref is out of range!
          * We'll make it appear to be from #0 instead because there's
@@ -2449,69 +2439,270 @@ dump_mail(PENNFILE *fp)
 }
 
 /** Find the first message in a player's mail chain, or NULL if none.
- * We first try to find a good place to start by looking for a connected
- * player with a dbref nearest to our target player. Then it's a linear
- * search.
  * \param player the player to search for.
  * \return pointer to first message in their mail chain, or NULL.
  */
 MAIL *
 find_exact_starting_point(dbref player)
 {
-  static MAIL *mp;
+  struct mailbox *mb = find_mailbox(player);
 
-  if (!HEAD)
-    return NULL;
-
-  mp = get_objdata(player, "MAIL");
-  if (!mp) {
-    /* Player hasn't already done something that looks up their mail. */
-    if (HEAD->to > player)
-      return NULL; /* No mail chain */
-    for (mp = HEAD; mp && (mp->to < player); mp = mp->next)
-      ;
-  } else {
-    while (mp && (mp->to >= player))
-      mp = mp->prev;
-    if (!mp)
-      mp = HEAD;
-    while (mp && (mp->to < player))
-      mp = mp->next;
-  }
-  if (mp && (mp->to == player)) {
-    set_objdata(player, "MAIL", mp);
-    return mp;
-  } else
-    return NULL;
+  return mb ? mb->first : NULL;
 }
 
 /* Find the place where new mail to this player should go (after):
  *  1. The last message in the player's mail chain, or
  *  2. The last message before where the player's chain should start, or
- *  3. NULL (meaning TAIL)
+ *  3. NULL (meaning HEAD)
  */
 static MAIL *
 find_insertion_point(dbref player)
 {
-  static MAIL *mp;
+  struct mailbox *mb;
+  int i;
 
   if (!HEAD)
     return NULL;
-  mp = get_objdata(player, "MAIL");
-  if (!mp) {
-    if (HEAD->to > player)
-      return NULL; /* No mail chain */
-    for (mp = TAIL; mp && (mp->to > player); mp = mp->prev)
-      ;
+  if ((mb = find_mailbox(player)))
+    return mb->last;
+  /* Every player with mail has a mailbox, so the chain goes after the
+   * one of the nearest player below this one. */
+  i = mail_owner_slot(player);
+  return i > 0 ? mailboxes[mail_owners[i - 1]]->last : NULL;
+}
+
+/* Where a player is, or would go, in mail_owners. */
+static int
+mail_owner_slot(dbref player)
+{
+  int lo = 0, hi = mail_owners_count, mid;
+
+  while (lo < hi) {
+    mid = lo + (hi - lo) / 2;
+    if (mail_owners[mid] < player)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+/* Get a player's mailbox, or NULL if they have no mail. */
+static struct mailbox *
+find_mailbox(dbref player)
+{
+  if (player < 0 || player >= mailboxes_size)
+    return NULL;
+  return mailboxes[player];
+}
+
+/* Get a player's mailbox with its folder indexes up to date. */
+static struct mailbox *
+get_mailbox(dbref player)
+{
+  struct mailbox *mb = find_mailbox(player);
+
+  if (mb && mb->stale)
+    reindex_mailbox(mb);
+  return mb;
+}
+
+/* Get a player's mailbox, making an empty one if needed. */
+static struct mailbox *
+make_mailbox(dbref player)
+{
+  if (player >= mailboxes_size) {
+    int size = mailboxes_size ? mailboxes_size : 256;
+
+    while (size <= player)
+      size *= 2;
+    mailboxes =
+      mush_realloc(mailboxes, size * sizeof *mailboxes, "mail.mailboxes");
+    memset(mailboxes + mailboxes_size, 0,
+           (size - mailboxes_size) * sizeof *mailboxes);
+    mailboxes_size = size;
+  }
+  if (!mailboxes[player]) {
+    int i = mail_owner_slot(player);
+
+    if (mail_owners_count >= mail_owners_size) {
+      mail_owners_size = mail_owners_size ? mail_owners_size * 2 : 256;
+      mail_owners = mush_realloc(
+        mail_owners, mail_owners_size * sizeof *mail_owners, "mail.owners");
+    }
+    memmove(mail_owners + i + 1, mail_owners + i,
+            (mail_owners_count - i) * sizeof *mail_owners);
+    mail_owners[i] = player;
+    mail_owners_count++;
+    mailboxes[player] = mush_calloc(1, sizeof(struct mailbox), "mail.mailbox");
+  }
+  return mailboxes[player];
+}
+
+static void
+free_mailbox(dbref player)
+{
+  struct mailbox *mb = find_mailbox(player);
+  int f, i;
+
+  if (!mb)
+    return;
+  for (f = 0; f <= MAX_FOLDERS; f++) {
+    if (mb->folders[f].msgs)
+      mush_free(mb->folders[f].msgs, "mail.folder");
+  }
+  mush_free(mb, "mail.mailbox");
+  mailboxes[player] = NULL;
+  i = mail_owner_slot(player);
+  mail_owners_count--;
+  memmove(mail_owners + i, mail_owners + i + 1,
+          (mail_owners_count - i) * sizeof *mail_owners);
+}
+
+/* Add (delta 1) or remove (delta -1) a message from a mailbox's counts. */
+static void
+count_in_mailbox(struct mailbox *mb, MAIL *mp, int delta)
+{
+  int f = Folder(mp);
+
+  if (Cleared(mp))
+    mb->cleared[f] += delta;
+  else if (Read(mp))
+    mb->read[f] += delta;
+  else
+    mb->unread[f] += delta;
+}
+
+static void
+add_to_folder(struct mail_folder *fl, MAIL *mp)
+{
+  if (fl->count >= fl->size) {
+    fl->size = fl->size ? fl->size * 2 : 8;
+    fl->msgs = mush_realloc(fl->msgs, fl->size * sizeof(MAIL *), "mail.folder");
+  }
+  fl->msgs[fl->count++] = mp;
+}
+
+/* Rebuild a mailbox's folder indexes from its mail chain. This is put
+ * off until a message is next fetched by number, so deleting or filing
+ * many messages at once only rebuilds them once.
+ */
+static void
+reindex_mailbox(struct mailbox *mb)
+{
+  MAIL *mp;
+  int f;
+
+  for (f = 0; f <= MAX_FOLDERS; f++)
+    mb->folders[f].count = 0;
+  for (mp = mb->first; mp; mp = mp->next) {
+    add_to_folder(&mb->folders[Folder(mp)], mp);
+    if (mp == mb->last)
+      break;
+  }
+  mb->stale = 0;
+}
+
+/* Add a new message to the end of its recipient's mailbox. */
+static void
+add_to_mailbox(MAIL *mp)
+{
+  struct mailbox *mb = make_mailbox(mp->to);
+
+  if (!mb->first)
+    mb->first = mp;
+  mb->last = mp;
+  mb->count++;
+  count_in_mailbox(mb, mp, 1);
+  if (!mb->stale)
+    add_to_folder(&mb->folders[Folder(mp)], mp);
+}
+
+/* Put a new message into the mail list after mp (NULL for the head). */
+static void
+mail_link(MAIL *newp, MAIL *mp)
+{
+  if (mp) {
+    newp->prev = mp;
+    newp->next = mp->next;
+    if (mp == TAIL)
+      TAIL = newp;
+    else
+      mp->next->prev = newp;
+    mp->next = newp;
   } else {
-    while (mp && (mp->to <= player))
-      mp = mp->next;
-    if (!mp)
-      mp = TAIL;
-    while (mp && (mp->to > player))
-      mp = mp->prev;
+    if (HEAD) {
+      /* Insert at the front */
+      newp->next = HEAD;
+      newp->prev = NULL;
+      HEAD->prev = newp;
+      HEAD = newp;
+    } else {
+      /* This is the first message in the maildb */
+      HEAD = newp;
+      TAIL = newp;
+      newp->prev = NULL;
+      newp->next = NULL;
+    }
   }
-  return mp;
+  add_to_mailbox(newp);
+  mdb_top++;
+}
+
+/* Take a message out of the mail list and its mailbox, and free it.
+ * mp->next is left alone, so callers walking the list should save it
+ * first.
+ */
+static void
+mail_delete(MAIL *mp)
+{
+  struct mailbox *mb = find_mailbox(mp->to);
+
+  if (mb) {
+    if (mb->count <= 1) {
+      free_mailbox(mp->to);
+    } else {
+      if (mp == mb->first)
+        mb->first = mp->next;
+      if (mp == mb->last)
+        mb->last = mp->prev;
+      mb->count--;
+      count_in_mailbox(mb, mp, -1);
+      mb->stale = 1;
+    }
+  }
+  /* head and tail of the list are special */
+  if (mp == HEAD)
+    HEAD = mp->next;
+  if (mp == TAIL)
+    TAIL = mp->prev;
+  /* relink the list */
+  if (mp->prev != NULL)
+    mp->prev->next = mp->next;
+  if (mp->next != NULL)
+    mp->next->prev = mp->prev;
+  /* then wipe */
+  mdb_top--;
+  if (mp->subject)
+    free(mp->subject);
+  chunk_delete(mp->msgid);
+  slab_free(mail_slab, mp);
+}
+
+/* Change a message's status and folder bits. */
+static void
+set_mail_flags(MAIL *mp, mail_flag flags)
+{
+  struct mailbox *mb = find_mailbox(mp->to);
+
+  if (mb) {
+    count_in_mailbox(mb, mp, -1);
+    if (Folder(mp) != ((flags & ~M_FMASK) >> 8U))
+      mb->stale = 1;
+  }
+  mp->read = flags;
+  if (mb)
+    count_in_mailbox(mb, mp, 1);
 }
 
 /** Initialize the mail database pointers */
@@ -2687,6 +2878,9 @@ load_mail(PENNFILE *fp)
       do_rawlog(LT_ERR, "MAIL: Trailing garbage in the mail database.");
   }
 
+  for (mp = HEAD; mp; mp = mp->next)
+    add_to_mailbox(mp);
+
   do_mail_debug(GOD, "fix", "");
   slab_set_opt(mail_slab, SLAB_ALLOC_BEST_FIT, 1);
   return mdb_top;
@@ -3250,7 +3444,7 @@ parse_message_spec(dbref player, const char *s, int *msglow, int *msghigh,
 
 static int
 send_mail_alias(dbref player, char *aname, char *subject, char *message,
-                mail_flag flags, int silent, int nosig)
+                const char *body, mail_flag flags, int silent, int nosig)
 {
   struct mail_alias *m;
   int i;
@@ -3276,7 +3470,8 @@ send_mail_alias(dbref player, char *aname, char *subject, char *message,
   }
 
   for (i = 0; i < m->size; i++) {
-    send_mail(player, m->members[i], subject, message, flags, silent, nosig);
+    send_mail(player, m->members[i], subject, message, body, flags, silent,
+              nosig);
   }
   return 1; /* Success */
 }
@@ -3326,3 +3521,236 @@ filter_mail(dbref from, dbref player, char *subject, char *message,
     do_mail_file(player, buf, buff);
   }
 }
+
+#ifndef WIN32
+#define MAIL_TEST_ALIAS 4
+#define MAIL_TEST_BOX 10
+#define MAIL_BENCH_ALIAS 2000
+#define MAIL_BENCH_BOX 5000
+#define MAIL_BENCH_LOOKUPS 2000
+
+/* Size of a mail test run, and the scratch file for its maildb */
+struct mail_bench_spec {
+  int alias_size;
+  int box_size;
+  char file[FILE_PATH_LEN];
+};
+
+/* Results of the mail tests, sent back from the child running them. */
+struct mail_bench {
+  int made;
+  int counted;
+  int fetched;
+  int filed;
+  int purged;
+  int reloaded;
+  int bulk;
+  int sorted;
+  double bulk_ms;
+  double lookup_us;
+};
+
+static dbref
+mail_bench_player(const char *name)
+{
+  dbref p = new_object();
+
+  set_name(p, name);
+  db[p].type = TYPE_PLAYER;
+  db[p].flags = string_to_bits("FLAG", "");
+  db[p].powers = string_to_bits("POWER", "");
+  db[p].owner = p;
+  return p;
+}
+
+static bool
+mail_bench_is(dbref player, int num, int folder, const char *text)
+{
+  MAIL *mp = real_mail_fetch(player, num, folder);
+
+  return mp && !strcmp(get_message(mp), text);
+}
+
+static bool
+mail_bench_count(dbref player, int folder, int read, int unread, int cleared)
+{
+  int rc, uc, cc;
+
+  count_mail(player, folder, &rc, &uc, &cc);
+  return rc == read && uc == unread && cc == cleared;
+}
+
+static double
+mail_bench_ms(struct timeval *start)
+{
+  struct timeval end;
+
+  penn_gettimeofday(&end);
+  return (end.tv_sec - start->tv_sec) * 1000.0 +
+         (end.tv_usec - start->tv_usec) / 1000.0;
+}
+
+/* Whether the mail list is still in order of recipient. */
+static bool
+mail_bench_sorted(void)
+{
+  MAIL *mp;
+
+  for (mp = HEAD; mp && mp->next; mp = mp->next) {
+    if (mp->next->to < mp->to)
+      return 0;
+  }
+  return 1;
+}
+
+static void
+mail_bench_run(void *arg, void *result)
+{
+  const struct mail_bench_spec *spec = arg;
+  struct mail_bench *r = result;
+  int alias_size = spec->alias_size, box_size = spec->box_size;
+  struct mail_alias *m;
+  struct timeval start;
+  PENNFILE *f;
+  dbref p, big, *members;
+  char to[BUFFER_LEN], alias[] = "+mailbench", list[] = "me";
+  char msg[BUFFER_LEN], first[] = "1", folder[] = "1";
+  int i, rc, uc, cc;
+
+  /* Numbering, folders and counts for one player */
+  p = mail_bench_player("Mail_Bench");
+  strcpy(to, unparse_dbref(p));
+  strcpy(msg, "Test/one");
+  do_mail_send(GOD, to, msg, 0, 1, 1);
+  strcpy(msg, "Test/two");
+  do_mail_send(GOD, to, msg, 0, 1, 1);
+  strcpy(msg, "Test/three");
+  do_mail_send(GOD, to, msg, 0, 1, 1);
+  r->made = GoodObject(p);
+  r->counted = mail_bench_count(p, -1, 0, 3, 0);
+  r->fetched =
+    mail_bench_is(p, 2, 0, "two") && mail_bench_is(p, 3, -1, "three");
+  do_mail_file(p, first, folder);
+  do_mail_read(p, first);
+  r->filed = mail_bench_count(p, 0, 1, 1, 0) &&
+             mail_bench_count(p, 1, 0, 1, 0) && mail_bench_is(p, 1, 0, "two") &&
+             mail_bench_is(p, 2, 0, "three") && mail_bench_is(p, 1, 1, "one") &&
+             !real_mail_fetch(p, 3, 0);
+  do_mail_clear(p, "1");
+  do_mail_purge(p);
+  r->purged = mail_bench_count(p, -1, 0, 2, 0) &&
+              mail_bench_is(p, 1, 0, "three") && mail_bench_is(p, 1, 1, "one");
+
+  /* Loading the maildb builds the mailboxes again */
+  if ((f = penn_fopen(spec->file, FOPEN_WRITE))) {
+    dump_mail(f);
+    penn_fclose(f);
+    do_mail_nuke(GOD);
+    if ((f = penn_fopen(spec->file, FOPEN_READ))) {
+      load_mail(f);
+      penn_fclose(f);
+    }
+  }
+  r->reloaded = mail_bench_count(p, 0, 0, 1, 0) &&
+                mail_bench_count(p, 1, 0, 1, 0) &&
+                mail_bench_is(p, 1, 0, "three") && mail_bench_is(p, 1, 1, "one");
+
+  /* One message to everyone on a large alias */
+  do_malias_create(GOD, alias, list);
+  m = get_malias(GOD, alias);
+  if (!m)
+    return;
+  members = mush_calloc(alias_size, sizeof(dbref), "malias_members");
+  /* Listed newest first, so each new mailbox goes in below the last */
+  for (i = alias_size - 1; i >= 0; i--)
+    members[i] = mail_bench_player(tprintf("Mail_Bench_%d", i));
+  mush_free(m->members, "malias_members");
+  m->members = members;
+  m->size = alias_size;
+  penn_gettimeofday(&start);
+  strcpy(msg, "Bulk/Everyone gets this.");
+  do_mail_send(GOD, alias, msg, 0, 1, 1);
+  r->bulk_ms = mail_bench_ms(&start);
+  r->bulk = 1;
+  for (i = 0; i < alias_size; i++) {
+    if (!mail_bench_is(members[i], 1, 0, "Everyone gets this."))
+      r->bulk = 0;
+  }
+  r->sorted = mail_bench_sorted();
+
+  /* Counting and fetching in a large mailbox */
+  big = mail_bench_player("Mail_Bench_Big");
+  atr_add(big, "MAILQUOTA", "50000", GOD, 0);
+  strcpy(to, unparse_dbref(big));
+  for (i = 0; i < box_size; i++) {
+    strcpy(msg, "Big/Message");
+    do_mail_send(GOD, to, msg, 0, 1, 1);
+  }
+  penn_gettimeofday(&start);
+  for (i = 0; i < MAIL_BENCH_LOOKUPS; i++) {
+    count_mail(big, 0, &rc, &uc, &cc);
+    if (!real_mail_fetch(big, uc, 0))
+      break;
+  }
+  r->lookup_us = mail_bench_ms(&start) * 1000.0 / MAIL_BENCH_LOOKUPS;
+  r->counted = r->counted && i == MAIL_BENCH_LOOKUPS && uc == box_size;
+  r->sorted = r->sorted && mail_bench_sorted();
+}
+
+/* Run the mail tests in a child, so the players and mail they make go
+ * away, with the maildb written to a scratch directory. */
+static bool
+mail_bench_fork(struct mail_bench *r, int alias_size, int box_size)
+{
+  struct mail_bench_spec spec;
+  char dir[FILE_PATH_LEN];
+  bool ok;
+
+  memset(r, 0, sizeof *r);
+  if (!test_scratch_dir(dir, sizeof dir, "mailbench"))
+    return 0;
+  spec.alias_size = alias_size;
+  spec.box_size = box_size;
+  if (snprintf(spec.file, sizeof spec.file, "%s/mail.db", dir) >=
+      (int) sizeof spec.file) {
+    rmdir(dir);
+    return 0;
+  }
+  ok = run_in_child(mail_bench_run, &spec, r, sizeof *r);
+  unlink(spec.file);
+  rmdir(dir);
+  return ok;
+}
+#endif
+
+TEST_GROUP(mailbox)
+{
+#ifndef WIN32
+  struct mail_bench r;
+  bool ok;
+
+  ok = mail_bench_fork(&r, MAIL_TEST_ALIAS, MAIL_TEST_BOX);
+  TEST("mailbox.1", ok && r.made);
+  TEST("mailbox.2", r.counted);
+  TEST("mailbox.3", r.fetched);
+  TEST("mailbox.4", r.filed);
+  TEST("mailbox.5", r.purged);
+  TEST("mailbox.6", r.reloaded);
+  TEST("mailbox.7", r.bulk);
+  TEST("mailbox.8", r.sorted);
+#endif
+}
+
+BENCHMARK(mailbox)
+{
+#ifndef WIN32
+  struct mail_bench r;
+
+  if (!mail_bench_fork(&r, MAIL_BENCH_ALIAS, MAIL_BENCH_BOX))
+    return;
+  do_rawlog(LT_TRACE,
+            "mailbox: sent to a %d member alias in %.1fms. Counted and "
+            "fetched the last of %d messages in %.2fus.",
+            MAIL_BENCH_ALIAS, r.bulk_ms, MAIL_BENCH_BOX, r.lookup_us);
+#endif
+}
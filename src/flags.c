@@ -55,9 +55,11 @@
 #include "parse.h"
 #include "privtab.h"
 #include "ptab.h"
+#include "snapshot.h"
 #include "sort.h"
 #include "strutil.h"
 #include "odbc.h"
+#include "tests.h"
 
 static bool can_set_flag(dbref player, dbref thing, const FLAG *flagp,
                          int negate);
@@ -109,6 +111,79 @@ HASHTAB htab_flagspaces; /**< Hash of flagspaces */
 slab *flag_slab = NULL;
 extern PTAB ptab_command; /* Uses flag bitmasks */
 
+/** Bumped whenever a flag name is added or removed, so that flag handles
+ * look their names up again. */
+static uint32_t flag_generation = 1;
+
+/** Bumped whenever some object's flags or powers, or a flag's permissions,
+ * change. */
+static uint32_t privs_changes = 0;
+
+/** Handles for the flags checked by the macros in dbdefs.h */
+FLAG_HANDLE core_flags[FH_COUNT] = {
+  [FH_ABODE] = FLAG_HANDLE_INIT("FLAG", "ABODE"),
+  [FH_ANSI] = FLAG_HANDLE_INIT("FLAG", "ANSI"),
+  [FH_AUDIBLE] = FLAG_HANDLE_INIT("FLAG", "AUDIBLE"),
+  [FH_CHAN_USEFIRSTMATCH] = FLAG_HANDLE_INIT("FLAG", "CHAN_USEFIRSTMATCH"),
+  [FH_CHOWN_OK] = FLAG_HANDLE_INIT("FLAG", "CHOWN_OK"),
+  [FH_CLOUDY] = FLAG_HANDLE_INIT("FLAG", "CLOUDY"),
+  [FH_COLOR] = FLAG_HANDLE_INIT("FLAG", "COLOR"),
+  [FH_CONNECTED] = FLAG_HANDLE_INIT("FLAG", "CONNECTED"),
+  [FH_DARK] = FLAG_HANDLE_INIT("FLAG", "DARK"),
+  [FH_DEBUG] = FLAG_HANDLE_INIT("FLAG", "DEBUG"),
+  [FH_DESTROY_OK] = FLAG_HANDLE_INIT("FLAG", "DESTROY_OK"),
+  [FH_ENTER_OK] = FLAG_HANDLE_INIT("FLAG", "ENTER_OK"),
+  [FH_FIXED] = FLAG_HANDLE_INIT("FLAG", "FIXED"),
+  [FH_FLOATING] = FLAG_HANDLE_INIT("FLAG", "FLOATING"),
+  [FH_GAGGED] = FLAG_HANDLE_INIT("FLAG", "GAGGED"),
+  [FH_GOING] = FLAG_HANDLE_INIT("FLAG", "GOING"),
+  [FH_GOING_TWICE] = FLAG_HANDLE_INIT("FLAG", "GOING_TWICE"),
+  [FH_HALT] = FLAG_HANDLE_INIT("FLAG", "HALT"),
+  [FH_HAVEN] = FLAG_HANDLE_INIT("FLAG", "HAVEN"),
+  [FH_HEAVY] = FLAG_HANDLE_INIT("FLAG", "HEAVY"),
+  [FH_JUMP_OK] = FLAG_HANDLE_INIT("FLAG", "JUMP_OK"),
+  [FH_LIGHT] = FLAG_HANDLE_INIT("FLAG", "LIGHT"),
+  [FH_LINK_OK] = FLAG_HANDLE_INIT("FLAG", "LINK_OK"),
+  [FH_LISTENER] = FLAG_HANDLE_INIT("FLAG", "LISTENER"),
+  [FH_LISTEN_PARENT] = FLAG_HANDLE_INIT("FLAG", "LISTEN_PARENT"),
+  [FH_LOUD] = FLAG_HANDLE_INIT("FLAG", "LOUD"),
+  [FH_MISTRUST] = FLAG_HANDLE_INIT("FLAG", "MISTRUST"),
+  [FH_MONIKER] = FLAG_HANDLE_INIT("FLAG", "MONIKER"),
+  [FH_MONITOR] = FLAG_HANDLE_INIT("FLAG", "MONITOR"),
+  [FH_MYOPIC] = FLAG_HANDLE_INIT("FLAG", "MYOPIC"),
+  [FH_NOACCENTS] = FLAG_HANDLE_INIT("FLAG", "NOACCENTS"),
+  [FH_NOLEAVE] = FLAG_HANDLE_INIT("FLAG", "NOLEAVE"),
+  [FH_NOSPOOF] = FLAG_HANDLE_INIT("FLAG", "NOSPOOF"),
+  [FH_NO_COMMAND] = FLAG_HANDLE_INIT("FLAG", "NO_COMMAND"),
+  [FH_NO_TEL] = FLAG_HANDLE_INIT("FLAG", "NO_TEL"),
+  [FH_NO_WARN] = FLAG_HANDLE_INIT("FLAG", "NO_WARN"),
+  [FH_ON_VACATION] = FLAG_HANDLE_INIT("FLAG", "ON-VACATION"),
+  [FH_OPAQUE] = FLAG_HANDLE_INIT("FLAG", "OPAQUE"),
+  [FH_OPEN_OK] = FLAG_HANDLE_INIT("FLAG", "OPEN_OK"),
+  [FH_ORPHAN] = FLAG_HANDLE_INIT("FLAG", "ORPHAN"),
+  [FH_PARANOID] = FLAG_HANDLE_INIT("FLAG", "PARANOID"),
+  [FH_PUPPET] = FLAG_HANDLE_INIT("FLAG", "PUPPET"),
+  [FH_QUIET] = FLAG_HANDLE_INIT("FLAG", "QUIET"),
+  [FH_ROYALTY] = FLAG_HANDLE_INIT("FLAG", "ROYALTY"),
+  [FH_SAFE] = FLAG_HANDLE_INIT("FLAG", "SAFE"),
+  [FH_SHARED] = FLAG_HANDLE_INIT("FLAG", "SHARED"),
+  [FH_STICKY] = FLAG_HANDLE_INIT("FLAG", "STICKY"),
+  [FH_SUSPECT] = FLAG_HANDLE_INIT("FLAG", "SUSPECT"),
+  [FH_TERSE] = FLAG_HANDLE_INIT("FLAG", "TERSE"),
+  [FH_TRACK_MONEY] = FLAG_HANDLE_INIT("FLAG", "TRACK_MONEY"),
+  [FH_TRANSPARENT] = FLAG_HANDLE_INIT("FLAG", "TRANSPARENT"),
+  [FH_TRUST] = FLAG_HANDLE_INIT("FLAG", "TRUST"),
+  [FH_UNFINDABLE] = FLAG_HANDLE_INIT("FLAG", "UNFINDABLE"),
+  [FH_UNINSPECTED] = FLAG_HANDLE_INIT("FLAG", "UNINSPECTED"),
+  [FH_UNREGISTERED] = FLAG_HANDLE_INIT("FLAG", "UNREGISTERED"),
+  [FH_VERBOSE] = FLAG_HANDLE_INIT("FLAG", "VERBOSE"),
+  [FH_VISUAL] = FLAG_HANDLE_INIT("FLAG", "VISUAL"),
+  [FH_WIZARD] = FLAG_HANDLE_INIT("FLAG", "WIZARD"),
+  [FH_XTERM256] = FLAG_HANDLE_INIT("FLAG", "XTERM256"),
+  [FH_Z_TEL] = FLAG_HANDLE_INIT("FLAG", "Z_TEL"),
+  [FH_CAN_DARK] = FLAG_HANDLE_INIT("POWER", "Can_Dark"),
+};
+
 /** Attempt to find a flagspace from its name */
 #define Flagspace_Lookup(n, ns)                                                \
   if (!(n = (FLAGSPACE *) hashfind(ns, &htab_flagspaces)))                     \
@@ -222,6 +297,7 @@ clear_all_flags(FLAGSPACE *n)
   }
 
   ptab_free(n->tab);
+  flag_generation++;
 
   /* Finally, the flags array */
   if (n->flags)
@@ -268,6 +344,7 @@ flag_add(FLAGSPACE *n, const char *name, FLAG *f)
 
   /* Insert the flag in the ptab by the given name (maybe an alias) */
   ptab_insert_one(n->tab, name, f);
+  flag_generation++;
   add_private_vocab(name, n->name);
 
   /* Is this a canonical flag (as opposed to an alias?)
@@ -757,6 +834,7 @@ init_flag_table(const char *ns)
     flag_add(n, cf->name, cf);
   }
   ptab_end_inserts(n->tab);
+  flag_generation++;
   /* now add in the aliases */
   for (a = n->flag_alias_table; a->alias; a++) {
     if ((cf = match_flag_ns(n, a->realname)))
@@ -1217,6 +1295,19 @@ new_flag_bitmask(const char *ns)
   return new_flag_bitmask_ns(n);
 }
 
+/** How long are the flagsets of a flagspace?
+ * \param ns the name of the flagspace.
+ * \return the length of its flagsets, in bytes.
+ */
+uint32_t
+flag_bitmask_bytes(const char *ns)
+{
+  FLAGSPACE *n;
+
+  Flagspace_Lookup(n, ns);
+  return FlagBytes(n);
+}
+
 /** Copy a managed flag bitmask.
  * \param ns name of flagspace to use.
  * \param given a flag bitmask.
@@ -1239,6 +1330,7 @@ destroy_flag_bitmask(const char *ns, const object_flag_type bitmask)
 
   Flagspace_Lookup(n, ns);
   flagcache_delete(n, bitmask);
+  privs_changes++;
 }
 
 /** Add a flag into a flagset.
@@ -1270,6 +1362,7 @@ set_flag_bitmask_ns(FLAGSPACE *n, const object_flag_type bitmask, int bit)
   if (managed_copy != copy)
     slab_free(n->cache->flagset_slab, copy);
   flagcache_delete(n, bitmask);
+  privs_changes++;
   return managed_copy;
 }
 
@@ -1323,6 +1416,7 @@ clear_flag_bitmask_ns(FLAGSPACE *n, const object_flag_type bitmask, int bit)
   if (managed_copy != copy)
     slab_free(n->cache->flagset_slab, copy);
   flagcache_delete(n, bitmask);
+  privs_changes++;
   return managed_copy;
 }
 
@@ -1529,6 +1623,45 @@ has_flag_ns(const FLAGSPACE *n, dbref thing, const FLAG *f)
                                 : has_bit(Powers(thing), f->bitpos);
 }
 
+/** Return a counter that changes whenever anything a flag or power
+ * check depends on might have changed: an object's flags or powers, or
+ * the flag tables themselves. Callers that cache the outcome of such
+ * checks compare it to the value they saw when they filled the cache.
+ * \return the current privileges generation.
+ */
+uint32_t
+privs_generation(void)
+{
+  return flag_generation + privs_changes;
+}
+
+/** Check an object for a flag, using a handle for the flag.
+ * This is the same as has_flag_in_space_by_name(), but only looks the flag
+ * up the first time, or after flags have been added or removed.
+ * \param thing object to check.
+ * \param h handle for the flag.
+ * \param type allowed types of flags to check for.
+ * \retval 1 object has the flag.
+ * \retval 0 object does not have the flag.
+ */
+bool
+has_flag_handle(dbref thing, FLAG_HANDLE *h, int type)
+{
+  const FLAG *f;
+
+  if (h->generation != flag_generation) {
+    h->n = hashfind(h->ns, &htab_flagspaces);
+    if (!h->n)
+      return 0; /* Too early; try again next time */
+    h->f = match_flag_ns(h->n, h->name);
+    h->generation = flag_generation;
+  }
+  f = h->f;
+  if (!f || (f->perms & F_DISABLED) || !(f->type & type))
+    return 0;
+  return has_flag_ns(h->n, thing, f);
+}
+
 static bool
 can_set_flag_generic(dbref player, dbref thing, const FLAG *flagp, int negate)
 {
@@ -1751,6 +1884,7 @@ twiddle_flag_internal(const char *ns, dbref thing, const char *flag, int negate)
                         ? clear_flag_bitmask_ns(n, Powers(thing), f->bitpos)
                         : set_flag_bitmask_ns(n, Powers(thing), f->bitpos);
     }
+    snapshot_touch(thing);
   }
 }
 
@@ -1812,6 +1946,7 @@ set_flag(dbref player, dbref thing, const char *flag, int negate, int hear,
     Flags(thing) = clear_flag_bitmask_ns(n, Flags(thing), f->bitpos);
   else
     Flags(thing) = set_flag_bitmask_ns(n, Flags(thing), f->bitpos);
+  snapshot_touch(thing);
 
   if (negate) {
     /* log if necessary */
@@ -1981,6 +2116,7 @@ set_power(dbref player, dbref thing, const char *flag, int negate)
     Powers(thing) = clear_flag_bitmask_ns(n, Powers(thing), f->bitpos);
   else
     Powers(thing) = set_flag_bitmask_ns(n, Powers(thing), f->bitpos);
+  snapshot_touch(thing);
 
   if (!AreQuiet(player, thing)) {
     tp = tbuf1;
@@ -2412,6 +2548,7 @@ do_flag_restrict(const char *ns, dbref player, const char *name,
   }
   f->perms = perms;
   f->negate_perms = negate_perms;
+  privs_changes++;
   notify_format(player, T("Permissions on %s %s set."), f->name,
                 strlower_r(ns, tmp, sizeof tmp));
 }
@@ -2489,6 +2626,7 @@ set_flag_type_by_name(const char *ns, const char *name, privbits type)
   Flagspace_Lookup(n, ns);
   f = flag_hash_lookup(n, name, NOTYPE);
   f->type = type;
+  privs_changes++;
 }
 
 /** Add a new flag
@@ -2701,8 +2839,7 @@ do_flag_alias(const char *ns, dbref player, const char *name, const char *alias)
                     strlower_r(ns, tmp, sizeof tmp));
       return;
     }
-    ptab_delete(n->tab, alias);
-    if (match_flag_ns(n, alias)) {
+    if (!delete_flag_alias_generic(ns, alias) || match_flag_ns(n, alias)) {
       notify(player, T("Unknown failure deleting alias."));
     } else {
       do_flag_info(ns, player, f->name);
@@ -2750,10 +2887,40 @@ alias_flag_generic(const char *ns, const char *name, const char *alias)
   f->perms = INCR_FLAG_REF(f->perms);
 
   ptab_insert_one(n->tab, alias, f);
+  flag_generation++;
 
   return (match_flag_ns(n, alias) ? 1 : 0);
 }
 
+/** Remove an alias of a flag.
+ * \param ns name of the flagspace to use.
+ * \param alias the alias to remove.
+ * \retval 1 alias removed successfully
+ * \retval 0 no such alias
+ */
+int
+delete_flag_alias_generic(const char *ns, const char *alias)
+{
+  FLAG *f;
+  FLAGSPACE *n;
+  char tmp[BUFFER_LEN];
+
+  Flagspace_Lookup(n, ns);
+
+  alias = strupper_r(alias, tmp, sizeof tmp);
+
+  f = ptab_find_exact(n->tab, alias);
+  if (!f || !strcasecmp(f->name, alias)) {
+    return 0; /* not an alias */
+  }
+
+  ptab_delete(n->tab, alias);
+  f->perms = DECR_FLAG_REF(f->perms);
+  flag_generation++;
+
+  return 1;
+}
+
 /** Change a flag's letter.
  * \param ns name of the flagspace to use.
  * \param player the enactor.
@@ -2907,12 +3074,14 @@ do_flag_delete(const char *ns, dbref player, const char *name)
       Flags(i) = clear_flag_bitmask_ns(n, Flags(i), f->bitpos);
     else
       Powers(i) = clear_flag_bitmask_ns(n, Powers(i), f->bitpos);
+    snapshot_touch(i);
   }
   /* Remove the flag's entry in flags */
   n->flags[f->bitpos] = NULL;
   /* Remove the flag from the ptab */
   ptab_delete(n->tab, f->name);
   delete_private_vocab(f->name, n->name);
+  flag_generation++;
   notify_format(player, T("%s %s deleted."), strinitial_r(ns, tmp, sizeof tmp),
                 f->name);
   /* Free the flag. */
@@ -3201,3 +3370,64 @@ do_flag_debug(const char *ns, dbref player)
   }
 #endif
 }
+
+TEST_GROUP(flag_handles)
+{
+  FLAG_HANDLE dark = FLAG_HANDLE_INIT("FLAG", "DARK");
+  FLAG_HANDLE nopay = FLAG_HANDLE_INIT("POWER", "NO_PAY");
+  FLAG_HANDLE alias = FLAG_HANDLE_INIT("FLAG", "HANDLE_TEST");
+  FLAGSPACE *n = hashfind("FLAG", &htab_flagspaces);
+  FLAG *f = match_flag_ns(n, "DARK");
+  uint32_t perms = f ? f->perms : 0;
+  int ok = 1;
+  dbref i;
+
+  for (i = 0; i < db_top; i++) {
+    ok &= has_flag_handle(i, &dark, NOTYPE) ==
+          has_flag_by_name(i, "DARK", NOTYPE);
+    ok &= has_flag_handle(i, &nopay, NOTYPE) ==
+          has_power_by_name(i, "NO_PAY", NOTYPE);
+    ok &= Wizard(i) == (God(i) || has_flag_by_name(i, "WIZARD", NOTYPE));
+    ok &= Connected(i) == IS(i, TYPE_PLAYER, "CONNECTED");
+    ok &= Haven(i) == has_flag_by_name(i, "HAVEN", TYPE_PLAYER);
+  }
+  TEST("flag_handles.1", ok);
+  TEST("flag_handles.2", !has_flag_handle(GOD, &alias, NOTYPE) && !alias.f);
+
+  /* Handles notice aliases being added and removed, and the flag table
+   * ends up as it started. */
+  alias_flag_generic("FLAG", "DARK", "HANDLE_TEST");
+  TEST("flag_handles.3", has_flag_handle(GOD, &alias, NOTYPE) ==
+                             has_flag_handle(GOD, &dark, NOTYPE) &&
+                           alias.f == f && dark.f == f && f);
+  TEST("flag_handles.4", delete_flag_alias_generic("FLAG", "HANDLE_TEST") &&
+                           !has_flag_handle(GOD, &alias, NOTYPE) && !alias.f);
+  TEST("flag_handles.5", f && f->perms == perms);
+}
+
+BENCHMARK(flag_handles)
+{
+  FLAG_HANDLE dark = FLAG_HANDLE_INIT("FLAG", "DARK");
+  const int checks = 1000000;
+  struct timeval start, mid, end;
+  double by_name, by_handle;
+  int hits = 0;
+  dbref i;
+
+  penn_gettimeofday(&start);
+  for (i = 0; i < checks; i++)
+    hits += has_flag_by_name(i % db_top, "DARK", NOTYPE);
+  penn_gettimeofday(&mid);
+  for (i = 0; i < checks; i++)
+    hits -= has_flag_handle(i % db_top, &dark, NOTYPE);
+  penn_gettimeofday(&end);
+  by_name = (mid.tv_sec - start.tv_sec) * 1000000.0 +
+            (mid.tv_usec - start.tv_usec);
+  by_handle = (end.tv_sec - mid.tv_sec) * 1000000.0 +
+              (end.tv_usec - mid.tv_usec);
+  do_rawlog(LT_TRACE,
+            "flag_handles: %d checks. By name: %.1f ns each. By handle: "
+            "%.1f ns each.%s",
+            checks, by_name * 1000.0 / checks, by_handle * 1000.0 / checks,
+            hits ? " (Results differ!)" : "");
+}
@@ -679,6 +679,7 @@ FUNTAB flist[] = {
   {"POS", fun_pos, 2, 2, FN_REG | FN_STRIPANSI},
   {"POSS", fun_poss, 1, 1, FN_REG | FN_STRIPANSI},
   {"POWERS", fun_powers, 0, 2, FN_REG | FN_STRIPANSI},
+  {"PROFILE", fun_profile, 0, 1, FN_WIZARD},
   {"PROMPT", fun_prompt, 2, -2, FN_REG},
   {"PUEBLO", fun_pueblo, 1, 1, FN_REG | FN_STRIPANSI},
   {"QUOTA", fun_quota, 1, 1, FN_REG | FN_STRIPANSI},
@@ -759,6 +760,7 @@ FUNTAB flist[] = {
   {"SPELLNUM", fun_spellnum, 1, 1, FN_REG | FN_STRIPANSI},
   {"SPLICE", fun_splice, 3, 4, FN_REG},
   {"SQL", fun_sql, 1, 4, FN_REG},
+  {"SQLASYNC", fun_sqlasync, 2, 4, FN_REG},
   {"SQLESCAPE", fun_sql_escape, 1, -1, FN_REG},
   {"SQUISH", fun_squish, 1, 2, FN_REG},
   {"SSL", fun_ssl, 1, 1, FN_REG | FN_STRIPANSI},
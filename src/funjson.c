@@ -612,7 +612,7 @@ FUNCTION(fun_json)
     safe_str(args[1], buff, bp);
     return;
   case JSON_STR:
-    strcpy(tmp, render_string(args[1], MSG_XTERM256));
+    render_string(args[1], MSG_XTERM256, tmp);
     safe_format(buff, bp, "\"%s\"", json_escape_string(tmp));
     return;
   case JSON_ARRAY: {
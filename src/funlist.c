@@ -2581,11 +2581,11 @@ FUNCTION(fun_table)
  * with an ig version */
 FUNCTION(fun_regreplace)
 {
+  struct cached_regexp cre;
   pcre2_code *re;
   pcre2_match_data *md;
   int errcode;
   int subpatterns;
-  PCRE2_SIZE erroffset;
   int flags = re_compile_flags, all = 0;
   PCRE2_SIZE match_offset = 0;
   PE_REGS *pe_regs = NULL;
@@ -2642,10 +2642,8 @@ FUNCTION(fun_regreplace)
     }
     *tbp = '\0';
 
-    if ((re =
-           pcre2_compile((const PCRE2_UCHAR *) remove_markup(tbuf, &searchlen),
-                         PCRE2_ZERO_TERMINATED, flags, &errcode, &erroffset,
-                         re_compile_ctx)) == NULL) {
+    if (!re_cache_get(&cre, remove_markup(tbuf, &searchlen),
+                      PCRE2_ZERO_TERMINATED, flags, &errcode)) {
       /* Matching error. */
       char errstr[120];
       pcre2_get_error_message(errcode, (PCRE2_UCHAR *) errstr, sizeof errstr);
@@ -2653,18 +2651,12 @@ FUNCTION(fun_regreplace)
       safe_str(errstr, buff, bp);
       goto exit_sequence;
     }
-    ADD_CHECK("pcre"); /* re */
+    re = cre.re;
+    md = cre.md;
     if (searchlen) {
       searchlen--;
     }
 
-    /* If we're doing a lot, jit the regexp to make it faster */
-    if (all) {
-      pcre2_jit_compile(re, PCRE2_JIT_COMPLETE);
-    }
-
-    md = pcre2_match_data_create_from_pattern(re, NULL);
-
     /* Do all the searches and replaces we can */
 
     start = prebuf;
@@ -2674,9 +2666,7 @@ FUNCTION(fun_regreplace)
     /* Match wasn't found... we're done */
     if (subpatterns < 0) {
       safe_str(prebuf, postbuf, &postp);
-      pcre2_code_free(re);
-      pcre2_match_data_free(md);
-      DEL_CHECK("pcre");
+      re_cache_put(&cre);
       continue;
     }
 
@@ -2699,9 +2689,7 @@ FUNCTION(fun_regreplace)
 
       if (process_expression(postbuf, &postp, &obp, executor, caller, enactor,
                              eflags | PE_DOLLAR, PT_DEFAULT, pe_info)) {
-        pcre2_code_free(re);
-        pcre2_match_data_free(md);
-        DEL_CHECK("pcre");
+        re_cache_put(&cre);
         goto exit_sequence;
       }
       if ((*bp == (buff + BUFFER_LEN - 1)) &&
@@ -2725,9 +2713,7 @@ FUNCTION(fun_regreplace)
     safe_str(start, postbuf, &postp);
     *postp = '\0';
 
-    pcre2_code_free(re);
-    pcre2_match_data_free(md);
-    DEL_CHECK("pcre");
+    re_cache_put(&cre);
   }
 
   /* We get to this point if there is ansi in an 'orig' string */
@@ -2748,10 +2734,8 @@ FUNCTION(fun_regreplace)
 
       *tbp = '\0';
 
-      if ((re = pcre2_compile(
-             (const PCRE2_UCHAR *) remove_markup(tbuf, &searchlen),
-             PCRE2_ZERO_TERMINATED, flags, &errcode, &erroffset,
-             re_compile_ctx)) == NULL) {
+      if (!re_cache_get(&cre, remove_markup(tbuf, &searchlen),
+                        PCRE2_ZERO_TERMINATED, flags, &errcode)) {
         /* Matching error. */
         char errstr[120];
         pcre2_get_error_message(errcode, (PCRE2_UCHAR *) errstr, sizeof errstr);
@@ -2759,16 +2743,12 @@ FUNCTION(fun_regreplace)
         safe_str(errstr, buff, bp);
         goto exit_sequence;
       }
-      ADD_CHECK("pcre"); /* re */
+      re = cre.re;
+      md = cre.md;
       if (searchlen) {
         searchlen--;
       }
 
-      if (all) {
-        pcre2_jit_compile(re, PCRE2_JIT_COMPLETE);
-      }
-      md = pcre2_match_data_create_from_pattern(re, NULL);
-
       search = 0;
       /* Do all the searches and replaces we can */
       do {
@@ -2784,9 +2764,7 @@ FUNCTION(fun_regreplace)
           tbp = tbuf;
           if (process_expression(tbuf, &tbp, &r, executor, caller, enactor,
                                  eflags | PE_DOLLAR, PT_DEFAULT, pe_info)) {
-            pcre2_code_free(re);
-            pcre2_match_data_free(md);
-            DEL_CHECK("pcre");
+            re_cache_put(&cre);
             goto exit_sequence;
           }
           *tbp = '\0';
@@ -2816,9 +2794,7 @@ FUNCTION(fun_regreplace)
           }
         }
       } while (subpatterns >= 0 && !cpu_time_limit_hit && all);
-      pcre2_code_free(re);
-      pcre2_match_data_free(md);
-      DEL_CHECK("pcre");
+      re_cache_put(&cre);
     }
     safe_ansi_string(orig, 0, orig->len, buff, bp);
     free_ansi_string(orig);
@@ -2848,10 +2824,10 @@ FUNCTION(fun_regmatch)
    */
   int i, nqregs;
   char *qregs[NUMQ], *holder[NUMQ];
+  struct cached_regexp cre;
   pcre2_code *re;
   pcre2_match_data *md;
   int errcode;
-  PCRE2_SIZE erroffset;
   const char *errptr = NULL;
   int subpatterns;
   char lbuff[BUFFER_LEN], *lbp;
@@ -2881,8 +2857,8 @@ FUNCTION(fun_regmatch)
     return;
   }
 
-  if ((re = pcre2_compile(needle, PCRE2_ZERO_TERMINATED, flags, &errcode,
-                          &erroffset, re_compile_ctx)) == NULL) {
+  if (!re_cache_get(&cre, (const char *) needle, PCRE2_ZERO_TERMINATED, flags,
+                    &errcode)) {
     char errstr[120];
     /* Matching error. */
     pcre2_get_error_message(errcode, (PCRE2_UCHAR *) errstr, sizeof errstr);
@@ -2891,8 +2867,8 @@ FUNCTION(fun_regmatch)
     free_ansi_string(as);
     return;
   }
-  ADD_CHECK("pcre");
-  md = pcre2_match_data_create_from_pattern(re, NULL);
+  re = cre.re;
+  md = cre.md;
 
   subpatterns =
     pcre2_match(re, txt, as->len, 0, re_match_flags, md, re_match_ctx);
@@ -2963,9 +2939,7 @@ FUNCTION(fun_regmatch)
   for (i = 0; i < nqregs; i++) {
     mush_free(holder[i], "regmatch");
   }
-  pcre2_code_free(re);
-  pcre2_match_data_free(md);
-  DEL_CHECK("pcre");
+  re_cache_put(&cre);
   free_ansi_string(as);
 }
 
@@ -2976,10 +2950,8 @@ FUNCTION(fun_regrab)
 {
   char *r, *s, *b, sep;
   size_t rlen;
-  pcre2_code *re;
-  pcre2_match_data *md;
+  struct cached_regexp cre;
   int errcode;
-  PCRE2_SIZE erroffset;
   int flags = re_compile_flags;
   char *osep, osepd[2] = {'\0', '\0'};
   char **ptrs;
@@ -3012,9 +2984,8 @@ FUNCTION(fun_regrab)
     pos = 1;
   }
 
-  if ((re = pcre2_compile((const PCRE2_UCHAR *) remove_markup(args[1], NULL),
-                          PCRE2_ZERO_TERMINATED, flags, &errcode, &erroffset,
-                          re_compile_ctx)) == NULL) {
+  if (!re_cache_get(&cre, remove_markup(args[1], NULL), PCRE2_ZERO_TERMINATED,
+                    flags, &errcode)) {
     /* Matching error. */
     char errstr[120];
     pcre2_get_error_message(errcode, (PCRE2_UCHAR *) errstr, sizeof errstr);
@@ -3022,8 +2993,6 @@ FUNCTION(fun_regrab)
     safe_str(errstr, buff, bp);
     return;
   }
-  ADD_CHECK("pcre");
-  md = pcre2_match_data_create_from_pattern(re, NULL);
 
   ptrs = mush_calloc(MAX_SORTSIZE, sizeof(char *), "ptrarray");
   if (!ptrs) {
@@ -3032,8 +3001,8 @@ FUNCTION(fun_regrab)
   nptrs = list2arr_ansi(ptrs, MAX_SORTSIZE, s, sep, 1);
   for (i = 0; i < nptrs && !cpu_time_limit_hit; i++) {
     r = remove_markup(ptrs[i], &rlen);
-    if (pcre2_match(re, (const PCRE2_UCHAR *) r, rlen - 1, 0, re_match_flags,
-                    md, re_match_ctx) >= 0) {
+    if (pcre2_match(cre.re, (const PCRE2_UCHAR *) r, rlen - 1, 0,
+                    re_match_flags, cre.md, re_match_ctx) >= 0) {
       if (all && *bp != b) {
         safe_str(osep, buff, bp);
       }
@@ -3050,21 +3019,16 @@ FUNCTION(fun_regrab)
   freearr(ptrs, nptrs);
   mush_free(ptrs, "ptrarray");
 
-  pcre2_code_free(re);
-  pcre2_match_data_free(md);
-  DEL_CHECK("pcre");
+  re_cache_put(&cre);
 }
 
 FUNCTION(fun_isregexp)
 {
-  pcre2_code *re;
+  struct cached_regexp cre;
   int errcode;
-  PCRE2_SIZE erroffset;
 
-  if (!!(re = pcre2_compile((const PCRE2_UCHAR *) args[0], arglens[0],
-                            re_compile_flags, &errcode, &erroffset,
-                            re_compile_ctx))) {
-    pcre2_code_free(re);
+  if (re_cache_get(&cre, args[0], arglens[0], re_compile_flags, &errcode)) {
+    re_cache_put(&cre);
     safe_chr('1', buff, bp);
     return;
   }
@@ -2409,8 +2409,12 @@ FUNCTION(fun_render)
 
   if (!flags)
     safe_str(remove_markup(args[0], NULL), buff, bp);
-  else
-    safe_str(render_string(args[0], flags), buff, bp);
+  else {
+    char rbuff[BUFFER_LEN];
+    size_t len = render_string(args[0], flags, rbuff);
+
+    safe_strl(rbuff, len, buff, bp);
+  }
 }
 
 FUNCTION(fun_urlencode)
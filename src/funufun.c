@@ -22,6 +22,7 @@
 #include "mymalloc.h"
 #include "notify.h"
 #include "parse.h"
+#include "profile.h"
 #include "strutil.h"
 
 /* ARGSUSED */
@@ -173,6 +174,7 @@ do_userfn(char *buff, char **bp, dbref obj, ATTR *attrib, int nargs,
   char const *tp;
   int pe_flags = PE_DEFAULT | extra_flags;
   PE_REGS *pe_regs;
+  int prof;
 
   if (nargs > MAX_STACK_ARGS)
     nargs = MAX_STACK_ARGS; /* maximum no of args */
@@ -195,8 +197,10 @@ do_userfn(char *buff, char **bp, dbref obj, ATTR *attrib, int nargs,
   else if (AF_Debug(attrib))
     pe_flags |= PE_DEBUG;
 
+  prof = PROFILE_ENTER(PROFILE_ATTRIBUTE, obj, AL_NAME(attrib));
   process_expression(buff, bp, &tp, obj, executor, enactor, pe_flags,
                      PT_DEFAULT, pe_info);
+  PROFILE_LEAVE(prof);
 
   mush_free(tbuf, "atrval.do_userfn");
 
@@ -60,9 +60,11 @@ void Win32MUSH_setup(void);
 #include "mushdb.h"
 #include "mymalloc.h"
 #include "mypcre.h"
+#include "odbc.h"
 #include "parse.h"
 #include "ptab.h"
 #include "sig.h"
+#include "snapshot.h"
 #include "strtree.h"
 #include "strutil.h"
 #include "version.h"
@@ -97,9 +99,11 @@ static void errdb_grow(void);
 
 extern const unsigned char *tables;
 extern void conf_default_set(void);
-static bool dump_database_internal(void);
+static bool dump_database_internal(bool objects, bool snapshot);
 static PENNFILE *db_open(const char *);
 static PENNFILE *db_open_write(const char *);
+static void db_close_write(PENNFILE *volatile *fp, const char *tmpfl,
+                           const char *dumpfile);
 static int fail_commands(dbref player);
 void do_readcache(dbref player);
 int check_alias(const char *command, const char *list);
@@ -138,6 +142,7 @@ char report_cmd[BUFFER_LEN];
 dbref report_dbref = NOTHING;
 
 pid_t forked_dump_pid = -1;
+pid_t snapshot_dump_pid = -1; /**< Forked dump writing a new snapshot */
 
 /** Open /dev/null to reserve a file descriptor that can be reused later. */
 void
@@ -302,8 +307,13 @@ do_shutdown(dbref player, enum shutdown_type flag)
 
 jmp_buf db_err;
 
+/** Save the databases.
+ * \param objects save the objects to the main database file.
+ * \param snapshot write the snapshot snapshot_checkpoint() asked for.
+ * \return true if everything was saved.
+ */
 static bool
-dump_database_internal(void)
+dump_database_internal(bool objects, bool snapshot)
 {
   PENNFILE *volatile f = NULL;
 
@@ -338,6 +348,9 @@ dump_database_internal(void)
       }
 #endif
       break;
+      case PFT_ASYNC:
+        errmsg = strerror(errno);
+        break;
       }
     } else {
       errmsg = strerror(errno);
@@ -366,6 +379,7 @@ dump_database_internal(void)
     char realtmpfl[2304];
     char tmpfl[2048];
 
+    dump_writer_begin();
     local_dump_database();
 
 #ifdef ALWAYS_PARANOID
@@ -375,36 +389,39 @@ dump_database_internal(void)
     }
 #endif
 
-    snprintf(realdumpfile, sizeof realdumpfile, "%s%s", globals.dumpfile,
-             options.compresssuff);
-    mush_strncpy(tmpfl, make_new_epoch_file(globals.dumpfile, epoch),
-                 sizeof tmpfl);
-    snprintf(realtmpfl, sizeof realtmpfl, "%s%s", tmpfl, options.compresssuff);
+    /* When the snapshot's journal holds the objects, there's no need to
+     * write them all out again. */
+    if (objects) {
+      snprintf(realdumpfile, sizeof realdumpfile, "%s%s", globals.dumpfile,
+               options.compresssuff);
+      mush_strncpy(tmpfl, make_new_epoch_file(globals.dumpfile, epoch),
+                   sizeof tmpfl);
+      snprintf(realtmpfl, sizeof realtmpfl, "%s%s", tmpfl,
+               options.compresssuff);
 
-    if ((f = db_open_write(tmpfl)) != NULL) {
-      switch (globals.paranoid_dump) {
-      case 0:
+      if ((f = db_open_write(tmpfl)) != NULL) {
+        switch (globals.paranoid_dump) {
+        case 0:
 #ifdef ALWAYS_PARANOID
-        db_paranoid_write(f, 0);
+          db_paranoid_write(f, 0);
 #else
-        db_write(f, 0);
+          db_write(f, 0);
 #endif
-        break;
-      case 1:
-        db_paranoid_write(f, 0);
-        break;
-      case 2:
-        db_paranoid_write(f, 1);
-        break;
-      }
-      penn_fclose(f);
-      if (rename_file(realtmpfl, realdumpfile) < 0) {
+          break;
+        case 1:
+          db_paranoid_write(f, 0);
+          break;
+        case 2:
+          db_paranoid_write(f, 1);
+          break;
+        }
+        db_close_write(&f, realtmpfl, realdumpfile);
+      } else {
         penn_perror(realtmpfl);
         longjmp(db_err, 1);
       }
-    } else {
-      penn_perror(realtmpfl);
-      longjmp(db_err, 1);
+      if (snapshot && !snapshot_write(options.snapshot_db))
+        longjmp(db_err, 1);
     }
     snprintf(realdumpfile, sizeof realdumpfile, "%s%s", options.mail_db,
              options.compresssuff);
@@ -413,11 +430,7 @@ dump_database_internal(void)
     if (mdb_top >= 0) {
       if ((f = db_open_write(tmpfl)) != NULL) {
         dump_mail(f);
-        penn_fclose(f);
-        if (rename_file(realtmpfl, realdumpfile) < 0) {
-          penn_perror(realtmpfl);
-          longjmp(db_err, 1);
-        }
+        db_close_write(&f, realtmpfl, realdumpfile);
       } else {
         penn_perror(realtmpfl);
         longjmp(db_err, 1);
@@ -429,11 +442,7 @@ dump_database_internal(void)
     snprintf(realtmpfl, sizeof realtmpfl, "%s%s", tmpfl, options.compresssuff);
     if ((f = db_open_write(tmpfl)) != NULL) {
       save_chatdb(f);
-      penn_fclose(f);
-      if (rename_file(realtmpfl, realdumpfile) < 0) {
-        penn_perror(realtmpfl);
-        longjmp(db_err, 1);
-      }
+      db_close_write(&f, realtmpfl, realdumpfile);
     } else {
       penn_perror(realtmpfl);
       longjmp(db_err, 1);
@@ -532,6 +541,16 @@ mush_panicf(const char *msg, ...)
   _exit(136); /* Not reached but kills warnings */
 }
 
+/** Should dumps keep the snapshot up to date? Objects are loaded from
+ * ODBC in preference to it whenever ODBC holds any, so it isn't written
+ * then.
+ */
+static bool
+snapshot_wanted(void)
+{
+  return *options.snapshot_db && ODBC_MUSH_CountObjects() <= 0;
+}
+
 /** Dump the database.
  * This function is a wrapper for dump_database_internal() that does
  * a little logging before and after the dump.
@@ -539,10 +558,22 @@ mush_panicf(const char *msg, ...)
 void
 dump_database(void)
 {
+  bool snapshot, journaled, status;
+  struct timeval start;
+
   epoch++;
 
+  penn_gettimeofday(&start);
   do_rawlog_lvl(LT_ERR, MLOG_INFO, "DUMPING: %s.#%d#", globals.dumpfile, epoch);
-  if (dump_database_internal()) {
+  snapshot = snapshot_wanted();
+  journaled = snapshot && snapshot_checkpoint(options.snapshot_db);
+  status = dump_database_internal(!journaled || globals.paranoid_dump,
+                                  snapshot && !journaled);
+  status = dump_writer_wait() && status;
+  if (snapshot && !journaled)
+    snapshot_compacted(status);
+  dump_writer_stall(&start);
+  if (status) {
     do_rawlog_lvl(LT_ERR, MLOG_INFO, "DUMPING: %s.#%d# (done)",
                   globals.dumpfile, epoch);
   }
@@ -561,12 +592,14 @@ bool
 fork_and_dump(int forking)
 {
   pid_t child;
-  bool nofork, status = true;
+  bool nofork, status = true, snapshot, journaled = false;
+  struct timeval start;
 #ifndef WIN32
   bool split = false;
 #endif
 
   epoch++;
+  penn_gettimeofday(&start);
 
 #ifdef LOG_CHUNK_STATS
   chunk_stats(NOTHING, 0);
@@ -574,6 +607,20 @@ fork_and_dump(int forking)
 #endif
   do_rawlog_lvl(LT_CHECK, MLOG_INFO, "CHECKPOINTING: %s.#%d#", globals.dumpfile,
                 epoch);
+  snapshot = snapshot_wanted();
+  if (snapshot)
+    journaled = snapshot_checkpoint(options.snapshot_db);
+  if (journaled && !globals.paranoid_dump) {
+    /* The objects are in the journal, and mail and chat are quick to
+     * write, so there's nothing worth forking for. */
+    status = dump_database_internal(false, false);
+    if (!forking)
+      status = dump_writer_wait() && status;
+    dump_writer_stall(&start);
+    if (status)
+      queue_event(SYSEVENT, "DUMP`COMPLETE", "%s,%d", DUMP_NOFORK_COMPLETE, 0);
+    return status;
+  }
   if (NO_FORK)
     nofork = 1;
   else
@@ -602,6 +649,9 @@ fork_and_dump(int forking)
   }
   if (!nofork) {
 #ifndef WIN32
+    /* Writer threads from an earlier nofork dump mustn't be running
+     * when the process is cloned. */
+    dump_writer_wait();
 #ifdef HAVE_FORK
     child = fork();
 #else
@@ -623,6 +673,8 @@ fork_and_dump(int forking)
       }
     } else if (child > 0) {
       forked_dump_pid = child;
+      if (snapshot && !journaled)
+        snapshot_dump_pid = child;
       lower_priority_by(child, 8);
       chunk_fork_parent();
     } else {
@@ -637,7 +689,12 @@ fork_and_dump(int forking)
   if (nofork || (!nofork && child == 0)) {
     /* in the child */
     release_fd();
-    status = dump_database_internal();
+    status = dump_database_internal(true, snapshot && !journaled);
+    /* A forked child, or a dump we were asked not to fork (@shutdown/reboot),
+     * must have its files on disk before going on. Otherwise the writer
+     * threads finish in the background and dump_writer_poll() reaps them. */
+    if (!nofork || !forking)
+      status = dump_writer_wait() && status;
 #ifndef WIN32
     if (split)
       chunk_fork_done();
@@ -647,6 +704,8 @@ fork_and_dump(int forking)
                                 should be 0 on success */
     } else {
       reserve_fd();
+      if (snapshot && !journaled)
+        snapshot_compacted(status);
       if (status) {
         queue_event(SYSEVENT, "DUMP`COMPLETE", "%s,%d", DUMP_NOFORK_COMPLETE,
                     0);
@@ -656,6 +715,7 @@ fork_and_dump(int forking)
       }
     }
   }
+  dump_writer_stall(&start);
 #ifdef LOG_CHUNK_STATS
   chunk_stats(NOTHING, 5);
 #endif
@@ -851,6 +911,27 @@ init_game_dbs(void)
   fcache_init();
   
 
+  panicdb = 0;
+  if (*options.snapshot_db && access(options.snapshot_db, R_OK) == 0) {
+    /* Objects are written to ODBC as they change, so when it holds any
+     * they're never older than the snapshot's, and db_read() loads them
+     * from there. The snapshot is only for games without ODBC, and
+     * snapshot_wanted() stops dumps writing it otherwise. */
+    ODBC_Init();
+    if (ODBC_MUSH_CountObjects() > 0) {
+      do_rawlog(LT_ERR, "LOADING: ODBC holds the database. Not using %s.",
+                options.snapshot_db);
+    } else {
+      do_rawlog(LT_ERR, "LOADING: %s", options.snapshot_db);
+      if (snapshot_read(options.snapshot_db) >= 0) {
+        do_rawlog(LT_ERR, "LOADING: %s (done)", options.snapshot_db);
+        goto db_loaded;
+      }
+      do_rawlog(LT_ERR, "LOADING: %s failed. Trying %s instead.",
+                options.snapshot_db, infile);
+    }
+  }
+
   if (setjmp(db_err) == 1) {
     do_rawlog(LT_ERR, "Couldn't open %s! Creating minimal world.", infile);
     if (f) {
@@ -922,26 +1003,27 @@ init_game_dbs(void)
     if (!panicdb) {
       penn_fclose(f);
     }
+  }
 
-    /* complain about bad config options */
-    if (!GoodObject(PLAYER_START) || (!IsRoom(PLAYER_START))) {
-      do_rawlog(LT_ERR, "WARNING: Player_start (#%d) is NOT a room.",
-                PLAYER_START);
-    }
-    if (!GoodObject(MASTER_ROOM) || (!IsRoom(MASTER_ROOM))) {
-      do_rawlog(LT_ERR, "WARNING: Master room (#%d) is NOT a room.",
-                MASTER_ROOM);
-    }
-    if (!GoodObject(BASE_ROOM) || (!IsRoom(BASE_ROOM))) {
-      do_rawlog(LT_ERR, "WARNING: Base room (#%d) is NOT a room.", BASE_ROOM);
-    }
-    if (!GoodObject(DEFAULT_HOME) || (!IsRoom(DEFAULT_HOME))) {
-      do_rawlog(LT_ERR, "WARNING: Default home (#%d) is NOT a room.",
-                DEFAULT_HOME);
-    }
-    if (!GoodObject(GOD) || (!IsPlayer(GOD))) {
-      do_rawlog(LT_ERR, "WARNING: God (#%d) is NOT a player.", GOD);
-    }
+db_loaded:
+  /* complain about bad config options */
+  if (!GoodObject(PLAYER_START) || (!IsRoom(PLAYER_START))) {
+    do_rawlog(LT_ERR, "WARNING: Player_start (#%d) is NOT a room.",
+              PLAYER_START);
+  }
+  if (!GoodObject(MASTER_ROOM) || (!IsRoom(MASTER_ROOM))) {
+    do_rawlog(LT_ERR, "WARNING: Master room (#%d) is NOT a room.",
+              MASTER_ROOM);
+  }
+  if (!GoodObject(BASE_ROOM) || (!IsRoom(BASE_ROOM))) {
+    do_rawlog(LT_ERR, "WARNING: Base room (#%d) is NOT a room.", BASE_ROOM);
+  }
+  if (!GoodObject(DEFAULT_HOME) || (!IsRoom(DEFAULT_HOME))) {
+    do_rawlog(LT_ERR, "WARNING: Default home (#%d) is NOT a room.",
+              DEFAULT_HOME);
+  }
+  if (!GoodObject(GOD) || (!IsPlayer(GOD))) {
+    do_rawlog(LT_ERR, "WARNING: God (#%d) is NOT a player.", GOD);
   }
 
   /* read mail database */
@@ -1618,7 +1700,7 @@ Listener(dbref thing)
   /* If a monitor flag is set on a room or thing, it's a listener.
    * Otherwise not (even if ^patterns are present)
    */
-  return has_flag_by_name(thing, "MONITOR", NOTYPE);
+  return HasCoreFlag(thing, FH_MONITOR, NOTYPE);
 }
 
 /** Reset all players' money.
@@ -2371,6 +2453,7 @@ do_uptime(dbref player, int mortal)
     strftime(tbuf1, sizeof tbuf1, "%a %b %d %X %Z %Y", when);
     notify_format(player, "%29s: %s", T("Time of last database save"), tbuf1);
   }
+  dump_writer_report(player);
 
   /* calculate times until various events */
   when = localtime(&options.dump_counter);
@@ -2547,61 +2630,31 @@ db_open_write(const char *fname)
             errno, strerror(errno));
   }
 
-  pf = mush_malloc(sizeof *pf, "pennfile");
+  /* Compression, if any, is done in the background */
+  pf = dump_writer_open(filename);
+  sqlite3_free(filename);
+  if (!pf)
+    longjmp(db_err, 1);
+  return pf;
+}
 
-#ifdef HAVE_LIBZ
-  if (*options.compressprog && strcmp(options.compressprog, "gzip") == 0) {
-    pf->type = PFT_GZFILE;
-    pf->handle.g = gzopen(filename, "wb");
-    if (!pf->handle.g) {
-      do_rawlog(LT_ERR, "Unable to open %s with libz: %s\n", filename,
-                strerror(errno));
-      sqlite3_free(filename);
-      mush_free(pf, "pennfile");
-      longjmp(db_err, 1);
-    }
-#ifdef HAVE_GZBUFFER
-    gzbuffer(pf->handle.g, 1024 * 64);
-#endif
-    sqlite3_free(filename);
-    return pf;
-  }
-#endif
+/* Finish writing a db file, and move it into place once it's all written.
+ * *fp is cleared first, so a failure here doesn't close it twice. */
+static void
+db_close_write(PENNFILE *volatile *fp, const char *tmpfl, const char *dumpfile)
+{
+  PENNFILE *pf = *fp;
 
-#ifndef WIN32
-  if (*options.compressprog) {
-    char *prog;
-    pf->type = PFT_PIPE;
-    fstr = sqlite3_str_new(NULL);
-    sqlite3_str_appendf(fstr, "%s > '%s'", options.compressprog, filename);
-    prog = sqlite3_str_finish(fstr);
-    pf->handle.f = popen(prog, "w");
-    sqlite3_free(prog);
-    /* Force the pipe to be fully buffered */
-    if (pf->handle.f) {
-      setvbuf(pf->handle.f, NULL, _IOFBF, 1024 * 32);
-    } else {
-      do_rawlog(LT_ERR, "Unable to run '%s > %s': %s", options.compressprog,
-                filename, strerror(errno));
-    }
-    sqlite3_free(filename);
-  } else
-#endif /* WIN32 */
-  {
-    pf->type = PFT_FILE;
-    pf->handle.f = fopen(filename, "wb");
-    if (!pf->handle.f) {
-      do_rawlog(LT_ERR, "Unable to open %s: %s\n", filename, strerror(errno));
-    }
-    sqlite3_free(filename);
+  *fp = NULL;
+  if (pf->type == PFT_ASYNC) {
+    dump_writer_close(pf, dumpfile);
+    return;
   }
-  if (!pf->handle.f) {
-    mush_free(pf, "pennfile");
+  penn_fclose(pf);
+  if (rename_file(tmpfl, dumpfile) < 0) {
+    penn_perror(tmpfl);
     longjmp(db_err, 1);
-  } else {
-    setvbuf(pf->handle.f, NULL, _IOFBF, 1024 * 32);
   }
-  return pf;
 }
 
 extern HASHTAB htab_function;
@@ -2717,6 +2770,9 @@ do_list_memstats(dbref player)
   im_stats(player, watchtable, "Inotify");
 #endif
 
+  notify(player, "Output Queues:");
+  notify_output_stats(player);
+
   notify(player, "Sqlite3 Databases:");
   sqlmem = sqlite3_memory_used();
   notify_format(player, " Using %ld megabytes and %ld kilobytes of memory.",
@@ -47,6 +47,7 @@
 #include "notify.h"
 #include "parse.h"
 #include "privtab.h"
+#include "snapshot.h"
 #include "strtree.h"
 #include "strutil.h"
 
@@ -452,6 +453,7 @@ add_lock(dbref player, dbref thing, lock_type type, boolexp key, privbits flags)
     ll->creator = player;
     if (flags != LF_DEFAULT)
       ll->flags = flags;
+    snapshot_touch(thing);
   } else {
     ll = next_free_lock(Locks(thing));
     if (!ll) {
@@ -481,6 +483,7 @@ add_lock(dbref player, dbref thing, lock_type type, boolexp key, privbits flags)
         t = &L_NEXT(*t);
       L_NEXT(ll) = *t;
       *t = ll;
+      snapshot_touch(thing);
     }
   }
   return 1;
@@ -535,6 +538,7 @@ add_lock_raw(dbref player, dbref thing, lock_type type, boolexp key,
       t = &L_NEXT(*t);
     L_NEXT(ll) = *t;
     *t = ll;
+    snapshot_touch(thing);
   }
   return 1;
 }
@@ -572,6 +576,7 @@ delete_lock(dbref player, dbref thing, lock_type type)
       ll = *llp;
       *llp = ll->next;
       free_one_lock_list(ll);
+      snapshot_touch(thing);
       return 1;
     } else
       return 0;
@@ -944,6 +949,7 @@ do_lset(dbref player, char *what, char *flags)
     L_FLAGS(l) &= ~flag;
   else
     L_FLAGS(l) |= flag;
+  snapshot_touch(thing);
 
   if (!Quiet(player) && !(Quiet(thing) && (Owner(thing) == player)))
     notify_format(player, "%s/%s - %s.", AName(thing, AN_SYS, NULL), L_TYPE(l),
@@ -996,7 +1002,13 @@ purge_locks(void)
 
   for (thing = 0; thing < db_top; thing++) {
     lock_list *ll;
-    for (ll = Locks(thing); ll; ll = L_NEXT(ll))
-      L_KEY(ll) = cleanup_boolexp(L_KEY(ll));
+    boolexp key;
+    for (ll = Locks(thing); ll; ll = L_NEXT(ll)) {
+      key = cleanup_boolexp(L_KEY(ll));
+      if (key != L_KEY(ll)) {
+        L_KEY(ll) = key;
+        snapshot_touch(thing);
+      }
+    }
   }
 }
@@ -0,0 +1,638 @@
+/**
+ * \file mccp.c
+ *
+ * \brief MUD Client Compression Protocol (MCCP2 and MCCP3) support.
+ *
+ * With MCCP2, everything the server sends after IAC SB MCCP2 IAC SE is a
+ * zlib stream; with MCCP3, so is everything the client sends after it
+ * sends the same. bsd.c does the telnet negotiation. Output is queued as
+ * usual, and compressed a batch at a time by process_output(), ending
+ * with a sync flush, into a queue of its own that's sent before anything
+ * else. That keeps the usual output limit and flushing working on text,
+ * and only compresses more as the socket takes it.
+ *
+ * WebSocket connections that negotiate permessage-deflate (RFC 7692)
+ * get a raw deflate stream for each direction instead. Those work a
+ * message at a time: websock.c frames each compressed message itself,
+ * and the streams keep their window between messages, so repeated text
+ * compresses to almost nothing.
+ *
+ * All the zlib state is counted, and new streams are refused when it
+ * would go over mccp_memory.
+ */
+
+#include "copyrite.h"
+
+#include <stdlib.h>
+#include <string.h>
+#ifdef HAVE_LIBZ
+#include <zlib.h>
+#endif
+
+#include "conf.h"
+#include "externs.h"
+#include "log.h"
+#include "mccp.h"
+#include "mymalloc.h"
+#include "strutil.h"
+#include "tests.h"
+
+void free_text_block(struct text_block *t);
+void init_text_queue(struct text_queue *q);
+void add_to_queue(struct text_queue *q, const char *b, int n);
+
+/* Output uses a smaller window than zlib's default; it costs a little
+ * compression on MUD output but saves most of the memory. Clients can
+ * use any window size for input, so it's inflated with the biggest. */
+#define MCCP_WINDOW_BITS 13
+#define MCCP_MEM_LEVEL 7
+/** Approximate zlib state for a stream, per zconf.h. That's about 102K
+ * for output: the window and hash chains take 32K, the hash table and
+ * pending buffer 64K, and the rest is the stream state itself. */
+#define MCCP_DEFLATE_COST                                                      \
+  ((1 << (MCCP_WINDOW_BITS + 2)) + (1 << (MCCP_MEM_LEVEL + 9)) + 6144)
+#define MCCP_INFLATE_COST ((1 << 15) + 7168)
+
+static size_t mccp_memory = 0; /**< Bytes of zlib state in use */
+
+#ifdef HAVE_LIBZ
+/** Header of a zlib allocation, so it can be counted when freed */
+union mccp_alloc {
+  size_t len;
+  void *align_p;
+  double align_d;
+};
+
+static voidpf
+mccp_zalloc(voidpf opaque __attribute__((__unused__)), uInt items, uInt size)
+{
+  union mccp_alloc *a;
+  size_t len = (size_t) items * size;
+
+  a = mush_malloc(sizeof *a + len, "mccp.zlib");
+  if (!a)
+    return Z_NULL;
+  a->len = len;
+  mccp_memory += len;
+  return a + 1;
+}
+
+static void
+mccp_zfree(voidpf opaque __attribute__((__unused__)), voidpf p)
+{
+  union mccp_alloc *a = (union mccp_alloc *) p - 1;
+
+  mccp_memory -= a->len;
+  mush_free(a, "mccp.zlib");
+}
+
+static struct mccp *
+mccp_get(DESC *d)
+{
+  if (!d->mccp) {
+    d->mccp = mush_calloc(1, sizeof(struct mccp), "mccp");
+    init_text_queue(&d->mccp->wire);
+  }
+  return d->mccp;
+}
+
+static z_stream *
+mccp_new_stream(void)
+{
+  z_stream *z = mush_calloc(1, sizeof *z, "mccp.stream");
+
+  z->zalloc = mccp_zalloc;
+  z->zfree = mccp_zfree;
+  z->opaque = Z_NULL;
+  return z;
+}
+
+/** Add compressed data to the wire queue */
+static void
+mccp_add(struct mccp *m, const unsigned char *buff, int len)
+{
+  if (len <= 0)
+    return;
+  add_to_queue(&m->wire, (const char *) buff, len);
+  m->wire_size += len;
+  m->zip_out += len;
+}
+
+/** Run the output stream until it's done with its input. */
+static void
+mccp_deflate(struct mccp *m, int flush)
+{
+  static unsigned char buff[16384];
+
+  do {
+    m->out->next_out = buff;
+    m->out->avail_out = sizeof buff;
+    if (deflate(m->out, flush) == Z_STREAM_ERROR)
+      break;
+    mccp_add(m, buff, sizeof buff - m->out->avail_out);
+  } while (m->out->avail_out == 0);
+}
+#endif
+
+/** Is there room for another compressed stream?
+ * \param output true for an MCCP2 output stream, false for MCCP3 input.
+ * \return true if one can be started.
+ */
+bool
+mccp_room(bool output)
+{
+#ifdef HAVE_LIBZ
+  if (MCCP_MEMORY <= 0)
+    return 0;
+  return mccp_memory + (output ? MCCP_DEFLATE_COST : MCCP_INFLATE_COST) <=
+         (size_t) MCCP_MEMORY;
+#else
+  (void) output;
+  return 0;
+#endif
+}
+
+/** Start compressing a connection's output. Anything already queued is
+ * sent as it is, so the IAC SB MCCP2 IAC SE that starts it should be
+ * queued first.
+ * \param d the connection.
+ * \return true if it was started.
+ */
+bool
+mccp_start_output(DESC *d)
+{
+#ifdef HAVE_LIBZ
+  struct mccp *m;
+  struct text_block *cur;
+
+  if (d->mccp && d->mccp->out)
+    return 1;
+  m = mccp_get(d);
+  m->out = mccp_new_stream();
+  if (deflateInit2(m->out, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                   MCCP_WINDOW_BITS, MCCP_MEM_LEVEL,
+                   Z_DEFAULT_STRATEGY) != Z_OK) {
+    mush_free(m->out, "mccp.stream");
+    m->out = NULL;
+    return 0;
+  }
+  /* What's already queued goes out uncompressed, ahead of the stream */
+  while ((cur = d->output.head)) {
+    d->output.head = cur->nxt;
+    cur->nxt = NULL;
+    if (m->wire.tail)
+      m->wire.tail->nxt = cur;
+    else
+      m->wire.head = cur;
+    m->wire.tail = cur;
+    m->wire_size += cur->nchars;
+    d->output_size -= cur->nchars;
+  }
+  d->output.tail = NULL;
+  return 1;
+#else
+  (void) d;
+  return 0;
+#endif
+}
+
+/** Stop compressing a connection's output. The stream is finished, so
+ * the client goes back to reading plain text after it.
+ * \param d the connection.
+ */
+void
+mccp_end_output(DESC *d)
+{
+#ifdef HAVE_LIBZ
+  struct mccp *m = d->mccp;
+
+  if (!m || !m->out)
+    return;
+  mccp_compress(d);
+  m->out->next_in = Z_NULL;
+  m->out->avail_in = 0;
+  mccp_deflate(m, Z_FINISH);
+  deflateEnd(m->out);
+  mush_free(m->out, "mccp.stream");
+  m->out = NULL;
+#else
+  (void) d;
+#endif
+}
+
+/** Start decompressing a connection's input.
+ * \param d the connection.
+ * \return true if it was started.
+ */
+bool
+mccp_start_input(DESC *d)
+{
+#ifdef HAVE_LIBZ
+  struct mccp *m;
+
+  if (d->mccp && d->mccp->in)
+    return 1;
+  m = mccp_get(d);
+  m->in = mccp_new_stream();
+  if (inflateInit(m->in) != Z_OK) {
+    mush_free(m->in, "mccp.stream");
+    m->in = NULL;
+    return 0;
+  }
+  return 1;
+#else
+  (void) d;
+  return 0;
+#endif
+}
+
+/** Free a connection's compression state, without finishing anything.
+ * \param d the connection.
+ */
+void
+mccp_free(DESC *d)
+{
+  struct mccp *m = d->mccp;
+  struct text_block *cur;
+
+  if (!m)
+    return;
+#ifdef HAVE_LIBZ
+  if (m->out) {
+    deflateEnd(m->out);
+    mush_free(m->out, "mccp.stream");
+  }
+  if (m->in) {
+    inflateEnd(m->in);
+    mush_free(m->in, "mccp.stream");
+  }
+  if (m->ws_out) {
+    deflateEnd(m->ws_out);
+    mush_free(m->ws_out, "mccp.stream");
+  }
+  if (m->ws_in) {
+    inflateEnd(m->ws_in);
+    mush_free(m->ws_in, "mccp.stream");
+  }
+#endif
+  while ((cur = m->wire.head)) {
+    m->wire.head = cur->nxt;
+    free_text_block(cur);
+  }
+  mush_free(m, "mccp");
+  d->mccp = NULL;
+}
+
+/** Compress everything in a connection's output queue onto the wire
+ * queue, and flush the stream so the client can show all of it.
+ * \param d the connection.
+ */
+void
+mccp_compress(DESC *d)
+{
+#ifdef HAVE_LIBZ
+  struct mccp *m = d->mccp;
+  struct text_block *cur;
+
+  if (!m || !m->out || !d->output.head)
+    return;
+  while ((cur = d->output.head)) {
+    m->out->next_in = (Bytef *) cur->start;
+    m->out->avail_in = cur->nchars;
+    mccp_deflate(m, cur->nxt ? Z_NO_FLUSH : Z_SYNC_FLUSH);
+    m->raw_out += cur->nchars;
+    d->output_size -= cur->nchars;
+    d->output.head = cur->nxt;
+    free_text_block(cur);
+  }
+  d->output.tail = NULL;
+#else
+  (void) d;
+#endif
+}
+
+/** Decompress some of a connection's input. When the client ends the
+ * stream, decompression stops, and the rest of the input is plain.
+ * \param d the connection.
+ * \param in pointer to the compressed input, advanced past what's used.
+ * \param inlen pointer to its length, reduced by what's used.
+ * \param out where to put the decompressed input.
+ * \param outlen the size of out.
+ * \return the number of bytes decompressed, or -1 on error.
+ */
+int
+mccp_inflate(DESC *d, const char **in, int *inlen, char *out, int outlen)
+{
+#ifdef HAVE_LIBZ
+  struct mccp *m = d->mccp;
+  int r, used, got;
+
+  if (!m || !m->in)
+    return -1;
+  m->in->next_in = (Bytef *) *in;
+  m->in->avail_in = *inlen;
+  m->in->next_out = (Bytef *) out;
+  m->in->avail_out = outlen;
+  r = inflate(m->in, Z_SYNC_FLUSH);
+  used = *inlen - m->in->avail_in;
+  got = outlen - m->in->avail_out;
+  *in += used;
+  *inlen -= used;
+  m->zip_in += used;
+  m->raw_in += got;
+  if (r == Z_STREAM_END) {
+    inflateEnd(m->in);
+    mush_free(m->in, "mccp.stream");
+    m->in = NULL;
+  } else if (r != Z_OK && !(r == Z_BUF_ERROR && (used || got))) {
+    return -1;
+  }
+  return got;
+#else
+  (void) d;
+  (void) in;
+  (void) inlen;
+  (void) out;
+  (void) outlen;
+  return -1;
+#endif
+}
+
+/** Start permessage-deflate on a WebSocket connection: a stream for
+ * the messages it sends, and one for those it receives. Both keep their
+ * context from one message to the next.
+ * \param d the connection.
+ * \return true if it was started.
+ */
+bool
+mccp_start_websocket(DESC *d)
+{
+#ifdef HAVE_LIBZ
+  struct mccp *m;
+
+  if (d->mccp && d->mccp->ws_out)
+    return 1;
+  if (MCCP_MEMORY <= 0 ||
+      mccp_memory + MCCP_DEFLATE_COST + MCCP_INFLATE_COST >
+        (size_t) MCCP_MEMORY)
+    return 0;
+  m = mccp_get(d);
+  m->ws_out = mccp_new_stream();
+  m->ws_in = mccp_new_stream();
+  /* Negative window bits make raw streams, with no zlib header. The
+   * client must be ready for a 32K window, so a smaller one is fine. */
+  if (deflateInit2(m->ws_out, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                   -MCCP_WINDOW_BITS, MCCP_MEM_LEVEL,
+                   Z_DEFAULT_STRATEGY) != Z_OK) {
+    mush_free(m->ws_out, "mccp.stream");
+    m->ws_out = NULL;
+  }
+  if (inflateInit2(m->ws_in, -MAX_WBITS) != Z_OK) {
+    mush_free(m->ws_in, "mccp.stream");
+    m->ws_in = NULL;
+  }
+  if (!m->ws_out || !m->ws_in) {
+    if (m->ws_out) {
+      deflateEnd(m->ws_out);
+      mush_free(m->ws_out, "mccp.stream");
+      m->ws_out = NULL;
+    }
+    if (m->ws_in) {
+      inflateEnd(m->ws_in);
+      mush_free(m->ws_in, "mccp.stream");
+      m->ws_in = NULL;
+    }
+    return 0;
+  }
+  return 1;
+#else
+  (void) d;
+  return 0;
+#endif
+}
+
+/** Compress one WebSocket message. The message is prefix followed by
+ * in. It's flushed so the client can read it all, and the empty block
+ * the flush ends with is left off, as RFC 7692 asks. If it doesn't fit
+ * in out, the stream can't be trusted any more and is ended; messages
+ * are sent uncompressed after that.
+ * \param d the connection.
+ * \param prefix the first byte of the message.
+ * \param in the rest of the message.
+ * \param inlen its length.
+ * \param out where to put the compressed message.
+ * \param outlen the size of out.
+ * \return the compressed length, or -1 to send it uncompressed.
+ */
+int
+mccp_ws_deflate(DESC *d, char prefix, const char *in, int inlen, char *out,
+                int outlen)
+{
+#ifdef HAVE_LIBZ
+  struct mccp *m = d->mccp;
+  z_stream *z;
+  int len;
+
+  if (!m || !(z = m->ws_out))
+    return -1;
+  z->next_out = (Bytef *) out;
+  z->avail_out = outlen;
+  z->next_in = (Bytef *) &prefix;
+  z->avail_in = 1;
+  if (deflate(z, Z_NO_FLUSH) != Z_OK)
+    goto fail;
+  z->next_in = (Bytef *) in;
+  z->avail_in = inlen;
+  if (deflate(z, Z_SYNC_FLUSH) != Z_OK || z->avail_out == 0)
+    goto fail;
+  len = outlen - z->avail_out - 4;
+  m->raw_out += inlen + 1;
+  m->zip_out += len;
+  return len;
+
+fail:
+  deflateEnd(z);
+  mush_free(z, "mccp.stream");
+  m->ws_out = NULL;
+  return -1;
+#else
+  (void) d;
+  (void) prefix;
+  (void) in;
+  (void) inlen;
+  (void) out;
+  (void) outlen;
+  return -1;
+#endif
+}
+
+/** Decompress some of a WebSocket message. The caller adds the empty
+ * block the sender left off after the last of it.
+ * \param d the connection.
+ * \param in pointer to the compressed input, advanced past what's used.
+ * \param inlen pointer to its length, reduced by what's used.
+ * \param out where to put the decompressed input.
+ * \param outlen the size of out.
+ * \return the number of bytes decompressed, or -1 on error.
+ */
+int
+mccp_ws_inflate(DESC *d, const char **in, int *inlen, char *out, int outlen)
+{
+#ifdef HAVE_LIBZ
+  struct mccp *m = d->mccp;
+  int r, used, got;
+
+  if (!m || !m->ws_in)
+    return -1;
+  m->ws_in->next_in = (Bytef *) *in;
+  m->ws_in->avail_in = *inlen;
+  m->ws_in->next_out = (Bytef *) out;
+  m->ws_in->avail_out = outlen;
+  r = inflate(m->ws_in, Z_SYNC_FLUSH);
+  used = *inlen - m->ws_in->avail_in;
+  got = outlen - m->ws_in->avail_out;
+  *in += used;
+  *inlen -= used;
+  m->zip_in += used;
+  m->raw_in += got;
+  if (r == Z_STREAM_END) {
+    /* The client ended its stream with a final block; it starts afresh
+     * with the next message. */
+    inflateReset(m->ws_in);
+  } else if (r != Z_OK && !(r == Z_BUF_ERROR && (used || got))) {
+    return -1;
+  }
+  return got;
+#else
+  (void) d;
+  (void) in;
+  (void) inlen;
+  (void) out;
+  (void) outlen;
+  return -1;
+#endif
+}
+
+/** Describe a connection's compression, for SOCKSET.
+ * \param d the connection.
+ * \param buff the buffer to write to.
+ * \param bp pointer into buff.
+ * \param nl the line ending to use before each line.
+ */
+void
+mccp_show(DESC *d, char *buff, char **bp, const char *nl)
+{
+  struct mccp *m = d->mccp;
+
+  if (d->conn_flags & CONN_WEBSOCKETS) {
+    safe_str(nl, buff, bp);
+    if (!m || !(m->raw_out || m->raw_in))
+      safe_format(buff, bp, "%-15s:  %s", "WS Deflate",
+                  (m && m->ws_out) ? "Yes" : "No");
+    else
+      safe_format(buff, bp,
+                  "%-15s:  %s, %llu bytes sent as %llu, %llu received as %llu",
+                  "WS Deflate", m->ws_out ? "Yes" : "No",
+                  (unsigned long long) m->raw_out,
+                  (unsigned long long) m->zip_out,
+                  (unsigned long long) m->raw_in,
+                  (unsigned long long) m->zip_in);
+    return;
+  }
+  safe_str(nl, buff, bp);
+  if (!m || !m->raw_out)
+    safe_format(buff, bp, "%-15s:  %s", "MCCP2",
+                (m && m->out) ? "Yes" : "No");
+  else
+    safe_format(buff, bp, "%-15s:  %s, %llu bytes sent as %llu (%.1f%%)",
+                "MCCP2", m->out ? "Yes" : "No",
+                (unsigned long long) m->raw_out,
+                (unsigned long long) m->zip_out,
+                m->zip_out * 100.0 / m->raw_out);
+  safe_str(nl, buff, bp);
+  if (!m || !m->zip_in)
+    safe_format(buff, bp, "%-15s:  %s", "MCCP3", (m && m->in) ? "Yes" : "No");
+  else
+    safe_format(buff, bp, "%-15s:  %s, %llu bytes received as %llu (%.1f%%)",
+                "MCCP3", m->in ? "Yes" : "No",
+                (unsigned long long) m->raw_in,
+                (unsigned long long) m->zip_in,
+                m->raw_in ? m->zip_in * 100.0 / m->raw_in : 0.0);
+}
+
+TEST_GROUP(mccp)
+{
+#ifdef HAVE_LIBZ
+  DESC d;
+  char text[BUFFER_LEN], back[BUFFER_LEN * 8];
+  const char *in;
+  struct text_block *cur;
+  z_stream z;
+  size_t before = mccp_memory;
+  int n, k, inlen, got = 0;
+  bool ok = 1;
+
+  memset(&d, 0, sizeof d);
+  init_text_queue(&d.output);
+  add_to_queue(&d.output, "plain", 5);
+  d.output_size = 5;
+  TEST("mccp.1", mccp_start_output(&d) && d.output_size == 0 &&
+                   d.mccp->wire_size == 5 && mccp_memory > before &&
+                   mccp_memory - before <= MCCP_DEFLATE_COST + 1024);
+  for (k = 0; k < 50; k++) {
+    n = snprintf(text, sizeof text,
+                 "Player%d has connected. The room is quiet.\r\n", k);
+    add_to_queue(&d.output, text, n);
+    d.output_size += n;
+  }
+  mccp_compress(&d);
+  TEST("mccp.2", d.output_size == 0 && !d.output.head &&
+                   d.mccp->zip_out < d.mccp->raw_out / 2);
+
+  /* Read back what a client would */
+  memset(&z, 0, sizeof z);
+  inflateInit(&z);
+  z.next_out = (Bytef *) back;
+  z.avail_out = sizeof back;
+  cur = d.mccp->wire.head;
+  TEST("mccp.3", cur && cur->nchars >= 5 && !memcmp(cur->start, "plain", 5));
+  for (k = 5; cur; cur = cur->nxt, k = 0) {
+    z.next_in = (Bytef *) cur->start + k;
+    z.avail_in = cur->nchars - k;
+    if (z.avail_in && inflate(&z, Z_SYNC_FLUSH) != Z_OK)
+      ok = 0;
+  }
+  inflateEnd(&z);
+  for (k = 0, in = back; ok && k < 50; k++) {
+    n = snprintf(text, sizeof text,
+                 "Player%d has connected. The room is quiet.\r\n", k);
+    ok = !strncmp(in, text, n);
+    in += n;
+  }
+  TEST("mccp.4", ok && in == (char *) z.next_out);
+
+  /* Input, with plain text after the stream ends */
+  memset(&z, 0, sizeof z);
+  deflateInit(&z, Z_DEFAULT_COMPRESSION);
+  z.next_in = (Bytef *) "look\r\nsay hi\r\n";
+  z.avail_in = 14;
+  z.next_out = (Bytef *) back;
+  z.avail_out = sizeof back;
+  deflate(&z, Z_FINISH);
+  inlen = sizeof back - z.avail_out;
+  deflateEnd(&z);
+  memcpy(back + inlen, "QUIT\r\n", 6);
+  inlen += 6;
+  in = back;
+  TEST("mccp.5", mccp_start_input(&d) && MCCPInput(&d));
+  while (inlen > 0 && MCCPInput(&d) &&
+         (n = mccp_inflate(&d, &in, &inlen, text + got, 4)) >= 0)
+    got += n;
+  TEST("mccp.6", got == 14 && !memcmp(text, "look\r\nsay hi\r\n", 14) &&
+                   !MCCPInput(&d) && inlen == 6 && !memcmp(in, "QUIT", 4));
+
+  mccp_end_output(&d);
+  mccp_free(&d);
+  TEST("mccp.7", !d.mccp && mccp_memory == before);
+#endif
+}
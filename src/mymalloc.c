@@ -54,6 +54,9 @@
 #define SZT "zu"
 #endif
 
+/** Number of mush_malloc() and friends calls. Used by the profiler. */
+uint64_t mush_allocations = 0;
+
 /** A malloc wrapper that tracks type of allocation.
  * This should be used in preference to malloc() when possible,
  * to enable memory leak tracing with MEM_CHECK.
@@ -72,6 +75,7 @@ mush_malloc(size_t bytes, const char *check)
     bytes += 16;
 #endif
 
+  mush_allocations++;
   ptr = malloc(bytes);
   if (!ptr)
     do_rawlog(LT_TRACE, "mush_malloc failed to malloc %" SZT " bytes for %s",
@@ -91,6 +95,7 @@ void *
 mush_malloc_zero(size_t bytes, const char *check)
 {
   void *ptr = calloc(bytes, 1);
+  mush_allocations++;
   if (!ptr)
     do_rawlog(LT_TRACE,
               "mush_malloc_zero failed to allocate %" SZT " bytes for %s",
@@ -112,6 +117,7 @@ mush_calloc(size_t count, size_t size, const char *check)
 {
   void *ptr;
 
+  mush_allocations++;
   ptr = calloc(count, size);
   if (!ptr)
     do_rawlog(LT_TRACE, "mush_calloc failed to allocate %" SZT " bytes for %s",
@@ -138,9 +144,10 @@ mush_realloc_where(void *restrict ptr, size_t newsize,
 
   newptr = realloc(ptr, newsize);
 
-  if (!ptr)
+  if (!ptr) {
+    mush_allocations++;
     add_check(check);
-  else if (newsize == 0)
+  } else if (newsize == 0)
     del_check(check, filename, line);
 
   return newptr;
@@ -66,6 +66,7 @@
 #include "lock.h"
 #include "log.h"
 #include "match.h"
+#include "mccp.h"
 #include "mushdb.h"
 #include "mymalloc.h"
 #include "mysocket.h"
@@ -74,6 +75,7 @@
 #include "strtree.h"
 #include "strutil.h"
 #include "charconv.h"
+#include "tests.h"
 #include "websock.h"
 
 extern CHAN *channels;
@@ -117,6 +119,13 @@ static struct text_block *make_text_block(const char *s, int n);
 void free_text_block(struct text_block *t);
 void add_to_queue(struct text_queue *q, const char *b, int n);
 static int flush_queue(struct text_queue *q, int n);
+static struct shared_text *make_shared_text(const char *s, int n);
+static void release_shared_text(struct shared_text *st);
+static int queue_newwrite_real(DESC *d, const char *b, int n, char ch,
+                               struct shared_text *st);
+static int queue_newwrite_text(DESC *d, const char *b, int n,
+                               struct shared_text *st);
+static int queue_newwrite_eol(DESC *d, const char *eol);
 int queue_write(DESC *d, const char *b, int n);
 int queue_newwrite(DESC *d, const char *b, int n);
 int queue_string(DESC *d, const char *s);
@@ -137,160 +146,64 @@ static int na_depth =
 #define MAX_NA_DEPTH                                                           \
   7 /**< Maximum value for na_depth, notify_anything recursions */
 
-/** Complete list of possible groupings of MSG_* flags.
- * These are all the different kinds of messages we may produce to send to a
- * player. Note that we don't have any  MSG_PUEBLO | MSG_TELNET groups - the
- * Telnet char is always escaped for Pueblo clients.
+/** Most distinct \@format-ed messages whose renderings are cached during a
+ * single broadcast. Past this, formatted messages are rendered separately for
+ * each object that hears them. */
+#define FORMAT_CACHE_SIZE 16
+
+/** A rendered message that the output queues of everyone who hears it
+ * can point into, instead of each getting a copy. It's freed when the
+ * last block using it has been sent.
  */
-#define MSGTYPE_ORIGINAL MSG_INTERNAL
-/*   Colors   Pueblo?   Telnet?   Accents? */
-#define MSGTYPE_PASCII                                                         \
-  (MSG_PLAYER) /*                                                      1       \
-                  0         0          1    */
-
-#define MSGTYPE_ANSI2                                                          \
-  (MSG_PLAYER |                                                                \
-   MSG_ANSI2) /*                                      2        0         0     \
-                 1    */
-#define MSGTYPE_ANSI16                                                         \
-  (MSG_PLAYER |                                                                \
-   MSG_ANSI16) /*                                     16        0         0    \
-                  1    */
-#define MSGTYPE_XTERM256                                                       \
-  (MSG_PLAYER | MSG_XTERM256) /*                                    256        \
-                                 0         0          1    */
-#define MSGTYPE_PUEBLO                                                         \
-  (MSG_PLAYER |                                                                \
-   MSG_PUEBLO) /*                                      1        1         ?    \
-                  1    */
-#define MSGTYPE_PUEBLOANSI2                                                    \
-  (MSG_PLAYER | MSG_PUEBLO | MSG_ANSI2) /*                              2      \
-                                           1         ?          1    */
-#define MSGTYPE_PUEBLOANSI16                                                   \
-  (MSG_PLAYER | MSG_PUEBLO |                                                   \
-   MSG_ANSI16) /*                             16        1         ? 1    */
-#define MSGTYPE_PUEBLOXTERM256                                                 \
-  (MSG_PLAYER | MSG_PUEBLO |                                                   \
-   MSG_XTERM256) /*                          256        1         ? 1    */
-
-#define MSGTYPE_TPASCII                                                        \
-  (MSG_PLAYER |                                                                \
-   MSG_TELNET) /*                                      1        0         1    \
-                  1    */
-#define MSGTYPE_TANSI2                                                         \
-  (MSG_PLAYER | MSG_TELNET | MSG_ANSI2) /*                              2      \
-                                           0         1          1    */
-#define MSGTYPE_TANSI16                                                        \
-  (MSG_PLAYER | MSG_TELNET |                                                   \
-   MSG_ANSI16) /*                             16        0         1 1    */
-#define MSGTYPE_TXTERM256                                                      \
-  (MSG_PLAYER | MSG_TELNET |                                                   \
-   MSG_XTERM256) /*                    256        0         1          1    */
-
-#define MSGTYPE_NPASCII                                                        \
-  (MSG_PLAYER | MSG_STRIPACCENTS) /*                              1        0   \
-                                     0          0    */
-#define MSGTYPE_NANSI2                                                         \
-  (MSG_PLAYER | MSG_STRIPACCENTS |                                             \
-   MSG_ANSI2) /*                      2        0         0          0    */
-#define MSGTYPE_NANSI16                                                        \
-  (MSG_PLAYER | MSG_STRIPACCENTS |                                             \
-   MSG_ANSI16) /*                     16        0         0          0    */
-#define MSGTYPE_NXTERM256                                                      \
-  (MSG_PLAYER | MSG_STRIPACCENTS |                                             \
-   MSG_XTERM256) /*                    256        0         0          0    */
-#define MSGTYPE_NPUEBLO                                                        \
-  (MSG_PLAYER | MSG_STRIPACCENTS |                                             \
-   MSG_PUEBLO) /*                      1        1         ?          0    */
-#define MSGTYPE_NPUEBLOANSI2                                                   \
-  (MSG_PLAYER | MSG_STRIPACCENTS | MSG_PUEBLO |                                \
-   MSG_ANSI2) /*      2        1         ?          0    */
-#define MSGTYPE_NPUEBLOANSI16                                                  \
-  (MSG_PLAYER | MSG_STRIPACCENTS | MSG_PUEBLO |                                \
-   MSG_ANSI16) /*     16        1         ?          0    */
-#define MSGTYPE_NPUEBLOXTERM256                                                \
-  (MSG_PLAYER | MSG_STRIPACCENTS | MSG_PUEBLO |                                \
-   MSG_XTERM256) /*    256        1         ?          0    */
-
-#define MSGTYPE_TNPASCII                                                       \
-  (MSG_PLAYER | MSG_TELNET | MSG_STRIPACCENTS) /*                      1       \
-                                                  0         1          0    */
-#define MSGTYPE_TNANSI2                                                        \
-  (MSG_PLAYER | MSG_TELNET | MSG_STRIPACCENTS |                                \
-   MSG_ANSI2) /*      2        0         1          0    */
-#define MSGTYPE_TNANSI16                                                       \
-  (MSG_PLAYER | MSG_TELNET | MSG_STRIPACCENTS |                                \
-   MSG_ANSI16) /*     16        0         1          0    */
-#define MSGTYPE_TNXTERM256                                                     \
-  (MSG_PLAYER | MSG_TELNET | MSG_STRIPACCENTS |                                \
-   MSG_XTERM256) /*    256        0         1          0    */
-
-#define MSGTYPE_WEBSOCKETS (MSG_PLAYER | MSG_WEBSOCKETS)
-#define MSGTYPE_WSANSI2 (MSG_PLAYER | MSG_WEBSOCKETS | MSG_ANSI2)
-#define MSGTYPE_WSANSI16 (MSG_PLAYER | MSG_WEBSOCKETS | MSG_ANSI16)
-#define MSGTYPE_WSXTERM256 (MSG_PLAYER | MSG_WEBSOCKETS | MSG_XTERM256)
-
-/* Corresponding NA_* enum for each of the MSGTYPE_* groups above.
- * See table of supported protocols for meanings */
-enum na_type {
-  NA_ORIGINAL = 0,
-  NA_PASCII,
-  NA_ANSI2,
-  NA_ANSI16,
-  NA_XTERM256,
-  NA_PUEBLO,
-  NA_PUEBLOANSI2,
-  NA_PUEBLOANSI16,
-  NA_PUEBLOXTERM256,
-  NA_TPASCII,
-  NA_TANSI2,
-  NA_TANSI16,
-  NA_TXTERM256,
-  NA_NPASCII,
-  NA_NANSI2,
-  NA_NANSI16,
-  NA_NXTERM256,
-  NA_NPUEBLO,
-  NA_NPUEBLOANSI2,
-  NA_NPUEBLOANSI16,
-  NA_NPUEBLOXTERM256,
-  NA_TNPASCII,
-  NA_TNANSI2,
-  NA_TNANSI16,
-  NA_TNXTERM256,
-  NA_WEBSOCKETS,
-  NA_WSANSI2,
-  NA_WSANSI16,
-  NA_WSXTERM256,
-  NA_COUNT /* Total number of NA_* flags */
+struct shared_text {
+  int refcount;                /**< Blocks and notify caches using it */
+  int len;                     /**< Length of text */
+  struct shared_text *utf8[2]; /**< UTF-8 versions, plain and telnet */
+  char text[];                 /**< The text itself */
 };
 
-static enum na_type msg_to_na(int output_type);
-
-/** Number of possible message text renderings */
-#define MESSAGE_TYPES (NA_COUNT)
-
-/** A place to store a single rendering of a message. */
+/** Output queue allocation counts, for \@stats/tables */
+static struct {
+  unsigned long copied;       /**< Blocks with their own copy of the text */
+  unsigned long copied_bytes; /**< Bytes copied into them */
+  unsigned long shared;       /**< Blocks pointing into shared text */
+  unsigned long shared_bytes; /**< Bytes they point to */
+  unsigned long renders;      /**< Shared texts made */
+  unsigned long live;         /**< Shared texts still in use */
+} output_stats;
+
+/** A single rendering of a message. */
 struct notify_strings {
-  char const *message; /**< The message text. */
-  size_t len;          /**< Length of message. */
-  int made;            /**< True if message has been rendered. */
+  char const *message;         /**< The rendered text. */
+  size_t len;                  /**< Length of message. */
+  int type;                    /**< MSG_* flags it was rendered with */
+  struct shared_text *shared;  /**< The rendering, shared with output queues */
+  struct notify_strings *next; /**< The next rendering of the same message */
 };
 
-/** A message, in every possible rendering */
+/** A message, and each rendering of it made so far */
 struct notify_message {
-  struct notify_strings
-    strs[MESSAGE_TYPES]; /**< The message, in a bunch of formats */
+  char const *message; /**< The original message */
+  size_t len;          /**< Length of the original */
   int type; /**< MSG_* flags for the types of chars possibly present in the
                original string */
+  struct notify_strings *renders; /**< Renderings, keyed by MSG_* flags */
 };
 
-/** Every possible rendering of a message, plus the nospoof and paranoid
- * prefixes */
+/** A message formatted through a ufun for some of the objects hearing it */
+struct notify_formatted {
+  struct notify_message msg;     /**< The formatted message */
+  struct notify_formatted *next; /**< The next formatted message */
+};
+
+/** Every rendering of a message made during one broadcast, plus the nospoof
+ * and paranoid prefixes and any \@format-ed versions of the message */
 struct notify_message_group {
-  struct notify_message messages;  /**< Message being notified */
-  struct notify_message nospoofs;  /**< Non-paranoid Nospoof prefix */
-  struct notify_message paranoids; /**< Paranoid Nospoof prefix */
+  struct notify_message messages;     /**< Message being notified */
+  struct notify_message nospoofs;     /**< Non-paranoid Nospoof prefix */
+  struct notify_message paranoids;    /**< Paranoid Nospoof prefix */
+  struct notify_formatted *formatted; /**< Formatted versions of messages */
+  int nformatted;                     /**< Length of formatted */
 };
 
 static void
@@ -311,10 +224,18 @@ static void make_prefix_str(dbref thing, dbref enactor, const char *msg,
                             char *tbuf1);
 
 static const char *notify_makestring_real(struct notify_message *message,
-                                          int output_type);
+                                          int output_type,
+                                          struct shared_text **shared);
 static char *notify_makestring_nocache(const char *message, int output_type);
+static void init_notify_message(struct notify_message *message,
+                                const char *text);
+static void free_notify_message(struct notify_message *message);
+static void
+free_notify_message_group(struct notify_message_group *real_message);
+static struct notify_message *
+notify_formatted(struct notify_message_group *real_message, const char *text);
 
-#define notify_makestring(msg, ot) notify_makestring_real(msg, ot)
+#define notify_makestring(msg, ot) notify_makestring_real(msg, ot, NULL)
 
 /** Check which kinds of markup or special characters a string may contain.
  * This is used to avoid generating message types we don't need. For
@@ -410,7 +331,7 @@ notify_type(DESC *d)
 
 /* Connnection type checks */
   if (IsWebSocket(d)) {
-    type |= MSGTYPE_WEBSOCKETS;
+    type |= MSG_WEBSOCKETS;
   }
   if (d->conn_flags & CONN_HTML) {
     type |= MSG_PUEBLO;
@@ -436,16 +357,16 @@ notify_type(DESC *d)
     }
   } else if (!d->connected) {
     type |= MSG_ANSI16;
-  } else if (IS(d->player, TYPE_PLAYER, "XTERM256")) {
+  } else if (IS_CORE(d->player, TYPE_PLAYER, FH_XTERM256)) {
     type |= MSG_XTERM256;
-  } else if (IS(d->player, TYPE_PLAYER, "COLOR")) {
+  } else if (IS_CORE(d->player, TYPE_PLAYER, FH_COLOR)) {
     type |= MSG_ANSI16;
-  } else if (IS(d->player, TYPE_PLAYER, "ANSI")) {
+  } else if (IS_CORE(d->player, TYPE_PLAYER, FH_ANSI)) {
     type |= MSG_ANSI2;
   }
 
   if ((d->conn_flags & CONN_STRIPACCENTS) ||
-      (d->connected && IS(d->player, TYPE_PLAYER, "NOACCENTS"))) {
+      (d->connected && IS_CORE(d->player, TYPE_PLAYER, FH_NOACCENTS))) {
     type |= MSG_STRIPACCENTS;
   }
 
@@ -572,29 +493,95 @@ na_loc(dbref current, void *data)
     return Next(current);
 }
 
+/** Initialize a notify_message with its original text, which isn't copied.
+ * \param message the notify_message to initialize.
+ * \param text the original message, or NULL to make it later.
+ */
+static void
+init_notify_message(struct notify_message *message, const char *text)
+{
+  message->message = text;
+  message->len = text ? strlen(text) : 0;
+  message->type = text ? str_type(text) : 0;
+  message->renders = NULL;
+}
+
 /** Initialize a notify_message_group with NULL/zero values
  */
 static void
 init_notify_message_group(struct notify_message_group *real_message)
 {
-  int i;
+  init_notify_message(&real_message->messages, NULL);
+  init_notify_message(&real_message->nospoofs, NULL);
+  init_notify_message(&real_message->paranoids, NULL);
+  real_message->formatted = NULL;
+  real_message->nformatted = 0;
+}
 
-  for (i = 0; i < MESSAGE_TYPES; i++) {
-    real_message->messages.strs[i].message = NULL;
-    real_message->messages.strs[i].made = 0;
-    real_message->messages.strs[i].len = 0;
+/** Free the renderings of a message. The original isn't freed.
+ * \param message the notify_message.
+ */
+static void
+free_notify_message(struct notify_message *message)
+{
+  struct notify_strings *str, *next;
 
-    real_message->nospoofs.strs[i].message = NULL;
-    real_message->nospoofs.strs[i].made = 0;
-    real_message->nospoofs.strs[i].len = 0;
+  for (str = message->renders; str; str = next) {
+    next = str->next;
+    release_shared_text(str->shared);
+    mush_free(str, "notify_strings");
+  }
+  message->renders = NULL;
+}
 
-    real_message->paranoids.strs[i].message = NULL;
-    real_message->paranoids.strs[i].made = 0;
-    real_message->paranoids.strs[i].len = 0;
+/** Free everything made for a notify_message_group during a broadcast.
+ * \param real_message the notify_message_group.
+ */
+static void
+free_notify_message_group(struct notify_message_group *real_message)
+{
+  struct notify_formatted *f, *next;
+
+  free_notify_message(&real_message->messages);
+  free_notify_message(&real_message->nospoofs);
+  free_notify_message(&real_message->paranoids);
+  if (real_message->nospoofs.message)
+    mush_free((void *) real_message->nospoofs.message, "notify_str");
+  if (real_message->paranoids.message)
+    mush_free((void *) real_message->paranoids.message, "notify_str");
+  for (f = real_message->formatted; f; f = next) {
+    next = f->next;
+    free_notify_message(&f->msg);
+    mush_free((void *) f->msg.message, "notify_str");
+    mush_free(f, "notify_formatted");
   }
-  real_message->messages.type = 0;
-  real_message->nospoofs.type = 0;
-  real_message->paranoids.type = 0;
+  real_message->formatted = NULL;
+  real_message->nformatted = 0;
+}
+
+/** Find the cached copy of a message formatted through a ufun, so that
+ * objects whose \@format gives the same text share its renderings.
+ * \param real_message the notify_message_group being broadcast.
+ * \param text the formatted message.
+ * \return the cached message, or NULL if too many are already cached.
+ */
+static struct notify_message *
+notify_formatted(struct notify_message_group *real_message, const char *text)
+{
+  struct notify_formatted *f;
+
+  for (f = real_message->formatted; f; f = f->next) {
+    if (!strcmp(f->msg.message, text))
+      return &f->msg;
+  }
+  if (real_message->nformatted >= FORMAT_CACHE_SIZE)
+    return NULL;
+  f = mush_malloc(sizeof *f, "notify_formatted");
+  init_notify_message(&f->msg, mush_strdup(text, "notify_str"));
+  f->next = real_message->formatted;
+  real_message->formatted = f;
+  real_message->nformatted++;
+  return &f->msg;
 }
 
 /** Evaluate an object's @prefix and store the result in a buffer.
@@ -630,10 +617,19 @@ make_prefix_str(dbref thing, dbref enactor, const char *msg, char *tbuf1)
   return;
 }
 
-/** Return the appropriate NA_* flag for a bitwise group of MSG_* flags */
-static enum na_type
-msg_to_na(int output_type)
+/** Reduce a set of MSG_* flags to the ones that change how a message is
+ * rendered, so that every client which would see the same text shares one
+ * rendering.
+ * \param output_type MSG_* flags for the client.
+ * \param msgtype MSG_* flags the message might need, from str_type().
+ * \return the MSG_* flags to render the message with.
+ */
+static int
+render_type(int output_type, int msgtype)
 {
+  if (output_type & MSG_PLAYER)
+    output_type &= (msgtype | MSG_PLAYER);
+
   if (output_type & (MSG_PUEBLO | MSG_WEBSOCKETS))
     output_type &= ~MSG_TELNET;
 
@@ -642,71 +638,7 @@ msg_to_na(int output_type)
   else if (output_type & MSG_ANSI16)
     output_type &= ~MSG_ANSI2;
 
-  switch (output_type) {
-  case MSGTYPE_ORIGINAL:
-    return NA_ORIGINAL;
-  case MSGTYPE_PASCII:
-    return NA_PASCII;
-  case MSGTYPE_ANSI2:
-    return NA_ANSI2;
-  case MSGTYPE_ANSI16:
-    return NA_ANSI16;
-  case MSGTYPE_XTERM256:
-    return NA_XTERM256;
-  case MSGTYPE_PUEBLO:
-    return NA_PUEBLO;
-  case MSGTYPE_PUEBLOANSI2:
-    return NA_PUEBLOANSI2;
-  case MSGTYPE_PUEBLOANSI16:
-    return NA_PUEBLOANSI16;
-  case MSGTYPE_PUEBLOXTERM256:
-    return NA_PUEBLOXTERM256;
-  case MSGTYPE_TPASCII:
-    return NA_TPASCII;
-  case MSGTYPE_TANSI2:
-    return NA_TANSI2;
-  case MSGTYPE_TANSI16:
-    return NA_TANSI16;
-  case MSGTYPE_TXTERM256:
-    return NA_TXTERM256;
-  case MSGTYPE_NPASCII:
-    return NA_NPASCII;
-  case MSGTYPE_NANSI2:
-    return NA_NANSI2;
-  case MSGTYPE_NANSI16:
-    return NA_NANSI16;
-  case MSGTYPE_NXTERM256:
-    return NA_NXTERM256;
-  case MSGTYPE_NPUEBLO:
-    return NA_NPUEBLO;
-  case MSGTYPE_NPUEBLOANSI2:
-    return NA_NPUEBLOANSI2;
-  case MSGTYPE_NPUEBLOANSI16:
-    return NA_NPUEBLOANSI16;
-  case MSGTYPE_NPUEBLOXTERM256:
-    return NA_NPUEBLOXTERM256;
-  case MSGTYPE_TNPASCII:
-    return NA_TNPASCII;
-  case MSGTYPE_TNANSI2:
-    return NA_TNANSI2;
-  case MSGTYPE_TNANSI16:
-    return NA_TNANSI16;
-  case MSGTYPE_TNXTERM256:
-    return NA_TNXTERM256;
-  case MSGTYPE_WEBSOCKETS:
-    return NA_WEBSOCKETS;
-  case MSGTYPE_WSANSI2:
-    return NA_WSANSI2;
-  case MSGTYPE_WSANSI16:
-    return NA_WSANSI16;
-  case MSGTYPE_WSXTERM256:
-    return NA_WSXTERM256;
-  }
-
-  /* we should never get here. */
-  do_rawlog(LT_ERR, "Invalid MSG_* flag setting '%d' in msg_to_na",
-            output_type);
-  return NA_PASCII;
+  return output_type;
 }
 
 /** Make a nospoof prefix for speaker, possibly for paranoid nospoof
@@ -734,18 +666,18 @@ make_nospoof(dbref speaker, int paranoid)
   return dest;
 }
 
-/** Render a string to the given format. Returns pointer to a STATIC buffer.
+/** Render a string to the given format.
  * Used by notify_makestring() to render a string for output to a player's
  * client, and by the softcode render() function.
  * \param message the string to render
  * \param output_type bitwise MSG_* flags for how to render the message
- * \return pointer to static string
+ * \param buff buffer of BUFFER_LEN chars to render the message into
+ * \return length of the rendered string
  */
-const char *
-render_string(const char *message, int output_type)
+size_t
+render_string(const char *message, int output_type, char *buff)
 {
-  static char buff[BUFFER_LEN];
-  static char *bp;
+  char *bp;
   const char *p;
 
   int ansi_format = ANSI_FORMAT_NONE;
@@ -756,9 +688,10 @@ render_string(const char *message, int output_type)
   ansifix = 0;
 
   if (output_type == MSG_INTERNAL) {
-    /* TODO: This looks really dangerous. Can't this overflow? */
-    strcpy(buff, message);
-    return buff;
+    bp = buff;
+    safe_str(message, buff, &bp);
+    *bp = '\0';
+    return bp - buff;
   }
 
   /* Everything is explicitly off by default */
@@ -926,49 +859,63 @@ render_string(const char *message, int output_type)
 
   *bp = '\0';
 
-  return buff;
+  return bp - buff;
 }
 
 /** Render a message into a given format, if we haven't already done so, and
  * cache the result.
- * If we've already cached the string in the requested format, return that.
- * Otherwise, render it, cache and return the newly cached version. Calls
- * render_string() to actually do the rendering, and strdup()s the result.
+ * If we've already cached the string in the requested format, or in one that
+ * renders identically, return that. Otherwise, render it, cache and return
+ * the newly cached version. Calls render_string() to actually do the
+ * rendering.
  * \param message a notify_message structure, with the original message and
  * cached copies
  * \param output_type MSG_* flags of how to render the message
+ * \param shared set to the shared rendering to queue, or NULL for the
+ * original
  * \return pointer to the cached, rendered string
  */
 static const char *
-notify_makestring_real(struct notify_message *message, int output_type)
+notify_makestring_real(struct notify_message *message, int output_type,
+                       struct shared_text **shared)
 {
-  enum na_type msgtype;
-  const char *newstr;
-
-  if (output_type & MSG_PLAYER)
-    output_type = (output_type & (message->type | MSG_PLAYER));
-
-  msgtype = msg_to_na(output_type);
+  struct notify_strings *str;
+  char buff[BUFFER_LEN];
+  size_t len;
 
-  if (message->strs[msgtype].made) {
-    return message->strs[msgtype].message;
+  output_type = render_type(output_type, message->type);
+  if (output_type == MSG_INTERNAL) {
+    if (shared)
+      *shared = NULL;
+    return message->message;
   }
 
-  /* Render the message */
-  newstr = render_string(message->strs[0].message, output_type);
+  for (str = message->renders; str; str = str->next) {
+    if (str->type == output_type)
+      break;
+  }
 
-  /* Save the new message */
-  message->strs[msgtype].made = 1;
-  message->strs[msgtype].message = mush_strdup(newstr, "notify_str");
-  message->strs[msgtype].len = strlen(newstr);
+  if (!str) {
+    /* Render the message, and save it where output queues can share it */
+    len = render_string(message->message, output_type, buff);
+    str = mush_malloc(sizeof *str, "notify_strings");
+    str->shared = make_shared_text(buff, len);
+    str->message = str->shared->text;
+    str->len = str->shared->len;
+    str->type = output_type;
+    str->next = message->renders;
+    message->renders = str;
+  }
 
-  return message->strs[msgtype].message;
+  if (shared)
+    *shared = str->shared;
+  return str->message;
 }
 
 /** Render a message in a given format and return the new message.
  * Does not cache the results like notify_makestring() - used for messages
- * which have been formatted through a ufun, and are thus different for
- * every object which hears them.
+ * which have been formatted through a ufun when too many different formatted
+ * messages have already been cached.
  * \param message the message to render
  * \param output_type MSG_* flags of how to render the msg
  * \return pointer to the newly rendered, strdup()'d string
@@ -976,7 +923,10 @@ notify_makestring_real(struct notify_message *message, int output_type)
 static char *
 notify_makestring_nocache(const char *message, int output_type)
 {
-  return mush_strdup(render_string(message, output_type), "notify_str");
+  char buff[BUFFER_LEN];
+
+  render_string(message, output_type, buff);
+  return mush_strdup(buff, "notify_str");
 }
 
 /* notify_except() is #define'd to notify_except2() */
@@ -1031,7 +981,6 @@ notify_anything(dbref executor, dbref speaker, na_lookup func, void *fdata,
 {
   struct notify_message_group real_message;
   struct notify_message_group *real_message_pointer = NULL;
-  int i;
 
   /* If we have no message, or noone to notify, do nothing */
   if (!func || ((!message || !*message) && !(flags & NA_PROMPT)))
@@ -1044,10 +993,7 @@ notify_anything(dbref executor, dbref speaker, na_lookup func, void *fdata,
   /* Do it */
   if (message && *message) {
     init_notify_message_group(&real_message);
-    real_message.messages.strs[0].message = message;
-    real_message.messages.strs[0].made = 1;
-    real_message.messages.strs[0].len = strlen(message);
-    real_message.messages.type = str_type(message);
+    init_notify_message(&real_message.messages, message);
     real_message_pointer = &real_message;
   }
 
@@ -1060,14 +1006,7 @@ notify_anything(dbref executor, dbref speaker, na_lookup func, void *fdata,
   if (!message || !*message)
     return;
   /* Cleanup */
-  for (i = 0; i < MESSAGE_TYPES; i++) {
-    if (i && real_message.messages.strs[i].made)
-      mush_free((void *) real_message.messages.strs[i].message, "notify_str");
-    if (real_message.nospoofs.strs[i].made)
-      mush_free((void *) real_message.nospoofs.strs[i].message, "notify_str");
-    if (real_message.paranoids.strs[i].made)
-      mush_free((void *) real_message.paranoids.strs[i].message, "notify_str");
-  }
+  free_notify_message_group(&real_message);
 }
 
 /** Notify one or more objects with a message.
@@ -1106,18 +1045,8 @@ notify_anything_sub(dbref executor, dbref speaker, na_lookup func, void *fdata,
 
   na_depth++;
   if (prefix && *prefix && message) {
-    int i;
-
     real_prefix = mush_malloc(sizeof(struct notify_message), "notify_message");
-    real_prefix->strs[0].message = prefix;
-    real_prefix->strs[0].made = 1;
-    real_prefix->strs[0].len = strlen(prefix);
-    real_prefix->type = str_type(prefix);
-    for (i = 1; i < MESSAGE_TYPES; i++) {
-      real_prefix->strs[i].message = NULL;
-      real_prefix->strs[i].made = 0;
-      real_prefix->strs[i].len = 0;
-    }
+    init_notify_message(real_prefix, prefix);
   }
   /* Tell everyone */
   while ((target = func(target, fdata)) != NOTHING) {
@@ -1136,12 +1065,7 @@ notify_anything_sub(dbref executor, dbref speaker, na_lookup func, void *fdata,
   }
 
   if (real_prefix != NULL) {
-    int i;
-
-    for (i = 1; i < MESSAGE_TYPES; i++) {
-      if (real_prefix->strs[i].made)
-        mush_free((void *) real_prefix->strs[i].message, "notify_str");
-    }
+    free_notify_message(real_prefix);
     mush_free(real_prefix, "notify_message");
   }
 
@@ -1162,7 +1086,8 @@ notify_anything_sub(dbref executor, dbref speaker, na_lookup func, void *fdata,
  * the given args prior to being displayed to a player, matched against
  * \@listens or sent to a puppet (but NOT propagated to other locations).
  * If format->obj is ambiguous (#-2), get the attr from the target, otherwise
- * use the obj given. Transformed strings are not cached.
+ * use the obj given. Transformed strings are cached for the rest of the
+ * broadcast, so objects whose formats give the same text share renderings.
  * \param target object to notify
  * \param executor The object causing the speech, for error/confirmation
  * messages
@@ -1192,11 +1117,15 @@ notify_internal(dbref target, dbref executor, dbref speaker, dbref *skips,
   int msglen = 0;            /**< Length of the rendered message */
   const char *prefixstr = NULL;
   int prefixlen = 0;
+  struct shared_text *prefixshare = NULL, *spoofshare = NULL,
+                     *msgshare = NULL; /**< Renderings queued by reference */
   static char buff[BUFFER_LEN],
     *bp; /**< Buffer used for processing the format attr */
   char *formatmsg =
     NULL; /**< Pointer to the rendered, formatted message. Must be free()d! */
   int cache = 1;  /**< Are we using a cached version of the message? */
+  struct notify_message *fmsg =
+    NULL; /**< The cached formatted message, if cache is 0 */
   int prompt = 0; /**< Show a prompt? */
   int heard = 1;  /**< After formatting, did this object hear something? */
   DESC *d;        /**< descriptor to loop through connected players */
@@ -1287,6 +1216,8 @@ notify_internal(dbref target, dbref executor, dbref speaker, dbref *skips,
       call_ufun(&ufun, buff, src, speaker, NULL, pe_regs);
       if (pe_regs)
         pe_regs_free(pe_regs);
+      if (*buff)
+        fmsg = notify_formatted(message, buff);
 
       /* Even if the format attr returns nothing, we must continue because the
        * sound must still be propagated to other objects, which may hear
@@ -1312,7 +1243,8 @@ notify_internal(dbref target, dbref executor, dbref speaker, dbref *skips,
         if (heard && prefix != NULL) {
           /* Figure out */
           if (!prefixstr || output_type != last_output_type) {
-            prefixstr = notify_makestring(prefix, output_type);
+            prefixstr =
+              notify_makestring_real(prefix, output_type, &prefixshare);
             prefixlen = strlen(prefixstr);
           }
         } else {
@@ -1324,26 +1256,18 @@ notify_internal(dbref target, dbref executor, dbref speaker, dbref *skips,
             ((flags & NA_NOSPOOF) ||
              (Nospoof(target) && ((target != speaker) || Paranoid(target))))) {
           if (Paranoid(target) || (flags & NA_PARANOID)) {
-            if (!message->paranoids.strs[0].made) {
-              message->paranoids.strs[0].message = make_nospoof(speaker, 1);
-              message->paranoids.strs[0].made = 1;
-              message->paranoids.strs[0].len =
-                strlen(message->paranoids.strs[0].message);
-              message->paranoids.type =
-                str_type((const char *) message->paranoids.strs[0].message);
-            }
-            spoofstr = notify_makestring(&message->paranoids, output_type);
+            if (!message->paranoids.message)
+              init_notify_message(&message->paranoids,
+                                  make_nospoof(speaker, 1));
+            spoofstr = notify_makestring_real(&message->paranoids,
+                                              output_type, &spoofshare);
             spooflen = strlen(spoofstr);
           } else {
-            if (!message->nospoofs.strs[0].made) {
-              message->nospoofs.strs[0].message = make_nospoof(speaker, 0);
-              message->nospoofs.strs[0].made = 1;
-              message->nospoofs.strs[0].len =
-                strlen(message->nospoofs.strs[0].message);
-              message->nospoofs.type =
-                str_type((const char *) message->nospoofs.strs[0].message);
-            }
-            spoofstr = notify_makestring(&message->nospoofs, output_type);
+            if (!message->nospoofs.message)
+              init_notify_message(&message->nospoofs,
+                                  make_nospoof(speaker, 0));
+            spoofstr = notify_makestring_real(&message->nospoofs,
+                                              output_type, &spoofshare);
             spooflen = strlen(spoofstr);
           }
         } else {
@@ -1358,8 +1282,12 @@ notify_internal(dbref target, dbref executor, dbref speaker, dbref *skips,
         if (heard) {
           if (!msgstr || output_type != last_output_type) {
             if (cache) {
-              msgstr = notify_makestring(&message->messages, output_type);
+              msgstr = notify_makestring_real(&message->messages, output_type,
+                                              &msgshare);
+            } else if (fmsg) {
+              msgstr = notify_makestring_real(fmsg, output_type, &msgshare);
             } else {
+              msgshare = NULL;
               if (formatmsg)
                 mush_free(formatmsg, "notify_str");
               msgstr = formatmsg = notify_makestring_nocache(buff, output_type);
@@ -1370,20 +1298,20 @@ notify_internal(dbref target, dbref executor, dbref speaker, dbref *skips,
 
           if (msglen) {
             if (prefixlen) /* send prefix */
-              queue_newwrite(d, prefixstr, prefixlen);
+              queue_newwrite_text(d, prefixstr, prefixlen, prefixshare);
             if (spooflen) /* send nospoof prefix */
-              queue_newwrite(d, spoofstr, spooflen);
+              queue_newwrite_text(d, spoofstr, spooflen, spoofshare);
 
             if (prompt) { /* send prompt */
               if (d->conn_flags & CONN_WEBSOCKETS) {
                 queue_newwrite_channel(d, msgstr, msglen,
                                        WEBSOCKET_CHANNEL_PROMPT);
               } else {
-                queue_newwrite(d, msgstr, msglen); /* send message */
+                queue_newwrite_text(d, msgstr, msglen, msgshare);
                 queue_newwrite(d, "\xFF\xF9", 2);
               }
             } else {
-              queue_newwrite(d, msgstr, msglen); /* send message */
+              queue_newwrite_text(d, msgstr, msglen, msgshare);
             }
           }
         }
@@ -1393,11 +1321,11 @@ notify_internal(dbref target, dbref executor, dbref speaker, dbref *skips,
           /* send lineending */
           if ((output_type & MSG_PUEBLO)) {
             if (flags & NA_NOPENTER)
-              queue_newwrite(d, "\n", 1);
+              queue_newwrite_eol(d, "\n");
             else
-              queue_newwrite(d, "<BR>\n", 5);
+              queue_newwrite_eol(d, "<BR>\n");
           } else {
-            queue_newwrite(d, "\r\n", 2);
+            queue_newwrite_eol(d, "\r\n");
           }
         }
       } /* for loop */
@@ -1440,7 +1368,7 @@ notify_internal(dbref target, dbref executor, dbref speaker, dbref *skips,
     } else {
       notify_anything(executor, speaker, na_one, &Owner(target), NULL,
                       PUPPET_FLAGS(flags) | nospoof_flags, buff,
-                      (prefix ? (char *) prefix->strs[0].message : NULL), loc,
+                      (prefix ? (char *) prefix->message : NULL), loc,
                       NULL);
     }
   }
@@ -1456,6 +1384,8 @@ notify_internal(dbref target, dbref executor, dbref speaker, dbref *skips,
     /* Figure out which message to use for listens */
     if (cache)
       msgstr = notify_makestring(&message->messages, MSG_INTERNAL);
+    else if (fmsg)
+      msgstr = fmsg->message;
     else
       msgstr = formatmsg = notify_makestring_nocache(buff, MSG_INTERNAL);
 
@@ -1541,7 +1471,7 @@ notify_internal(dbref target, dbref executor, dbref speaker, dbref *skips,
        * unlike normal @listen, don't pass the message on.
        */
 
-      if (has_flag_by_name(target, "MONITOR", NOTYPE)) {
+      if (HasCoreFlag(target, FH_MONITOR, NOTYPE)) {
         if (!listen_lock_checked)
           listen_lock_passed = eval_lock(speaker, target, Listen_Lock);
         if (listen_lock_passed) {
@@ -1787,7 +1717,7 @@ flag_broadcast(const char *flag1, const char *flag2, const char *fmt, ...)
 slab *text_block_slab = NULL; /**< Slab for 'struct text_block' allocations */
 
 static struct text_block *
-make_text_block(const char *s, int n)
+alloc_text_block(void)
 {
   struct text_block *p;
   if (text_block_slab == NULL) {
@@ -1799,6 +1729,16 @@ make_text_block(const char *s, int n)
   p = slab_malloc(text_block_slab, NULL);
   if (!p)
     mush_panic("Out of memory");
+  p->shared = NULL;
+  p->nxt = NULL;
+  return p;
+}
+
+static struct text_block *
+make_text_block(const char *s, int n)
+{
+  struct text_block *p = alloc_text_block();
+
   p->buf = mush_malloc(n, "text_block_buff");
   if (!p->buf)
     mush_panic("Out of memory");
@@ -1806,10 +1746,71 @@ make_text_block(const char *s, int n)
   memcpy(p->buf, s, n);
   p->nchars = n;
   p->start = p->buf;
-  p->nxt = NULL;
+  output_stats.copied++;
+  output_stats.copied_bytes += n;
   return p;
 }
 
+/** Make a text block that points into shared text.
+ * \param st the shared text.
+ * \param s where in it the block starts.
+ * \param n the length of the block.
+ * \return the new block, holding a reference to st.
+ */
+static struct text_block *
+make_shared_block(struct shared_text *st, const char *s, int n)
+{
+  struct text_block *p = alloc_text_block();
+
+  st->refcount++;
+  p->shared = st;
+  p->buf = NULL;
+  p->start = (char *) s;
+  p->nchars = n;
+  output_stats.shared++;
+  output_stats.shared_bytes += n;
+  return p;
+}
+
+/** Make shared text, with one reference held by the caller.
+ * \param s the text.
+ * \param n its length.
+ * \return the shared text.
+ */
+static struct shared_text *
+make_shared_text(const char *s, int n)
+{
+  struct shared_text *st;
+
+  st = mush_malloc(sizeof(struct shared_text) + n + 1, "shared_text");
+  if (!st)
+    mush_panic("Out of memory");
+  st->refcount = 1;
+  st->len = n;
+  st->utf8[0] = st->utf8[1] = NULL;
+  memcpy(st->text, s, n);
+  st->text[n] = '\0';
+  output_stats.renders++;
+  output_stats.live++;
+  return st;
+}
+
+/** Drop a reference to shared text, freeing it if it was the last.
+ * \param st the shared text.
+ */
+static void
+release_shared_text(struct shared_text *st)
+{
+  if (--st->refcount > 0)
+    return;
+  if (st->utf8[0])
+    release_shared_text(st->utf8[0]);
+  if (st->utf8[1])
+    release_shared_text(st->utf8[1]);
+  output_stats.live--;
+  mush_free(st, "shared_text");
+}
+
 /** Free a text_block structure.
  * \param t pointer to text_block to free.
  */
@@ -1817,12 +1818,33 @@ void
 free_text_block(struct text_block *t)
 {
   if (t) {
-    if (t->buf)
+    if (t->shared)
+      release_shared_text(t->shared);
+    else if (t->buf)
       mush_free(t->buf, "text_block_buff");
     slab_free(text_block_slab, t);
   }
 }
 
+/** Show output queue allocation counts.
+ * \param player the player to show them to.
+ */
+void
+notify_output_stats(dbref player)
+{
+  unsigned long blocks = output_stats.copied + output_stats.shared;
+
+  notify_format(player, "Output:    %10lu blocks    (%10lu shared, %3lu%%)",
+                blocks, output_stats.shared,
+                blocks ? output_stats.shared * 100 / blocks : 0);
+  notify_format(player, "           %10lu copied    (%10lu bytes)",
+                output_stats.copied, output_stats.copied_bytes);
+  notify_format(player, "           %10lu bytes shared, from %lu renderings",
+                output_stats.shared_bytes, output_stats.renders);
+  notify_format(player, "           %10lu renderings in use",
+                output_stats.live);
+}
+
 /** Initialize a text_queue structure.
  */
 void
@@ -1857,6 +1879,69 @@ add_to_queue(struct text_queue *q, const char *b, int n)
   }
 }
 
+/** Add shared text to the end of a queue, without copying it.
+ * \param q pointer to text_queue.
+ * \param st the shared text.
+ * \param b where in it to start.
+ * \param n how many bytes to add.
+ */
+static void
+add_shared_to_queue(struct text_queue *q, struct shared_text *st,
+                    const char *b, int n)
+{
+  struct text_block *p;
+
+  if (n == 0 || !q)
+    return;
+
+  p = make_shared_block(st, b, n);
+
+  if (!q->head) {
+    q->head = q->tail = p;
+  } else {
+    q->tail->nxt = p;
+    q->tail = p;
+  }
+}
+
+/** Join the blocks at the head of a queue into one, so they can be
+ * sent with a single write.
+ * \param q pointer to text_queue.
+ * \param max the most bytes to join.
+ */
+void
+coalesce_queue(struct text_queue *q, int max)
+{
+  struct text_block *p, *cur, *next;
+  char *bp;
+  int n = 0, count = 0;
+
+  for (cur = q->head; cur && n + cur->nchars <= max; cur = cur->nxt) {
+    n += cur->nchars;
+    count++;
+  }
+  if (count < 2)
+    return;
+
+  p = alloc_text_block();
+  p->buf = mush_malloc(n, "text_block_buff");
+  if (!p->buf)
+    mush_panic("Out of memory");
+  p->start = bp = p->buf;
+  p->nchars = n;
+
+  for (cur = q->head; count--; cur = next) {
+    next = cur->nxt;
+    memcpy(bp, cur->start, cur->nchars);
+    bp += cur->nchars;
+    free_text_block(cur);
+  }
+  p->nxt = cur;
+  q->head = p;
+  if (!cur)
+    q->tail = p;
+}
+
 static int
 flush_queue(struct text_queue *q, int n)
 {
@@ -1922,7 +2007,7 @@ int
 queue_write(DESC *d, const char *b, int n)
 {
   char buff[BUFFER_LEN];
-  const char *s;
+  char rendered[BUFFER_LEN];
   int output_type;
   PUEBLOBUFF;
   size_t len;
@@ -1930,8 +2015,8 @@ queue_write(DESC *d, const char *b, int n)
   if ((n == 2) && (b[0] == '\r') && (b[1] == '\n')) {
     return queue_eol(d);
   }
-  if (n > BUFFER_LEN)
-    n = BUFFER_LEN;
+  if (n >= BUFFER_LEN)
+    n = BUFFER_LEN - 1;
 
   memcpy(buff, b, n);
   buff[n] = '\0';
@@ -1942,12 +2027,11 @@ queue_write(DESC *d, const char *b, int n)
     PUSE;
     tag_wrap("SAMP", NULL, buff);
     PEND;
-    s = render_string(pbuff, output_type);
+    len = render_string(pbuff, output_type, rendered);
   } else {
-    s = render_string(buff, output_type);
+    len = render_string(buff, output_type, rendered);
   }
-  len = strlen(s);
-  queue_newwrite(d, s, len);
+  queue_newwrite(d, rendered, len);
 
   return len;
 }
@@ -1968,6 +2052,51 @@ queue_newwrite(DESC *d, const char *b, int n)
 
 int
 queue_newwrite_channel(DESC *d, const char *b, int n, char ch)
+{
+  return queue_newwrite_real(d, b, n, ch, NULL);
+}
+
+/** Add text that may be shared to the queue associated with a given
+ * descriptor. If it is, whatever isn't sent right away is queued by
+ * reference instead of being copied.
+ * \param d pointer to descriptor to receive the text.
+ * \param b text to send.
+ * \param n length of b.
+ * \param st the shared text b is, or NULL.
+ * \return number of characters added.
+ */
+static int
+queue_newwrite_text(DESC *d, const char *b, int n, struct shared_text *st)
+{
+  return queue_newwrite_real(d, b, n, WEBSOCKET_CHANNEL_AUTO, st);
+}
+
+/** Add a line ending to the queue associated with a given descriptor.
+ * The common ones are shared by every queue, and never freed.
+ * \param d pointer to descriptor to receive the text.
+ * \param eol the line ending.
+ * \return number of characters added.
+ */
+static int
+queue_newwrite_eol(DESC *d, const char *eol)
+{
+  static struct shared_text *eols[3] = {NULL, NULL, NULL};
+  static const char *const texts[3] = {"\r\n", "<BR>\n", "\n"};
+  int i;
+
+  for (i = 0; i < 3; i++) {
+    if (strcmp(eol, texts[i]) == 0) {
+      if (!eols[i])
+        eols[i] = make_shared_text(texts[i], strlen(texts[i]));
+      return queue_newwrite_text(d, eols[i]->text, eols[i]->len, eols[i]);
+    }
+  }
+  return queue_newwrite(d, eol, strlen(eol));
+}
+
+static int
+queue_newwrite_real(DESC *d, const char *b, int n, char ch,
+                    struct shared_text *st)
 {
 
   int space;
@@ -1985,10 +2114,26 @@ queue_newwrite_channel(DESC *d, const char *b, int n, char ch)
 
   if (d->conn_flags & CONN_UTF8) {
     int utf8bytes = 0;
-    utf8 = latin1_to_utf8_tn(b, n, &utf8bytes, d->conn_flags & CONN_TELNET,
-                             "string");
-    b = utf8;
-    n = utf8bytes;
+    int telnet = (d->conn_flags & CONN_TELNET) ? 1 : 0;
+
+    if (st && st->utf8[telnet]) {
+      /* Already converted for someone else */
+      st = st->utf8[telnet];
+    } else {
+      utf8 = latin1_to_utf8_tn(b, n, &utf8bytes, telnet, "string");
+      if (st) {
+        st = st->utf8[telnet] = make_shared_text(utf8, utf8bytes);
+        mush_free(utf8, "string");
+        utf8 = NULL;
+      } else {
+        b = utf8;
+        n = utf8bytes;
+      }
+    }
+    if (st) {
+      b = st->text;
+      n = st->len;
+    }
   }
 
   /*
@@ -1997,10 +2142,14 @@ queue_newwrite_channel(DESC *d, const char *b, int n, char ch)
    */
   if ((d->conn_flags & CONN_WEBSOCKETS)) {
     /* TODO: Uses a static buffer; probably safe in this case. */
-    to_websocket_frame(&b, &n, ch);
+    to_websocket_frame(d, &b, &n, ch);
+    st = NULL;
   }
 
-  if (d->source != CS_OPENSSL_SOCKET && !d->output.head) {
+  /* WebSocket frames are always queued, so that everything a pass of the
+   * game loop sends a client goes out in one write. */
+  if (d->source != CS_OPENSSL_SOCKET && !d->output.head && !MCCPOutput(d) &&
+      !(d->conn_flags & CONN_WEBSOCKETS)) {
     /* If there's no data already buffered to write out, try writing
        directly to the socket. Add whatever's left to the buffer to
        queue for later. */
@@ -2044,7 +2193,18 @@ queue_newwrite_channel(DESC *d, const char *b, int n, char ch)
   if (space < SPILLOVER_THRESHOLD) {
     process_output(d);
     space = MAX_OUTPUT - d->output_size - n;
-    if (space < 0) {
+    if (space < 0 && WSDeflate(d)) {
+      /* Each frame is compressed against the ones before it, so none can
+       * be dropped without the client losing its place in the stream.
+       * Close the connection instead. */
+      queue_websocket_close(d, WEBSOCKET_CLOSE_TOO_BIG);
+      d->conn_flags |= CONN_SHUTDOWN | CONN_NOWRITE;
+      d->closer = GOD;
+      d->close_reason = "output overflow";
+      if (utf8)
+        mush_free(utf8, "string");
+      return 0;
+    } else if (space < 0) {
 #ifdef HAVE_SSL
       if (d->ssl) {
         /* Now we have a problem, as SSL works in blocks and you can't
@@ -2056,7 +2216,10 @@ queue_newwrite_channel(DESC *d, const char *b, int n, char ch)
         d->output_size -= flush_queue(&d->output, -space);
     }
   }
-  add_to_queue(&d->output, b, n);
+  if (st)
+    add_shared_to_queue(&d->output, st, b, n);
+  else
+    add_to_queue(&d->output, b, n);
   d->output_size += n;
   if (utf8)
     mush_free(utf8, "string");
@@ -2071,9 +2234,9 @@ int
 queue_eol(DESC *d)
 {
   if ((d->conn_flags & CONN_HTML))
-    return queue_newwrite(d, "<BR>\n", 5);
+    return queue_newwrite_eol(d, "<BR>\n");
   else
-    return queue_newwrite(d, "\r\n", 2);
+    return queue_newwrite_eol(d, "\r\n");
 }
 
 /** Add a string and an end-of-line to a descriptor's text queue.
@@ -2103,13 +2266,14 @@ queue_string_eol(DESC *d, const char *fmt, ...)
 int
 queue_string(DESC *d, const char *s)
 {
-  const char *rendered;
+  char rendered[BUFFER_LEN];
   int output_type;
   int ret;
+  size_t len;
 
   output_type = notify_type(d);
-  rendered = render_string(s, output_type);
-  ret = queue_newwrite(d, rendered, strlen(rendered));
+  len = render_string(s, output_type, rendered);
+  ret = queue_newwrite(d, rendered, len);
 
   return ret;
 }
@@ -2146,3 +2310,89 @@ freeqs(DESC *d)
   d->raw_input_at = 0;
 }
 
+TEST_GROUP(shared_text)
+{
+  DESC a, b;
+  struct shared_text *st;
+  unsigned long live = output_stats.live;
+
+  memset(&a, 0, sizeof a);
+  a.source = CS_OPENSSL_SOCKET;
+  init_text_queue(&a.output);
+  b = a;
+
+  st = make_shared_text("Hello, room.", 12);
+  queue_newwrite_text(&a, st->text, st->len, st);
+  queue_newwrite_text(&b, st->text, st->len, st);
+  TEST("shared_text.1", a.output.head && a.output.head->shared == st &&
+                          b.output.head->start == st->text &&
+                          st->refcount == 3 && a.output_size == 12);
+  queue_newwrite_eol(&a, "\r\n");
+  queue_newwrite_eol(&b, "\r\n");
+  TEST("shared_text.2", a.output.tail->shared &&
+                          a.output.tail->shared == b.output.tail->shared &&
+                          !memcmp(a.output.tail->start, "\r\n", 2));
+  release_shared_text(st);
+  freeqs(&a);
+  TEST("shared_text.3", st->refcount == 1 && b.output.head->nchars == 12);
+  freeqs(&b);
+
+  /* UTF-8 connections share a converted copy */
+  a.conn_flags = b.conn_flags = CONN_UTF8;
+  st = make_shared_text("caf\xe9", 4);
+  queue_newwrite_text(&a, st->text, st->len, st);
+  queue_newwrite_text(&b, st->text, st->len, st);
+  TEST("shared_text.4", st->utf8[0] && a.output.head->shared == st->utf8[0] &&
+                          b.output.head->shared == st->utf8[0] &&
+                          a.output.head->nchars == 5 &&
+                          !memcmp(a.output.head->start, "caf\xc3\xa9", 5));
+  release_shared_text(st);
+  freeqs(&a);
+  freeqs(&b);
+  /* The three line endings are kept */
+  TEST("shared_text.5", output_stats.live <= live + 1);
+}
+
+TEST_GROUP(render_cache)
+{
+  struct notify_message_group group;
+  struct notify_message *f;
+  struct shared_text *sa, *sb;
+  const char *a, *b;
+  char buff[BUFFER_LEN];
+  size_t len;
+  unsigned long renders = output_stats.renders;
+  unsigned long live = output_stats.live;
+  int i;
+
+  len = render_string("caf\xe9", MSG_PLAYER | MSG_STRIPACCENTS, buff);
+  TEST("render_cache.1", len == 4 && !strcmp(buff, "cafe"));
+
+  /* Clients that would see the same text share one rendering */
+  init_notify_message_group(&group);
+  init_notify_message(&group.messages, "caf\xe9 <b>");
+  a = notify_makestring_real(&group.messages,
+                             MSG_PLAYER | MSG_PUEBLO | MSG_TELNET, &sa);
+  b = notify_makestring_real(&group.messages,
+                             MSG_PLAYER | MSG_PUEBLO | MSG_XTERM256, &sb);
+  TEST("render_cache.2", a == b && sa == sb && sa->text == a &&
+                           output_stats.renders == renders + 1 &&
+                           !strcmp(a, "caf&eacute; &lt;b&gt;"));
+  b = notify_makestring_real(&group.messages,
+                             MSG_PLAYER | MSG_PUEBLO | MSG_WEBSOCKETS, &sb);
+  TEST("render_cache.3", a == b && output_stats.renders == renders + 1);
+  b = notify_makestring_real(&group.messages, MSG_INTERNAL, &sb);
+  TEST("render_cache.4", b == group.messages.message && !sb);
+
+  /* Formatted messages are cached by their text, up to a limit */
+  f = notify_formatted(&group, "formatted");
+  TEST("render_cache.5", f && f == notify_formatted(&group, "formatted") &&
+                           group.nformatted == 1);
+  for (i = 0; i < FORMAT_CACHE_SIZE; i++) {
+    snprintf(buff, sizeof buff, "formatted %d", i);
+    f = notify_formatted(&group, buff);
+  }
+  TEST("render_cache.6", !f && group.nformatted == FORMAT_CACHE_SIZE);
+  free_notify_message_group(&group);
+  TEST("render_cache.7", output_stats.live == live);
+}
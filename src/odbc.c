@@ -18,6 +18,8 @@ SQLRETURN retcode;
 SQLHENV henv;
 SQLHDBC hdbc;
 
+static bool odbc_connected = false; /**< Has ODBC_Init() connected? */
+
 // ODBC_FreeQuery
 // Free the memory used by an ODBC_Query structure.
 //
@@ -383,11 +385,15 @@ ODBC_ProcessError(SQLRETURN sqlreturn, SQLHANDLE handle)
 }
 
 // ODBC_Init
-// Initialize the ODBC connection
+// Initialize the ODBC connection. Once connected, later calls keep
+// the connection that's already open.
 //
 void
 ODBC_Init(void)
 {
+  if (odbc_connected)
+    return;
+
   retcode = SQLAllocHandle(SQL_HANDLE_ENV, SQL_NULL_HANDLE, &henv);
 
   // Set the ODBC version environment attribute
@@ -414,6 +420,8 @@ ODBC_Init(void)
           0,                    /* Length of output connect string */
           SQL_DRIVER_NOPROMPT); /* Don’t display a prompt window */
         HandleDiagnosticRecord(hdbc, SQL_HANDLE_DBC, retcode);
+        odbc_connected =
+          (retcode == SQL_SUCCESS || retcode == SQL_SUCCESS_WITH_INFO);
         // Allocate statement handle
       }
     }
@@ -293,6 +293,29 @@ ODBC_MUSH_LoadAllObjects(void)
   
 }
 
+// ODBC_MUSH_CountObjects
+// Count the objects kept in the database, without loading them
+// Returns:
+// int - -1 if the database can't be reached, the count if it can
+int
+ODBC_MUSH_CountObjects(void)
+{
+  ODBC_Query *q;
+  ODBC_Result *res;
+  int count;
+
+  q = ODBC_NewQuery("object", 1, NULL, ODBC_GET);
+  q->fields[0].name = "COUNT(*)";
+  q->fields[0].type = ODBC_INT;
+  res = ODBC_ExecuteQuery(q);
+  ODBC_FreeQuery(q);
+  if (res == NULL)
+    return -1;
+  count = res->fields[0].iValue;
+  ODBC_FreeResult(res);
+  return count;
+}
+
 // ODBC_MUSH_WriteObject
 // Write an object to the database
 // Returns 1 on success, 0 on failure
@@ -37,6 +37,7 @@
 #include "mymalloc.h"
 #include "mypcre.h"
 #include "notify.h"
+#include "profile.h"
 #include "strtree.h"
 #include "strutil.h"
 #include "tests.h"
@@ -2087,6 +2088,7 @@ process_expression(char *buff, char **bp, char const **str, dbref executor,
         LT_TRACE,
         "CPU time limit exceeded. enactor=#%d executor=#%d caller=#%d code=%s",
         enactor, executor, caller, *str);
+      profile_limit_hit();
     }
     return 1;
   }
@@ -3136,9 +3138,11 @@ process_expression(char *buff, char **bp, char const **str, dbref executor,
             safe_integer(nfargs, buff, bp);
           } else {
             char *fbuff, *fbp;
+            int prof;
 
             global_fun_recursions++;
             pe_info->fun_recursions++;
+            prof = PROFILE_ENTER(PROFILE_FUNCTION, NOTHING, fp->name);
             if (fp->flags & FN_LOCALIZE) {
               pe_regs =
                 pe_regs_localize(pe_info, PE_REGS_LOCALQ, "process_expression");
@@ -3205,6 +3209,7 @@ process_expression(char *buff, char **bp, char const **str, dbref executor,
             else
               *bp = fbp;
 
+            PROFILE_LEAVE(prof);
             if (pe_regs) {
               pe_regs_restore(pe_info, pe_regs);
               pe_regs_free(pe_regs);
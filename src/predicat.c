@@ -1539,17 +1539,16 @@ grep_util(dbref player, dbref thing, char *attrs, char *findstr, char *buff,
   if (flags & GREP_REGEXP) {
     /* regexp grep */
     struct regrep_data rgd;
+    struct cached_regexp cre;
     int errcode;
-    PCRE2_SIZE erroffset;
     int reflags = re_compile_flags;
 
     if (flags & GREP_NOCASE) {
       reflags |= PCRE2_CASELESS;
     }
 
-    if ((rgd.re = pcre2_compile((const PCRE2_UCHAR *) cleanfind,
-                                PCRE2_ZERO_TERMINATED, reflags, &errcode,
-                                &erroffset, re_compile_ctx)) == NULL) {
+    if (!re_cache_get(&cre, cleanfind, PCRE2_ZERO_TERMINATED, reflags,
+                      &errcode)) {
       char errstr[120];
       pcre2_get_error_message(errcode, (PCRE2_UCHAR *) errstr, sizeof errstr);
       /* Matching error. */
@@ -1561,9 +1560,8 @@ grep_util(dbref player, dbref thing, char *attrs, char *findstr, char *buff,
       }
       return 0;
     }
-    ADD_CHECK("pcre");
-    pcre2_jit_compile(rgd.re, PCRE2_JIT_COMPLETE);
-    rgd.md = pcre2_match_data_create_from_pattern(rgd.re, NULL);
+    rgd.re = cre.re;
+    rgd.md = cre.md;
     rgd.buff = buff;
     rgd.bp = bp;
     rgd.count = 0;
@@ -1575,9 +1573,7 @@ grep_util(dbref player, dbref thing, char *attrs, char *findstr, char *buff,
       atr_iter_get(player, thing, attrs, AIG_NONE, regrep_helper,
                    (void *) &rgd);
     }
-    pcre2_code_free(rgd.re);
-    pcre2_match_data_free(rgd.md);
-    DEL_CHECK("pcre");
+    re_cache_put(&cre);
 
     return rgd.count;
   } else {
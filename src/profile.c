@@ -0,0 +1,529 @@
+/**
+ * \file profile.c
+ *
+ * \brief The softcode profiler.
+ *
+ * While the profiler is running, queue entries, ufuns, \@functions and
+ * function calls are timed, and their wall clock time, CPU time, call
+ * counts and memory allocations are charged to the attribute (as
+ * "#dbref/ATTR") or function (as "NAME()") they belong to. The stack of
+ * names is also kept, so the time spent in each distinct call path can be
+ * written out in the collapsed-stack format used by flame graph tools.
+ *
+ * When it isn't running, each hook costs one test of profile_active.
+ */
+
+#include "copyrite.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#ifdef HAVE_SYS_TIME_H
+#include <sys/time.h>
+#endif
+
+#include "conf.h"
+#include "dbdefs.h"
+#include "externs.h"
+#include "function.h"
+#include "htab.h"
+#include "log.h"
+#include "mushtype.h"
+#include "mymalloc.h"
+#include "notify.h"
+#include "parse.h"
+#include "profile.h"
+#include "strutil.h"
+#include "tests.h"
+
+/** Counters for one attribute or function */
+struct prof_entry {
+  char *name;           /**< #dbref/ATTR or NAME() */
+  unsigned long calls;  /**< Number of times it was entered */
+  uint64_t total;       /**< Wall clock ns, including callees */
+  uint64_t self;        /**< Wall clock ns, not including callees */
+  uint64_t cpu_total;   /**< CPU ns, including callees */
+  uint64_t cpu_self;    /**< CPU ns, not including callees */
+  uint64_t allocs;      /**< Allocations, not including callees */
+  unsigned long limits; /**< Times the CPU limit was hit while active */
+  int active;           /**< How many frames for it are on the stack */
+};
+
+/** A frame on the profiler's stack */
+struct prof_frame {
+  struct prof_entry *entry; /**< What the frame is charged to */
+  uint64_t start;           /**< Wall clock time it started */
+  uint64_t cpu_start;       /**< CPU time it started */
+  uint64_t allocs_start;    /**< mush_allocations when it started */
+  uint64_t child;           /**< Wall clock time spent in callees */
+  uint64_t cpu_child;       /**< CPU time spent in callees */
+  uint64_t allocs_child;    /**< Allocations made by callees */
+  size_t path_len;          /**< Length of prof_path before this frame */
+};
+
+#define PROF_MAX_DEPTH 250 /**< Deeper frames are charged to their parent */
+#define PROF_PATH_LEN 8192 /**< Longer stacks are truncated */
+
+/* A handle from profile_enter() holds the run it belongs to above the
+ * frame's depth, so a frame begun before the profiler was restarted
+ * can't close frames of the new run. */
+#define PROF_HANDLE_SHIFT 8 /**< Must have room for PROF_MAX_DEPTH */
+#define PROF_HANDLE(depth)                                                     \
+  ((int) ((prof_generation << PROF_HANDLE_SHIFT) | (depth)))
+#define PROF_HANDLE_DEPTH(frame) ((frame) & ((1 << PROF_HANDLE_SHIFT) - 1))
+
+bool profile_active = 0; /**< Is the profiler running? */
+
+static HASHTAB prof_entries; /**< prof_entry structs by name */
+static HASHTAB prof_stacks;  /**< Self time (uint64_t) by stack */
+static bool prof_init = 0;
+static struct prof_frame prof_stack[PROF_MAX_DEPTH];
+static int prof_depth = 0;
+static unsigned int prof_generation = 0; /**< Bumped for each run */
+static char prof_path[PROF_PATH_LEN];
+static size_t prof_path_len = 0;
+static uint64_t prof_started = 0; /**< Wall clock time the run started */
+static uint64_t prof_elapsed = 0; /**< Length of the last finished run */
+
+static void prof_free(void *);
+static uint64_t prof_now(bool cpu);
+static void prof_clear(void);
+static const char *prof_dump(void);
+static int prof_cmp(const void *, const void *);
+
+static void
+prof_free(void *data)
+{
+  struct prof_entry *e = data;
+
+  if (e->name)
+    mush_free(e->name, "profile.name");
+  mush_free(e, "profile.entry");
+}
+
+/* Nanoseconds on the monotonic clock, or of CPU time used by the process */
+static uint64_t
+prof_now(bool cpu)
+{
+#ifdef CLOCK_PROCESS_CPUTIME_ID
+  struct timespec ts;
+
+  clock_gettime(cpu ? CLOCK_PROCESS_CPUTIME_ID : CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#else
+  struct timeval tv;
+
+  if (cpu)
+    return (uint64_t) clock() * (1000000000ULL / CLOCKS_PER_SEC);
+  penn_gettimeofday(&tv);
+  return (uint64_t) tv.tv_sec * 1000000000ULL + tv.tv_usec * 1000ULL;
+#endif
+}
+
+static void
+prof_clear(void)
+{
+  if (!prof_init) {
+    hash_init(&prof_entries, 256, prof_free);
+    hash_init(&prof_stacks, 256, NULL);
+    prof_init = 1;
+  } else {
+    uint64_t *n;
+    for (n = hash_firstentry(&prof_stacks); n; n = hash_nextentry(&prof_stacks))
+      mush_free(n, "profile.stack");
+    hashflush(&prof_entries, 256);
+    hashflush(&prof_stacks, 256);
+  }
+  prof_depth = 0;
+  prof_path_len = 0;
+  prof_path[0] = '\0';
+  prof_elapsed = 0;
+  /* Stays positive when shifted, so handles are never 0 or negative */
+  prof_generation = (prof_generation + 1) & (INT_MAX >> PROF_HANDLE_SHIFT);
+}
+
+/** Start a profiled frame.
+ * Use PROFILE_ENTER() instead, which doesn't make the call at all when
+ * the profiler is stopped.
+ * \param type what kind of frame this is.
+ * \param thing the object the attribute is on, or the executor of a
+ * command. For attributes, NOTHING means name is already "#dbref/ATTR".
+ * \param name the attribute or function name.
+ * \return a handle for profile_leave(), or 0 if nothing was pushed.
+ */
+int
+profile_enter(enum profile_type type, dbref thing, const char *name)
+{
+  char key[BUFFER_LEN];
+  struct prof_entry *e;
+  struct prof_frame *f;
+  size_t len;
+  uint64_t allocs = mush_allocations;
+
+  if (!profile_active || prof_depth >= PROF_MAX_DEPTH)
+    return 0;
+
+  switch (type) {
+  case PROFILE_COMMAND:
+    snprintf(key, sizeof key, "#%d(command)", thing);
+    break;
+  case PROFILE_ATTRIBUTE:
+    if (thing != NOTHING)
+      snprintf(key, sizeof key, "#%d/%s", thing, name);
+    else if (!strncasecmp(name, "#LAMBDA/", 8))
+      mush_strncpy(key, "#LAMBDA", sizeof key);
+    else
+      snprintf(key, sizeof key, "%s", name);
+    break;
+  case PROFILE_FUNCTION:
+    snprintf(key, sizeof key, "%s()", name);
+    break;
+  }
+
+  e = hashfind(key, &prof_entries);
+  if (!e) {
+    e = mush_malloc_zero(sizeof *e, "profile.entry");
+    e->name = mush_strdup(key, "profile.name");
+    hashadd(key, e, &prof_entries);
+  }
+  e->calls++;
+  e->active++;
+
+  f = &prof_stack[prof_depth++];
+  f->entry = e;
+  f->child = f->cpu_child = f->allocs_child = 0;
+  f->path_len = prof_path_len;
+  len = strlen(key);
+  if (prof_path_len + len + 2 < sizeof prof_path) {
+    if (prof_path_len)
+      prof_path[prof_path_len++] = ';';
+    memcpy(prof_path + prof_path_len, key, len + 1);
+    prof_path_len += len;
+  }
+  /* The profiler's own allocations aren't charged to anything */
+  mush_allocations = allocs;
+  f->allocs_start = allocs;
+  f->cpu_start = prof_now(1);
+  f->start = prof_now(0);
+  return PROF_HANDLE(prof_depth);
+}
+
+/** Finish a profiled frame, and any left open inside it.
+ * \param frame the handle returned by profile_enter().
+ */
+void
+profile_leave(int frame)
+{
+  uint64_t now, cpu_now, allocs_now, wall, cpu, allocs;
+  uint64_t *n;
+  struct prof_frame *f;
+  struct prof_entry *e;
+  int depth = PROF_HANDLE_DEPTH(frame);
+
+  /* The profiler was stopped, or restarted, since the frame began */
+  if (frame != PROF_HANDLE(depth) || depth > prof_depth)
+    return;
+  now = prof_now(0);
+  cpu_now = prof_now(1);
+  allocs_now = mush_allocations;
+  while (prof_depth >= depth) {
+    f = &prof_stack[--prof_depth];
+    e = f->entry;
+    wall = now - f->start;
+    cpu = cpu_now - f->cpu_start;
+    allocs = allocs_now - f->allocs_start;
+    if (--e->active == 0) {
+      /* Only the outermost of a recursive set counts toward the total */
+      e->total += wall;
+      e->cpu_total += cpu;
+    }
+    e->self += wall - f->child;
+    e->cpu_self += cpu - f->cpu_child;
+    e->allocs += allocs - f->allocs_child;
+
+    n = hashfind(prof_path, &prof_stacks);
+    if (!n) {
+      n = mush_malloc_zero(sizeof *n, "profile.stack");
+      hashadd(prof_path, n, &prof_stacks);
+    }
+    *n += wall - f->child;
+    prof_path_len = f->path_len;
+    prof_path[prof_path_len] = '\0';
+
+    if (prof_depth > 0) {
+      prof_stack[prof_depth - 1].child += wall;
+      prof_stack[prof_depth - 1].cpu_child += cpu;
+      prof_stack[prof_depth - 1].allocs_child += allocs;
+    }
+  }
+  mush_allocations = allocs_now;
+}
+
+/** Note that the CPU time limit was hit.
+ * Every attribute and function on the stack is charged with it, and the
+ * stack is logged, so it's clear which code used up the time.
+ */
+void
+profile_limit_hit(void)
+{
+  int i;
+
+  if (!profile_active || !prof_depth)
+    return;
+  for (i = 0; i < prof_depth; i++)
+    prof_stack[i].entry->limits++;
+  do_rawlog(LT_TRACE, "CPU time limit exceeded in %s", prof_path);
+}
+
+/* Write the collapsed stacks out to the log directory */
+static const char *
+prof_dump(void)
+{
+  static char filename[FILE_PATH_LEN];
+  const char *slash;
+  const char *path;
+  uint64_t *n;
+  FILE *fp;
+
+  slash = strrchr(ERRLOG, '/');
+  if (slash)
+    snprintf(filename, sizeof filename, "%.*s/profile.folded",
+             (int) (slash - ERRLOG), ERRLOG);
+  else
+    mush_strncpy(filename, "profile.folded", sizeof filename);
+  fp = fopen(filename, "w");
+  if (!fp) {
+    do_rawlog(LT_ERR, "Couldn't open %s: %s", filename, strerror(errno));
+    return NULL;
+  }
+  for (path = hash_firstentry_key(&prof_stacks); path;
+       path = hash_nextentry_key(&prof_stacks)) {
+    n = hashfind(path, &prof_stacks);
+    if (*n >= 1000)
+      fprintf(fp, "%s %llu\n", path, (unsigned long long) (*n / 1000));
+  }
+  fclose(fp);
+  return filename;
+}
+
+/** Start (or restart) the profiler, throwing away any earlier results.
+ * \param player the enactor.
+ */
+void
+profile_start(dbref player)
+{
+  prof_clear();
+  prof_started = prof_now(0);
+  profile_active = 1;
+  notify(player, T("Profiler started."));
+}
+
+/** Stop the profiler, keeping its results for \@profile/report.
+ * \param player the enactor.
+ */
+void
+profile_stop(dbref player)
+{
+  const char *file;
+
+  if (!profile_active) {
+    notify(player, T("The profiler isn't running."));
+    return;
+  }
+  profile_active = 0;
+  prof_elapsed = prof_now(0) - prof_started;
+  /* Frames still open never finish, and aren't counted */
+  prof_depth = 0;
+  prof_path_len = 0;
+  prof_path[0] = '\0';
+  file = prof_dump();
+  if (file)
+    notify_format(player, T("Profiler stopped. Call stacks written to %s."),
+                  file);
+  else
+    notify(player, T("Profiler stopped."));
+}
+
+static int
+prof_cmp(const void *a, const void *b)
+{
+  const struct prof_entry *x = *(const struct prof_entry **) a;
+  const struct prof_entry *y = *(const struct prof_entry **) b;
+
+  if (x->self != y->self)
+    return x->self > y->self ? -1 : 1;
+  return strcmp(x->name, y->name);
+}
+
+/* Results sorted by self time, most expensive first. Caller frees. */
+static struct prof_entry **
+prof_sorted(int *count)
+{
+  struct prof_entry **list;
+  struct prof_entry *e;
+  int n = 0;
+
+  *count = 0;
+  if (!prof_init || !prof_entries.entries)
+    return NULL;
+  list = mush_calloc(prof_entries.entries, sizeof *list, "profile.list");
+  for (e = hash_firstentry(&prof_entries); e;
+       e = hash_nextentry(&prof_entries))
+    list[n++] = e;
+  qsort(list, n, sizeof *list, prof_cmp);
+  *count = n;
+  return list;
+}
+
+/** Show the most expensive attributes and functions.
+ * \param player the enactor.
+ * \param count how many to show.
+ */
+void
+profile_report(dbref player, int count)
+{
+  struct prof_entry **list;
+  uint64_t elapsed;
+  int n, i;
+
+  list = prof_sorted(&n);
+  if (!list) {
+    notify(player, T("There are no profiler results."));
+    return;
+  }
+  elapsed = profile_active ? prof_now(0) - prof_started : prof_elapsed;
+  if (count <= 0 || count > n)
+    count = n;
+  notify_format(player, T("Profile of %.3f seconds, %d names:"),
+                elapsed / 1e9, n);
+  notify_format(player, "%10s %10s %10s %10s %10s %6s  %s", T("Calls"),
+                T("Total ms"), T("Self ms"), T("CPU ms"), T("Allocs"),
+                T("Limits"), T("Name"));
+  for (i = 0; i < count; i++)
+    notify_format(player, "%10lu %10.2f %10.2f %10.2f %10llu %6lu  %s",
+                  list[i]->calls, list[i]->total / 1e6, list[i]->self / 1e6,
+                  list[i]->cpu_self / 1e6,
+                  (unsigned long long) list[i]->allocs, list[i]->limits,
+                  list[i]->name);
+  mush_free(list, "profile.list");
+}
+
+/** Say whether the profiler is running.
+ * \param player the enactor.
+ */
+void
+profile_status(dbref player)
+{
+  if (profile_active)
+    notify_format(player,
+                  T("The profiler has been running for %.3f seconds, and has "
+                    "seen %d names."),
+                  (prof_now(0) - prof_started) / 1e9, prof_entries.entries);
+  else
+    notify(player, T("The profiler isn't running."));
+}
+
+/* ARGSUSED */
+FUNCTION(fun_profile)
+{
+  struct prof_entry **list;
+  struct prof_entry *e;
+  int n, i;
+
+  if (nargs == 0 || !*args[0]) {
+    list = prof_sorted(&n);
+    for (i = 0; i < n; i++) {
+      if (i)
+        safe_chr(' ', buff, bp);
+      safe_str(list[i]->name, buff, bp);
+    }
+    if (list)
+      mush_free(list, "profile.list");
+    return;
+  }
+  e = prof_init ? hashfind(args[0], &prof_entries) : NULL;
+  if (!e && prof_init && arglens[0] < BUFFER_LEN - 2) {
+    /* Functions can be given without the parens */
+    char name[BUFFER_LEN];
+    snprintf(name, sizeof name, "%s()", args[0]);
+    e = hashfind(strupper(name), &prof_entries);
+  }
+  if (!e) {
+    safe_str("#-1 NOT PROFILED", buff, bp);
+    return;
+  }
+  safe_format(buff, bp, "%lu %.2f %.2f %.2f %llu %lu", e->calls,
+              e->total / 1e6, e->self / 1e6, e->cpu_self / 1e6,
+              (unsigned long long) e->allocs, e->limits);
+}
+
+TEST_GROUP(profile)
+{
+  char buff[BUFFER_LEN], *bp;
+  const char *args[1];
+  int lens[1];
+  struct prof_entry *a, *f;
+  int outer, inner, fn;
+  bool was_active = profile_active;
+
+  if (was_active)
+    return; /* Don't disturb a profile someone is taking */
+
+  TEST("profile.1", PROFILE_ENTER(PROFILE_FUNCTION, NOTHING, "ADD") == 0);
+  prof_clear();
+  profile_active = 1;
+  outer = PROFILE_ENTER(PROFILE_ATTRIBUTE, 1, "OUTER");
+  fn = PROFILE_ENTER(PROFILE_FUNCTION, NOTHING, "ADD");
+  PROFILE_LEAVE(fn);
+  inner = PROFILE_ENTER(PROFILE_ATTRIBUTE, NOTHING, "#1/OUTER");
+  mush_free(mush_malloc(16, "profile.test"), "profile.test");
+  TEST("profile.2", PROF_HANDLE_DEPTH(inner) == 2 &&
+                      !strcmp(prof_path, "#1/OUTER;#1/OUTER"));
+  /* Leaving the outer frame also closes the recursive one in it */
+  PROFILE_LEAVE(outer);
+  TEST("profile.3", prof_depth == 0 && prof_path_len == 0);
+  PROFILE_LEAVE(inner);
+  a = hashfind("#1/OUTER", &prof_entries);
+  f = hashfind("ADD()", &prof_entries);
+  TEST("profile.4", a && a->calls == 2 && a->active == 0 && a->allocs == 1);
+  TEST("profile.5", f && f->calls == 1 && f->total <= a->total);
+  TEST("profile.6", a && a->total >= a->self);
+  TEST("profile.7", hashfind("#1/OUTER;ADD()", &prof_stacks) &&
+                      hashfind("#1/OUTER;#1/OUTER", &prof_stacks));
+
+  args[0] = "add";
+  lens[0] = 3;
+  bp = buff;
+  fun_profile(NULL, buff, &bp, 1, (char **) args, lens, GOD, GOD, GOD,
+              "PROFILE", NULL, 0);
+  *bp = '\0';
+  TEST("profile.8", !strncmp(buff, "1 ", 2));
+  args[0] = "#1/NOPE";
+  lens[0] = 7;
+  bp = buff;
+  fun_profile(NULL, buff, &bp, 1, (char **) args, lens, GOD, GOD, GOD,
+              "PROFILE", NULL, 0);
+  *bp = '\0';
+  TEST("profile.9", !strcmp(buff, "#-1 NOT PROFILED"));
+  bp = buff;
+  fun_profile(NULL, buff, &bp, 0, (char **) args, lens, GOD, GOD, GOD,
+              "PROFILE", NULL, 0);
+  *bp = '\0';
+  TEST("profile.10",
+       !strcmp(buff, "#1/OUTER ADD()") || !strcmp(buff, "ADD() #1/OUTER"));
+
+  /* A frame left open across a restart doesn't touch the new run's */
+  outer = PROFILE_ENTER(PROFILE_ATTRIBUTE, 1, "OUTER");
+  prof_clear();
+  fn = PROFILE_ENTER(PROFILE_FUNCTION, NOTHING, "ADD");
+  PROFILE_LEAVE(outer);
+  TEST("profile.11", prof_depth == 1 && fn != outer);
+  PROFILE_LEAVE(fn);
+  TEST("profile.12", prof_depth == 0);
+
+  profile_active = 0;
+  prof_clear();
+}
@@ -40,6 +40,7 @@
 #include "mymalloc.h"
 #include "mypcre.h"
 #include "parse.h"
+#include "snapshot.h"
 #include "strutil.h"
 #include "odbc.h"
 
@@ -334,6 +335,7 @@ chown_object(dbref player, dbref thing, dbref newowner, int preserve)
     if (ok_to_zone)
       Zone(thing) = Zone(newowner);
   }
+  search_index_touch(thing);
   clear_flag_internal(thing, "CHOWN_OK");
   if (!preserve || !Wizard(player)) {
     clear_flag_internal(thing, "WIZARD");
@@ -342,6 +344,7 @@ chown_object(dbref player, dbref thing, dbref newowner, int preserve)
     set_flag_internal(thing, "HALT");
     destroy_flag_bitmask("POWER", Powers(thing));
     Powers(thing) = new_flag_bitmask("POWER");
+    snapshot_touch(thing);
     do_halt(thing, "", thing);
   } else {
     if (preserve == 1 && (newowner != player) && Wizard(thing) &&
@@ -462,6 +465,7 @@ do_chzone(dbref player, char const *name, char const *newobj, bool noisy,
   }
   /* everything is okay, do the change */
   Zone(thing) = zone;
+  search_index_touch(thing);
 
   /* If we're not unzoning, and we're working with a non-player object,
    * we'll remove wizard, royalty, inherit, and powers, for security, unless
@@ -479,6 +483,7 @@ do_chzone(dbref player, char const *name, char const *newobj, bool noisy,
     clear_flag_internal(thing, "TRUST");
     destroy_flag_bitmask("POWER", Powers(thing));
     Powers(thing) = new_flag_bitmask("POWER");
+    snapshot_touch(thing);
   } else {
     if (noisy && (zone != NOTHING)) {
       if (Hasprivs(thing))
@@ -519,6 +524,8 @@ af_helper(dbref player, dbref thing, dbref parent __attribute__((__unused__)),
     return 0;
   }
 
+  AttrVersion(thing)++;
+
   /* Clear flags first, then set flags */
   if (af->clrf) {
     AL_FLAGS(atr) &= ~af->clrf;
@@ -565,6 +572,7 @@ copy_attrib_flags(dbref player, dbref target, ATTR *atr, int flags)
   else
     flags &= ~AF_ROOT;
   AL_FLAGS(atr) = flags;
+  AttrVersion(target)++;
 }
 
 /** Set a flag on an attribute.
@@ -1503,6 +1511,7 @@ do_parent(dbref player, char *name, char *parent_name, NEW_PE_INFO *pe_info)
   }
   /* everything is okay, do the change */
   Parent(thing) = parent;
+  search_index_touch(thing);
   if (!AreQuiet(player, thing))
     notify(player, T("Parent changed."));
 }
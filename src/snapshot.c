@@ -0,0 +1,2138 @@
+/**
+ * \file snapshot.c
+ *
+ * \brief Binary database snapshots and their journals.
+ *
+ * The text database is read a character at a time, and every attribute
+ * in it is compressed again as it's added, so a large game takes a long
+ * time to start. A snapshot holds the same objects in a form that can be
+ * memory mapped and used almost as it is:
+ *
+ * \verbatim
+ * header     "PENNSNAP", format version, byte order marker
+ * sections   type, CRC32 of the payload, payload length, payload
+ *   META     server version, save time, db_top, compression scheme, and
+ *            the journal frame it's up to date with
+ *   COMPRESS the state the compressed attribute values depend on
+ *   TABLES   the flag, power and attribute tables, in the text format
+ *   STRINGS  every attribute name, lock type, object name and flag list
+ *   OBJECTS  fixed size object records, each followed by its locks and
+ *            attributes, SNAP_BLOCK objects to a section
+ * \endverbatim
+ *
+ * Attribute values are stored as they are held in memory, compressed,
+ * when the compression scheme can rebuild its state from the COMPRESS
+ * section, and lock keys are stored as compiled bytecode. Loading maps the
+ * file, checks and decodes the OBJECTS sections in worker threads, and
+ * then links everything into the database in one serial pass, since the
+ * name, attribute and chunk tables aren't thread-safe.
+ *
+ * Once there's a snapshot, a checkpoint doesn't write every object
+ * again. The objects that have changed since the last checkpoint (see
+ * snapshot_touch()) are appended to the snapshot's journal,
+ * \<snapshot\>.journal, as a frame:
+ *
+ * \verbatim
+ * header     "PENNJRNL", format version, byte order marker
+ *   JOURNAL  the lineage of the snapshots the journal belongs to
+ * frames
+ *   TABLES   only when the tables have changed
+ *   STRINGS  the strings the frame's objects use
+ *   CHANGED  dbref and object record of each changed object
+ *   COMMIT   frame number, db_top; a frame without one is ignored
+ * \endverbatim
+ *
+ * Frames hold whole objects, so replaying one over any older copy of the
+ * database brings those objects up to date. When the journal grows past
+ * SNAP_COMPACT_PERCENT of the snapshot, the next checkpoint writes a new
+ * snapshot in a forked dump. The journal is moved to
+ * \<snapshot\>.journal.old until that succeeds, and new frames go to a
+ * fresh journal in the meantime. Startup reads the snapshot and replays
+ * the frames newer than it from both journals.
+ *
+ * A snapshot is only read by the server version that wrote it. The text
+ * format is still the one to use for moving a database around.
+ */
+
+#include "copyrite.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#ifdef HAVE_SYS_TIME_H
+#include <sys/time.h>
+#endif
+#ifdef HAVE_SYS_STAT_H
+#include <sys/stat.h>
+#endif
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#if defined(HAVE_PTHREAD_H) && !defined(WIN32)
+#include <pthread.h>
+#endif
+
+#include "attrib.h"
+#include "boolexp.h"
+#include "chunk.h"
+#include "conf.h"
+#include "dbdefs.h"
+#include "dbio.h"
+#include "externs.h"
+#include "flags.h"
+#include "htab.h"
+#include "lock.h"
+#include "log.h"
+#include "map_file.h"
+#include "memcheck.h"
+#include "mushdb.h"
+#include "mushsql.h"
+#include "mymalloc.h"
+#include "snapshot.h"
+#include "strutil.h"
+#include "tests.h"
+#include "version.h"
+
+extern char db_timestamp[];
+extern int loading_db;
+
+#define SNAP_MAGIC "PENNSNAP"   /**< First bytes of every snapshot */
+#define SNAP_JMAGIC "PENNJRNL"  /**< First bytes of every journal */
+#define SNAP_VERSION 2          /**< Version of the snapshot format */
+#define SNAP_ENDIAN 0x01020304U /**< Catches snapshots from other hosts */
+#define SNAP_BLOCK 4096         /**< Objects per OBJECTS or CHANGED section */
+#define SNAP_NONE 0xFFFFFFFFU   /**< String table index for no string */
+#define SNAP_MAX_THREADS 8      /**< Most worker threads used to load */
+/** How big the journals can get, as a percentage of the snapshot, before
+ * a new snapshot is written */
+#define SNAP_COMPACT_PERCENT 50
+
+/** The database flags of a text dump, which describe a snapshot too */
+#define SNAP_DBFLAGS                                                           \
+  (DBF_NO_CHAT_SYSTEM | DBF_WARNINGS | DBF_CREATION_TIMES |                    \
+   DBF_SPIFFY_LOCKS | DBF_NEW_STRINGS | DBF_TYPE_GARBAGE |                     \
+   DBF_SPLIT_IMMORTAL | DBF_NO_TEMPLE | DBF_LESS_GARBAGE | DBF_AF_VISUAL |     \
+   DBF_VALUE_IS_COST | DBF_LINK_ANYWHERE | DBF_NO_STARTUP_FLAG |               \
+   DBF_AF_NODUMP | DBF_NEW_FLAGS | DBF_NEW_POWERS | DBF_POWERS_LOGGED |        \
+   DBF_LABELS | DBF_SPIFFY_AF_ANSI | DBF_HEAR_CONNECT | DBF_NEW_VERSIONS)
+
+/** Section types */
+enum snap_type {
+  SNAP_META = 1,
+  SNAP_COMPRESS,
+  SNAP_TABLES,
+  SNAP_STRINGS,
+  SNAP_OBJECTS,
+  SNAP_JOURNAL,
+  SNAP_CHANGED,
+  SNAP_COMMIT
+};
+
+/** The start of a snapshot or journal file */
+struct snap_header {
+  char magic[8];    /**< SNAP_MAGIC or SNAP_JMAGIC */
+  uint32_t version; /**< SNAP_VERSION */
+  uint32_t endian;  /**< SNAP_ENDIAN, in the writer's byte order */
+};
+
+/** The start of a section. The payload follows, padded to 8 bytes. */
+struct snap_section {
+  uint32_t type; /**< An enum snap_type */
+  uint32_t crc;  /**< CRC32 of the payload */
+  uint64_t len;  /**< Length of the payload, not counting padding */
+};
+
+/** The META section */
+struct snap_meta {
+  char server[32];      /**< VERSION and PATCHLEVEL of the writer */
+  char savedtime[100];  /**< When it was written */
+  char compression[32]; /**< attr_compression of the writer */
+  int32_t db_top;       /**< Number of objects */
+  uint32_t dbflags;     /**< DBF_* flags for the tables */
+  uint32_t dbversion;   /**< NDBF_VERSION of the writer */
+  uint32_t compressed;  /**< Are attribute values stored compressed? */
+  uint64_t lineage;     /**< Lineage of its journals, or 0 for none */
+  uint64_t seq;         /**< Last journal frame it includes */
+};
+
+/** The JOURNAL section at the start of a journal */
+struct snap_journal {
+  uint64_t lineage;    /**< Lineage of the snapshots it goes with */
+  uint32_t compressed; /**< Are attribute values stored compressed? */
+  uint32_t unused;     /**< Padding */
+};
+
+/** Where a journal's first frame starts */
+#define SNAP_JOURNAL_START                                                     \
+  (sizeof(struct snap_header) + sizeof(struct snap_section) +                 \
+   sizeof(struct snap_journal))
+
+/** The COMMIT section at the end of a journal frame */
+struct snap_commit {
+  uint64_t seq;   /**< Frame number */
+  int32_t db_top; /**< db_top when the frame was written */
+  uint32_t count; /**< Number of objects in the frame */
+};
+
+/** An object. It's followed by its locks, then its attributes. */
+struct snap_object {
+  int64_t created;   /**< Creation time */
+  int64_t modified;  /**< Modification time */
+  int32_t location;  /**< Location */
+  int32_t contents;  /**< First object in the contents */
+  int32_t exits;     /**< First exit */
+  int32_t next;      /**< Next object in the list it's in */
+  int32_t parent;    /**< Parent */
+  int32_t owner;     /**< Owner */
+  int32_t zone;      /**< Zone */
+  int32_t pennies;   /**< Pennies */
+  uint32_t type;     /**< TYPE_* */
+  uint32_t warnings; /**< Warnings */
+  uint32_t name;     /**< String index of the name */
+  uint32_t flags;    /**< String index of the flag list */
+  uint32_t powers;   /**< String index of the power list */
+  uint32_t locks;    /**< Number of locks */
+  uint32_t attrs;    /**< Number of attributes */
+};
+
+/** A lock. Its bytecode follows, padded to 4 bytes. */
+struct snap_lock {
+  uint32_t type;   /**< String index of the lock type */
+  int32_t creator; /**< Lock creator */
+  uint32_t flags;  /**< Lock flags */
+  uint32_t derefs; /**< Chunk deref count */
+  uint32_t len;    /**< Length of the bytecode */
+};
+
+/** An attribute. Its value follows, padded to 4 bytes. */
+struct snap_attr {
+  uint32_t name;   /**< String index of the attribute name */
+  int32_t creator; /**< Attribute creator */
+  uint32_t flags;  /**< Attribute flags */
+  uint32_t derefs; /**< Chunk deref count */
+  uint32_t len;    /**< Length of the value */
+};
+
+/** A growable output buffer */
+struct snap_buf {
+  unsigned char *data; /**< The bytes */
+  size_t len;          /**< Bytes used */
+  size_t cap;          /**< Bytes allocated */
+};
+
+/** A string table being read */
+struct snap_strtab {
+  const unsigned char *offsets; /**< String offsets into blob */
+  const char *blob;             /**< The strings */
+  uint32_t nstrings;            /**< Size of the table */
+  object_flag_type *flagsets;   /**< Flag lists already turned into flagsets */
+  object_flag_type *powersets;  /**< The same, for power lists */
+  struct snap_strtab *next;     /**< Next journal frame's table */
+};
+
+/** An object record that's been checked and is waiting to be linked in */
+struct snap_pending {
+  struct snap_object rec;      /**< The record */
+  const unsigned char *extra;  /**< Its locks and attributes */
+  struct snap_strtab *strings; /**< The string table it uses */
+};
+
+/** Everything the loader's worker threads share */
+struct snap_load {
+  const struct snap_section **blocks; /**< OBJECTS sections */
+  int nblocks;                        /**< Number of OBJECTS sections */
+  struct snap_pending *pending;       /**< Decoded records, by dbref */
+  dbref top;                          /**< db_top, as of the last frame */
+  dbref cap;                          /**< Entries allocated in pending */
+  struct snap_strtab strings;         /**< The snapshot's string table */
+  struct snap_strtab *frames;         /**< Journal frames' string tables */
+  bool *failed;                       /**< Set for each bad section */
+};
+
+/** The plain values in an object, as they were at the last frame. These
+ * are set directly all over the server, so they're compared to tell if
+ * they've changed. Names, flags, powers and locks are marked with
+ * snapshot_touch() where they change instead, and attributes bump
+ * attr_version. */
+struct snap_shadow {
+  dbref location;
+  dbref contents;
+  dbref exits;
+  dbref next;
+  dbref parent;
+  dbref owner;
+  dbref zone;
+  int penn;
+  warn_type warnings;
+  int64_t creation_time;
+  int64_t modification_time;
+  uint32_t attr_version;
+  int attrcount;
+  int type;
+};
+
+/** A worker thread's share of the load */
+struct snap_job {
+  struct snap_load *load; /**< The load */
+  int first;              /**< First section to do */
+  int stride;             /**< Do every stride'th section from there */
+};
+
+static uint32_t crc_table[256];
+static bool crc_ready = 0;
+
+static HASHTAB snap_strings;
+static bool snap_strings_ready = 0;
+static struct snap_buf snap_blob, snap_offsets;
+static uint32_t snap_nstrings;
+
+/* The journal being written */
+static char snap_file[FILE_PATH_LEN]; /**< The snapshot it goes with */
+static uint64_t snap_lineage = 0;     /**< Its lineage, 0 if there's none */
+static uint64_t snap_seq = 0;         /**< The last frame written */
+static FILE *snap_jfile = NULL;       /**< The journal */
+static long snap_jlen = 0;            /**< Length of the journal */
+static long snap_oldlen = 0;          /**< Length of the old journal */
+static bool snap_compacting = 0;      /**< Is a new snapshot being written? */
+static struct snap_shadow *snap_shadows = NULL; /**< Objects at last frame */
+static bool *snap_dirty = NULL;      /**< Objects touched since then */
+static dbref snap_nshadows = 0;      /**< Size of those two */
+static uint32_t snap_tables_crc = 0; /**< CRC of the last tables written */
+
+/** Fill in the CRC32 table. */
+static void
+crc_init(void)
+{
+  uint32_t c;
+  int n, k;
+
+  for (n = 0; n < 256; n++) {
+    c = (uint32_t) n;
+    for (k = 0; k < 8; k++)
+      c = (c & 1) ? 0xEDB88320U ^ (c >> 1) : c >> 1;
+    crc_table[n] = c;
+  }
+  crc_ready = 1;
+}
+
+/** CRC32 of a buffer, as used by zlib and gzip. crc_init() must have been
+ * called.
+ */
+static uint32_t
+snap_crc(const unsigned char *p, size_t len)
+{
+  uint32_t c = 0xFFFFFFFFU;
+
+  while (len--)
+    c = crc_table[(c ^ *p++) & 0xFF] ^ (c >> 8);
+  return c ^ 0xFFFFFFFFU;
+}
+
+static void
+sbuf_add(struct snap_buf *b, const void *p, size_t n)
+{
+  if (!n)
+    return;
+  if (b->len + n > b->cap) {
+    size_t cap = b->cap ? b->cap : 65536;
+    while (cap < b->len + n)
+      cap *= 2;
+    b->data = mush_realloc(b->data, cap, "snapshot.buffer");
+    b->cap = cap;
+  }
+  memcpy(b->data + b->len, p, n);
+  b->len += n;
+}
+
+static void
+sbuf_pad(struct snap_buf *b, size_t align)
+{
+  static const unsigned char zeros[8] = {0};
+
+  if (b->len % align)
+    sbuf_add(b, zeros, align - b->len % align);
+}
+
+static void
+sbuf_free(struct snap_buf *b)
+{
+  if (b->data)
+    mush_free(b->data, "snapshot.buffer");
+  b->data = NULL;
+  b->len = b->cap = 0;
+}
+
+/** Write out a file header. */
+static bool
+snap_put_header(FILE *f, const char *magic)
+{
+  struct snap_header h;
+
+  memset(&h, 0, sizeof h);
+  memcpy(h.magic, magic, sizeof h.magic);
+  h.version = SNAP_VERSION;
+  h.endian = SNAP_ENDIAN;
+  return fwrite(&h, sizeof h, 1, f) == 1;
+}
+
+/** Write out a section. */
+static bool
+snap_put_section(FILE *f, enum snap_type type, const void *payload,
+                 size_t len)
+{
+  static const unsigned char zeros[8] = {0};
+  struct snap_section s;
+
+  s.type = type;
+  s.crc = snap_crc(payload, len);
+  s.len = len;
+  if (fwrite(&s, sizeof s, 1, f) != 1)
+    return 0;
+  if (len && fwrite(payload, len, 1, f) != 1)
+    return 0;
+  if (len % 8 && fwrite(zeros, 8 - len % 8, 1, f) != 1)
+    return 0;
+  return 1;
+}
+
+/** Start a new string table to write. */
+static void
+snap_strings_start(void)
+{
+  hashinit(&snap_strings, 4096);
+  snap_strings_ready = 1;
+  snap_nstrings = 0;
+  snap_blob.len = snap_offsets.len = 0;
+}
+
+/** Throw away the string table being written. */
+static void
+snap_strings_done(void)
+{
+  if (snap_strings_ready)
+    hashfree(&snap_strings);
+  snap_strings_ready = 0;
+  sbuf_free(&snap_blob);
+  sbuf_free(&snap_offsets);
+}
+
+/** Look up, or add, a string in the table being written. */
+static uint32_t
+snap_string(const char *s)
+{
+  void *idx;
+  uint32_t off;
+
+  if (!s)
+    return SNAP_NONE;
+  idx = hashfind(s, &snap_strings);
+  if (idx)
+    return (uint32_t) ((uintptr_t) idx - 1);
+  off = snap_blob.len;
+  sbuf_add(&snap_offsets, &off, sizeof off);
+  sbuf_add(&snap_blob, s, strlen(s) + 1);
+  hashadd(s, (void *) (uintptr_t) (snap_nstrings + 1), &snap_strings);
+  return snap_nstrings++;
+}
+
+/** Write out the string table as a STRINGS section.
+ * \param f the file to write to.
+ * \param b a buffer to use.
+ */
+static bool
+snap_put_strings(FILE *f, struct snap_buf *b)
+{
+  uint32_t n = snap_nstrings;
+
+  b->len = 0;
+  sbuf_add(b, &n, sizeof n);
+  sbuf_add(b, snap_offsets.data, snap_offsets.len);
+  sbuf_add(b, snap_blob.data, snap_blob.len);
+  return snap_put_section(f, SNAP_STRINGS, b->data, b->len);
+}
+
+/** Put every string an object's record refers to in the table. */
+static void
+snap_object_strings(dbref i)
+{
+  ALIST *a;
+  lock_list *ll;
+
+  snap_string(Name(i));
+  snap_string(db[i].flags ? bits_to_string("FLAG", db[i].flags, GOD, NOTHING)
+                          : "");
+  snap_string(db[i].powers
+                ? bits_to_string("POWER", db[i].powers, GOD, NOTHING)
+                : "");
+  for (ll = Locks(i); ll; ll = ll->next)
+    snap_string(L_TYPE(ll));
+  ATTR_FOR_EACH (i, a) {
+    if (!AF_Nodump(a))
+      snap_string(AL_NAME(a));
+  }
+}
+
+/** Add an object's record, locks and attributes to a buffer. */
+static void
+snap_object(struct snap_buf *b, dbref i, bool compressed)
+{
+  static char value[BUFFER_LEN * 2];
+  struct snap_object rec;
+  ALIST *a;
+  lock_list *ll;
+  struct object *o = db + i;
+
+  memset(&rec, 0, sizeof rec);
+  rec.created = o->creation_time;
+  rec.modified = o->modification_time;
+  rec.location = o->location;
+  rec.contents = o->contents;
+  rec.exits = o->exits;
+  rec.next = o->next;
+  rec.parent = o->parent;
+  rec.owner = o->owner;
+  rec.zone = o->zone;
+  rec.pennies = o->penn;
+  rec.type = o->type;
+  rec.warnings = o->warnings;
+  rec.name = snap_string(o->name);
+  rec.flags = snap_string(
+    o->flags ? bits_to_string("FLAG", o->flags, GOD, NOTHING) : "");
+  rec.powers = snap_string(
+    o->powers ? bits_to_string("POWER", o->powers, GOD, NOTHING) : "");
+  for (ll = o->locks; ll; ll = ll->next)
+    rec.locks++;
+  ATTR_FOR_EACH (i, a) {
+    if (!AF_Nodump(a))
+      rec.attrs++;
+  }
+  sbuf_add(b, &rec, sizeof rec);
+
+  for (ll = o->locks; ll; ll = ll->next) {
+    struct snap_lock l;
+    uint32_t len = 0;
+
+    memset(&l, 0, sizeof l);
+    l.type = snap_string(L_TYPE(ll));
+    l.creator = L_CREATOR(ll);
+    l.flags = L_FLAGS(ll);
+    if (ll->key != TRUE_BOOLEXP) {
+      len = chunk_fetch(ll->key, value, sizeof value);
+      if (len > sizeof value)
+        len = 0;
+      l.derefs = chunk_derefs(ll->key);
+    }
+    l.len = len;
+    sbuf_add(b, &l, sizeof l);
+    sbuf_add(b, value, len);
+    sbuf_pad(b, 4);
+  }
+
+  ATTR_FOR_EACH (i, a) {
+    struct snap_attr r;
+    const char *data = value;
+    uint32_t len = 0;
+
+    if (AF_Nodump(a))
+      continue;
+    memset(&r, 0, sizeof r);
+    r.name = snap_string(AL_NAME(a));
+    r.creator = AL_CREATOR(a);
+    r.flags = AL_FLAGS(a);
+    r.derefs = AL_DEREFS(a);
+    if (compressed) {
+      if (a->data) {
+        len = chunk_fetch(a->data, value, sizeof value);
+        if (len > sizeof value)
+          len = 0;
+      }
+    } else {
+      data = atr_value(a);
+      len = strlen(data);
+    }
+    r.len = len;
+    sbuf_add(b, &r, sizeof r);
+    sbuf_add(b, data, len);
+    sbuf_pad(b, 4);
+  }
+}
+
+/** Put the flag, power and attribute tables in a buffer, in the text
+ * format. They're small.
+ * \return true if they were written.
+ */
+static bool
+snap_tables(struct snap_buf *b)
+{
+  unsigned char chunk[8192];
+  FILE *tf;
+  PENNFILE pf;
+  long tlen;
+  size_t n;
+
+  b->len = 0;
+  tf = tmpfile();
+  if (!tf)
+    return 0;
+  pf.type = PFT_FILE;
+  pf.handle.f = tf;
+  penn_fputs("+FLAGS LIST\n", &pf);
+  flag_write_all(&pf, "FLAG");
+  penn_fputs("+POWER LIST\n", &pf);
+  flag_write_all(&pf, "POWER");
+  penn_fputs("+ATTRIBUTES LIST\n", &pf);
+  attr_write_all(&pf);
+  /* The table readers peek past their last entry, and can't at EOF. */
+  penn_fputs("***END OF DUMP***\n", &pf);
+  tlen = ftell(tf);
+  rewind(tf);
+  while ((n = fread(chunk, 1, sizeof chunk, tf)) > 0)
+    sbuf_add(b, chunk, n);
+  fclose(tf);
+  return tlen > 0 && b->len == (size_t) tlen;
+}
+
+/** Write the database out as a snapshot.
+ * The snapshot is written to a temporary file that's renamed over
+ * filename once it's complete. If it can't be written, filename is left
+ * alone, since its journal still builds on it.
+ * \param filename the file to write.
+ * \return true if the snapshot was written.
+ */
+bool
+snapshot_write(const char *filename)
+{
+  char tmpfl[FILE_PATH_LEN + 8];
+  struct snap_meta meta;
+  struct snap_buf b = {NULL, 0, 0};
+  const void *state = NULL;
+  size_t statelen = 0;
+  bool compressed;
+  FILE *f;
+  dbref i;
+  uint32_t first;
+
+  if (!crc_ready)
+    crc_init();
+
+  snprintf(tmpfl, sizeof tmpfl, "%s.tmp", filename);
+  f = fopen(tmpfl, "wb");
+  if (!f) {
+    do_rawlog(LT_ERR, "Unable to open %s for writing: %s", tmpfl,
+              strerror(errno));
+    return 0;
+  }
+  if (!snap_put_header(f, SNAP_MAGIC))
+    goto fail;
+
+  compressed = compress_state(&state, &statelen);
+  memset(&meta, 0, sizeof meta);
+  snprintf(meta.server, sizeof meta.server, "%sp%s", VERSION, PATCHLEVEL);
+  mush_strncpy(meta.savedtime, show_time(mudtime, 1), sizeof meta.savedtime);
+  mush_strncpy(meta.compression, options.attr_compression,
+               sizeof meta.compression);
+  meta.db_top = db_top;
+  meta.dbflags = SNAP_DBFLAGS;
+  meta.dbversion = NDBF_VERSION;
+  meta.compressed = compressed;
+  meta.lineage = snap_lineage;
+  meta.seq = snap_seq;
+  if (!snap_put_section(f, SNAP_META, &meta, sizeof meta))
+    goto fail;
+  if (!snap_put_section(f, SNAP_COMPRESS, state, compressed ? statelen : 0))
+    goto fail;
+  if (!snap_tables(&b) || !snap_put_section(f, SNAP_TABLES, b.data, b.len))
+    goto fail;
+
+  snap_strings_start();
+  for (i = 0; i < db_top; i++)
+    snap_object_strings(i);
+  if (!snap_put_strings(f, &b))
+    goto fail;
+
+  for (first = 0; first < (uint32_t) db_top; first += SNAP_BLOCK) {
+    uint32_t count = db_top - first < SNAP_BLOCK ? db_top - first : SNAP_BLOCK;
+    b.len = 0;
+    sbuf_add(&b, &first, sizeof first);
+    sbuf_add(&b, &count, sizeof count);
+    for (i = first; i < (dbref) (first + count); i++)
+      snap_object(&b, i, compressed);
+    if (!snap_put_section(f, SNAP_OBJECTS, b.data, b.len))
+      goto fail;
+  }
+
+  sbuf_free(&b);
+  snap_strings_done();
+  if (fclose(f) != 0) {
+    f = NULL;
+    goto fail;
+  }
+  if (rename_file(tmpfl, filename) < 0) {
+    f = NULL;
+    goto fail;
+  }
+  return 1;
+
+fail:
+  do_rawlog(LT_ERR, "Unable to write snapshot %s: %s", tmpfl,
+            strerror(errno));
+  if (f)
+    fclose(f);
+  sbuf_free(&b);
+  snap_strings_done();
+  unlink(tmpfl);
+  return 0;
+}
+
+/** Copy the plain values out of an object. */
+static void
+snap_shadow(struct snap_shadow *sh, dbref i)
+{
+  const struct object *o = db + i;
+
+  memset(sh, 0, sizeof *sh);
+  sh->location = o->location;
+  sh->contents = o->contents;
+  sh->exits = o->exits;
+  sh->next = o->next;
+  sh->parent = o->parent;
+  sh->owner = o->owner;
+  sh->zone = o->zone;
+  sh->penn = o->penn;
+  sh->warnings = o->warnings;
+  sh->creation_time = o->creation_time;
+  sh->modification_time = o->modification_time;
+  sh->attr_version = o->attr_version;
+  sh->attrcount = o->attrcount;
+  sh->type = o->type;
+}
+
+/** Has an object changed since the last frame? */
+static bool
+snap_changed(dbref i)
+{
+  struct snap_shadow sh;
+
+  if (i >= snap_nshadows || snap_dirty[i])
+    return 1;
+  snap_shadow(&sh, i);
+  return memcmp(&sh, snap_shadows + i, sizeof sh) != 0;
+}
+
+/** Note that an object is as it was written to the journal. */
+static void
+snap_unchanged(dbref i)
+{
+  snap_shadow(snap_shadows + i, i);
+  snap_dirty[i] = 0;
+}
+
+/** Make room to keep track of every object. */
+static void
+snap_grow_shadows(void)
+{
+  if (snap_nshadows >= db_top)
+    return;
+  snap_shadows = mush_realloc(snap_shadows, (db_top + 1) * sizeof *snap_shadows,
+                              "snapshot.shadows");
+  snap_dirty = mush_realloc(snap_dirty, (db_top + 1) * sizeof *snap_dirty,
+                            "snapshot.dirty");
+  snap_nshadows = db_top;
+}
+
+/** Take every object, and the tables, as they are now. */
+static void
+snap_reprint(void)
+{
+  struct snap_buf b = {NULL, 0, 0};
+  dbref i;
+
+  snap_grow_shadows();
+  for (i = 0; i < db_top; i++)
+    snap_unchanged(i);
+  snap_tables_crc = snap_tables(&b) ? snap_crc(b.data, b.len) : 0;
+  sbuf_free(&b);
+}
+
+/** Mark an object as changed, so the next checkpoint journals it. This is
+ * called wherever an object's name, flags, powers or locks change, or it
+ * is created; the rest of what a snapshot holds is caught by comparing it
+ * with how it was.
+ * \param thing the object.
+ */
+void
+snapshot_touch(dbref thing)
+{
+  if (thing >= 0 && thing < snap_nshadows)
+    snap_dirty[thing] = 1;
+}
+
+/** The names of a snapshot's journal and old journal. */
+static void
+snap_journal_names(const char *filename, char *jname, char *oldname)
+{
+  snprintf(jname, FILE_PATH_LEN + 16, "%s.journal", filename);
+  snprintf(oldname, FILE_PATH_LEN + 16, "%s.journal.old", filename);
+}
+
+static void
+snap_close_journal(void)
+{
+  if (snap_jfile)
+    fclose(snap_jfile);
+  snap_jfile = NULL;
+}
+
+/** Start an empty journal for the current lineage. */
+static void
+snap_new_journal(const char *jname)
+{
+  struct snap_journal j;
+  const void *state;
+  size_t statelen;
+
+  snap_jlen = 0;
+  snap_jfile = fopen(jname, "wb");
+  if (!snap_jfile) {
+    do_rawlog(LT_ERR, "Unable to open %s for writing: %s", jname,
+              strerror(errno));
+    return;
+  }
+  memset(&j, 0, sizeof j);
+  j.lineage = snap_lineage;
+  j.compressed = compress_state(&state, &statelen);
+  if (!snap_put_header(snap_jfile, SNAP_JMAGIC) ||
+      !snap_put_section(snap_jfile, SNAP_JOURNAL, &j, sizeof j) ||
+      fflush(snap_jfile) != 0) {
+    do_rawlog(LT_ERR, "Unable to write to %s: %s", jname, strerror(errno));
+    snap_close_journal();
+    unlink(jname);
+    return;
+  }
+  snap_jlen = ftell(snap_jfile);
+}
+
+/** Append the objects that have changed since the last checkpoint to the
+ * journal, as a frame. If it can't be written, the partial frame is cut
+ * off again, and the changes are picked up by the next checkpoint.
+ * \return true if the frame was written, or there was nothing to write.
+ */
+static bool
+snap_journal_frame(void)
+{
+  char jname[FILE_PATH_LEN + 16], oldname[FILE_PATH_LEN + 16];
+  struct snap_buf b = {NULL, 0, 0}, tables = {NULL, 0, 0};
+  struct snap_commit c;
+  const void *state;
+  size_t statelen;
+  uint32_t tables_crc, count = 0, k, first, n;
+  dbref *changed;
+  bool compressed, ok = 0;
+  dbref i;
+
+  if (!snap_jfile)
+    return 0;
+  compressed = compress_state(&state, &statelen);
+  changed = mush_calloc(db_top + 1, sizeof *changed, "snapshot.journal");
+  for (i = 0; i < db_top; i++) {
+    if (snap_changed(i))
+      changed[count++] = i;
+  }
+  if (!snap_tables(&tables))
+    goto done;
+  tables_crc = snap_crc(tables.data, tables.len);
+  if (!count && tables_crc == snap_tables_crc) {
+    ok = 1;
+    goto done;
+  }
+
+  if (tables_crc != snap_tables_crc &&
+      !snap_put_section(snap_jfile, SNAP_TABLES, tables.data, tables.len))
+    goto done;
+  snap_strings_start();
+  for (k = 0; k < count; k++)
+    snap_object_strings(changed[k]);
+  if (!snap_put_strings(snap_jfile, &b))
+    goto done;
+  for (first = 0; first < count; first += SNAP_BLOCK) {
+    n = count - first < SNAP_BLOCK ? count - first : SNAP_BLOCK;
+    b.len = 0;
+    sbuf_add(&b, &n, sizeof n);
+    for (k = first; k < first + n; k++) {
+      uint32_t d = changed[k];
+      sbuf_add(&b, &d, sizeof d);
+      snap_object(&b, changed[k], compressed);
+    }
+    if (!snap_put_section(snap_jfile, SNAP_CHANGED, b.data, b.len))
+      goto done;
+  }
+  memset(&c, 0, sizeof c);
+  c.seq = snap_seq + 1;
+  c.db_top = db_top;
+  c.count = count;
+  if (!snap_put_section(snap_jfile, SNAP_COMMIT, &c, sizeof c) ||
+      fflush(snap_jfile) != 0)
+    goto done;
+#ifdef HAVE_FDATASYNC
+  fdatasync(fileno(snap_jfile));
+#endif
+
+  ok = 1;
+  snap_seq = c.seq;
+  snap_jlen = ftell(snap_jfile);
+  snap_tables_crc = tables_crc;
+  snap_grow_shadows();
+  for (k = 0; k < count; k++)
+    snap_unchanged(changed[k]);
+  do_rawlog_lvl(LT_CHECK, MLOG_INFO,
+                "JOURNAL: %s frame %llu, %u changed object%s", snap_file,
+                (unsigned long long) snap_seq, count, count == 1 ? "" : "s");
+
+done:
+  if (!ok) {
+    do_rawlog(LT_ERR, "Unable to write to the journal of %s: %s", snap_file,
+              strerror(errno));
+    /* Drop whatever got written of the frame */
+    snap_close_journal();
+    snap_journal_names(snap_file, jname, oldname);
+    if (truncate(jname, snap_jlen) == 0)
+      snap_jfile = fopen(jname, "ab");
+  }
+  snap_strings_done();
+  sbuf_free(&b);
+  sbuf_free(&tables);
+  mush_free(changed, "snapshot.journal");
+  return ok;
+}
+
+/** Keep the current journal until a new snapshot has been written, by
+ * moving it to the old journal, or adding its frames to the old journal
+ * if there is one already.
+ * \return true if the journal was kept.
+ */
+static bool
+snap_keep_journal(const char *jname, const char *oldname)
+{
+  char chunk[8192];
+  FILE *in, *out;
+  size_t n;
+  bool ok = 1;
+
+  if (!snap_oldlen) {
+    if (rename_file(jname, oldname) < 0)
+      return 0;
+    snap_oldlen = snap_jlen;
+    return 1;
+  }
+  in = fopen(jname, "rb");
+  if (!in)
+    return 0;
+  out = fopen(oldname, "ab");
+  if (!out) {
+    fclose(in);
+    return 0;
+  }
+  if (fseek(in, SNAP_JOURNAL_START, SEEK_SET) < 0)
+    ok = 0;
+  while (ok && (n = fread(chunk, 1, sizeof chunk, in)) > 0) {
+    if (fwrite(chunk, 1, n, out) != n)
+      ok = 0;
+    snap_oldlen += n;
+  }
+  if (ferror(in))
+    ok = 0;
+  fclose(in);
+  if (fclose(out) != 0)
+    ok = 0;
+  if (ok)
+    unlink(jname);
+  return ok;
+}
+
+/** Get ready for a new snapshot. The journal is brought up to date and
+ * kept until the snapshot's written, in case it isn't, and a new one
+ * started. If there's no snapshot to build on, or the journal can't be
+ * kept, a new lineage is started instead, and the old snapshot and
+ * journals are removed, since they'd be out of date.
+ */
+static void
+snap_start_compaction(void)
+{
+  char jname[FILE_PATH_LEN + 16], oldname[FILE_PATH_LEN + 16];
+  bool kept;
+
+  snap_journal_names(snap_file, jname, oldname);
+  kept = snap_lineage && snap_journal_frame();
+  snap_close_journal();
+  if (!kept || !snap_keep_journal(jname, oldname))
+    snap_lineage = 0;
+  if (!snap_lineage) {
+    unlink(snap_file);
+    unlink(jname);
+    unlink(oldname);
+    snap_lineage = ((uint64_t) time(NULL) << 32) |
+                   get_random_u32(0, UINT32_MAX - 1);
+    snap_seq = 0;
+    snap_oldlen = 0;
+  }
+  snap_new_journal(jname);
+  snap_compacting = 1;
+  snap_reprint();
+}
+
+/** Save the objects at a checkpoint.
+ * If there's a snapshot to build on and its journals aren't too big, the
+ * objects that have changed since the last checkpoint are added to the
+ * journal, and that's all. Otherwise this gets ready for a new snapshot,
+ * which the caller writes with snapshot_write(), usually in a forked dump,
+ * and then reports on with snapshot_compacted().
+ * \param filename the snapshot.
+ * \retval true the changes were journaled.
+ * \retval false a new snapshot must be written.
+ */
+bool
+snapshot_checkpoint(const char *filename)
+{
+  struct stat st;
+
+  if (!crc_ready)
+    crc_init();
+  if (strcmp(filename, snap_file)) {
+    snap_close_journal();
+    snap_lineage = 0;
+    snap_compacting = 0;
+    mush_strncpy(snap_file, filename, sizeof snap_file);
+  }
+  memset(&st, 0, sizeof st);
+  if (snap_lineage && !snap_compacting && stat(filename, &st) < 0)
+    snap_lineage = 0; /* The snapshot's gone, so the journal is no use */
+  if (snap_lineage &&
+      (snap_compacting || (snap_jlen + snap_oldlen) * 100 <=
+                            (long) st.st_size * SNAP_COMPACT_PERCENT)) {
+    /* While a new snapshot is being written, the journal is all there is. */
+    if (snap_journal_frame() || snap_compacting)
+      return 1;
+  }
+  snap_start_compaction();
+  return 0;
+}
+
+/** Report how writing the snapshot snapshot_checkpoint() asked for went.
+ * Once it's written, the old journal isn't needed.
+ * \param ok true if the snapshot was written.
+ */
+void
+snapshot_compacted(bool ok)
+{
+  char jname[FILE_PATH_LEN + 16], oldname[FILE_PATH_LEN + 16];
+
+  if (!snap_compacting)
+    return;
+  snap_compacting = 0;
+  if (!ok) {
+    do_rawlog(LT_ERR, "Snapshot %s wasn't written. Keeping its journals.",
+              snap_file);
+    return;
+  }
+  snap_journal_names(snap_file, jname, oldname);
+  unlink(oldname);
+  snap_oldlen = 0;
+}
+
+/** A string from a table being read. */
+static const char *
+snap_str(const struct snap_strtab *t, uint32_t idx)
+{
+  uint32_t off;
+
+  if (idx == SNAP_NONE)
+    return NULL;
+  memcpy(&off, t->offsets + idx * sizeof off, sizeof off);
+  return t->blob + off;
+}
+
+/** Check that a string index is in range. */
+#define SNAP_GOOD_STRING(idx, n) ((idx) == SNAP_NONE || (idx) < (n))
+
+/** Set up a string table from its STRINGS section, checking it over.
+ * \return true if it's good.
+ */
+static bool
+snap_strtab_read(struct snap_strtab *t, const struct snap_section *s)
+{
+  size_t bloblen;
+  uint32_t n, off;
+
+  if (s->len < sizeof(uint32_t))
+    return 0;
+  memcpy(&t->nstrings, s + 1, sizeof(uint32_t));
+  if ((s->len - sizeof(uint32_t)) / sizeof(uint32_t) < t->nstrings)
+    return 0;
+  t->offsets = (const unsigned char *) (s + 1) + sizeof(uint32_t);
+  t->blob = (const char *) t->offsets + t->nstrings * sizeof(uint32_t);
+  bloblen = s->len - sizeof(uint32_t) * (t->nstrings + 1);
+  if (t->nstrings && (!bloblen || t->blob[bloblen - 1]))
+    return 0;
+  for (n = 0; n < t->nstrings; n++) {
+    memcpy(&off, t->offsets + n * sizeof off, sizeof off);
+    if (off >= bloblen)
+      return 0;
+  }
+  return 1;
+}
+
+/** Free the flagsets cached for a string table. */
+static void
+snap_strtab_free(struct snap_strtab *t)
+{
+  uint32_t n;
+
+  for (n = 0; n < t->nstrings; n++) {
+    if (t->flagsets && t->flagsets[n])
+      destroy_flag_bitmask("FLAG", t->flagsets[n]);
+    if (t->powersets && t->powersets[n])
+      destroy_flag_bitmask("POWER", t->powersets[n]);
+  }
+  if (t->flagsets)
+    mush_free(t->flagsets, "snapshot.load");
+  if (t->powersets)
+    mush_free(t->powersets, "snapshot.load");
+  t->flagsets = t->powersets = NULL;
+}
+
+/** Check and decode one object record.
+ * \param t the string table it uses.
+ * \param p the start of the record.
+ * \param end the end of its section.
+ * \param sp where to put it.
+ * \return the end of the record, or NULL if it's bad.
+ */
+static const unsigned char *
+snap_decode_record(struct snap_strtab *t, const unsigned char *p,
+                   const unsigned char *end, struct snap_pending *sp)
+{
+  size_t padded;
+  uint32_t j;
+
+  if ((size_t) (end - p) < sizeof sp->rec)
+    return NULL;
+  memcpy(&sp->rec, p, sizeof sp->rec);
+  p += sizeof sp->rec;
+  if (!SNAP_GOOD_STRING(sp->rec.name, t->nstrings) ||
+      !SNAP_GOOD_STRING(sp->rec.flags, t->nstrings) ||
+      !SNAP_GOOD_STRING(sp->rec.powers, t->nstrings))
+    return NULL;
+  sp->extra = p;
+  sp->strings = t;
+  for (j = 0; j < sp->rec.locks; j++) {
+    struct snap_lock l;
+    if ((size_t) (end - p) < sizeof l)
+      return NULL;
+    memcpy(&l, p, sizeof l);
+    p += sizeof l;
+    padded = ((size_t) l.len + 3) & ~(size_t) 3;
+    if (l.type >= t->nstrings || (size_t) (end - p) < padded)
+      return NULL;
+    p += padded;
+  }
+  for (j = 0; j < sp->rec.attrs; j++) {
+    struct snap_attr r;
+    if ((size_t) (end - p) < sizeof r)
+      return NULL;
+    memcpy(&r, p, sizeof r);
+    p += sizeof r;
+    padded = ((size_t) r.len + 3) & ~(size_t) 3;
+    if (r.name >= t->nstrings || (size_t) (end - p) < padded ||
+        r.len >= BUFFER_LEN * 2)
+      return NULL;
+    p += padded;
+  }
+  return p;
+}
+
+/** Check and decode one OBJECTS section.
+ * \return true if it's good.
+ */
+static bool
+snap_decode_block(struct snap_load *load, const struct snap_section *s)
+{
+  const unsigned char *p = (const unsigned char *) (s + 1);
+  const unsigned char *end = p + s->len;
+  uint32_t first, count, k;
+
+  if (snap_crc(p, s->len) != s->crc || s->len < 2 * sizeof(uint32_t))
+    return 0;
+  memcpy(&first, p, sizeof first);
+  memcpy(&count, p + sizeof first, sizeof count);
+  p += 2 * sizeof(uint32_t);
+  if (first > (uint32_t) load->top || count > (uint32_t) load->top - first)
+    return 0;
+
+  for (k = 0; k < count; k++) {
+    p = snap_decode_record(&load->strings, p, end, load->pending + first + k);
+    if (!p)
+      return 0;
+  }
+  return 1;
+}
+
+static void *
+snap_worker(void *arg)
+{
+  struct snap_job *job = arg;
+  int n;
+
+  for (n = job->first; n < job->load->nblocks; n += job->stride)
+    if (!snap_decode_block(job->load, job->load->blocks[n]))
+      job->load->failed[n] = 1;
+  return NULL;
+}
+
+/** Decode all the OBJECTS sections, in parallel where we can. */
+static void
+snap_decode(struct snap_load *load, int *threads)
+{
+  struct snap_job jobs[SNAP_MAX_THREADS];
+  int nthreads = 1, n;
+#if defined(HAVE_PTHREAD_H) && !defined(WIN32)
+  pthread_t tids[SNAP_MAX_THREADS];
+  bool started[SNAP_MAX_THREADS];
+  long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+
+  nthreads = ncpu > 1 ? ncpu : 1;
+  if (nthreads > SNAP_MAX_THREADS)
+    nthreads = SNAP_MAX_THREADS;
+  if (nthreads > load->nblocks)
+    nthreads = load->nblocks > 0 ? load->nblocks : 1;
+#endif
+
+  for (n = 0; n < nthreads; n++) {
+    jobs[n].load = load;
+    jobs[n].first = n;
+    jobs[n].stride = nthreads;
+  }
+#if defined(HAVE_PTHREAD_H) && !defined(WIN32)
+  /* This thread does the first share itself */
+  for (n = 1; n < nthreads; n++)
+    started[n] = !pthread_create(&tids[n], NULL, snap_worker, &jobs[n]);
+  snap_worker(&jobs[0]);
+  for (n = 1; n < nthreads; n++) {
+    if (started[n])
+      pthread_join(tids[n], NULL);
+    else
+      snap_worker(&jobs[n]);
+  }
+#else
+  snap_worker(&jobs[0]);
+#endif
+  *threads = nthreads;
+}
+
+/** Make room for objects up to top in a load. */
+static void
+snap_grow_pending(struct snap_load *load, dbref top)
+{
+  if (top < load->cap)
+    return;
+  load->pending = mush_realloc(load->pending, (top + 1) * sizeof *load->pending,
+                               "snapshot.load");
+  memset(load->pending + load->cap, 0,
+         (top + 1 - load->cap) * sizeof *load->pending);
+  load->cap = top + 1;
+}
+
+/** Apply one complete journal frame to a load.
+ * \param load the load.
+ * \param p the frame's first section.
+ * \param end the end of its COMMIT section.
+ * \param c its COMMIT section.
+ * \param tables the newest TABLES section; updated.
+ * \return true if the frame was good.
+ */
+static bool
+snap_apply_frame(struct snap_load *load, const unsigned char *p,
+                 const unsigned char *end, const struct snap_commit *c,
+                 const struct snap_section **tables)
+{
+  const struct snap_section *s;
+  const unsigned char *r, *rend;
+  struct snap_strtab *t = NULL;
+  struct snap_pending sp;
+  uint32_t count, k, total = 0, d;
+
+  if (c->db_top < 0)
+    return 0;
+  snap_grow_pending(load, c->db_top);
+  for (; p < end; p += sizeof *s + ((s->len + 7) & ~7ULL)) {
+    s = (const struct snap_section *) p;
+    r = (const unsigned char *) (s + 1);
+    rend = r + s->len;
+    switch (s->type) {
+    case SNAP_TABLES:
+      *tables = s;
+      break;
+    case SNAP_STRINGS:
+      t = mush_calloc(1, sizeof *t, "snapshot.load");
+      t->next = load->frames;
+      load->frames = t;
+      if (!snap_strtab_read(t, s))
+        return 0;
+      break;
+    case SNAP_CHANGED:
+      if (!t || s->len < sizeof count)
+        return 0;
+      memcpy(&count, r, sizeof count);
+      r += sizeof count;
+      for (k = 0; k < count; k++) {
+        if ((size_t) (rend - r) < sizeof d)
+          return 0;
+        memcpy(&d, r, sizeof d);
+        r += sizeof d;
+        if (d >= (uint32_t) c->db_top)
+          return 0;
+        r = snap_decode_record(t, r, rend, &sp);
+        if (!r)
+          return 0;
+        load->pending[d] = sp;
+      }
+      total += count;
+      break;
+    }
+  }
+  load->top = c->db_top;
+  return total == c->count;
+}
+
+/** Replay the frames of a journal that come after what's been loaded.
+ * A frame that was cut short, because the game went down while it was
+ * being written, ends the journal.
+ * \param load the load to apply the frames to.
+ * \param m the journal.
+ * \param jname its name.
+ * \param meta the snapshot's META section.
+ * \param next the number of the next frame wanted; updated.
+ * \param tables the newest TABLES section; updated.
+ * \return the length of the journal up to the end of its last complete
+ * frame, 0 if it doesn't go with this snapshot, or -1 if it's corrupt or
+ * frames are missing.
+ */
+static long
+snap_replay(struct snap_load *load, const MAPPED_FILE *m, const char *jname,
+            const struct snap_meta *meta, uint64_t *next,
+            const struct snap_section **tables)
+{
+  const unsigned char *start = m->data, *end = start + m->len, *p, *q;
+  const struct snap_header *h = m->data;
+  const struct snap_section *s;
+  struct snap_journal j;
+  struct snap_commit c;
+  long good;
+
+  if (m->len < SNAP_JOURNAL_START ||
+      memcmp(h->magic, SNAP_JMAGIC, sizeof h->magic) ||
+      h->version != SNAP_VERSION || h->endian != SNAP_ENDIAN)
+    return 0;
+  s = (const struct snap_section *) (start + sizeof *h);
+  if (s->type != SNAP_JOURNAL || s->len != sizeof j ||
+      snap_crc((const unsigned char *) (s + 1), s->len) != s->crc)
+    return 0;
+  memcpy(&j, s + 1, sizeof j);
+  if (j.lineage != meta->lineage || j.compressed != meta->compressed)
+    return 0;
+
+  good = SNAP_JOURNAL_START;
+  for (p = start + good; p < end; p = start + good) {
+    /* Find the frame's COMMIT, checking each section on the way */
+    for (q = p;;) {
+      if ((size_t) (end - q) < sizeof *s)
+        return good;
+      s = (const struct snap_section *) q;
+      if ((uint64_t) (end - q) - sizeof *s < ((s->len + 7) & ~7ULL) ||
+          snap_crc((const unsigned char *) (s + 1), s->len) != s->crc)
+        return good;
+      q += sizeof *s + ((s->len + 7) & ~7ULL);
+      if (s->type == SNAP_COMMIT)
+        break;
+    }
+    if (s->len != sizeof c) {
+      do_rawlog(LT_ERR, "Journal %s is corrupt.", jname);
+      return -1;
+    }
+    memcpy(&c, s + 1, sizeof c);
+    if (c.seq > *next) {
+      do_rawlog(LT_ERR, "Journal %s is missing frames %llu to %llu.", jname,
+                (unsigned long long) *next, (unsigned long long) c.seq - 1);
+      return -1;
+    }
+    if (c.seq == *next) {
+      if (!snap_apply_frame(load, p, q, &c, tables)) {
+        do_rawlog(LT_ERR, "Journal %s is corrupt.", jname);
+        return -1;
+      }
+      (*next)++;
+    }
+    good = q - start;
+  }
+  return good;
+}
+
+/** Read the flag, power and attribute tables from their section.
+ * \return true if they were read.
+ */
+static bool
+snap_read_tables(const struct snap_section *s)
+{
+  FILE *tf;
+  PENNFILE pf;
+  int c;
+
+  tf = tmpfile();
+  if (!tf)
+    return 0;
+  if (fwrite(s + 1, 1, s->len, tf) != s->len) {
+    fclose(tf);
+    return 0;
+  }
+  rewind(tf);
+  pf.type = PFT_FILE;
+  pf.handle.f = tf;
+  if (setjmp(db_err) == 1) {
+    fclose(tf);
+    return 0;
+  }
+  while ((c = penn_fgetc(&pf)) == '+') {
+    c = penn_fgetc(&pf);
+    (void) getstring_noalloc(&pf);
+    if (c == 'F')
+      flag_read_all(&pf, "FLAG");
+    else if (c == 'P')
+      flag_read_all(&pf, "POWER");
+    else if (c == 'A')
+      attr_read_all(&pf);
+  }
+  fclose(tf);
+  return 1;
+}
+
+/** Take GOING, GOING_TWICE and CONNECTED out of a flag list. Objects
+ * scheduled for destruction get a reprieve, and nobody's connected yet.
+ */
+static const char *
+snap_clean_flags(const char *list)
+{
+  static char buff[BUFFER_LEN];
+  char copy[BUFFER_LEN];
+  char *bp = buff, *s, *w;
+
+  mush_strncpy(copy, list, sizeof copy);
+  s = trim_space_sep(copy, ' ');
+  while ((w = split_token(&s, ' '))) {
+    if (!*w || !strcasecmp(w, "GOING") || !strcasecmp(w, "GOING_TWICE") ||
+        !strcasecmp(w, "CONNECTED"))
+      continue;
+    if (bp != buff)
+      safe_chr(' ', buff, &bp);
+    safe_str(w, buff, &bp);
+  }
+  *bp = '\0';
+  return buff;
+}
+
+/** Turn a flag or power list from a string table into a flagset. Lists are
+ * only parsed once per table; most objects share a few of them.
+ * \param t the string table.
+ * \param idx the list's index.
+ * \param powers true for a power list, false for a flag list.
+ * \return a managed flagset.
+ */
+static object_flag_type
+snap_bits(struct snap_strtab *t, uint32_t idx, bool powers)
+{
+  const char *ns = powers ? "POWER" : "FLAG";
+  object_flag_type **cache = powers ? &t->powersets : &t->flagsets;
+
+  if (idx == SNAP_NONE)
+    return new_flag_bitmask(ns);
+  if (!*cache)
+    *cache = mush_calloc(t->nstrings + 1, sizeof **cache, "snapshot.load");
+  if (!(*cache)[idx])
+    (*cache)[idx] =
+      string_to_bits(ns, powers ? snap_str(t, idx)
+                                : snap_clean_flags(snap_str(t, idx)));
+  return clone_flag_bitmask(ns, (*cache)[idx]);
+}
+
+/** Carry on with a snapshot's journal after loading it.
+ * \param filename the snapshot.
+ * \param lineage its lineage.
+ * \param seq the last frame replayed.
+ * \param oldlen the good length of the old journal.
+ * \param jlen the good length of the journal.
+ */
+static void
+snap_attach(const char *filename, uint64_t lineage, uint64_t seq,
+            long oldlen, long jlen)
+{
+  char jname[FILE_PATH_LEN + 16], oldname[FILE_PATH_LEN + 16];
+
+  snap_close_journal();
+  mush_strncpy(snap_file, filename, sizeof snap_file);
+  snap_lineage = lineage;
+  snap_seq = seq;
+  snap_compacting = 0;
+  snap_jlen = snap_oldlen = 0;
+  if (!lineage)
+    return;
+  snap_journal_names(filename, jname, oldname);
+  /* Cut off any frame that was being written when the game went down, so
+   * new frames can follow on. */
+  if (oldlen > 0) {
+    if (truncate(oldname, oldlen) < 0) {
+      snap_lineage = 0;
+      return;
+    }
+    snap_oldlen = oldlen;
+  } else
+    unlink(oldname);
+  if (jlen > 0 && truncate(jname, jlen) == 0 &&
+      (snap_jfile = fopen(jname, "ab")))
+    snap_jlen = jlen;
+  else
+    snap_new_journal(jname);
+  snap_reprint();
+}
+
+/** Read a snapshot, and replay its journals, into the database.
+ * Everything in the files is checked before the current database is
+ * thrown away, so if this fails the caller can fall back on another
+ * database.
+ * \param filename the snapshot to read.
+ * \return the number of objects read, or -1 on failure.
+ */
+dbref
+snapshot_read(const char *filename)
+{
+  MAPPED_FILE *m, *journals[2] = {NULL, NULL};
+  char jnames[2][FILE_PATH_LEN + 16];
+  long jlens[2] = {0, 0};
+  const unsigned char *p, *end;
+  const struct snap_header *h;
+  const struct snap_section *s;
+  const struct snap_section *meta_s = NULL, *comp_s = NULL, *tables_s = NULL,
+                            *strings_s = NULL;
+  struct snap_meta meta;
+  struct snap_load load;
+  struct snap_strtab *t;
+  char server[32];
+  char value[BUFFER_LEN * 2 + 1];
+  int nblocks = 0, threads = 1, n;
+  uint64_t next = 0;
+  dbref i, result = -1;
+  sqlite3 *sqldb;
+  sqlite3_stmt *adder;
+  int status;
+
+  if (!crc_ready)
+    crc_init();
+
+  memset(&load, 0, sizeof load);
+  memset(&meta, 0, sizeof meta);
+  m = map_file(filename, 0);
+  if (!m)
+    return -1;
+  p = m->data;
+  end = p + m->len;
+
+  h = (const struct snap_header *) p;
+  if (m->len < sizeof *h || memcmp(h->magic, SNAP_MAGIC, sizeof h->magic) ||
+      h->version != SNAP_VERSION || h->endian != SNAP_ENDIAN) {
+    do_rawlog(LT_ERR, "%s is not a snapshot this server can read.", filename);
+    goto done;
+  }
+
+  /* Find the sections */
+  for (p += sizeof *h; p < end; p += sizeof *s + ((s->len + 7) & ~7ULL)) {
+    s = (const struct snap_section *) p;
+    if ((size_t) (end - p) < sizeof *s ||
+        (uint64_t) (end - p) - sizeof *s < s->len) {
+      do_rawlog(LT_ERR, "Snapshot %s is truncated.", filename);
+      goto done;
+    }
+    switch (s->type) {
+    case SNAP_META:
+      meta_s = s;
+      break;
+    case SNAP_COMPRESS:
+      comp_s = s;
+      break;
+    case SNAP_TABLES:
+      tables_s = s;
+      break;
+    case SNAP_STRINGS:
+      strings_s = s;
+      break;
+    case SNAP_OBJECTS:
+      nblocks++;
+      break;
+    }
+  }
+  if (!meta_s || !comp_s || !tables_s || !strings_s ||
+      meta_s->len != sizeof meta) {
+    do_rawlog(LT_ERR, "Snapshot %s is missing sections.", filename);
+    goto done;
+  }
+  for (s = meta_s; s;
+       s = (s == meta_s ? comp_s
+                        : s == comp_s ? tables_s
+                                      : s == tables_s ? strings_s : NULL)) {
+    if (snap_crc((const unsigned char *) (s + 1), s->len) != s->crc) {
+      do_rawlog(LT_ERR, "Snapshot %s has a bad checksum.", filename);
+      goto done;
+    }
+  }
+
+  memcpy(&meta, meta_s + 1, sizeof meta);
+  meta.server[sizeof meta.server - 1] = '\0';
+  meta.savedtime[sizeof meta.savedtime - 1] = '\0';
+  meta.compression[sizeof meta.compression - 1] = '\0';
+  snprintf(server, sizeof server, "%sp%s", VERSION, PATCHLEVEL);
+  if (strcmp(meta.server, server)) {
+    do_rawlog(LT_ERR, "Snapshot %s was written by version %s, not %s.",
+              filename, meta.server, server);
+    goto done;
+  }
+  if (meta.db_top < 0) {
+    do_rawlog(LT_ERR, "Snapshot %s is corrupt.", filename);
+    goto done;
+  }
+  if (meta.compressed &&
+      strcasecmp(meta.compression, options.attr_compression)) {
+    do_rawlog(LT_ERR,
+              "Snapshot %s uses %s attribute compression, not %s. Not using "
+              "it.",
+              filename, meta.compression, options.attr_compression);
+    goto done;
+  }
+
+  if (!snap_strtab_read(&load.strings, strings_s))
+    goto corrupt;
+
+  /* The objects */
+  load.top = meta.db_top;
+  load.nblocks = nblocks;
+  load.blocks = mush_calloc(nblocks + 1, sizeof *load.blocks, "snapshot.load");
+  load.failed = mush_calloc(nblocks + 1, sizeof *load.failed, "snapshot.load");
+  snap_grow_pending(&load, load.top);
+  nblocks = 0;
+  for (p = (const unsigned char *) m->data + sizeof *h; p < end;
+       p += sizeof *s + ((s->len + 7) & ~7ULL)) {
+    s = (const struct snap_section *) p;
+    if (s->type == SNAP_OBJECTS)
+      load.blocks[nblocks++] = s;
+  }
+  snap_decode(&load, &threads);
+  for (n = 0; n < load.nblocks; n++)
+    if (load.failed[n])
+      goto corrupt;
+
+  /* Then whatever's changed since, from the journals, oldest first */
+  next = meta.seq + 1;
+  if (meta.lineage) {
+    snap_journal_names(filename, jnames[1], jnames[0]);
+    for (n = 0; n < 2; n++) {
+      if (access(jnames[n], R_OK) < 0 || !(journals[n] = map_file(jnames[n], 0)))
+        continue;
+      jlens[n] = snap_replay(&load, journals[n], jnames[n], &meta, &next,
+                             &tables_s);
+      if (jlens[n] < 0)
+        goto done;
+    }
+  }
+  for (i = 0; i < load.top; i++)
+    if (!load.pending[i].extra)
+      goto corrupt;
+
+  /* Everything checks out. Out with the old database. */
+  if (meta.compressed
+        ? !init_compress_state(comp_s + 1, comp_s->len)
+        : !init_compress(NULL)) {
+    do_rawlog(LT_ERR, "Unable to set up attribute compression from %s.",
+              filename);
+    goto done;
+  }
+  db_read_setup();
+  globals.indb_flags = meta.dbflags;
+  globals.new_indb_version = meta.dbversion;
+  mush_strncpy(db_timestamp, meta.savedtime, 100);
+  do_rawlog(LT_ERR, "Loading snapshot saved on %s UTC", db_timestamp);
+  if (next - 1 > meta.seq)
+    do_rawlog(LT_ERR, "Replaying journal frames %llu to %llu",
+              (unsigned long long) meta.seq + 1,
+              (unsigned long long) next - 1);
+
+  if (!snap_read_tables(tables_s)) {
+    do_rawlog(LT_ERR, "Unable to read the tables in %s.", filename);
+    goto done;
+  }
+
+  db_grow(load.top);
+  sqldb = get_shared_db();
+  sqlite3_exec(sqldb, "BEGIN TRANSACTION", NULL, NULL, NULL);
+  adder = prepare_statement(sqldb, "INSERT INTO objects(dbref) VALUES (?)",
+                            "objects.add");
+
+  for (i = 0; i < load.top; i++) {
+    struct snap_pending *sp = load.pending + i;
+    struct object *o = db + i;
+    const unsigned char *x = sp->extra;
+    uint32_t j;
+
+    o->location = sp->rec.location;
+    o->contents = sp->rec.contents;
+    o->exits = sp->rec.exits;
+    o->next = sp->rec.next;
+    o->parent = sp->rec.parent;
+    o->owner = sp->rec.owner;
+    o->zone = sp->rec.zone;
+    o->penn = sp->rec.pennies;
+    o->type = sp->rec.type;
+    o->warnings = sp->rec.warnings;
+    o->creation_time = (time_t) sp->rec.created;
+    o->modification_time = (time_t) sp->rec.modified;
+    set_name(i, snap_str(sp->strings, sp->rec.name));
+    o->flags = snap_bits(sp->strings, sp->rec.flags, 0);
+    o->powers = snap_bits(sp->strings, sp->rec.powers, 1);
+
+    for (j = 0; j < sp->rec.locks; j++) {
+      struct snap_lock l;
+      memcpy(&l, x, sizeof l);
+      x += sizeof l;
+      if (l.len)
+        add_lock_raw(l.creator, i, snap_str(sp->strings, l.type),
+                     chunk_create((const char *) x, l.len, l.derefs), l.flags);
+      x += (l.len + 3) & ~3U;
+    }
+
+    attr_reserve(i, sp->rec.attrs);
+    for (j = 0; j < sp->rec.attrs; j++) {
+      struct snap_attr r;
+      memcpy(&r, x, sizeof r);
+      x += sizeof r;
+      if (meta.compressed)
+        atr_new_add_compressed(i, snap_str(sp->strings, r.name),
+                               (const char *) x, r.len, r.creator, r.flags,
+                               r.derefs);
+      else {
+        memcpy(value, x, r.len);
+        value[r.len] = '\0';
+        atr_new_add(i, snap_str(sp->strings, r.name), value, r.creator,
+                    r.flags, r.derefs, 1);
+      }
+      x += (r.len + 3) & ~3U;
+    }
+
+    switch (Typeof(i)) {
+    case TYPE_PLAYER:
+      current_state.players++;
+      current_state.garbage--;
+      break;
+    case TYPE_THING:
+      current_state.things++;
+      current_state.garbage--;
+      break;
+    case TYPE_EXIT:
+      current_state.exits++;
+      current_state.garbage--;
+      break;
+    case TYPE_ROOM:
+      current_state.rooms++;
+      current_state.garbage--;
+      break;
+    }
+
+    sqlite3_bind_int(adder, 1, i);
+    do {
+      status = sqlite3_step(adder);
+    } while (is_busy_status(status));
+    if (status != SQLITE_DONE)
+      do_rawlog(LT_ERR, "Unable to add #%d to objects table: %s", i,
+                sqlite3_errstr(status));
+    sqlite3_reset(adder);
+
+    if (IsPlayer(i) && Name(i))
+      add_player(i);
+  }
+  sqlite3_exec(sqldb, "COMMIT TRANSACTION", NULL, NULL, NULL);
+
+  loading_db = 0;
+  fix_free_list();
+  dbck();
+  do_rawlog(LT_ERR, "READING: done (%d objects, %d thread%s)", db_top,
+            threads, threads == 1 ? "" : "s");
+  result = db_top;
+  goto done;
+
+corrupt:
+  do_rawlog(LT_ERR, "Snapshot %s is corrupt.", filename);
+
+done:
+  snap_strtab_free(&load.strings);
+  while ((t = load.frames)) {
+    load.frames = t->next;
+    snap_strtab_free(t);
+    mush_free(t, "snapshot.load");
+  }
+  if (load.blocks)
+    mush_free(load.blocks, "snapshot.load");
+  if (load.failed)
+    mush_free(load.failed, "snapshot.load");
+  if (load.pending)
+    mush_free(load.pending, "snapshot.load");
+  for (n = 0; n < 2; n++)
+    if (journals[n])
+      unmap_file(journals[n]);
+  unmap_file(m);
+  if (result >= 0) {
+    snap_attach(filename, meta.lineage, next - 1, jlens[0], jlens[1]);
+    log_mem_check();
+  }
+  return result;
+}
+
+#ifndef WIN32
+#define SNAP_TEST_OBJECTS 8      /**< Objects the test adds */
+#define SNAP_BENCH_OBJECTS 20000 /**< Objects the benchmark adds */
+#define SNAP_BENCH_ATTRS 8       /**< Attributes on each of them */
+
+/** Size of a round trip run, and the scratch files it writes */
+struct snap_bench_spec {
+  int count;                    /**< Objects to add */
+  char textfile[FILE_PATH_LEN]; /**< Where to write the text database */
+  char snapfile[FILE_PATH_LEN]; /**< Where to write the snapshot */
+};
+
+/** Results of the round trip test and benchmark, sent back from the child
+ * doing them */
+struct snap_bench {
+  bool made;         /**< Were both files written? */
+  bool text_ok;      /**< Did the text database read back right? */
+  bool snap_ok;      /**< Did the snapshot read back right? */
+  long text_bytes;   /**< Size of the text database */
+  long snap_bytes;   /**< Size of the snapshot */
+  double text_write; /**< ms to write the text database */
+  double snap_write; /**< ms to write the snapshot */
+  double text_read;  /**< ms to read the text database */
+  double snap_read;  /**< ms to read the snapshot */
+};
+
+static double
+snap_ms(struct timeval *start)
+{
+  struct timeval end;
+
+  penn_gettimeofday(&end);
+  return (end.tv_sec - start->tv_sec) * 1000.0 +
+         (end.tv_usec - start->tv_usec) / 1000.0;
+}
+
+static void
+snap_bench_value(char *buff, int k, int j)
+{
+  if (j == 0)
+    snprintf(buff, BUFFER_LEN, "$bench%d *:@pemit %%#=%%0 is [add(%%0,%d)]", k,
+             k);
+  else
+    snprintf(buff, BUFFER_LEN,
+             "Line %d of object %d: the quick brown fox jumps over the lazy "
+             "dog %d times.",
+             j, k, k * j);
+}
+
+/** Add count objects with a few attributes and a lock each to Room Zero. */
+static void
+snap_bench_make(int count)
+{
+  char name[BUFFER_LEN], value[BUFFER_LEN], attr[32];
+  dbref o;
+  int k, j;
+
+  for (k = 0; k < count; k++) {
+    o = new_object();
+    snprintf(name, sizeof name, "Bench object %d", k);
+    set_name(o, name);
+    db[o].type = TYPE_THING;
+    db[o].flags = string_to_bits("FLAG", k % 4 ? "NO_COMMAND" : "SAFE");
+    db[o].owner = GOD;
+    db[o].location = db[o].exits = 0;
+    db[o].next = db[0].contents;
+    db[0].contents = o;
+    for (j = 0; j < SNAP_BENCH_ATTRS; j++) {
+      snprintf(attr, sizeof attr, "BENCH_%d", j);
+      snap_bench_value(value, k, j);
+      atr_new_add(o, attr, value, GOD, 0, 1, 1);
+    }
+    add_lock_raw(GOD, o, Basic_Lock, parse_boolexp(GOD, "#1|=#1", Basic_Lock),
+                 LF_DEFAULT);
+  }
+}
+
+/** Check that the count objects snap_bench_make() made came back as they
+ * were. */
+static bool
+snap_bench_check(dbref base, dbref top, int count)
+{
+  char name[BUFFER_LEN], value[BUFFER_LEN];
+  dbref o = base + count / 2;
+  ATTR *a;
+  int attrs = 0;
+  dbref i;
+
+  if (db_top != top)
+    return 0;
+  for (i = base; i < top; i++)
+    attrs += AttrCount(i);
+  snprintf(name, sizeof name, "Bench object %d", count / 2);
+  snap_bench_value(value, count / 2, 3);
+  a = atr_get_noparent(o, "BENCH_3");
+  return attrs == count * SNAP_BENCH_ATTRS && Name(o) &&
+         !strcmp(Name(o), name) && a && !strcmp(atr_value(a), value) &&
+         IsThing(o) && Location(o) == 0 &&
+         getlock_noparent(o, Basic_Lock) != TRUE_BOOLEXP &&
+         has_flag_by_name(base, "SAFE", NOTYPE) &&
+         !has_flag_by_name(base + 1, "SAFE", NOTYPE);
+}
+
+/** Add count objects, then write and read the database both ways,
+ * timing each. This runs in a child process, since it throws the
+ * database away.
+ */
+static void
+snap_bench_run(void *arg, void *result)
+{
+  const struct snap_bench_spec *spec = arg;
+  const char *textfile = spec->textfile, *snapfile = spec->snapfile;
+  struct snap_bench *r = result;
+  int count = spec->count;
+  struct timeval start;
+  PENNFILE *f;
+  FILE *fp;
+  dbref base = db_top, top;
+
+  snap_bench_make(count);
+  top = db_top;
+
+  globals.paranoid_checkpt = db_top;
+  f = penn_fopen(textfile, "w");
+  if (!f)
+    return;
+  penn_gettimeofday(&start);
+  db_paranoid_write(f, 0);
+  penn_fclose(f);
+  r->text_write = snap_ms(&start);
+  penn_gettimeofday(&start);
+  r->made = snapshot_write(snapfile);
+  r->snap_write = snap_ms(&start);
+  if (!r->made)
+    return;
+
+  if ((fp = fopen(textfile, "r"))) {
+    fseek(fp, 0, SEEK_END);
+    r->text_bytes = ftell(fp);
+    fclose(fp);
+  }
+  if ((fp = fopen(snapfile, "r"))) {
+    fseek(fp, 0, SEEK_END);
+    r->snap_bytes = ftell(fp);
+    fclose(fp);
+  }
+
+  f = penn_fopen(textfile, "r");
+  if (f) {
+    penn_gettimeofday(&start);
+    r->text_ok = db_read_text(f) == top;
+    r->text_read = snap_ms(&start);
+    penn_fclose(f);
+    r->text_ok = r->text_ok && snap_bench_check(base, top, count);
+  }
+
+  penn_gettimeofday(&start);
+  r->snap_ok = snapshot_read(snapfile) == top;
+  r->snap_read = snap_ms(&start);
+  r->snap_ok = r->snap_ok && snap_bench_check(base, top, count);
+}
+
+/** Run snap_bench_run() in a child process, writing its files to a
+ * scratch directory.
+ * \return true if the child sent back its results.
+ */
+static bool
+snap_bench_fork(struct snap_bench *r, int count)
+{
+  struct snap_bench_spec spec;
+  char dir[FILE_PATH_LEN];
+  bool ok;
+
+  memset(r, 0, sizeof *r);
+  if (!test_scratch_dir(dir, sizeof dir, "snapbench"))
+    return 0;
+  spec.count = count;
+  if (snprintf(spec.textfile, sizeof spec.textfile, "%s/bench.db", dir) >=
+        (int) sizeof spec.textfile ||
+      snprintf(spec.snapfile, sizeof spec.snapfile, "%s/bench.snap", dir) >=
+        (int) sizeof spec.snapfile) {
+    rmdir(dir);
+    return 0;
+  }
+  ok = run_in_child(snap_bench_run, &spec, r, sizeof *r);
+  unlink(spec.textfile);
+  unlink(spec.snapfile);
+  rmdir(dir);
+  return ok;
+}
+
+/** Results of the journal test, sent back from the child doing it */
+struct snap_jtest {
+  bool started; /**< Did the first checkpoint ask for a snapshot? */
+  bool wrote;   /**< Was it written? */
+  bool frames;  /**< Did the next checkpoints journal their changes? */
+  bool read1;   /**< Did the snapshot and journal read back? */
+  bool right1;  /**< With the changes in them? */
+  bool frame3;  /**< Did a checkpoint after that journal its change? */
+  bool read2;   /**< Did it all read back again? */
+  bool right2;  /**< With every change in it? */
+  bool marked;  /**< Did flag, lock and move changes come back too? */
+};
+
+/** Does the journal test's object look the way it should? */
+static bool
+snap_jtest_check(dbref o, const char *name, const char *value)
+{
+  ATTR *a = atr_get_noparent(o, "JOURNAL_TEST");
+
+  return IsThing(o) && Name(o) && !strcmp(Name(o), name) && a &&
+         !strcmp(atr_value(a), value);
+}
+
+/** Take a snapshot, journal some changes to it, and read it all back.
+ * This runs in a child process, since it throws the database away.
+ */
+static void
+snap_jtest_run(void *arg, void *result)
+{
+  const char *snapfile = arg;
+  struct snap_jtest *r = result;
+  char jname[FILE_PATH_LEN + 16], oldname[FILE_PATH_LEN + 16];
+  FILE *fp;
+  dbref base = db_top, o, top;
+
+  /* Plenty of objects, so the journal stays well short of compaction */
+  snap_bench_make(500);
+  r->started = !snapshot_checkpoint(snapfile);
+  r->wrote = snapshot_write(snapfile);
+  snapshot_compacted(r->wrote);
+
+  o = new_object();
+  set_name(o, "Journal test");
+  db[o].type = TYPE_THING;
+  db[o].flags = string_to_bits("FLAG", "SAFE");
+  db[o].owner = GOD;
+  db[o].location = db[o].exits = 0;
+  db[o].next = db[0].contents;
+  db[0].contents = o;
+  atr_add(o, "JOURNAL_TEST", "first", GOD, 0);
+  r->frames = snapshot_checkpoint(snapfile);
+  atr_add(o, "JOURNAL_TEST", "second", GOD, 0);
+  set_name(o, "Journal test 2");
+  r->frames = snapshot_checkpoint(snapfile) && r->frames;
+  top = db_top;
+
+  /* A frame cut short by a crash is ignored */
+  snap_journal_names(snapfile, jname, oldname);
+  if ((fp = fopen(jname, "ab"))) {
+    fputs("torn frame", fp);
+    fclose(fp);
+  }
+  r->read1 = snapshot_read(snapfile) == top;
+  r->right1 = r->read1 && snap_jtest_check(o, "Journal test 2", "second");
+
+  /* A flag and a lock are marked where they're set, and a move is
+   * noticed by comparing the object with how it was */
+  atr_add(o, "JOURNAL_TEST", "third", GOD, 0);
+  set_flag_internal(base, "NO_COMMAND");
+  add_lock_raw(GOD, base + 1, Use_Lock, parse_boolexp(GOD, "#1", Use_Lock),
+               LF_DEFAULT);
+  moveto(base + 2, GOD, GOD, "move");
+  r->frame3 = snapshot_checkpoint(snapfile);
+  r->read2 = snapshot_read(snapfile) == top;
+  r->right2 = r->read2 && snap_jtest_check(o, "Journal test 2", "third");
+  r->marked = r->read2 && has_flag_by_name(base, "NO_COMMAND", NOTYPE) &&
+              getlock_noparent(base + 1, Use_Lock) != TRUE_BOOLEXP &&
+              Location(base + 2) == GOD;
+}
+#endif
+
+TEST_GROUP(snapshot)
+{
+#ifndef WIN32
+  struct snap_bench r;
+  bool sent;
+
+  sent = snap_bench_fork(&r, SNAP_TEST_OBJECTS);
+  TEST("snapshot.1", sent && r.made);
+  TEST("snapshot.2", r.text_ok);
+  TEST("snapshot.3", r.snap_ok);
+  TEST("snapshot.4", r.snap_bytes > 0 && r.snap_bytes < r.text_bytes * 2);
+#endif
+}
+
+BENCHMARK(snapshot)
+{
+#ifndef WIN32
+  struct snap_bench r;
+
+  if (!snap_bench_fork(&r, SNAP_BENCH_OBJECTS) || !r.text_ok || !r.snap_ok) {
+    do_rawlog(LT_TRACE, "snapshot: round trip failed.");
+    return;
+  }
+  do_rawlog(LT_TRACE,
+            "snapshot: %d objects with %d attributes each. Text database: %ld "
+            "bytes, written in %.1fms, read in %.1fms. Snapshot: %ld bytes, "
+            "written in %.1fms, read in %.1fms (%.1fx faster).",
+            SNAP_BENCH_OBJECTS, SNAP_BENCH_ATTRS, r.text_bytes, r.text_write,
+            r.text_read, r.snap_bytes, r.snap_write, r.snap_read,
+            r.snap_read > 0 ? r.text_read / r.snap_read : 0.0);
+#endif
+}
+
+TEST_GROUP(snapshot_journal)
+{
+#ifndef WIN32
+  char dir[FILE_PATH_LEN], snapfile[FILE_PATH_LEN];
+  char jname[FILE_PATH_LEN + 16], oldname[FILE_PATH_LEN + 16];
+  struct snap_jtest r;
+  bool sent = 0;
+
+  memset(&r, 0, sizeof r);
+  if (test_scratch_dir(dir, sizeof dir, "snapjournal")) {
+    if (snprintf(snapfile, sizeof snapfile, "%s/journal.snap", dir) <
+        (int) sizeof snapfile) {
+      sent = run_in_child(snap_jtest_run, snapfile, &r, sizeof r);
+      snap_journal_names(snapfile, jname, oldname);
+      unlink(snapfile);
+      unlink(jname);
+      unlink(oldname);
+    }
+    rmdir(dir);
+  }
+
+  TEST("snapshot_journal.1", sent && r.started && r.wrote);
+  TEST("snapshot_journal.2", r.frames);
+  TEST("snapshot_journal.3", r.read1);
+  TEST("snapshot_journal.4", r.right1);
+  TEST("snapshot_journal.5", r.frame3 && r.read2);
+  TEST("snapshot_journal.6", r.right2);
+  TEST("snapshot_journal.7", r.marked);
+#endif
+}
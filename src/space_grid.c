@@ -0,0 +1,219 @@
+/* space_grid.c */
+
+#include "config.h"
+#include "space.h"
+
+/* ------------------------------------------------------------------------ */
+
+/* Uniform grid over sdb[].coords, used to find the objects a sensor sweep
+ * can possibly see without looking at every slot. Cells are a little larger
+ * than the sweep limit, so anything in range of an object lies in the same
+ * cell or one of its 26 neighbours. Objects in different locations or
+ * spaces never share a cell.
+ *
+ * The grid is rebuilt at the start of every do_space_db_iterate() pass,
+ * which picks up objects created, read or moved by softcode since the last
+ * one, and kept current during the pass by kern_tick_move().
+ */
+
+#define GRID_LIMIT      (PARSEC * 100.0)
+#define GRID_CELL       (GRID_LIMIT * 1.01)
+#define GRID_MAX_INDEX  (1 << 30)
+#define GRID_CELLS      8192 /* power of two, at least 2*MAX_SPACE_OBJECTS */
+
+struct grid_cell_t {
+     int location;
+     int space;
+     int x;
+     int y;
+     int z;
+     int head;    /* first slot in this cell, 0 if none */
+     int used;    /* this table entry holds a cell */
+};
+
+static struct grid_cell_t grid_cells[GRID_CELLS];
+static int grid_cell_of[MAX_SPACE_OBJECTS + 1];  /* table entry + 1, 0 if none */
+static int grid_next[MAX_SPACE_OBJECTS + 1];
+static int grid_prev[MAX_SPACE_OBJECTS + 1];
+static int grid_valid = 0;   /* every object with a type is indexed */
+
+/* ------------------------------------------------------------------------ */
+
+static int
+grid_index(double coord)
+{
+  double i = floor(coord / GRID_CELL);
+
+  /* Clamping keeps neighbouring coordinates in neighbouring cells. */
+  if (!(i > -GRID_MAX_INDEX))
+    return -GRID_MAX_INDEX;
+  if (i > GRID_MAX_INDEX)
+    return GRID_MAX_INDEX;
+  return (int) i;
+}
+
+/* ------------------------------------------------------------------------ */
+
+static unsigned int
+grid_hash(int location, int space, int x, int y, int z)
+{
+  unsigned int h = 2166136261u;
+
+  h = (h ^ (unsigned int) location) * 16777619u;
+  h = (h ^ (unsigned int) space) * 16777619u;
+  h = (h ^ (unsigned int) x) * 16777619u;
+  h = (h ^ (unsigned int) y) * 16777619u;
+  h = (h ^ (unsigned int) z) * 16777619u;
+  return h & (GRID_CELLS - 1);
+}
+
+/* ------------------------------------------------------------------------ */
+
+/* Find the table entry for a cell, claiming an empty one if create is set.
+ * Returns -1 if the cell doesn't exist or the table is full. */
+static int
+grid_find_cell(int location, int space, int x, int y, int z, int create)
+{
+  unsigned int h = grid_hash(location, space, x, y, z);
+  register int i;
+
+  for (i = 0; i < GRID_CELLS; ++i, h = (h + 1) & (GRID_CELLS - 1)) {
+    if (!grid_cells[h].used) {
+      if (!create)
+        return -1;
+      grid_cells[h].used = 1;
+      grid_cells[h].location = location;
+      grid_cells[h].space = space;
+      grid_cells[h].x = x;
+      grid_cells[h].y = y;
+      grid_cells[h].z = z;
+      grid_cells[h].head = 0;
+      return h;
+    }
+    if (grid_cells[h].location == location && grid_cells[h].space == space &&
+        grid_cells[h].x == x && grid_cells[h].y == y && grid_cells[h].z == z)
+      return h;
+  }
+  return -1;
+}
+
+/* ------------------------------------------------------------------------ */
+
+static void
+grid_unlink(int x)
+{
+  int c = grid_cell_of[x] - 1;
+
+  if (c < 0)
+    return;
+  if (grid_prev[x])
+    grid_next[grid_prev[x]] = grid_next[x];
+  else
+    grid_cells[c].head = grid_next[x];
+  if (grid_next[x])
+    grid_prev[grid_next[x]] = grid_prev[x];
+  grid_cell_of[x] = 0;
+  grid_next[x] = grid_prev[x] = 0;
+  return;
+}
+
+/* ------------------------------------------------------------------------ */
+
+static void
+grid_link(int x, int c)
+{
+  grid_cell_of[x] = c + 1;
+  grid_prev[x] = 0;
+  grid_next[x] = grid_cells[c].head;
+  if (grid_cells[c].head)
+    grid_prev[grid_cells[c].head] = x;
+  grid_cells[c].head = x;
+  return;
+}
+
+/* ------------------------------------------------------------------------ */
+
+void
+grid_rebuild(void)
+{
+  register int x;
+
+  memset(grid_cells, 0, sizeof(grid_cells));
+  memset(grid_cell_of, 0, sizeof(grid_cell_of));
+  memset(grid_next, 0, sizeof(grid_next));
+  memset(grid_prev, 0, sizeof(grid_prev));
+  grid_valid = 1;
+  for (x = MIN_SPACE_OBJECTS; x <= max_space_objects; ++x)
+    if (sdb[x].structure.type)
+      grid_move(x);
+  return;
+}
+
+/* ------------------------------------------------------------------------ */
+
+void
+grid_move(int x)
+{
+  int c;
+
+  if (!sdb[x].structure.type) {
+    grid_unlink(x);
+    return;
+  }
+  c = grid_find_cell(sdb[x].location, sdb[x].space,
+                     grid_index(sdb[x].coords.x), grid_index(sdb[x].coords.y),
+                     grid_index(sdb[x].coords.z), 1);
+  if (c >= 0 && c + 1 == grid_cell_of[x])
+    return;
+  grid_unlink(x);
+  if (c >= 0)
+    grid_link(x, c);
+  else
+    grid_valid = 0; /* table full; sweeps scan everything until rebuilt */
+  return;
+}
+
+/* ------------------------------------------------------------------------ */
+
+static int
+grid_slot_cmp(const void *a, const void *b)
+{
+  return *(const int *) a - *(const int *) b;
+}
+
+/* ------------------------------------------------------------------------ */
+
+/* Fill list with every object that might be within sensor range of x,
+ * in slot order, and return how many there are. */
+int
+grid_neighbours(int x, int *list)
+{
+  int cx = grid_index(sdb[x].coords.x);
+  int cy = grid_index(sdb[x].coords.y);
+  int cz = grid_index(sdb[x].coords.z);
+  register int dx, dy, dz, c, object;
+  int count = 0;
+
+  if (!grid_valid || !grid_cell_of[x]) {
+    /* Not indexed; fall back to every slot. */
+    for (object = MIN_SPACE_OBJECTS; object <= max_space_objects; ++object)
+      list[count++] = object;
+    return count;
+  }
+
+  for (dx = -1; dx <= 1; ++dx)
+    for (dy = -1; dy <= 1; ++dy)
+      for (dz = -1; dz <= 1; ++dz) {
+        c = grid_find_cell(sdb[x].location, sdb[x].space, cx + dx, cy + dy,
+                           cz + dz, 0);
+        if (c < 0)
+          continue;
+        for (object = grid_cells[c].head; object; object = grid_next[object])
+          list[count++] = object;
+      }
+
+  qsort(list, count, sizeof(int), grid_slot_cmp);
+  return count;
+}
+
+/* ------------------------------------------------------------------------ */
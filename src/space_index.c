@@ -0,0 +1,231 @@
+/* space_index.c */
+
+#include "config.h"
+#include "space.h"
+
+/* ------------------------------------------------------------------------ */
+
+/* Lookup tables for dbref2sdb(), name2sdb() and the slot search in
+ * do_space_db_read()/do_space_db_write(), which used to scan every slot.
+ *
+ * Slots holding the same object are chained in slot order under that
+ * dbref in sdb_by_object, so the first one on the chain is the one the old
+ * scans found. Anything that changes sdb[x].object or
+ * sdb[x].structure.type calls sdb_index_set(x), and do_space_db_iterate()
+ * resynchronises every slot once per pass in case something slipped past.
+ *
+ * The name table is rebuilt the next time it's needed after any slot
+ * changes or any object is renamed, and only handles plain names; patterns
+ * with wildcards or < and > comparisons still scan.
+ */
+
+static intmap *sdb_by_object = NULL;
+static dbref sdb_indexed[MAX_SPACE_OBJECTS + 1]; /* object filed under, 0 if none */
+static int sdb_object_next[MAX_SPACE_OBJECTS + 1];
+
+static HASHTAB sdb_by_name;
+static int sdb_name_next[MAX_SPACE_OBJECTS + 1];
+static int sdb_names_init = 0;
+static int sdb_names_valid = 0;
+static unsigned int sdb_names_generation = 0;
+
+/* ------------------------------------------------------------------------ */
+
+static void
+sdb_object_unlink(int x)
+{
+  dbref obj = sdb_indexed[x];
+  int head, i;
+
+  if (!obj)
+    return;
+  head = (int) (intptr_t) im_find(sdb_by_object, obj);
+  if (head == x) {
+    im_delete(sdb_by_object, obj);
+    if (sdb_object_next[x])
+      im_insert(sdb_by_object, obj, (void *) (intptr_t) sdb_object_next[x]);
+  } else {
+    for (i = head; i && sdb_object_next[i] != x; i = sdb_object_next[i])
+      ;
+    if (i)
+      sdb_object_next[i] = sdb_object_next[x];
+  }
+  sdb_indexed[x] = 0;
+  sdb_object_next[x] = 0;
+  return;
+}
+
+/* ------------------------------------------------------------------------ */
+
+static void
+sdb_object_link(int x, dbref obj)
+{
+  int head, i;
+
+  sdb_indexed[x] = obj;
+  head = (int) (intptr_t) im_find(sdb_by_object, obj);
+  if (!head || x < head) {
+    if (head)
+      im_delete(sdb_by_object, obj);
+    im_insert(sdb_by_object, obj, (void *) (intptr_t) x);
+    sdb_object_next[x] = head;
+    return;
+  }
+  for (i = head; sdb_object_next[i] && sdb_object_next[i] < x;
+       i = sdb_object_next[i])
+    ;
+  sdb_object_next[x] = sdb_object_next[i];
+  sdb_object_next[i] = x;
+  return;
+}
+
+/* ------------------------------------------------------------------------ */
+
+/* Refile slot x after its object or type has changed. Object 0 is what an
+ * empty slot holds, so it isn't indexed. */
+void
+sdb_index_set(int x)
+{
+  dbref obj = sdb[x].object;
+
+  if (x < MIN_SPACE_OBJECTS || x > MAX_SPACE_OBJECTS)
+    return;
+  if (!sdb_by_object)
+    sdb_by_object = im_new();
+  sdb_names_valid = 0;
+  if (obj < 0)
+    obj = 0;
+  if (sdb_indexed[x] == obj)
+    return;
+  sdb_object_unlink(x);
+  if (obj)
+    sdb_object_link(x, obj);
+  return;
+}
+
+/* ------------------------------------------------------------------------ */
+
+void
+sdb_index_sync(void)
+{
+  register int x;
+  dbref obj;
+
+  for (x = MIN_SPACE_OBJECTS; x <= MAX_SPACE_OBJECTS; ++x) {
+    obj = sdb[x].object < 0 ? 0 : sdb[x].object;
+    if (sdb_indexed[x] != obj)
+      sdb_index_set(x);
+  }
+  return;
+}
+
+/* ------------------------------------------------------------------------ */
+
+/* Returns the first slot holding obj, loaded or not, 0 if none. */
+int
+sdb_find_object(dbref obj)
+{
+  int x;
+
+  if (obj <= 0 || !sdb_by_object)
+    return 0;
+  for (x = (int) (intptr_t) im_find(sdb_by_object, obj); x;
+       x = sdb_object_next[x])
+    if (sdb[x].object == obj)
+      return x;
+  return 0;
+}
+
+/* ------------------------------------------------------------------------ */
+
+/* Returns the first loaded slot holding obj, 0 if none. */
+int
+sdb_find_loaded(dbref obj)
+{
+  int x;
+
+  if (obj <= 0 || !sdb_by_object)
+    return 0;
+  for (x = (int) (intptr_t) im_find(sdb_by_object, obj); x;
+       x = sdb_object_next[x])
+    if (sdb[x].structure.type && sdb[x].object == obj)
+      return x;
+  return 0;
+}
+
+/* ------------------------------------------------------------------------ */
+
+/* Fold a name the way local_wild_match() does before comparing. */
+static char *
+sdb_name_key(const char *name, char *buff)
+{
+  mush_strncpy(buff, remove_markup(name, NULL), BUFFER_LEN);
+  upcasestr(buff);
+  return buff;
+}
+
+/* ------------------------------------------------------------------------ */
+
+static void
+sdb_names_rebuild(void)
+{
+  char key[BUFFER_LEN];
+  int tail[MAX_SPACE_OBJECTS + 1];
+  register int x, head;
+
+  if (!sdb_names_init) {
+    hash_init(&sdb_by_name, 256, NULL);
+    sdb_names_init = 1;
+  } else
+    hash_flush(&sdb_by_name, 256);
+
+  memset(tail, 0, sizeof(tail));
+  for (x = MIN_SPACE_OBJECTS; x <= max_space_objects; ++x) {
+    sdb_name_next[x] = 0;
+    if (!sdb[x].structure.type || !GoodObject(sdb[x].object))
+      continue;
+    sdb_name_key(Name(sdb[x].object), key);
+    head = (int) (intptr_t) hash_value(&sdb_by_name, key);
+    if (head) {
+      /* Names are added in slot order, so append to keep the chain sorted. */
+      sdb_name_next[tail[head]] = x;
+      tail[head] = x;
+    } else {
+      hash_add(&sdb_by_name, key, (void *) (intptr_t) x);
+      tail[x] = x;
+    }
+  }
+  sdb_names_valid = 1;
+  sdb_names_generation = name_generation;
+  return;
+}
+
+/* ------------------------------------------------------------------------ */
+
+/* Returns the first loaded slot named exactly name, SENSOR_FAIL if none, or
+ * 0 if name is a pattern the table can't answer. */
+int
+sdb_find_name(const char *name)
+{
+  char key[BUFFER_LEN];
+  int x;
+
+  if (!name || !*name || *name == '<' || *name == '>')
+    return 0;
+  sdb_name_key(name, key);
+  if (!*key || strpbrk(key, "*?\\"))
+    return 0;
+
+  if (!sdb_names_valid || sdb_names_generation != name_generation)
+    sdb_names_rebuild();
+
+  for (x = (int) (intptr_t) hash_value(&sdb_by_name, key); x;
+       x = sdb_name_next[x])
+    if (sdb[x].structure.type && GoodObject(sdb[x].object) &&
+        SpaceObj(sdb[x].object) &&
+        local_wild_match(name, Name(sdb[x].object), NULL))
+      return x;
+  return SENSOR_FAIL;
+}
+
+/* ------------------------------------------------------------------------ */
@@ -2,12 +2,14 @@
 
 #include "config.h"
 #include "space.h"
+#include "tests.h"
 
 /* ------------------------------------------------------------------------ */
 
 int temp_sdb[MAX_SENSOR_CONTACTS];
 int temp_num[MAX_SENSOR_CONTACTS];
 double temp_lev[MAX_SENSOR_CONTACTS];
+static int temp_near[MAX_SPACE_OBJECTS + 1];
 
 extern time_t mudtime;
 
@@ -725,14 +727,8 @@ up_cochranes(void)
 void
 up_velocity(void)
 {
-  if (sdb[n].engine.warp_exist || sdb[n].engine.impulse_exist) {
-    if (sdb[n].move.out >= 1.0) {
-      sdb[n].move.v = LIGHTSPEED * pow(sdb[n].move.out, 3.333333);
-    } else if (sdb[n].move.out <= -1.0) {
-      sdb[n].move.v = LIGHTSPEED * -pow(fabs(sdb[n].move.out), 3.333333);
-    } else
-      sdb[n].move.v = LIGHTSPEED * sdb[n].move.out;
-  }
+  if (sdb[n].engine.warp_exist || sdb[n].engine.impulse_exist)
+    kern_one_velocity(n);
 
   return;
 }
@@ -915,49 +911,7 @@ up_roll_io(void)
 void
 up_vectors(void)
 {
-  double d2r = PI / 180.0;
-  double sy = sin(sdb[n].course.yaw_out * d2r);
-  double cy = cos(sdb[n].course.yaw_out * d2r);
-  double sp = sin(sdb[n].course.pitch_out * d2r);
-  double cp = cos(sdb[n].course.pitch_out * d2r);
-  double sr = sin(sdb[n].course.roll_out * d2r);
-  double cr = cos(sdb[n].course.roll_out * d2r);
-
-  sdb[n].course.d[0][0] = cy * cp;
-  sdb[n].course.d[0][1] = sy * cp;
-  sdb[n].course.d[0][2] = sp;
-  sdb[n].course.d[1][0] = -(sy * cr) + (cy * sp * sr);
-  sdb[n].course.d[1][1] = (cy * cr) + (sy * sp * sr);
-  sdb[n].course.d[1][2] = -(cp * sr);
-  sdb[n].course.d[2][0] = -(sy * sr) - (cy * sp * cr);
-  sdb[n].course.d[2][1] = (cy * sr) - (sy * sp * cr);
-  sdb[n].course.d[2][2] = (cp * cr);
-  sdb[n].course.version = 0;
-
-  return;
-}
-
-/* ------------------------------------------------------------------------ */
-
-void
-up_position(void)
-{
-  double dv = sdb[n].move.v * sdb[n].move.dt;
-
-  if (fabs(sdb[n].move.out) >= 1.0)
-    dv *= sdb[n].move.cochranes;
-  if (sdb[n].status.tractoring) {
-    sdb[sdb[n].status.tractoring].coords.x += dv * sdb[n].course.d[0][0];
-    sdb[sdb[n].status.tractoring].coords.y += dv * sdb[n].course.d[0][1];
-    sdb[sdb[n].status.tractoring].coords.z += dv * sdb[n].course.d[0][2];
-  } else if (sdb[n].status.tractored) {
-    sdb[sdb[n].status.tractored].coords.x += dv * sdb[n].course.d[0][0];
-    sdb[sdb[n].status.tractored].coords.y += dv * sdb[n].course.d[0][1];
-    sdb[sdb[n].status.tractored].coords.z += dv * sdb[n].course.d[0][2];
-  }
-  sdb[n].coords.x += dv * sdb[n].course.d[0][0];
-  sdb[n].coords.y += dv * sdb[n].course.d[0][1];
-  sdb[n].coords.z += dv * sdb[n].course.d[0][2];
+  kern_one_vectors(n);
 
   return;
 }
@@ -967,26 +921,8 @@ up_position(void)
 void
 up_resolution(void)
 {
-  // int i;
-
-  if (sdb[n].sensor.lrs_active) {
-    sdb[n].sensor.lrs_resolution =
-      sdb[n].tech.sensors * sdb[n].sensor.lrs_damage;
-    if (sdb[n].sensor.ew_active)
-      sdb[n].sensor.lrs_resolution *= sdb2eccm_lrs(n);
-    if (sdb[n].cloak.active)
-      sdb[n].sensor.lrs_resolution /= 10.0;
-  } else
-    sdb[n].sensor.lrs_resolution = 0.0;
-  if (sdb[n].sensor.srs_active) {
-    sdb[n].sensor.srs_resolution =
-      sdb[n].tech.sensors * sdb[n].sensor.srs_damage;
-    if (sdb[n].sensor.ew_active)
-      sdb[n].sensor.srs_resolution *= sdb2eccm_srs(n);
-    if (sdb[n].cloak.active)
-      sdb[n].sensor.srs_resolution /= 10.0;
-  } else
-    sdb[n].sensor.srs_resolution = 0.0;
+  kern_one_resolution(n);
+
   return;
 }
 
@@ -995,40 +931,8 @@ up_resolution(void)
 void
 up_signature(int x)
 {
-  double base =
-    pow(sdb[x].structure.displacement, 0.333333) / sdb[x].tech.stealth / 100.0;
-  double sig = base;
-  // double cloak;
-
-  if (sdb[x].cloak.active) {
-    sdb[x].cloak.level = 0.001 / sdb[x].power.total / sdb[x].alloc.cloak /
-                         sdb[x].tech.cloak * sdb[x].cloak.cost;
-    if (sdb[x].status.tractored)
-      sdb[x].cloak.level *= 100.0;
-    if (sdb[x].status.tractoring)
-      sdb[x].cloak.level *= 100.0;
-    if (sdb[x].beam.out > 1.0)
-      sdb[x].cloak.level *= sdb[x].beam.out;
-    if (sdb[x].missile.out > 1.0)
-      sdb[x].cloak.level *= sdb[x].missile.out;
-    if (sdb[x].sensor.visibility < 1.0)
-      sdb[x].cloak.level *= (1.0 - sdb[x].sensor.visibility) * 10000.0;
-    if (sdb[x].cloak.level > 1.0)
-      sdb[x].cloak.level = 1.0;
-  } else
-    sdb[x].cloak.level = 1.0;
-
-  sdb[x].sensor.lrs_signature = sig;
-  sdb[x].sensor.srs_signature = sig * 10.0;
-  sdb[x].sensor.lrs_signature *= sdb[x].move.out * sdb[n].move.out + 1.0;
-  sdb[x].sensor.srs_signature *= 1.0 + sdb[x].power.main +
-                                 (sdb[x].power.aux / 10.0) +
-                                 (sdb[x].power.batt / 100.0);
-  if (sdb[x].sensor.ew_active) {
-    sdb[x].sensor.lrs_signature /= sdb2ecm_lrs(x);
-    sdb[x].sensor.srs_signature /= sdb2ecm_srs(x);
-  }
-  sdb[x].sensor.version = 0;
+  kern_one_signature(x, sdb[n].move.out);
+
   return;
 }
 
@@ -1144,43 +1048,46 @@ up_sensor_list(void)
   register int object, i;
   register int contacts = 0;
   double x, y, z, level, limit = PARSEC * 100.0;
-
-  for (object = MIN_SPACE_OBJECTS; object <= max_space_objects; ++object)
-    if (sdb[n].location == sdb[object].location &&
-        sdb[n].space == sdb[object].space && sdb[object].structure.type &&
-        n != object) {
-      x = fabs(sdb[n].coords.x - sdb[object].coords.x);
-      if (x > limit)
-        continue;
-      y = fabs(sdb[n].coords.y - sdb[object].coords.y);
-      if (y > limit)
-        continue;
-      z = fabs(sdb[n].coords.z - sdb[object].coords.z);
-      if (z > limit)
-        continue;
-      level = (sdb[n].sensor.srs_resolution + 0.01) *
-              sdb[object].sensor.srs_signature /
-              (0.1 + (x * x + y * y + z * z) / 10101.010101);
-      x /= PARSEC;
-      y /= PARSEC;
-      z /= PARSEC;
-      level += sdb[n].sensor.lrs_resolution * sdb[object].sensor.lrs_signature /
-               (1.0 + (x * x + y * y + z * z) * 99.0);
-      level *= sdb[n].sensor.visibility * sdb[object].sensor.visibility;
-      if (level < 0.01)
-        continue;
-      if (sdb[object].cloak.active)
-        if (sdb[n].tech.sensors < 2.0)
-          level *= sdb[object].cloak.level;
-      if (level < 0.01)
-        continue;
-      temp_sdb[contacts] = object;
-      temp_lev[contacts] = level;
-      ++contacts;
-      if (contacts == MAX_SENSOR_CONTACTS) {
-        break;
-      }
+  int near = grid_neighbours(n, temp_near);
+
+  for (i = 0; i < near; ++i) {
+    object = temp_near[i];
+    if (sdb[n].location != sdb[object].location ||
+        sdb[n].space != sdb[object].space || !sdb[object].structure.type ||
+        n == object)
+      continue;
+    x = fabs(sdb[n].coords.x - sdb[object].coords.x);
+    if (x > limit)
+      continue;
+    y = fabs(sdb[n].coords.y - sdb[object].coords.y);
+    if (y > limit)
+      continue;
+    z = fabs(sdb[n].coords.z - sdb[object].coords.z);
+    if (z > limit)
+      continue;
+    level = (sdb[n].sensor.srs_resolution + 0.01) *
+            sdb[object].sensor.srs_signature /
+            (0.1 + (x * x + y * y + z * z) / 10101.010101);
+    x /= PARSEC;
+    y /= PARSEC;
+    z /= PARSEC;
+    level += sdb[n].sensor.lrs_resolution * sdb[object].sensor.lrs_signature /
+             (1.0 + (x * x + y * y + z * z) * 99.0);
+    level *= sdb[n].sensor.visibility * sdb[object].sensor.visibility;
+    if (level < 0.01)
+      continue;
+    if (sdb[object].cloak.active)
+      if (sdb[n].tech.sensors < 2.0)
+        level *= sdb[object].cloak.level;
+    if (level < 0.01)
+      continue;
+    temp_sdb[contacts] = object;
+    temp_lev[contacts] = level;
+    ++contacts;
+    if (contacts == MAX_SENSOR_CONTACTS) {
+      break;
     }
+  }
 
   if (contacts != sdb[n].sensor.contacts) {
     up_sensor_message(contacts);
@@ -1213,11 +1120,19 @@ up_repair(void)
 int
 do_space_db_iterate(void)
 {
-  register int count = 0;
+  static int list[MAX_SPACE_OBJECTS];
+  static int velocity[MAX_SPACE_OBJECTS];
+  register int count = 0, ticked = 0, i;
   // mudtime is sometimes in accurate. Grab the current time ourself.
   time_t now;
   time(&now);
 
+  ++space_tick;
+  sdb_index_sync();
+  grid_rebuild();
+
+  /* Power, helm and weapons, one ship at a time. */
+
   for (n = MIN_SPACE_OBJECTS; n <= max_space_objects; ++n)
     if (sdb[n].status.active && sdb[n].structure.type) {
       if (sdb[n].status.time > 1)
@@ -1225,6 +1140,8 @@ do_space_db_iterate(void)
       sdb[n].move.dt = now - sdb[n].move.time;
       sdb[n].move.time = now;
       if (sdb[n].move.dt > 0.0) {
+        list[ticked] = n;
+        velocity[ticked] = 0;
         if (sdb[n].structure.type == 1)
           if (sdb[n].move.time - sdb[n].status.time > 3600) {
             if (sdb[n].main.in > 0.0) {
@@ -1280,7 +1197,7 @@ do_space_db_iterate(void)
           up_autopilot();
         if (sdb[n].move.in != sdb[n].move.out) {
           up_speed_io();
-          up_velocity();
+          velocity[ticked] = 1;
           up_turn_rate();
         }
         if (sdb[n].move.out != 0.0) {
@@ -1293,28 +1210,160 @@ do_space_db_iterate(void)
           up_pitch_io();
         if (sdb[n].course.roll_in != sdb[n].course.roll_out)
           up_roll_io();
-        if (sdb[n].course.version)
-          up_vectors();
-        if (sdb[n].move.v != 0.0) {
-          up_position();
-          up_cochranes();
-          up_empire(n);
-          up_quadrant();
-          up_visibility();
-        }
-        if (sdb[n].cloak.version)
-          up_cloak_status();
-        if (sdb[n].sensor.version) {
-          up_resolution();
-          up_signature(n);
-        }
-        up_sensor_list();
-        if (sdb[n].structure.repair != sdb[n].structure.max_repair)
-          up_repair();
+        ++ticked;
       }
     }
 
+  /* Velocity, course and position, all ships at once. */
+
+  kern_tick_move(list, velocity, ticked);
+
+  for (i = 0; i < ticked; ++i) {
+    n = list[i];
+    if (sdb[n].move.v != 0.0) {
+      up_cochranes();
+      up_empire(n);
+      up_quadrant();
+      up_visibility();
+    }
+    if (sdb[n].cloak.version)
+      up_cloak_status();
+  }
+
+  /* Sensor levels, all ships at once, then sweeps against the new
+   * positions. */
+
+  kern_tick_sensors(list, ticked);
+
+  for (i = 0; i < ticked; ++i) {
+    n = list[i];
+    up_sensor_list();
+    if (sdb[n].structure.repair != sdb[n].structure.max_repair)
+      up_repair();
+  }
+
   return count;
 }
 
 /* ------------------------------------------------------------------------ */
+
+/* ------------------------------------------------------------------------ */
+
+#ifndef WIN32
+#define TICK_TEST_SHIPS 8
+#define TICK_TEST_TICKS 4
+#define TICK_BENCH_SHIPS 40
+#define TICK_BENCH_TICKS 200
+
+/* Size of a tick benchmark run */
+struct tick_bench_spec {
+  int ships;
+  int ticks;
+};
+
+/* Results of the tick benchmark, sent back from the child running it. */
+struct tick_bench {
+  int made;
+  int ticked;
+  double us;
+};
+
+/* Ships in two groups that swap over every tick, so each ship gains and
+ * loses sensor contacts, and sends console messages to a crew member. */
+static void
+tick_bench_run(void *arg, void *result)
+{
+  const struct tick_bench_spec *spec = arg;
+  struct tick_bench *r = result;
+  int ships = spec->ships, ticks = spec->ticks;
+  dbref crew, console, parent, ship;
+  struct timeval start, end;
+  time_t now;
+  register int i, t;
+
+  /* Tests run before initSpace(), so the flag may not exist yet. */
+  add_flag("SPACE-OBJECT", '+', TYPE_THING | TYPE_PLAYER, F_WIZARD, F_WIZARD);
+  parent = new_object();
+  set_name(parent, "Tick bench console parent");
+  console = new_object();
+  set_name(console, "Tick bench console");
+  crew = new_object();
+  set_name(crew, "Tick bench crew");
+  db[parent].type = db[console].type = db[crew].type = TYPE_THING;
+  db[parent].owner = db[console].owner = db[crew].owner = GOD;
+  db[parent].flags = string_to_bits("FLAG", "");
+  db[console].flags = string_to_bits("FLAG", "");
+  db[crew].flags = string_to_bits("FLAG", "");
+  db[console].parent = parent;
+  console_fighter = parent;
+  atr_add(console, CONSOLE_USER_ATTR_NAME, unparse_dbref(crew), GOD, 0);
+
+  memset(&sdb[MIN_SPACE_OBJECTS], 0, ships * sizeof(sdb[0]));
+  for (i = 0; i < ships; ++i) {
+    ship = new_object();
+    set_name(ship, tprintf("Tick bench ship %d", i));
+    db[ship].type = TYPE_THING;
+    db[ship].owner = GOD;
+    db[ship].flags = string_to_bits("FLAG", "SPACE-OBJECT");
+    atr_add(ship, CONSOLE_ATTR_NAME, unparse_dbref(console), GOD, 0);
+    n = MIN_SPACE_OBJECTS + i;
+    sdb[n].object = ship;
+    sdb[n].structure.type = 1;
+    sdb[n].status.active = 1;
+    sdb[n].sensor.srs_resolution = 1.0;
+    sdb[n].sensor.srs_signature = 1.0;
+    sdb[n].sensor.visibility = 1.0;
+  }
+  if (max_space_objects < MIN_SPACE_OBJECTS + ships)
+    max_space_objects = MIN_SPACE_OBJECTS + ships;
+  r->made = SpaceObj(sdb[MIN_SPACE_OBJECTS].object);
+
+  penn_gettimeofday(&start);
+  for (t = 0; t < ticks; ++t) {
+    time(&now);
+    for (i = 0; i < ships; ++i) {
+      n = MIN_SPACE_OBJECTS + i;
+      sdb[n].space = (t + i) & 1;
+      sdb[n].move.time = now - 1;
+      sdb[n].status.time = now;
+    }
+    do_space_db_iterate();
+    r->ticked += sdb[MIN_SPACE_OBJECTS].sensor.contacts > 0;
+  }
+  penn_gettimeofday(&end);
+  r->us = (end.tv_sec - start.tv_sec) * 1000000.0 +
+          (end.tv_usec - start.tv_usec);
+  return;
+}
+#endif
+
+TEST_GROUP(space_tick)
+{
+#ifndef WIN32
+  struct tick_bench_spec spec = {TICK_TEST_SHIPS, TICK_TEST_TICKS};
+  struct tick_bench r;
+  bool ok;
+
+  /* Run in a child, so the ships and objects it makes go away. */
+  memset(&r, 0, sizeof r);
+  ok = run_in_child(tick_bench_run, &spec, &r, sizeof r);
+  TEST("space_tick.1", ok && r.made);
+  TEST("space_tick.2", r.ticked == TICK_TEST_TICKS);
+#endif
+}
+
+BENCHMARK(space_tick)
+{
+#ifndef WIN32
+  struct tick_bench_spec spec = {TICK_BENCH_SHIPS, TICK_BENCH_TICKS};
+  struct tick_bench r;
+
+  memset(&r, 0, sizeof r);
+  if (!run_in_child(tick_bench_run, &spec, &r, sizeof r))
+    return;
+  do_rawlog(LT_TRACE,
+            "space_tick: %d ships swapping sensor contacts, %d ticks, "
+            "%.1f us/tick",
+            TICK_BENCH_SHIPS, TICK_BENCH_TICKS, r.us / TICK_BENCH_TICKS);
+#endif
+}
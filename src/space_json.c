@@ -9,65 +9,285 @@ cJSON *get_sensor_report(int shipSDB);
 cJSON *get_space_status(char *system, char *subsystem, int shipSDB, char *buff,
                         char **bp);
 
-void
-space_json_iterate()
+/* ------------------------------------------------------------------------ */
+
+/* Ship status pushes to SPACE-JSON bridge crew. Each ship's document is
+ * built at most once per space tick. A client gets the whole document
+ * under "ship" the first time, and after that only an RFC 7396 merge
+ * patch against the previous one under "ship.delta", if anything changed.
+ *
+ * Routing from a ship to its consoles and their users is cached, and
+ * only re-read when AttrVersion() says the ship or a console has had an
+ * attribute set since.
+ */
+
+struct json_console_t {
+  dbref console;
+  uint32_t version;     /* console's AttrVersion() when user was read */
+  dbref user;
+};
+
+struct json_client_t {
+  int descriptor;
+  time_t connected_at;
+};
+
+struct json_ship_t {
+  dbref ship;           /* routing below belongs to this object */
+  uint32_t version;     /* ship's AttrVersion() when consoles were read */
+  int valid;            /* routing has been read */
+  int consoles;
+  int console_size;
+  struct json_console_t *console;
+
+  unsigned int tick;    /* space_tick last pushed on */
+  cJSON *last;          /* document the clients below have */
+  int clients;
+  int client_size;
+  struct json_client_t *client;
+};
+
+static struct json_ship_t json_ships[MAX_SPACE_OBJECTS + 1];
+
+/* ------------------------------------------------------------------------ */
+
+static void
+json_read_user(struct json_console_t *c)
 {
-  for (int x = MIN_SPACE_OBJECTS; x <= max_space_objects; ++x) {
-    ATTR *a, *b;
-    char *q, *pq, show_message[BUFFER_LEN];
-    
-    dbref console, user;
-    memset(show_message, 0, sizeof(show_message));
-    if (!sdb[x].status.active)
-      continue;
+  ATTR *b;
 
-    get_space_status("ship", NULL, x, NULL, NULL);
-
-    a = atr_get(sdb[x].object, CONSOLE_ATTR_NAME);
-
-    if (a && *AL_STR(a)) { // Attribute exists AND isn't empty
-
-      q = safe_atr_value(a, "space.consoles.all");
-      pq = trim_space_sep(q, ' ');
-      while (pq) {
-        console = parse_dbref(split_token(&pq, ' '));
-
-        if (console != NOTHING) {
-          b = atr_get(console, CONSOLE_USER_ATTR_NAME);
-          if (b != NULL) {
-            user = parse_dbref(atr_value(b));
-            if (GoodObject(user) &&
-                has_flag_by_name(user, "SPACE-JSON", TYPE_PLAYER)) {
-              DESC *match = lookup_desc(user, Name(user));
-              if (match) {
-                if (match->conn_flags & CONN_WEBSOCKETS) {
-                  send_websocket_object(
-                    match, "ship",
-                    get_space_status("ship", NULL, x, NULL, NULL));
-                }
-                if (match->conn_flags & CONN_GMCP) {
-                  send_oob(match, "ship",
-                           get_space_status("ship", NULL, x, NULL, NULL));
-                }
-              }
-            }
-          }
-        }
-      }
-      mush_free(q, "space.consoles.all");
-      // mush_free(show_message, "console_message");
-    } else {
+  c->user = NOTHING;
+  if (!GoodObject(c->console)) {
+    c->version = 0;
+    return;
+  }
+  c->version = AttrVersion(c->console);
+  b = atr_get(c->console, CONSOLE_USER_ATTR_NAME);
+  if (b != NULL)
+    c->user = parse_dbref(atr_value(b));
+  return;
+}
+
+/* ------------------------------------------------------------------------ */
+
+/* Bring ship x's console routing up to date. Returns the number of
+ * consoles. */
+static int
+json_route(int x)
+{
+  struct json_ship_t *j = &json_ships[x];
+  dbref ship = sdb[x].object;
+  register int i;
+  char *q, *pq;
+  ATTR *a;
+
+  if (j->ship != ship) {
+    /* A different object has the slot; its clients start from scratch. */
+    if (j->last)
+      cJSON_Delete(j->last);
+    j->last = NULL;
+    j->clients = 0;
+    j->valid = 0;
+  }
+
+  if (!j->valid || j->ship != ship || j->version != AttrVersion(ship)) {
+    j->valid = 1;
+    j->ship = ship;
+    j->version = AttrVersion(ship);
+    j->consoles = 0;
+
+    a = atr_get(ship, CONSOLE_ATTR_NAME);
+    if (!a || !*AL_STR(a)) { // Attribute missing or empty
       write_spacelog(
-        GOD, sdb[x].object,
+        GOD, ship,
         tprintf("CONSOLE_NOTIFY_ALL: Missing or Empty %s ATTRIBUTE on #%d (%d)",
-                CONSOLE_ATTR_NAME, sdb[x].object, x));
-      return;
+                CONSOLE_ATTR_NAME, ship, x));
+      return 0;
+    }
+
+    q = safe_atr_value(a, "space.consoles.all");
+    pq = trim_space_sep(q, ' ');
+    while (pq) {
+      dbref console = parse_dbref(split_token(&pq, ' '));
+
+      if (console == NOTHING)
+        continue;
+      if (j->consoles == j->console_size) {
+        j->console_size = j->console_size ? j->console_size * 2 : 8;
+        j->console = mush_realloc(j->console,
+                                  j->console_size * sizeof(*j->console),
+                                  "space.json.consoles");
+      }
+      j->console[j->consoles].console = console;
+      json_read_user(&j->console[j->consoles]);
+      j->consoles++;
+    }
+    mush_free(q, "space.consoles.all");
+    return j->consoles;
+  }
+
+  for (i = 0; i < j->consoles; ++i)
+    if (!GoodObject(j->console[i].console) ||
+        j->console[i].version != AttrVersion(j->console[i].console))
+      json_read_user(&j->console[i]);
+  return j->consoles;
+}
+
+/* ------------------------------------------------------------------------ */
+
+/* Returns an RFC 7396 merge patch that turns from into to, or NULL if
+ * they're the same. Arrays are replaced whole. */
+static cJSON *
+json_merge_patch(const cJSON *from, const cJSON *to)
+{
+  cJSON *patch = NULL, *item, *old, *sub;
+
+  cJSON_ArrayForEach(item, to)
+  {
+    old = cJSON_GetObjectItemCaseSensitive(from, item->string);
+    if (old && cJSON_IsObject(old) && cJSON_IsObject(item))
+      sub = json_merge_patch(old, item);
+    else if (!old || !cJSON_Compare(old, item, 1))
+      sub = cJSON_Duplicate(item, 1);
+    else
+      sub = NULL;
+    if (sub) {
+      if (!patch)
+        patch = cJSON_CreateObject();
+      cJSON_AddItemToObject(patch, item->string, sub);
     }
-    // mush_free(q, "space.consoles.some");
-    // mush_free(show_message, "console_message");
+  }
+  cJSON_ArrayForEach(old, from)
+  {
+    if (cJSON_GetObjectItemCaseSensitive(to, old->string))
+      continue;
+    if (!patch)
+      patch = cJSON_CreateObject();
+    cJSON_AddNullToObject(patch, old->string);
+  }
+  return patch;
+}
+
+/* ------------------------------------------------------------------------ */
+
+static void
+json_send(DESC *d, char *package, cJSON *data)
+{
+  if (d->conn_flags & CONN_WEBSOCKETS) {
+    send_websocket_object(d, package, data);
+    /* That tags the object itself with the package; take it back off. */
+    cJSON_DeleteItemFromObjectCaseSensitive(data, "gmcp");
+  }
+  if (d->conn_flags & CONN_GMCP)
+    send_oob(d, package, data);
+  return;
+}
+
+/* ------------------------------------------------------------------------ */
+
+static void
+json_push(int x)
+{
+  static DESC **targets = NULL;
+  static int target_size = 0;
+  struct json_ship_t *j = &json_ships[x];
+  DESC *match;
+  cJSON *doc, *patch;
+  register int i, k, count = 0;
+  int had;
+  dbref user;
+
+  if (target_size < j->consoles) {
+    target_size = j->consoles;
+    targets = mush_realloc(targets, target_size * sizeof(*targets),
+                           "space.json.targets");
+  }
+
+  for (i = 0; i < j->consoles; ++i) {
+    user = j->console[i].user;
+    if (!GoodObject(user) || !SpaceJson(user))
+      continue;
+    match = lookup_desc(user, Name(user));
+    if (!match || !(match->conn_flags & (CONN_WEBSOCKETS | CONN_GMCP)))
+      continue;
+    for (k = 0; k < count && targets[k] != match; ++k)
+      ;
+    if (k == count)
+      targets[count++] = match;
+  }
+
+  if (!count) {
+    /* Nobody's listening; the next client starts from scratch. */
+    if (j->last)
+      cJSON_Delete(j->last);
+    j->last = NULL;
+    j->clients = 0;
+    return;
+  }
+
+  doc = get_space_status("ship", NULL, x, NULL, NULL);
+  if (!doc)
     return;
+  patch = j->last ? json_merge_patch(j->last, doc) : NULL;
+
+  if (j->client_size < count) {
+    j->client_size = count;
+    j->client = mush_realloc(j->client, count * sizeof(*j->client),
+                             "space.json.clients");
+  }
+
+  for (i = 0; i < count; ++i) {
+    match = targets[i];
+    had = 0;
+    if (j->last)
+      for (k = 0; k < j->clients; ++k)
+        if (j->client[k].descriptor == match->descriptor &&
+            j->client[k].connected_at == match->connected_at) {
+          had = 1;
+          break;
+        }
+    if (!had)
+      json_send(match, "ship", doc);
+    else if (patch)
+      json_send(match, "ship.delta", patch);
+  }
+
+  /* Everyone on the list now has doc. */
+  for (i = 0; i < count; ++i) {
+    j->client[i].descriptor = targets[i]->descriptor;
+    j->client[i].connected_at = targets[i]->connected_at;
+  }
+  j->clients = count;
+  if (j->last)
+    cJSON_Delete(j->last);
+  j->last = doc;
+  if (patch)
+    cJSON_Delete(patch);
+  return;
+}
+
+/* ------------------------------------------------------------------------ */
+
+void
+space_json_iterate(void)
+{
+  register int x;
+
+  for (x = MIN_SPACE_OBJECTS; x <= max_space_objects; ++x) {
+    if (!sdb[x].status.active || !sdb[x].structure.type)
+      continue;
+    if (json_ships[x].tick == space_tick)
+      continue;
+    json_ships[x].tick = space_tick;
+    if (!json_route(x))
+      continue;
+    json_push(x);
   }
+  return;
 }
+
+/* ------------------------------------------------------------------------ */
+
 FUNCTION(fun_aspace_jsondata)
 {
   int shipSDB = parse_number(args[0]);
@@ -0,0 +1,537 @@
+/* space_kernel.c */
+
+#include "config.h"
+#include "space.h"
+#include "tests.h"
+
+/* ------------------------------------------------------------------------ */
+
+/* Batched physics for do_space_db_iterate(). Each pass copies the fields a
+ * step needs out of sdb[] into the structure-of-arrays mirror below, runs
+ * one of the kern_* loops over the whole batch, and copies the results
+ * back. sdb[] stays the master copy, since softcode writes it directly.
+ *
+ * The kernels are straight loops over separate arrays with the branches
+ * written as selects, so the compiler can vectorise them. A skipped step
+ * becomes a multiply or divide by 1.0, which leaves the arithmetic the same
+ * as the old per-ship code. This file is built with -O3 (see
+ * CMakeLists.txt); the rest of the tree is built for debugging.
+ *
+ * The last lane is kept free for the single-ship kern_one_* calls, which
+ * the space commands make through up_velocity() and friends.
+ */
+
+#define HOT_LANES  (MAX_SPACE_OBJECTS + 1)
+#define HOT_ONE    MAX_SPACE_OBJECTS
+
+static struct {
+  int slot[HOT_LANES];
+
+  /* movement */
+  double out[HOT_LANES];
+  double v[HOT_LANES];
+  double dt[HOT_LANES];
+  double cochranes[HOT_LANES];
+  double yaw[HOT_LANES];
+  double pitch[HOT_LANES];
+  double roll[HOT_LANES];
+  double d[9][HOT_LANES];    /* course.d[][] flattened */
+  double dx[HOT_LANES];
+  double dy[HOT_LANES];
+  double dz[HOT_LANES];
+
+  /* sensors */
+  int lrs_active[HOT_LANES];
+  int srs_active[HOT_LANES];
+  int ew_active[HOT_LANES];
+  int cloak_active[HOT_LANES];
+  int tractored[HOT_LANES];
+  int tractoring[HOT_LANES];
+  double sensors[HOT_LANES];
+  double lrs_damage[HOT_LANES];
+  double srs_damage[HOT_LANES];
+  double eccm_lrs[HOT_LANES];
+  double eccm_srs[HOT_LANES];
+  double ecm_lrs[HOT_LANES];
+  double ecm_srs[HOT_LANES];
+  double displacement[HOT_LANES];
+  double stealth[HOT_LANES];
+  double total[HOT_LANES];
+  double alloc_cloak[HOT_LANES];
+  double tech_cloak[HOT_LANES];
+  double cloak_cost[HOT_LANES];
+  double beam_out[HOT_LANES];
+  double missile_out[HOT_LANES];
+  double visibility[HOT_LANES];
+  double speed[HOT_LANES];   /* move.out the lrs signature scales with */
+  double main[HOT_LANES];
+  double aux[HOT_LANES];
+  double batt[HOT_LANES];
+  double lrs_resolution[HOT_LANES];
+  double srs_resolution[HOT_LANES];
+  double cloak_level[HOT_LANES];
+  double lrs_signature[HOT_LANES];
+  double srs_signature[HOT_LANES];
+} hot;
+
+/* ------------------------------------------------------------------------ */
+
+static void
+kern_velocity(int from, int to)
+{
+  register int i;
+  double a, p;
+
+  for (i = from; i < to; ++i) {
+    a = fabs(hot.out[i]);
+    p = a >= 1.0 ? pow(a, 3.333333) : a;
+    hot.v[i] = LIGHTSPEED * (hot.out[i] < 0.0 ? -p : p);
+  }
+  return;
+}
+
+/* ------------------------------------------------------------------------ */
+
+static void
+kern_vectors(int from, int to)
+{
+  const double d2r = PI / 180.0;
+  double sy, cy, sp, cp, sr, cr;
+  register int i;
+
+  for (i = from; i < to; ++i) {
+    sy = sin(hot.yaw[i] * d2r);
+    cy = cos(hot.yaw[i] * d2r);
+    sp = sin(hot.pitch[i] * d2r);
+    cp = cos(hot.pitch[i] * d2r);
+    sr = sin(hot.roll[i] * d2r);
+    cr = cos(hot.roll[i] * d2r);
+    hot.d[0][i] = cy * cp;
+    hot.d[1][i] = sy * cp;
+    hot.d[2][i] = sp;
+    hot.d[3][i] = -(sy * cr) + (cy * sp * sr);
+    hot.d[4][i] = (cy * cr) + (sy * sp * sr);
+    hot.d[5][i] = -(cp * sr);
+    hot.d[6][i] = -(sy * sr) - (cy * sp * cr);
+    hot.d[7][i] = (cy * sr) - (sy * sp * cr);
+    hot.d[8][i] = (cp * cr);
+  }
+  return;
+}
+
+/* ------------------------------------------------------------------------ */
+
+static void
+kern_position(int from, int to)
+{
+  register int i;
+  double dv;
+
+  for (i = from; i < to; ++i) {
+    dv = hot.v[i] * hot.dt[i] *
+         (fabs(hot.out[i]) >= 1.0 ? hot.cochranes[i] : 1.0);
+    hot.dx[i] = dv * hot.d[0][i];
+    hot.dy[i] = dv * hot.d[1][i];
+    hot.dz[i] = dv * hot.d[2][i];
+  }
+  return;
+}
+
+/* ------------------------------------------------------------------------ */
+
+static void
+kern_resolution(int from, int to)
+{
+  register int i;
+  double cloak;
+
+  for (i = from; i < to; ++i) {
+    cloak = hot.cloak_active[i] ? 10.0 : 1.0;
+    hot.lrs_resolution[i] =
+      hot.lrs_active[i] ? hot.sensors[i] * hot.lrs_damage[i] *
+                            (hot.ew_active[i] ? hot.eccm_lrs[i] : 1.0) / cloak
+                        : 0.0;
+    hot.srs_resolution[i] =
+      hot.srs_active[i] ? hot.sensors[i] * hot.srs_damage[i] *
+                            (hot.ew_active[i] ? hot.eccm_srs[i] : 1.0) / cloak
+                        : 0.0;
+  }
+  return;
+}
+
+/* ------------------------------------------------------------------------ */
+
+static void
+kern_signature(int from, int to)
+{
+  register int i;
+  double sig, l;
+
+  /* pow() won't vectorise, so the base signature gets a loop of its own
+   * and is parked in lrs_signature until the second one. */
+  for (i = from; i < to; ++i)
+    hot.lrs_signature[i] =
+      pow(hot.displacement[i], 0.333333) / hot.stealth[i] / 100.0;
+
+  for (i = from; i < to; ++i) {
+    sig = hot.lrs_signature[i];
+
+    l = 0.001 / hot.total[i] / hot.alloc_cloak[i] / hot.tech_cloak[i] *
+        hot.cloak_cost[i];
+    l *= hot.tractored[i] ? 100.0 : 1.0;
+    l *= hot.tractoring[i] ? 100.0 : 1.0;
+    l *= hot.beam_out[i] > 1.0 ? hot.beam_out[i] : 1.0;
+    l *= hot.missile_out[i] > 1.0 ? hot.missile_out[i] : 1.0;
+    l *= hot.visibility[i] < 1.0 ? (1.0 - hot.visibility[i]) * 10000.0 : 1.0;
+    hot.cloak_level[i] = !hot.cloak_active[i] ? 1.0 : l > 1.0 ? 1.0 : l;
+
+    hot.lrs_signature[i] = sig * (hot.out[i] * hot.speed[i] + 1.0) /
+                           (hot.ew_active[i] ? hot.ecm_lrs[i] : 1.0);
+    hot.srs_signature[i] =
+      sig * 10.0 *
+      (1.0 + hot.main[i] + (hot.aux[i] / 10.0) + (hot.batt[i] / 100.0)) /
+      (hot.ew_active[i] ? hot.ecm_srs[i] : 1.0);
+  }
+  return;
+}
+
+/* ------------------------------------------------------------------------ */
+
+static void
+hot_load_course(int i, int x)
+{
+  hot.slot[i] = x;
+  hot.yaw[i] = sdb[x].course.yaw_out;
+  hot.pitch[i] = sdb[x].course.pitch_out;
+  hot.roll[i] = sdb[x].course.roll_out;
+  return;
+}
+
+static void
+hot_store_course(int i, int x)
+{
+  register int j, k;
+
+  for (j = 0; j < 3; ++j)
+    for (k = 0; k < 3; ++k)
+      sdb[x].course.d[j][k] = hot.d[j * 3 + k][i];
+  sdb[x].course.version = 0;
+  return;
+}
+
+/* ------------------------------------------------------------------------ */
+
+static void
+hot_load_sensors(int i, int x, double speed)
+{
+  hot.slot[i] = x;
+  hot.lrs_active[i] = sdb[x].sensor.lrs_active;
+  hot.srs_active[i] = sdb[x].sensor.srs_active;
+  hot.ew_active[i] = sdb[x].sensor.ew_active;
+  hot.cloak_active[i] = sdb[x].cloak.active;
+  hot.tractored[i] = sdb[x].status.tractored;
+  hot.tractoring[i] = sdb[x].status.tractoring;
+  hot.sensors[i] = sdb[x].tech.sensors;
+  hot.lrs_damage[i] = sdb[x].sensor.lrs_damage;
+  hot.srs_damage[i] = sdb[x].sensor.srs_damage;
+  if (sdb[x].sensor.ew_active) {
+    hot.eccm_lrs[i] = sdb2eccm_lrs(x);
+    hot.eccm_srs[i] = sdb2eccm_srs(x);
+    hot.ecm_lrs[i] = sdb2ecm_lrs(x);
+    hot.ecm_srs[i] = sdb2ecm_srs(x);
+  } else
+    hot.eccm_lrs[i] = hot.eccm_srs[i] = hot.ecm_lrs[i] = hot.ecm_srs[i] = 1.0;
+  hot.displacement[i] = sdb[x].structure.displacement;
+  hot.stealth[i] = sdb[x].tech.stealth;
+  hot.total[i] = sdb[x].power.total;
+  hot.alloc_cloak[i] = sdb[x].alloc.cloak;
+  hot.tech_cloak[i] = sdb[x].tech.cloak;
+  hot.cloak_cost[i] = sdb[x].cloak.cost;
+  hot.beam_out[i] = sdb[x].beam.out;
+  hot.missile_out[i] = sdb[x].missile.out;
+  hot.visibility[i] = sdb[x].sensor.visibility;
+  hot.out[i] = sdb[x].move.out;
+  hot.speed[i] = speed;
+  hot.main[i] = sdb[x].power.main;
+  hot.aux[i] = sdb[x].power.aux;
+  hot.batt[i] = sdb[x].power.batt;
+  return;
+}
+
+/* ------------------------------------------------------------------------ */
+
+/* Velocity, course vectors and position for every ship in list. velocity[i]
+ * is set for the ships whose speed changed this tick. A tractor beam drags
+ * its target along by the same amount, in slot order as before. */
+void
+kern_tick_move(const int *list, const int *velocity, int count)
+{
+  register int i, j, x, t;
+
+  /* VELOCITY */
+
+  for (i = j = 0; i < count; ++i) {
+    x = list[i];
+    if (velocity[i] &&
+        (sdb[x].engine.warp_exist || sdb[x].engine.impulse_exist)) {
+      hot.slot[j] = x;
+      hot.out[j++] = sdb[x].move.out;
+    }
+  }
+  kern_velocity(0, j);
+  for (i = 0; i < j; ++i)
+    sdb[hot.slot[i]].move.v = hot.v[i];
+
+  /* VECTORS */
+
+  for (i = j = 0; i < count; ++i)
+    if (sdb[list[i]].course.version)
+      hot_load_course(j++, list[i]);
+  kern_vectors(0, j);
+  for (i = 0; i < j; ++i)
+    hot_store_course(i, hot.slot[i]);
+
+  /* POSITION */
+
+  for (i = j = 0; i < count; ++i) {
+    x = list[i];
+    if (sdb[x].move.v == 0.0)
+      continue;
+    hot.slot[j] = x;
+    hot.v[j] = sdb[x].move.v;
+    hot.dt[j] = sdb[x].move.dt;
+    hot.out[j] = sdb[x].move.out;
+    hot.cochranes[j] = sdb[x].move.cochranes;
+    hot.d[0][j] = sdb[x].course.d[0][0];
+    hot.d[1][j] = sdb[x].course.d[0][1];
+    hot.d[2][j] = sdb[x].course.d[0][2];
+    ++j;
+  }
+  kern_position(0, j);
+  for (i = 0; i < j; ++i) {
+    x = hot.slot[i];
+    t = sdb[x].status.tractoring ? sdb[x].status.tractoring
+                                 : sdb[x].status.tractored;
+    if (t) {
+      sdb[t].coords.x += hot.dx[i];
+      sdb[t].coords.y += hot.dy[i];
+      sdb[t].coords.z += hot.dz[i];
+      grid_move(t);
+    }
+    sdb[x].coords.x += hot.dx[i];
+    sdb[x].coords.y += hot.dy[i];
+    sdb[x].coords.z += hot.dz[i];
+    grid_move(x);
+  }
+  return;
+}
+
+/* ------------------------------------------------------------------------ */
+
+/* Sensor resolution and signature for every ship in list that needs them
+ * recalculated. */
+void
+kern_tick_sensors(const int *list, int count)
+{
+  register int i, j, x;
+
+  for (i = j = 0; i < count; ++i) {
+    x = list[i];
+    if (sdb[x].sensor.version)
+      hot_load_sensors(j++, x, sdb[x].move.out);
+  }
+  kern_resolution(0, j);
+  kern_signature(0, j);
+  for (i = 0; i < j; ++i) {
+    x = hot.slot[i];
+    sdb[x].sensor.lrs_resolution = hot.lrs_resolution[i];
+    sdb[x].sensor.srs_resolution = hot.srs_resolution[i];
+    sdb[x].cloak.level = hot.cloak_level[i];
+    sdb[x].sensor.lrs_signature = hot.lrs_signature[i];
+    sdb[x].sensor.srs_signature = hot.srs_signature[i];
+    sdb[x].sensor.version = 0;
+  }
+  return;
+}
+
+/* ------------------------------------------------------------------------ */
+
+void
+kern_one_velocity(int x)
+{
+  hot.out[HOT_ONE] = sdb[x].move.out;
+  kern_velocity(HOT_ONE, HOT_ONE + 1);
+  sdb[x].move.v = hot.v[HOT_ONE];
+  return;
+}
+
+/* ------------------------------------------------------------------------ */
+
+void
+kern_one_vectors(int x)
+{
+  hot_load_course(HOT_ONE, x);
+  kern_vectors(HOT_ONE, HOT_ONE + 1);
+  hot_store_course(HOT_ONE, x);
+  return;
+}
+
+/* ------------------------------------------------------------------------ */
+
+void
+kern_one_resolution(int x)
+{
+  hot_load_sensors(HOT_ONE, x, sdb[x].move.out);
+  kern_resolution(HOT_ONE, HOT_ONE + 1);
+  sdb[x].sensor.lrs_resolution = hot.lrs_resolution[HOT_ONE];
+  sdb[x].sensor.srs_resolution = hot.srs_resolution[HOT_ONE];
+  return;
+}
+
+/* ------------------------------------------------------------------------ */
+
+void
+kern_one_signature(int x, double speed)
+{
+  hot_load_sensors(HOT_ONE, x, speed);
+  kern_signature(HOT_ONE, HOT_ONE + 1);
+  sdb[x].cloak.level = hot.cloak_level[HOT_ONE];
+  sdb[x].sensor.lrs_signature = hot.lrs_signature[HOT_ONE];
+  sdb[x].sensor.srs_signature = hot.srs_signature[HOT_ONE];
+  sdb[x].sensor.version = 0;
+  return;
+}
+
+/* ------------------------------------------------------------------------ */
+
+/* Fill the mirror with synthetic ships: a mix of impulse and warp speeds,
+ * some cloaked, some tractoring, some with EW up. */
+static void
+kern_test_fill(int count)
+{
+  register int i, k;
+
+  for (i = 0; i < count; ++i) {
+    k = i % 7;
+    hot.slot[i] = i + 1;
+    hot.out[i] = (i % 5 == 0) ? 0.0 : (k - 3) * 0.75 + 0.01 * i / count;
+    hot.dt[i] = 1.0;
+    hot.cochranes[i] = 1.0 + k * 100.0;
+    hot.yaw[i] = (i * 37) % 360;
+    hot.pitch[i] = (i * 11) % 180 - 90;
+    hot.roll[i] = (i * 53) % 360;
+    hot.lrs_active[i] = (k != 0);
+    hot.srs_active[i] = (k != 1);
+    hot.ew_active[i] = (k == 2);
+    hot.cloak_active[i] = (k == 3);
+    hot.tractored[i] = (k == 4);
+    hot.tractoring[i] = (k == 5);
+    hot.sensors[i] = 1.0 + k * 0.1;
+    hot.lrs_damage[i] = hot.srs_damage[i] = 1.0 - k * 0.05;
+    hot.eccm_lrs[i] = hot.eccm_srs[i] = 1.2;
+    hot.ecm_lrs[i] = hot.ecm_srs[i] = 1.5;
+    hot.displacement[i] = 1000.0 + i;
+    hot.stealth[i] = 1.0 + k * 0.2;
+    hot.total[i] = 100.0 + i;
+    hot.alloc_cloak[i] = 0.25;
+    hot.tech_cloak[i] = 1.0;
+    hot.cloak_cost[i] = 50.0;
+    hot.beam_out[i] = k * 0.5;
+    hot.missile_out[i] = k * 0.3;
+    hot.visibility[i] = (k == 6) ? 0.5 : 1.0;
+    hot.speed[i] = hot.out[i];
+    hot.main[i] = 10.0 + k;
+    hot.aux[i] = 5.0 + k;
+    hot.batt[i] = 2.0 + k;
+  }
+  return;
+}
+
+/* ------------------------------------------------------------------------ */
+
+static int
+kern_test_close(double a, double b)
+{
+  return fabs(a - b) <= 1e-12 * fmax(1.0, fmax(fabs(a), fabs(b)));
+}
+
+/* ------------------------------------------------------------------------ */
+
+TEST_GROUP(space_kernels)
+{
+  const int ships = MAX_SPACE_OBJECTS;
+  register int i;
+  double dv, sig, lvl;
+  int ok;
+
+  kern_test_fill(ships);
+  kern_velocity(0, ships);
+  kern_vectors(0, ships);
+  kern_position(0, ships);
+  kern_resolution(0, ships);
+  kern_signature(0, ships);
+
+  /* Spot check a few ships against the old per-ship arithmetic. */
+  for (i = 0; i < 7; ++i) {
+    ok = 1;
+    if (hot.out[i] >= 1.0)
+      ok &= kern_test_close(hot.v[i], LIGHTSPEED * pow(hot.out[i], 3.333333));
+    else if (hot.out[i] <= -1.0)
+      ok &= kern_test_close(hot.v[i],
+                            LIGHTSPEED * -pow(fabs(hot.out[i]), 3.333333));
+    else
+      ok &= kern_test_close(hot.v[i], LIGHTSPEED * hot.out[i]);
+    ok &= kern_test_close(hot.d[1][i], sin(hot.yaw[i] * PI / 180.0) *
+                                         cos(hot.pitch[i] * PI / 180.0));
+    dv = hot.v[i] * hot.dt[i];
+    if (fabs(hot.out[i]) >= 1.0)
+      dv *= hot.cochranes[i];
+    ok &= kern_test_close(hot.dx[i], dv * hot.d[0][i]);
+    if (!hot.lrs_active[i])
+      ok &= (hot.lrs_resolution[i] == 0.0);
+    else if (hot.cloak_active[i])
+      ok &= kern_test_close(hot.lrs_resolution[i],
+                            hot.sensors[i] * hot.lrs_damage[i] / 10.0);
+    sig = pow(hot.displacement[i], 0.333333) / hot.stealth[i] / 100.0;
+    if (hot.ew_active[i])
+      ok &= kern_test_close(hot.lrs_signature[i],
+                            sig * (hot.out[i] * hot.out[i] + 1.0) /
+                              hot.ecm_lrs[i]);
+    if (hot.cloak_active[i]) {
+      lvl = 0.001 / hot.total[i] / hot.alloc_cloak[i] / hot.tech_cloak[i] *
+            hot.cloak_cost[i];
+      if (hot.beam_out[i] > 1.0)
+        lvl *= hot.beam_out[i];
+      if (hot.missile_out[i] > 1.0)
+        lvl *= hot.missile_out[i];
+      ok &= kern_test_close(hot.cloak_level[i], lvl > 1.0 ? 1.0 : lvl);
+    } else
+      ok &= (hot.cloak_level[i] == 1.0);
+    TEST("space_kernels.matches", ok);
+  }
+
+}
+
+/* Time a full set of kernels over every lane, the worst case for a tick. */
+BENCHMARK(space_kernels)
+{
+  const int ships = MAX_SPACE_OBJECTS, ticks = 200;
+  struct timeval start, end;
+  register int t;
+  double us;
+
+  kern_test_fill(ships);
+  penn_gettimeofday(&start);
+  for (t = 0; t < ticks; ++t) {
+    kern_velocity(0, ships);
+    kern_vectors(0, ships);
+    kern_position(0, ships);
+    kern_resolution(0, ships);
+    kern_signature(0, ships);
+  }
+  penn_gettimeofday(&end);
+  us = (end.tv_sec - start.tv_sec) * 1000000.0 +
+       (end.tv_usec - start.tv_usec);
+  do_rawlog(LT_TRACE, "space_kernels: %d ships, %d ticks, %.1f ns/ship/tick",
+            ships, ticks, us * 1000.0 / ships / ticks);
+}
@@ -7,6 +7,10 @@
 
 intmap *border_map;
 HASHTAB aspace_consoles;
+FLAG_HANDLE space_object_flag = FLAG_HANDLE_INIT("FLAG", "SPACE-OBJECT");
+FLAG_HANDLE space_json_flag = FLAG_HANDLE_INIT("FLAG", "SPACE-JSON");
+FLAG_HANDLE sdb_ok_power = FLAG_HANDLE_INIT("POWER", "SDB-OK");
+FLAG_HANDLE sdb_read_power = FLAG_HANDLE_INIT("POWER", "SDB-READ");
 
 struct pennmush_flag_info {
   const char *name;
@@ -111,8 +115,7 @@ FUNCTION(local_fun_sdb) /* sdb
   double a;
   static char blank[] = "   \0";
 
-  if (!Wizard(executor) && !has_power_by_name(executor, "SDB-OK", NOTYPE) &&
-      !has_power_by_name(executor, "SDB-READ", NOTYPE)) {
+  if (!Wizard(executor) && !SdbOk(executor) && !SdbRead(executor)) {
     /* Mordak Aspace v1.0.0p1 Removed Cursing from a major function call*/
     safe_str("#-1 Permission Denied", buff, bp);
     /* End Aspace v1.0.0p1 */
@@ -652,7 +655,7 @@ FUNCTION(local_fun_sdb) /* sdb
     do_space_db_put(x, args[2], args[3], args[4], args[5], args[6], buff, bp);
     break;
   case 'r': /* read */
-    if (!Wizard(executor) && !has_power_by_name(executor, "SDB-READ", NOTYPE)) {
+    if (!Wizard(executor) && !SdbRead(executor)) {
       safe_str("#-1 Permission Denied", buff, bp);
     }
     ship = parse_dbref(args[1]);
@@ -1472,8 +1475,7 @@ FUNCTION(local_fun_coords)
   int sdb_num = parse_integer(args[0]);
   int c_type = parse_integer(args[1]);
 
-  if (Hasprivs(executor) || has_power_by_name(executor, "SDB-OK", NOTYPE) ||
-      has_power_by_name(executor, "SDB-READ", NOTYPE)) {
+  if (Hasprivs(executor) || SdbOk(executor) || SdbRead(executor)) {
 
     if (!GoodSDB(sdb_num))
       safe_str("#-1 SDB OUT OF RANGE", buff, bp);
@@ -1512,8 +1514,7 @@ FUNCTION(local_fun_inrange)
   q = parse_number(args[1]);
   r = parse_integer(args[2]);
 
-  if (Hasprivs(executor) || has_power_by_name(executor, "SDB-OK", NOTYPE) ||
-      has_power_by_name(executor, "SDB-READ", NOTYPE)) {
+  if (Hasprivs(executor) || SdbOk(executor) || SdbRead(executor)) {
     if (GoodSDB(n)) {
       if (r == 0) {
         q = pc2su(q);
@@ -571,6 +571,7 @@ debug_space(int x)
     sdb[x].structure.type = 0;
     bug = 0;
   }
+  sdb_index_set(x);
 
   /* --- LOCATION ----------------------------------------------------------- */
 
@@ -222,7 +222,7 @@ void do_space_db_put (int x, char *value, char *f1, char *f2, char *f3, char *f4
 			default: safe_str("#-1 NO SUCH FIELD", buff, bp); return; break;
 			} break;
 /* object ----------------------------------------------------------------- */
-		case 'o': sdb[x].object = parse_integer(value); break;
+		case 'o': sdb[x].object = parse_integer(value); sdb_index_set(x); break;
 /* power ------------------------------------------------------------------ */
 		case 'p': switch (f2[0]) {
 			case 'v': sdb[x].power.version = parse_integer(value); break;
@@ -351,7 +351,7 @@ void do_space_db_put (int x, char *value, char *f1, char *f2, char *f3, char *f4
 						} break;
 					case 'r': sdb[x].structure.repair = parse_number(value); break;
 					case 's': sdb[x].structure.superstructure = parse_number(value); break;
-					case 't': sdb[x].structure.type = parse_integer(value); break;
+					case 't': sdb[x].structure.type = parse_integer(value); sdb_index_set(x); break;
 					default: safe_str("#-1 NO SUCH FIELD", buff, bp); return; break;
 					} break;
 				default: safe_str("#-1 NO SUCH FIELD", buff, bp); return; break;
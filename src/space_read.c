@@ -33,12 +33,9 @@ do_space_db_read(dbref ship, dbref executor)
 
   /* SDB */
 
-  x = 0;
-  for (i = MIN_SPACE_OBJECTS; i <= max_space_objects; ++i)
-    if (sdb[i].object == ship) {
-      x = i;
-      break;
-    }
+  x = sdb_find_object(ship);
+  if (x > max_space_objects)
+    x = 0;
 
   if (x == 0) {
     a = atr_get(ship, SDB_ATTR_NAME);
@@ -64,8 +61,10 @@ do_space_db_read(dbref ship, dbref executor)
   if (!SpaceObj(ship) || !GoodObject(ship)) {
     write_spacelog(executor, ship, "READ: unable to validate SPACE_OBJECT.");
     return 0;
-  } else
+  } else {
     sdb[x].object = ship;
+    sdb_index_set(x);
+  }
 
   /* SPACE */
 
@@ -414,6 +413,7 @@ do_space_db_read(dbref ship, dbref executor)
   /* STRUCTURE */
 
   sdb[x].structure.type = do_space_read_attr(ship, STRUCTURE_ATTR_NAME, "TYPE");
+  sdb_index_set(x);
   sdb[x].structure.displacement =
     do_space_read_attr(ship, STRUCTURE_ATTR_NAME, "DISPLACEMENT");
   sdb[x].structure.cargo_hold =
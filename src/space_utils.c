@@ -415,6 +415,10 @@ name2sdb(char *name) /* Returns the sdb# of a named space object */
 {
   register int i;
 
+  i = sdb_find_name(name);
+  if (i)
+    return i;
+
   for (i = MIN_SPACE_OBJECTS; i <= max_space_objects; ++i)
     if (sdb[i].structure.type)
       if (SpaceObj(sdb[i].object) && GoodObject(sdb[i].object))
@@ -682,11 +686,10 @@ dbref2sdb(dbref x)
   if (!GoodObject(x))
     return 0;
 
-  for (i = MIN_SPACE_OBJECTS; i <= max_space_objects; ++i)
-    if (sdb[i].structure.type)
-      if (sdb[i].object == x)
-        return i;
-  return 0;
+  i = sdb_find_loaded(x);
+  if (i > max_space_objects)
+    return 0;
+  return i;
 }
 // Returns 1 if both are within 0.001 of the same IFF frequency
 int
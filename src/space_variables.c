@@ -11,6 +11,7 @@ double cochrane = COCHRANE;
 int n;
 int max_space_objects = MIN_SPACE_OBJECTS;
 int max_comms_objects = MIN_COMMS_OBJECTS;
+unsigned int space_tick = 0;
 
 dbref console_security = CONSOLE_SECURITY;
 dbref console_helm = CONSOLE_HELM;
@@ -28,12 +28,7 @@ do_space_db_write(dbref ship, dbref executor)
   /* SDB */
 
 
-  x = 0;
-  for (i = MIN_SPACE_OBJECTS; i <= max_space_objects; ++i)
-    if (sdb[i].object == ship) {
-      x = i;
-      break;
-    }
+  x = sdb_find_object(ship);
   if (!GoodSDB(x)) {
     a = atr_get(ship, SDB_ATTR_NAME);
     if (a == NULL) {
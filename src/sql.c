@@ -21,6 +21,7 @@
  *  fun_sql_escape
  *  fun_sql
  *  fun_mapsql
+ *  fun_sqlasync
  *  cmd_sql
  *
  * \endverbatim
@@ -78,6 +79,7 @@ static sqlite3 *sqlite3_connp = NULL;
 #include "charconv.h"
 #include "mushsql.h"
 #include "charclass.h"
+#include "tests.h"
 
 /* Supported platforms */
 typedef enum {
@@ -124,6 +126,9 @@ static void penn_sqlite3_free_sql_query(sqlite3_stmt *);
 #endif
 static sqlplatform sql_platform(void);
 static char *sql_sanitize(const char *res);
+#if defined(HAVE_PTHREAD_H) && !defined(WIN32)
+static void sql_async_stop(void);
+#endif
 #define SANITIZE(s, n) ((s && *s) ? mush_strdup(sql_sanitize(s), n) : NULL)
 
 static char *
@@ -265,6 +270,9 @@ sql_error(void)
 void
 sql_shutdown(void)
 {
+#if defined(HAVE_PTHREAD_H) && !defined(WIN32)
+  sql_async_stop();
+#endif
   switch (sql_platform()) {
 #ifdef HAVE_MYSQL
   case SQL_PLATFORM_MYSQL:
@@ -1523,3 +1531,897 @@ penn_sqlite3_free_sql_query(sqlite3_stmt *stmt)
 {
   sqlite3_finalize(stmt);
 }
+
+/* Asynchronous queries
+ *
+ * sqlasync() hands a query to a small pool of worker threads, each with
+ * its own connection to the database, and returns at once. Workers
+ * collect results into plain malloc'd memory and write to sql_async_fd,
+ * which check_sockets() watches; sql_async_reap() then converts the
+ * results in the main thread and queues the callback attribute.
+ *
+ * Nothing the workers touch belongs to the rest of the server: the
+ * connection settings are copied when the pool starts, the query text is
+ * owned by the job until it comes back, and logging and events wait for
+ * the main thread.
+ */
+
+/** File descriptor that becomes readable when queries finish. */
+int sql_async_fd = -1;
+/** Changes whenever sql_async_fd is reopened, which can reuse the number. */
+int sql_async_generation = 0;
+
+#if defined(HAVE_PTHREAD_H) && !defined(WIN32)
+
+#ifdef HAVE_SYS_EVENTFD_H
+#include <sys/eventfd.h>
+#endif
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/time.h>
+#include "mysocket.h"
+
+/* Most queries that can be waiting for a worker at once */
+#define SQL_ASYNC_MAX_PENDING 1000
+
+struct sql_async_job {
+  struct sql_async_job *next;
+  uint32_t id;
+  char *query; /**< Query text, in the database's encoding */
+  int qlen;
+
+  /* Filled in by the worker */
+  int numfields;
+  int numrows;   /**< Rows returned */
+  int stored;    /**< Rows kept in cells; the rest didn't fit */
+  int affected;  /**< Rows changed, or -1 */
+  char **names;  /**< numfields column names */
+  char **cells;  /**< stored * numfields values, NULL for NULL */
+  char *error;   /**< Error message, or NULL */
+
+  /* Only used by the main thread */
+  dbref executor;
+  dbref thing;
+  char *attrname;
+  char *rowsep;
+  char *fieldsep;
+  PE_REGS *pe_regs;
+};
+
+/* Connection settings, copied when the pool starts */
+static struct {
+  sqlplatform platform;
+  char host[256];
+  char db[256];
+  char user[256];
+  char pass[256];
+} sql_async_config;
+
+/* A worker's own connection */
+struct sql_async_conn {
+#ifdef HAVE_MYSQL
+  MYSQL *mysql;
+#endif
+#ifdef HAVE_POSTGRESQL
+  PGconn *pg;
+#endif
+  sqlite3 *sqlite;
+};
+
+static pthread_mutex_t sql_async_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t sql_async_wakeup = PTHREAD_COND_INITIALIZER;
+static struct sql_async_job *sql_async_pending = NULL, *sql_async_pending_tail;
+static struct sql_async_job *sql_async_done = NULL, *sql_async_done_tail;
+static int sql_async_npending = 0;
+static bool sql_async_stopping = 0;
+static pthread_t *sql_async_threads = NULL;
+static int sql_async_nthreads = 0;
+static int sql_async_notifier = -1;
+static uint32_t sql_async_next_id = 1;
+
+static void
+sql_async_free_job(struct sql_async_job *job)
+{
+  int i;
+
+  if (job->names) {
+    for (i = 0; i < job->numfields; i++)
+      free(job->names[i]);
+    free(job->names);
+  }
+  if (job->cells) {
+    for (i = 0; i < job->stored * job->numfields; i++)
+      free(job->cells[i]);
+    free(job->cells);
+  }
+  free(job->error);
+  if (job->query)
+    mush_free(job->query, "sql.async.query");
+  if (job->attrname)
+    mush_free(job->attrname, "sql.async.attr");
+  if (job->rowsep)
+    mush_free(job->rowsep, "sql.async.sep");
+  if (job->fieldsep)
+    mush_free(job->fieldsep, "sql.async.sep");
+  if (job->pe_regs)
+    pe_regs_free(job->pe_regs);
+  mush_free(job, "sql.async.job");
+}
+
+/* Remember an error in a job. Called by workers, so plain malloc. */
+static void
+sql_async_set_error(struct sql_async_job *job, const char *msg)
+{
+  free(job->error);
+  job->error = strdup(msg ? msg : "unknown error");
+}
+
+/* Set up the result arrays for a query returning numfields columns. */
+static void
+sql_async_begin_rows(struct sql_async_job *job, int numfields)
+{
+  job->numfields = numfields;
+  job->names = calloc(numfields ? numfields : 1, sizeof(char *));
+}
+
+/* Add one row of results. Rows past BUFFER_LEN bytes of data are counted
+ * but not kept, since the callback couldn't see them anyway. */
+static void
+sql_async_add_row(struct sql_async_job *job, const char **vals,
+                  const int *lens, size_t *used)
+{
+  int i;
+  char **cells;
+
+  job->numrows++;
+  if (*used > BUFFER_LEN || job->numfields == 0)
+    return;
+  cells = realloc(job->cells,
+                  sizeof(char *) * (job->stored + 1) * job->numfields);
+  if (!cells)
+    return;
+  job->cells = cells;
+  cells += job->stored * job->numfields;
+  for (i = 0; i < job->numfields; i++) {
+    if (vals[i]) {
+      cells[i] = malloc(lens[i] + 1);
+      if (cells[i]) {
+        memcpy(cells[i], vals[i], lens[i]);
+        cells[i][lens[i]] = '\0';
+      }
+      *used += lens[i] + 1;
+    } else
+      cells[i] = NULL;
+  }
+  job->stored++;
+}
+
+static void
+sql_async_run_sqlite(struct sql_async_conn *conn, struct sql_async_job *job)
+{
+  sqlite3_stmt *stmt = NULL;
+  const char **vals;
+  int *lens;
+  size_t used = 0;
+  int status, i;
+
+  if (!conn->sqlite) {
+    if (sqlite3_open_v2(sql_async_config.db, &conn->sqlite,
+                        SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE |
+                          SQLITE_OPEN_NOMUTEX,
+                        NULL) != SQLITE_OK) {
+      sql_async_set_error(job, conn->sqlite ? sqlite3_errmsg(conn->sqlite)
+                                            : "unable to open database");
+      sqlite3_close(conn->sqlite);
+      conn->sqlite = NULL;
+      return;
+    }
+    sqlite3_busy_timeout(conn->sqlite, 5000);
+    sqlite3_db_config(conn->sqlite, SQLITE_DBCONFIG_DEFENSIVE, 1,
+                      (int *) NULL);
+  }
+
+  if (sqlite3_prepare_v2(conn->sqlite, job->query, job->qlen, &stmt, NULL) !=
+      SQLITE_OK) {
+    sql_async_set_error(job, sqlite3_errmsg(conn->sqlite));
+    return;
+  }
+  if (!stmt) {
+    /* Empty query */
+    job->affected = 0;
+    return;
+  }
+
+  sql_async_begin_rows(job, sqlite3_column_count(stmt));
+  for (i = 0; i < job->numfields; i++)
+    job->names[i] = strdup(sqlite3_column_name(stmt, i));
+  vals = calloc(job->numfields + 1, sizeof *vals);
+  lens = calloc(job->numfields + 1, sizeof *lens);
+
+  do {
+    status = sqlite3_step(stmt);
+    if (status == SQLITE_ROW) {
+      for (i = 0; i < job->numfields; i++) {
+        vals[i] = (const char *) sqlite3_column_text(stmt, i);
+        lens[i] = sqlite3_column_bytes(stmt, i);
+      }
+      sql_async_add_row(job, vals, lens, &used);
+    }
+  } while (status == SQLITE_ROW || is_busy_status(status));
+
+  if (status != SQLITE_DONE)
+    sql_async_set_error(job, sqlite3_errmsg(conn->sqlite));
+  else if (job->numfields == 0)
+    job->affected = sqlite3_changes(conn->sqlite);
+  free(vals);
+  free(lens);
+  sqlite3_finalize(stmt);
+}
+
+#ifdef HAVE_MYSQL
+static void
+sql_async_run_mysql(struct sql_async_conn *conn, struct sql_async_job *job)
+{
+  MYSQL_RES *qres;
+  MYSQL_FIELD *fields;
+  MYSQL_ROW row;
+  unsigned long *rowlens;
+  const char **vals;
+  int *lens;
+  size_t used = 0;
+  char host[256], *p;
+  unsigned int port = 3306;
+  int i;
+
+  if (conn->mysql && mysql_ping(conn->mysql)) {
+    mysql_close(conn->mysql);
+    conn->mysql = NULL;
+  }
+  if (!conn->mysql) {
+    mush_strncpy(host, sql_async_config.host, sizeof host);
+    if ((p = strchr(host, ':'))) {
+      *p++ = '\0';
+      port = atoi(p);
+      if (!port)
+        port = 3306;
+    }
+    conn->mysql = mysql_init(NULL);
+    if (!conn->mysql) {
+      sql_async_set_error(job, "out of memory");
+      return;
+    }
+    if (!mysql_real_connect(conn->mysql, host, sql_async_config.user,
+                            sql_async_config.pass, sql_async_config.db, port,
+                            0, 0)) {
+      sql_async_set_error(job, mysql_error(conn->mysql));
+      mysql_close(conn->mysql);
+      conn->mysql = NULL;
+      return;
+    }
+  }
+
+  if (mysql_real_query(conn->mysql, job->query, job->qlen)) {
+    sql_async_set_error(job, mysql_error(conn->mysql));
+    return;
+  }
+  qres = mysql_store_result(conn->mysql);
+  if (!qres) {
+    if (mysql_field_count(conn->mysql) == 0)
+      job->affected = (int) mysql_affected_rows(conn->mysql);
+    else
+      sql_async_set_error(job, mysql_error(conn->mysql));
+    return;
+  }
+
+  sql_async_begin_rows(job, mysql_num_fields(qres));
+  fields = mysql_fetch_fields(qres);
+  for (i = 0; i < job->numfields; i++)
+    job->names[i] = strdup(fields[i].name);
+  vals = calloc(job->numfields + 1, sizeof *vals);
+  lens = calloc(job->numfields + 1, sizeof *lens);
+  while ((row = mysql_fetch_row(qres))) {
+    rowlens = mysql_fetch_lengths(qres);
+    for (i = 0; i < job->numfields; i++) {
+      vals[i] = row[i];
+      lens[i] = (int) rowlens[i];
+    }
+    sql_async_add_row(job, vals, lens, &used);
+  }
+  free(vals);
+  free(lens);
+  mysql_free_result(qres);
+}
+#endif
+
+#ifdef HAVE_POSTGRESQL
+static void
+sql_async_run_pg(struct sql_async_conn *conn, struct sql_async_job *job)
+{
+  PGresult *qres;
+  const char *keys[] = {"host", "dbname", "user", "password", NULL};
+  const char *values[] = {sql_async_config.host, sql_async_config.db,
+                          sql_async_config.user, sql_async_config.pass, NULL};
+  const char **vals;
+  int *lens;
+  size_t used = 0;
+  int i, r;
+
+  if (conn->pg && PQstatus(conn->pg) != CONNECTION_OK) {
+    PQreset(conn->pg);
+    if (PQstatus(conn->pg) != CONNECTION_OK) {
+      PQfinish(conn->pg);
+      conn->pg = NULL;
+    }
+  }
+  if (!conn->pg) {
+    conn->pg = PQconnectdbParams(keys, values, 0);
+    if (!conn->pg || PQstatus(conn->pg) != CONNECTION_OK) {
+      sql_async_set_error(job, conn->pg ? PQerrorMessage(conn->pg)
+                                        : "out of memory");
+      PQfinish(conn->pg);
+      conn->pg = NULL;
+      return;
+    }
+  }
+
+  qres = PQexec(conn->pg, job->query);
+  switch (PQresultStatus(qres)) {
+  case PGRES_COMMAND_OK:
+    job->affected = atoi(PQcmdTuples(qres));
+    break;
+  case PGRES_TUPLES_OK:
+    sql_async_begin_rows(job, PQnfields(qres));
+    for (i = 0; i < job->numfields; i++)
+      job->names[i] = strdup(PQfname(qres, i));
+    vals = calloc(job->numfields + 1, sizeof *vals);
+    lens = calloc(job->numfields + 1, sizeof *lens);
+    for (r = 0; r < PQntuples(qres); r++) {
+      for (i = 0; i < job->numfields; i++) {
+        vals[i] = PQgetisnull(qres, r, i) ? NULL : PQgetvalue(qres, r, i);
+        lens[i] = PQgetlength(qres, r, i);
+      }
+      sql_async_add_row(job, vals, lens, &used);
+    }
+    free(vals);
+    free(lens);
+    break;
+  default:
+    sql_async_set_error(job, qres ? PQresultErrorMessage(qres)
+                                  : PQerrorMessage(conn->pg));
+    break;
+  }
+  PQclear(qres);
+}
+#endif
+
+static void
+sql_async_disconnect(struct sql_async_conn *conn)
+{
+#ifdef HAVE_MYSQL
+  if (conn->mysql)
+    mysql_close(conn->mysql);
+  conn->mysql = NULL;
+#endif
+#ifdef HAVE_POSTGRESQL
+  if (conn->pg)
+    PQfinish(conn->pg);
+  conn->pg = NULL;
+#endif
+  if (conn->sqlite)
+    sqlite3_close_v2(conn->sqlite);
+  conn->sqlite = NULL;
+}
+
+static void *
+sql_async_worker(void *arg __attribute__((__unused__)))
+{
+  struct sql_async_conn conn;
+  struct sql_async_job *job;
+  int64_t data = 1;
+
+  memset(&conn, 0, sizeof conn);
+#ifdef HAVE_MYSQL
+  if (sql_async_config.platform == SQL_PLATFORM_MYSQL)
+    mysql_thread_init();
+#endif
+
+  pthread_mutex_lock(&sql_async_lock);
+  for (;;) {
+    while (!sql_async_pending && !sql_async_stopping)
+      pthread_cond_wait(&sql_async_wakeup, &sql_async_lock);
+    if (sql_async_stopping)
+      break;
+    job = sql_async_pending;
+    sql_async_pending = job->next;
+    sql_async_npending--;
+    pthread_mutex_unlock(&sql_async_lock);
+
+    job->next = NULL;
+    switch (sql_async_config.platform) {
+#ifdef HAVE_MYSQL
+    case SQL_PLATFORM_MYSQL:
+      sql_async_run_mysql(&conn, job);
+      break;
+#endif
+#ifdef HAVE_POSTGRESQL
+    case SQL_PLATFORM_POSTGRESQL:
+      sql_async_run_pg(&conn, job);
+      break;
+#endif
+    case SQL_PLATFORM_SQLITE3:
+      sql_async_run_sqlite(&conn, job);
+      break;
+    default:
+      sql_async_set_error(job, "no database configured");
+      break;
+    }
+
+    pthread_mutex_lock(&sql_async_lock);
+    if (sql_async_done)
+      sql_async_done_tail->next = job;
+    else
+      sql_async_done = job;
+    sql_async_done_tail = job;
+    if (write(sql_async_notifier, &data, sizeof data) < 0) {
+      /* Only fails if a wakeup is already waiting to be read. */
+    }
+  }
+  pthread_mutex_unlock(&sql_async_lock);
+
+  sql_async_disconnect(&conn);
+#ifdef HAVE_MYSQL
+  if (sql_async_config.platform == SQL_PLATFORM_MYSQL)
+    mysql_thread_end();
+#endif
+  return NULL;
+}
+
+/* Start nworkers threads talking to database db on platform. */
+static bool
+sql_async_start(sqlplatform platform, const char *db, int nworkers)
+{
+  int i;
+
+  if (sql_async_nthreads)
+    return 1;
+  if (nworkers <= 0)
+    return 0;
+
+#ifdef HAVE_EVENTFD
+  sql_async_fd = sql_async_notifier = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (sql_async_fd < 0) {
+    penn_perror("sql_async_start: eventfd");
+    return 0;
+  }
+#else
+  {
+    int fds[2];
+#ifdef HAVE_PIPE2
+    if (pipe2(fds, O_CLOEXEC | O_NONBLOCK) < 0) {
+      penn_perror("sql_async_start: pipe2");
+      return 0;
+    }
+#else
+    if (pipe(fds) < 0) {
+      penn_perror("sql_async_start: pipe");
+      return 0;
+    }
+    set_close_exec(fds[0]);
+    make_nonblocking(fds[0]);
+    set_close_exec(fds[1]);
+    make_nonblocking(fds[1]);
+#endif
+    sql_async_fd = fds[0];
+    sql_async_notifier = fds[1];
+  }
+#endif
+  sql_async_generation++;
+
+  sql_async_config.platform = platform;
+  mush_strncpy(sql_async_config.host, SQL_HOST, sizeof sql_async_config.host);
+  mush_strncpy(sql_async_config.db, db, sizeof sql_async_config.db);
+  mush_strncpy(sql_async_config.user, SQL_USER, sizeof sql_async_config.user);
+  mush_strncpy(sql_async_config.pass, SQL_PASS, sizeof sql_async_config.pass);
+#ifdef HAVE_MYSQL
+  if (platform == SQL_PLATFORM_MYSQL)
+    mysql_library_init(0, NULL, NULL);
+#endif
+
+  sql_async_stopping = 0;
+  sql_async_threads =
+    mush_calloc(nworkers, sizeof(pthread_t), "sql.async.threads");
+  for (i = 0; i < nworkers; i++) {
+    if (pthread_create(&sql_async_threads[i], NULL, sql_async_worker, NULL)) {
+      do_rawlog(LT_ERR, "sql: Unable to start query worker: %s",
+                strerror(errno));
+      break;
+    }
+    sql_async_nthreads++;
+  }
+  if (!sql_async_nthreads) {
+    sql_async_stop();
+    return 0;
+  }
+  return 1;
+}
+
+/* Stop the workers, waiting for queries in progress, and throw away
+ * anything they didn't get to. */
+static void
+sql_async_stop(void)
+{
+  struct sql_async_job *job, *next;
+  int i;
+
+  pthread_mutex_lock(&sql_async_lock);
+  sql_async_stopping = 1;
+  pthread_cond_broadcast(&sql_async_wakeup);
+  pthread_mutex_unlock(&sql_async_lock);
+  for (i = 0; i < sql_async_nthreads; i++)
+    pthread_join(sql_async_threads[i], NULL);
+  if (sql_async_threads)
+    mush_free(sql_async_threads, "sql.async.threads");
+  sql_async_threads = NULL;
+  sql_async_nthreads = 0;
+
+  for (job = sql_async_pending; job; job = next) {
+    next = job->next;
+    sql_async_free_job(job);
+  }
+  for (job = sql_async_done; job; job = next) {
+    next = job->next;
+    sql_async_free_job(job);
+  }
+  sql_async_pending = sql_async_done = NULL;
+  sql_async_npending = 0;
+
+  if (sql_async_notifier >= 0 && sql_async_notifier != sql_async_fd)
+    close(sql_async_notifier);
+  if (sql_async_fd >= 0)
+    close(sql_async_fd);
+  sql_async_fd = sql_async_notifier = -1;
+}
+
+/* Make a job for a query, converting it to the database's encoding. */
+static struct sql_async_job *
+sql_async_new_job(const char *query)
+{
+  struct sql_async_job *job;
+
+  job = mush_calloc(1, sizeof *job, "sql.async.job");
+  job->id = sql_async_next_id++;
+  job->affected = -1;
+  job->executor = job->thing = NOTHING;
+  if (sql_async_config.platform == SQL_PLATFORM_SQLITE3) {
+    char *utf8 = latin1_to_utf8(query, strlen(query), &job->qlen, "string");
+    job->query = mush_strdup(utf8, "sql.async.query");
+    mush_free(utf8, "string");
+  } else {
+    job->query = mush_strdup(query, "sql.async.query");
+    job->qlen = strlen(query);
+  }
+  return job;
+}
+
+/* Hand a job to the workers. Returns false if too many are waiting. */
+static bool
+sql_async_submit(struct sql_async_job *job)
+{
+  pthread_mutex_lock(&sql_async_lock);
+  if (sql_async_npending >= SQL_ASYNC_MAX_PENDING) {
+    pthread_mutex_unlock(&sql_async_lock);
+    return 0;
+  }
+  job->next = NULL;
+  if (sql_async_pending)
+    sql_async_pending_tail->next = job;
+  else
+    sql_async_pending = job;
+  sql_async_pending_tail = job;
+  sql_async_npending++;
+  pthread_cond_signal(&sql_async_wakeup);
+  pthread_mutex_unlock(&sql_async_lock);
+  return 1;
+}
+
+/* Take every finished job, in the order they finished. */
+static struct sql_async_job *
+sql_async_collect(void)
+{
+  struct sql_async_job *jobs;
+  int64_t data;
+
+  if (sql_async_fd < 0)
+    return NULL;
+  while (read(sql_async_fd, &data, sizeof data) > 0)
+    ;
+  pthread_mutex_lock(&sql_async_lock);
+  jobs = sql_async_done;
+  sql_async_done = NULL;
+  pthread_mutex_unlock(&sql_async_lock);
+  return jobs;
+}
+
+/* Sanitize a value from the database for the MUSH. */
+static const char *
+sql_async_cell(const char *val)
+{
+  static char buff[BUFFER_LEN];
+  char *latin1;
+
+  if (!val)
+    return "";
+  if (sql_async_config.platform != SQL_PLATFORM_SQLITE3)
+    return sql_sanitize(val);
+  latin1 = utf8_to_latin1(val, strlen(val), NULL, 0, "string");
+  if (!latin1)
+    return "";
+  mush_strncpy(buff, sql_sanitize(latin1), sizeof buff);
+  mush_free(latin1, "string");
+  return buff;
+}
+
+/** Queue the callbacks of any finished asynchronous queries.
+ * Called from check_sockets() when sql_async_fd is readable.
+ */
+void
+sql_async_reap(void)
+{
+  struct sql_async_job *job, *next;
+  char buff[BUFFER_LEN], *bp;
+  char num[20];
+  int r, i;
+
+  for (job = sql_async_collect(); job; job = next) {
+    next = job->next;
+    if (!GoodObject(job->executor) || IsGarbage(job->executor) ||
+        !GoodObject(job->thing) || IsGarbage(job->thing)) {
+      sql_async_free_job(job);
+      continue;
+    }
+
+    snprintf(num, sizeof num, "%u", job->id);
+    pe_regs_setenv(job->pe_regs, 0, num);
+
+    bp = buff;
+    for (r = 0; r < job->stored; r++) {
+      if (r)
+        safe_str(job->rowsep, buff, &bp);
+      for (i = 0; i < job->numfields; i++) {
+        if (i)
+          safe_str(job->fieldsep, buff, &bp);
+        safe_str(sql_async_cell(job->cells[r * job->numfields + i]), buff,
+                 &bp);
+      }
+    }
+    *bp = '\0';
+    pe_regs_set(job->pe_regs, PE_REGS_Q, "SQLROWS", buff);
+
+    bp = buff;
+    for (i = 0; i < job->numfields; i++) {
+      if (i)
+        safe_str(job->fieldsep, buff, &bp);
+      safe_str(sql_async_cell(job->names[i]), buff, &bp);
+    }
+    *bp = '\0';
+    pe_regs_set(job->pe_regs, PE_REGS_Q, "SQLFIELDS", buff);
+    pe_regs_set_int(job->pe_regs, PE_REGS_Q, "SQLCOUNT", job->numrows);
+    pe_regs_set_int(job->pe_regs, PE_REGS_Q, "SQLAFFECTED", job->affected);
+    if (job->error) {
+      mush_strncpy(buff, job->error, sizeof buff);
+      remove_trailing_whitespace(buff, strlen(buff));
+      pe_regs_set(job->pe_regs, PE_REGS_Q, "SQLERROR", sql_sanitize(buff));
+    } else
+      pe_regs_set(job->pe_regs, PE_REGS_Q, "SQLERROR", "");
+
+    queue_attribute_base_priv(job->thing, job->attrname, job->executor, 0,
+                              job->pe_regs, QUEUE_DEFAULT, job->executor, NULL,
+                              NULL);
+    sql_async_free_job(job);
+  }
+}
+
+#else /* HAVE_PTHREAD_H && !WIN32 */
+
+void
+sql_async_reap(void)
+{
+}
+
+#endif /* HAVE_PTHREAD_H && !WIN32 */
+
+/* sqlasync(<obj>/<attr>, <query>[, <row sep>[, <field sep>]]) */
+FUNCTION(fun_sqlasync)
+{
+#if defined(HAVE_PTHREAD_H) && !defined(WIN32)
+  struct sql_async_job *job;
+  char tbuf[BUFFER_LEN];
+  char *s;
+  dbref thing;
+  uint32_t id;
+
+  if (sql_platform() == SQL_PLATFORM_DISABLED || SQL_ASYNC_WORKERS <= 0) {
+    safe_str(T(e_disabled), buff, bp);
+    return;
+  }
+  if (!Sql_Ok(executor)) {
+    safe_str(T(e_perm), buff, bp);
+    return;
+  }
+  if (!*args[1]) {
+    safe_str(T("#-1 NO QUERY"), buff, bp);
+    return;
+  }
+
+  mush_strncpy(tbuf, args[0], sizeof tbuf);
+  s = strchr(tbuf, '/');
+  if (!s || !s[1]) {
+    safe_str(T("#-1 NO SUCH ATTRIBUTE"), buff, bp);
+    return;
+  }
+  *(s++) = '\0';
+  upcasestr(s);
+  thing = match_thing(executor, tbuf);
+  if (!GoodObject(thing)) {
+    safe_str(T(e_notvis), buff, bp);
+    return;
+  }
+  if (!controls(executor, thing) &&
+      !(Owns(executor, thing) && LinkOk(thing))) {
+    safe_str(T(e_perm), buff, bp);
+    return;
+  }
+  if (God(thing) && !God(executor)) {
+    safe_str(T(e_perm), buff, bp);
+    return;
+  }
+
+  if (!sql_async_start(sql_platform(), SQL_DB, SQL_ASYNC_WORKERS)) {
+    safe_str(T("#-1 SQL ERROR: UNABLE TO START WORKERS"), buff, bp);
+    return;
+  }
+
+  job = sql_async_new_job(args[1]);
+  job->executor = executor;
+  job->thing = thing;
+  job->attrname = mush_strdup(s, "sql.async.attr");
+  job->rowsep =
+    mush_strdup(nargs > 2 && *args[2] ? args[2] : " ", "sql.async.sep");
+  job->fieldsep =
+    mush_strdup(nargs > 3 && *args[3] ? args[3] : " ", "sql.async.sep");
+  job->pe_regs = pe_regs_create(PE_REGS_ARG | PE_REGS_Q, "fun_sqlasync");
+  pe_regs_qcopy(job->pe_regs, pe_info->regvals);
+
+  id = job->id;
+  if (!sql_async_submit(job)) {
+    sql_async_free_job(job);
+    safe_str(T("#-1 TOO MANY QUERIES"), buff, bp);
+    return;
+  }
+  safe_uinteger(id, buff, bp);
+#else
+  safe_str(T(e_disabled), buff, bp);
+#endif
+}
+
+#if defined(HAVE_PTHREAD_H) && !defined(WIN32)
+/* Wait for up to want queries to come back, putting them in done in the
+ * order they arrive. Gives up if nothing arrives for ten seconds. */
+static int
+sql_async_wait(struct sql_async_job **done, int want, double *when)
+{
+  struct sql_async_job *job, *next;
+  struct pollfd pfd;
+  struct timeval start, now;
+  int n = 0;
+
+  pfd.fd = sql_async_fd;
+  pfd.events = POLLIN;
+  gettimeofday(&start, NULL);
+  while (n < want && poll(&pfd, 1, 10000) > 0) {
+    gettimeofday(&now, NULL);
+    for (job = sql_async_collect(); job; job = next) {
+      next = job->next;
+      if (n < want) {
+        if (when)
+          when[n] = (now.tv_sec - start.tv_sec) * 1000.0 +
+                    (now.tv_usec - start.tv_usec) / 1000.0;
+        done[n++] = job;
+      } else
+        sql_async_free_job(job);
+    }
+  }
+  return n;
+}
+#endif
+
+TEST_GROUP(sql_async)
+{
+#if defined(HAVE_PTHREAD_H) && !defined(WIN32)
+  struct sql_async_job *big, *quick, *bad;
+  struct sql_async_job *done[2];
+  int i, n;
+
+  if (sql_async_nthreads)
+    return; /* Don't disturb a pool the game is using */
+
+  TEST("sql_async.1", sql_async_start(SQL_PLATFORM_SQLITE3, ":memory:", 2));
+  if (!sql_async_nthreads)
+    return;
+
+  big = sql_async_new_job("WITH RECURSIVE c(x) AS (SELECT 1 UNION ALL "
+                          "SELECT x + 1 FROM c WHERE x < 1000) "
+                          "SELECT count(*), 'caf\xE9' FROM c");
+  quick = sql_async_new_job("SELECT 1 AS a, NULL AS b UNION ALL SELECT 2, 'x'");
+  TEST("sql_async.2", sql_async_submit(big) && sql_async_submit(quick));
+  n = sql_async_wait(done, 2, NULL);
+  TEST("sql_async.3",
+       n == 2 && ((done[0] == quick && done[1] == big) ||
+                  (done[0] == big && done[1] == quick)));
+  if (n == 2) {
+    TEST("sql_async.4", quick->numfields == 2 && quick->numrows == 2 &&
+                          quick->stored == 2 && !quick->error &&
+                          !strcmp(quick->names[0], "a") &&
+                          !strcmp(quick->names[1], "b") &&
+                          !strcmp(quick->cells[0], "1") && !quick->cells[1] &&
+                          !strcmp(quick->cells[3], "x"));
+    TEST("sql_async.5", big->numrows == 1 && !big->error &&
+                          !strcmp(big->cells[0], "1000") &&
+                          !strcmp(big->cells[1], "caf\xC3\xA9"));
+  }
+  for (i = 0; i < n; i++)
+    sql_async_free_job(done[i]);
+
+  bad = sql_async_new_job("SELECT * FROM no_such_table");
+  sql_async_submit(bad);
+  n = sql_async_wait(done, 1, NULL);
+  TEST("sql_async.6", n == 1 && done[0] == bad && bad->error &&
+                        strstr(bad->error, "no such table") &&
+                        bad->affected == -1);
+  if (n)
+    sql_async_free_job(done[0]);
+  sql_async_stop();
+#endif
+}
+
+BENCHMARK(sql_async)
+{
+#if defined(HAVE_PTHREAD_H) && !defined(WIN32)
+  struct sql_async_job *slow, *quick;
+  struct sql_async_job *done[2];
+  double when[2];
+  struct timeval start, now;
+  double submit_us;
+  int i, n;
+
+  if (sql_async_nthreads)
+    return;
+  if (!sql_async_start(SQL_PLATFORM_SQLITE3, ":memory:", 2))
+    return;
+
+  /* A slow query shouldn't hold up the game, or a quick query behind it
+   * that another worker can take. */
+  slow = sql_async_new_job("WITH RECURSIVE c(x) AS (SELECT 1 UNION ALL "
+                           "SELECT x + 1 FROM c WHERE x < 1000000) "
+                           "SELECT count(*) FROM c");
+  quick = sql_async_new_job("SELECT 1 AS a, NULL AS b UNION ALL SELECT 2, 'x'");
+  gettimeofday(&start, NULL);
+  sql_async_submit(slow);
+  gettimeofday(&now, NULL);
+  submit_us = (now.tv_sec - start.tv_sec) * 1000000.0 +
+              (now.tv_usec - start.tv_usec);
+  sql_async_submit(quick);
+  n = sql_async_wait(done, 2, when);
+  if (n == 2)
+    do_rawlog(LT_TRACE,
+              "sql_async: submitting a 1M-row query took %.1fus. It came "
+              "back after %.1fms, and a quick query sent behind it after "
+              "%.1fms.",
+              submit_us, done[0] == slow ? when[0] : when[1],
+              done[0] == quick ? when[0] : when[1]);
+  for (i = 0; i < n; i++)
+    sql_async_free_job(done[i]);
+  sql_async_stop();
+#endif
+}
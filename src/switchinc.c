@@ -1,6 +1,6 @@
 /* AUTOGENERATED FILE. DO NOT EDIT! */
-static const int max_switch = 193;
-SWITCH_VALUE switch_list[194] = {
+static const int max_switch = 196;
+SWITCH_VALUE switch_list[197] = {
   {"ACCESS", SWITCH_ACCESS, 0},
   {"ADD", SWITCH_ADD, 0},
   {"AFTER", SWITCH_AFTER, 0},
@@ -140,6 +140,7 @@ SWITCH_VALUE switch_list[194] = {
   {"REMIT", SWITCH_REMIT, 0},
   {"REMOVE", SWITCH_REMOVE, 0},
   {"RENAME", SWITCH_RENAME, 0},
+  {"REPORT", SWITCH_REPORT, 0},
   {"RESTART", SWITCH_RESTART, 0},
   {"RESTORE", SWITCH_RESTORE, 0},
   {"RESTRICT", SWITCH_RESTRICT, 0},
@@ -163,8 +164,10 @@ SWITCH_VALUE switch_list[194] = {
   {"SKIPDEFAULTS", SWITCH_SKIPDEFAULTS, 0},
   {"SPEAK", SWITCH_SPEAK, 0},
   {"SPOOF", SWITCH_SPOOF, 0},
+  {"START", SWITCH_START, 0},
   {"STATS", SWITCH_STATS, 0},
   {"STATUS", SWITCH_STATUS, 0},
+  {"STOP", SWITCH_STOP, 0},
   {"SUMMARY", SWITCH_SUMMARY, 0},
   {"TABLES", SWITCH_TABLES, 0},
   {"TAG", SWITCH_TAG, 0},
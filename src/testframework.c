@@ -3,8 +3,16 @@
  * \brief Hardcode test framework
  */
 
+#include "config.h"
+
+#include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#ifndef WIN32
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
 
 #include "sqlite3.h"
 #include "tests.h"
@@ -72,3 +80,102 @@ run_tests(void)
   sqlite3_free(logstr);
   return total_failure == 0;
 }
+
+/** Run the hardcode benchmarks.
+ * Benchmarks only log their timings; they have no pass or fail.
+ */
+void
+run_benchmarks(void)
+{
+  struct bench_record *b;
+  do_rawlog(LT_TRACE, "Starting benchmarks.");
+  for (b = benchmarks; b->name; b += 1) {
+    do_rawlog(LT_TRACE, "Benchmark %s:", b->name);
+    b->fun();
+  }
+  do_rawlog(LT_TRACE, "Benchmarks done.");
+}
+
+/** Run part of a test or benchmark in a child process, so the objects
+ * and other game state it makes go away when it's done. fn fills in
+ * result, which is sent back to this process. The game's SIGCHLD
+ * handler may reap the child first, so its exit status isn't used.
+ * \param fn the function to run in the child.
+ * \param arg passed to fn.
+ * \param result where fn puts its results, and where they're copied to.
+ * \param size the size of result.
+ * \return true if the child sent back all of result.
+ */
+bool
+run_in_child(void (*fn)(void *arg, void *result), void *arg, void *result,
+             size_t size)
+{
+#ifdef WIN32
+  (void) fn;
+  (void) arg;
+  (void) result;
+  (void) size;
+  return 0;
+#else
+  int fds[2];
+  size_t got = 0;
+  ssize_t n;
+  pid_t pid;
+
+  if (pipe(fds) < 0)
+    return 0;
+  pid = fork();
+  if (pid == 0) {
+    close(fds[0]);
+    fn(arg, result);
+    for (got = 0; got < size; got += n) {
+      n = write(fds[1], (char *) result + got, size - got);
+      if (n < 0 && errno == EINTR)
+        n = 0;
+      else if (n <= 0)
+        _exit(1);
+    }
+    _exit(0);
+  }
+  close(fds[1]);
+  while (pid > 0 && got < size) {
+    n = read(fds[0], (char *) result + got, size - got);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      break;
+    got += n;
+  }
+  close(fds[0]);
+  if (pid > 0)
+    while (waitpid(pid, NULL, 0) < 0 && errno == EINTR)
+      ;
+  return pid > 0 && got == size;
+#endif
+}
+
+/** Make a scratch directory under $TMPDIR for a test's files. The
+ * caller removes it, and anything it put there, when done.
+ * \param dir buffer for the directory's name.
+ * \param len the size of dir.
+ * \param prefix start of the directory's name.
+ * \return false if none could be made.
+ */
+bool
+test_scratch_dir(char *dir, size_t len, const char *prefix)
+{
+#ifdef WIN32
+  (void) dir;
+  (void) len;
+  (void) prefix;
+  return 0;
+#else
+  const char *base = getenv("TMPDIR");
+  int n;
+
+  if (!base || !*base)
+    base = "/tmp";
+  n = snprintf(dir, len, "%s/%sXXXXXX", base, prefix);
+  return n > 0 && (size_t) n < len && mkdtemp(dir) != NULL;
+#endif
+}
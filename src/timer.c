@@ -46,6 +46,7 @@
 #include "parse.h"
 #include "sig.h"
 #include "strutil.h"
+#include "tests.h"
 
 bool inactivity_check(void);
 static void migrate_stuff(int amount);
@@ -385,9 +386,110 @@ reset_cpu_timer(void)
 }
 
 /** System queue stuff. Timed events like dbcks and purges are handled
- *  through this system. */
+ *  through this system.
+ *
+ * Pending events are kept in a binary heap ordered by when they run, with
+ * ties going to whichever was registered first. Cancelling an event only
+ * marks it; dead entries are thrown away when they reach the top of the
+ * heap, or all at once when they make up most of it.
+ */
+
+static struct squeue **sq_heap = NULL;
+static int sq_heap_count = 0;  /**< Entries in the heap, dead or alive */
+static int sq_heap_size = 0;   /**< Allocated size of sq_heap */
+static int sq_heap_dead = 0;   /**< Cancelled entries still in the heap */
+static uint64_t sq_next_seq = 0;
+static struct squeue *sq_running = NULL;
+
+/* Does a run before b? */
+static inline bool
+sq_before(const struct squeue *a, const struct squeue *b)
+{
+  return a->when < b->when || (a->when == b->when && a->seq < b->seq);
+}
+
+static void
+sq_sift_up(int i)
+{
+  struct squeue *sq = sq_heap[i];
+  int parent;
+
+  while (i > 0) {
+    parent = (i - 1) / 2;
+    if (!sq_before(sq, sq_heap[parent]))
+      break;
+    sq_heap[i] = sq_heap[parent];
+    i = parent;
+  }
+  sq_heap[i] = sq;
+}
+
+static void
+sq_sift_down(int i)
+{
+  struct squeue *sq = sq_heap[i];
+  int child;
+
+  while ((child = 2 * i + 1) < sq_heap_count) {
+    if (child + 1 < sq_heap_count &&
+        sq_before(sq_heap[child + 1], sq_heap[child]))
+      child++;
+    if (!sq_before(sq_heap[child], sq))
+      break;
+    sq_heap[i] = sq_heap[child];
+    i = child;
+  }
+  sq_heap[i] = sq;
+}
+
+/* Remove the top of the heap and return it. */
+static struct squeue *
+sq_pop(void)
+{
+  struct squeue *top = sq_heap[0];
+
+  sq_heap[0] = sq_heap[--sq_heap_count];
+  if (sq_heap_count > 0)
+    sq_sift_down(0);
+  return top;
+}
 
-struct squeue *sq_head = NULL;
+static void
+sq_free(struct squeue *sq)
+{
+  if (sq->event)
+    mush_free(sq->event, "squeue.event");
+  mush_free(sq, "squeue.node");
+}
+
+/* Discard cancelled events from the top of the heap, so that it's the
+ * next one that will actually run. */
+static void
+sq_skip_dead(void)
+{
+  while (sq_heap_count > 0 && !sq_heap[0]->fun) {
+    sq_free(sq_pop());
+    sq_heap_dead--;
+  }
+}
+
+/* Drop every cancelled event and rebuild the heap from what's left. */
+static void
+sq_compact(void)
+{
+  int i, n = 0;
+
+  for (i = 0; i < sq_heap_count; i++) {
+    if (sq_heap[i]->fun)
+      sq_heap[n++] = sq_heap[i];
+    else
+      sq_free(sq_heap[i]);
+  }
+  sq_heap_count = n;
+  sq_heap_dead = 0;
+  for (i = n / 2 - 1; i >= 0; i--)
+    sq_sift_down(i);
+}
 
 /** Register a callback function to be executed at a certain time.
  * \param w when to run the event
@@ -410,24 +512,15 @@ sq_register(uint64_t w, sq_func f, void *d, const char *ev)
     sq->event = strupper_a(ev, "squeue.event");
   else
     sq->event = NULL;
-  sq->next = NULL;
+  sq->seq = sq_next_seq++;
 
-  if (!sq_head)
-    sq_head = sq;
-  else if (sq_head->when > sq->when) {
-    sq->next = sq_head;
-    sq_head = sq;
-  } else {
-    struct squeue *c, *prev = NULL;
-    for (prev = sq_head, c = sq_head->next; c; prev = c, c = c->next) {
-      if (c->when > sq->when) {
-        sq->next = c;
-        prev->next = sq;
-        return sq;
-      }
-    }
-    prev->next = sq;
+  if (sq_heap_count == sq_heap_size) {
+    sq_heap_size = sq_heap_size ? sq_heap_size * 2 : 64;
+    sq_heap = mush_realloc(sq_heap, sizeof(struct squeue *) * sq_heap_size,
+                           "squeue.heap");
   }
+  sq_heap[sq_heap_count++] = sq;
+  sq_sift_up(sq_heap_count - 1);
 
   return sq;
 }
@@ -438,25 +531,19 @@ sq_register(uint64_t w, sq_func f, void *d, const char *ev)
 void
 sq_cancel(struct squeue *sq)
 {
-  struct squeue *tmp, *prev = NULL;
-
-  if (!sq)
+  if (!sq || !sq->fun || sq == sq_running)
     return;
 
-  /* Remove from list */
-  for (tmp = sq_head; tmp; tmp = tmp->next) {
-    if (tmp == sq) {
-      if (prev)
-        prev->next = tmp->next;
-      else
-        sq_head = tmp->next;
-      if (sq->event)
-        mush_free(sq->event, "squeue.event");
-      mush_free(sq, "squeue.node");
-      return;
-    }
-    prev = tmp;
+  /* Leave it in the heap to be thrown away later. */
+  sq->fun = NULL;
+  sq->data = NULL;
+  if (sq->event) {
+    mush_free(sq->event, "squeue.event");
+    sq->event = NULL;
   }
+  sq_heap_dead++;
+  if (sq_heap_dead > 64 && sq_heap_dead > sq_heap_count / 2)
+    sq_compact();
 }
 
 /** Register a callback function to be executed in N miliseconds.
@@ -525,20 +612,16 @@ sq_run_one(void)
   struct squeue *torun;
   bool r;
 
-  if (sq_head) {
-    if (sq_head->when <= now) {
-      torun = sq_head;
-      sq_head = torun->next;
+  sq_skip_dead();
+  if (sq_heap_count > 0 && sq_heap[0]->when <= now) {
+    torun = sq_running = sq_pop();
 
-      r = torun->fun(torun->data);
-      if (torun->event) {
-        if (r)
-          queue_event(SYSEVENT, torun->event, "%s", "");
-        mush_free(torun->event, "squeue.event");
-      }
-      mush_free(torun, "squeue.node");
-      return true;
-    }
+    r = torun->fun(torun->data);
+    if (torun->event && r)
+      queue_event(SYSEVENT, torun->event, "%s", "");
+    sq_running = NULL;
+    sq_free(torun);
+    return true;
   }
   return false;
 }
@@ -563,8 +646,97 @@ uint64_t
 sq_msecs_till_next(void)
 {
   uint64_t now = now_msecs();
-  if (sq_head) {
-    return sq_head->when - now;
+
+  sq_skip_dead();
+  if (sq_heap_count > 0) {
+    if (sq_heap[0]->when <= now)
+      return 0;
+    return sq_heap[0]->when - now;
   }
   return 500;
 }
+
+static int sq_test_order[8];
+static int sq_test_ran = 0;
+
+static bool
+sq_test_fun(void *arg)
+{
+  if (sq_test_ran < 8)
+    sq_test_order[sq_test_ran++] = (int) (intptr_t) arg;
+  return false;
+}
+
+/* Connection storm: every connection registers a timer and most cancel
+ * it before it fires. */
+static void
+sq_test_storm(struct squeue **held, int cycles, uint64_t later)
+{
+  int i;
+
+  for (i = 0; i < cycles; i++)
+    held[i] = sq_register(later + (i * 7919) % 1000, sq_test_fun, NULL, NULL);
+  for (i = 0; i < cycles; i++)
+    sq_cancel(held[i]);
+  for (i = 0; i < cycles; i++)
+    sq_cancel(sq_register(later + i % 1000, sq_test_fun, NULL, NULL));
+}
+
+TEST_GROUP(squeue)
+{
+  const int cycles = 2000;
+  struct squeue **held;
+  struct squeue *a, *b;
+  uint64_t later = now_msecs() + 1000000000;
+  int i, count;
+
+  /* These are due before anything the game has registered, so they run
+   * first, in time order with ties in registration order. */
+  sq_test_ran = 0;
+  sq_register(3, sq_test_fun, (void *) 4, NULL);
+  sq_register(1, sq_test_fun, (void *) 1, NULL);
+  a = sq_register(2, sq_test_fun, (void *) 99, NULL);
+  sq_register(2, sq_test_fun, (void *) 2, NULL);
+  sq_register(2, sq_test_fun, (void *) 3, NULL);
+  sq_cancel(a);
+  for (i = 0; i < 4; i++)
+    sq_run_one();
+  TEST("squeue.order", sq_test_ran == 4 && sq_test_order[0] == 1 &&
+                         sq_test_order[1] == 2 && sq_test_order[2] == 3 &&
+                         sq_test_order[3] == 4);
+
+  count = sq_heap_count - sq_heap_dead;
+  a = sq_register(0, sq_test_fun, NULL, "TEST`EVENT");
+  b = sq_register(0, sq_test_fun, NULL, NULL);
+  sq_cancel(a);
+  sq_cancel(b);
+  sq_cancel(b);
+  TEST("squeue.cancel", sq_msecs_till_next() > 0 &&
+                          sq_heap_count - sq_heap_dead == count &&
+                          !sq_run_one());
+
+  held = mush_calloc(cycles, sizeof *held, "squeue.test");
+  sq_test_storm(held, cycles, later);
+  mush_free(held, "squeue.test");
+  TEST("squeue.storm", sq_heap_count - sq_heap_dead == count &&
+                         sq_heap_dead <= sq_heap_count / 2 + 64);
+}
+
+BENCHMARK(squeue)
+{
+  const int cycles = 100000;
+  struct squeue **held;
+  struct timeval start, end;
+  uint64_t later = now_msecs() + 1000000000;
+  double us;
+
+  held = mush_calloc(cycles, sizeof *held, "squeue.test");
+  penn_gettimeofday(&start);
+  sq_test_storm(held, cycles, later);
+  penn_gettimeofday(&end);
+  mush_free(held, "squeue.test");
+  us = (end.tv_sec - start.tv_sec) * 1000000.0 +
+       (end.tv_usec - start.tv_usec);
+  do_rawlog(LT_TRACE, "squeue: %d register/cancel cycles, %.1f ns/cycle",
+            cycles * 2, us * 1000.0 / (cycles * 2));
+}
@@ -51,6 +51,7 @@
 #include "mushdb.h"
 #include "mymalloc.h"
 #include "parse.h"
+#include "profile.h"
 #include "strutil.h"
 #include "pcg_basic.h"
 
@@ -303,6 +304,7 @@ call_ufun_int(ufun_attrib *ufun, char *ret, dbref caller, dbref enactor,
   PE_REGS *pe_regs;
   PE_REGS *pe_regs_old;
   int pe_reg_flags = 0;
+  int prof;
 
   /* Make sure we have a ufun first */
   if (!ufun)
@@ -360,8 +362,10 @@ call_ufun_int(ufun_attrib *ufun, char *ret, dbref caller, dbref enactor,
 
   /* And now, make the call! =) */
   ap = ufun->contents;
+  prof = PROFILE_ENTER(PROFILE_ATTRIBUTE, NOTHING, pe_info->attrname);
   pe_ret = process_expression(ret, &rp, &ap, ufun->thing, caller, enactor,
                               ufun->pe_flags, PT_DEFAULT, pe_info);
+  PROFILE_LEAVE(prof);
   *rp = '\0';
 
   if ((ufun->ufun_flags & UFUN_NAME) && np == rp) {
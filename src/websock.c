@@ -11,6 +11,9 @@
 #include <stdlib.h>
 #include <string.h>
 #include <openssl/sha.h>
+#ifdef HAVE_LIBZ
+#include <zlib.h>
+#endif
 #include "conf.h"
 #include "externs.h"
 #include "log.h"
@@ -21,6 +24,8 @@
 #include "notify.h"
 #include "mymalloc.h"
 #include "connlog.h"
+#include "mccp.h"
+#include "tests.h"
 #include "websock.h"
 
 /* Length of 16 bytes, Base64 encoded (with padding). */
@@ -32,6 +37,10 @@
 /* Length of 20 bytes, Base64 encoded (with padding). */
 #define WEBSOCKET_ACCEPT_LEN 28
 
+/* The empty block that ends each permessage-deflate message, which
+ * isn't sent (RFC 7692, section 7.2.1). */
+#define WEBSOCKET_DEFLATE_TAIL "\x00\x00\xff\xff"
+
 /* Escaped characters. */
 #define WEBSOCKET_ESCAPE_IAC ((char) 255) /* introduces escape sequence */
 #define WEBSOCKET_ESCAPE_NUL 'n'          /* \0 not allowed within a string */
@@ -132,6 +141,11 @@ complete_handshake(DESC *d)
                                       "Upgrade: websocket\r\n"
                                       "Connection: Upgrade\r\n"
                                       "Sec-WebSocket-Accept: ";
+  /* The client starts each message afresh, so what it sends can still be
+   * inflated after a reboot loses the server's window. */
+  static const char *const DEFLATE = "\r\nSec-WebSocket-Extensions: "
+                                     "permessage-deflate; "
+                                     "client_no_context_takeover";
 
   static size_t RESPONSE_LEN = 0;
 
@@ -148,6 +162,14 @@ complete_handshake(DESC *d)
   compute_websocket_accept(bp, d->checksum);
   bp += WEBSOCKET_ACCEPT_LEN;
 
+  /* Compression starts with the first frame after this response. */
+  if ((d->conn_flags & CONN_WEBSOCKETS_DEFLATE) && mccp_start_websocket(d)) {
+    memcpy(bp, DEFLATE, strlen(DEFLATE));
+    bp += strlen(DEFLATE);
+  } else {
+    d->conn_flags &= ~CONN_WEBSOCKETS_DEFLATE;
+  }
+
   memcpy(bp, "\r\n\r\n", 4);
   bp += 4;
 
@@ -192,15 +214,63 @@ is_websocket(const char *command)
   return strncmp(command, REQUEST_LINE, REQUEST_LINE_LEN) == 0;
 }
 
+/* Is there a permessage-deflate offer we can accept in the value of a
+ * Sec-WebSocket-Extensions header? Offers are separated by commas, and
+ * their parameters by semicolons. Offers that limit the server's window
+ * or context are turned down; the client's own are its business. */
+static int
+deflate_offered(const char *value)
+{
+  static const char *const NAME = "permessage-deflate";
+  static const char *const PARAMS[] = {"client_max_window_bits",
+                                       "client_no_context_takeover", NULL};
+
+  const char *end, *param;
+  size_t len;
+  int ok, ii;
+
+  while (*value) {
+    end = value + strcspn(value, ",");
+    value += strspn(value, " \t");
+    len = strcspn(value, " \t;,");
+    ok = (len == strlen(NAME) && strncasecmp(value, NAME, len) == 0);
+
+    for (param = value + len; ok && param < end;
+         param += strcspn(param, ";,")) {
+      param += strspn(param, " \t;");
+      if (param >= end) {
+        break;
+      }
+      len = strcspn(param, " \t;=,");
+      for (ok = 0, ii = 0; PARAMS[ii]; ++ii) {
+        if (len == strlen(PARAMS[ii]) &&
+            strncasecmp(param, PARAMS[ii], len) == 0) {
+          ok = 1;
+        }
+      }
+    }
+
+    if (ok) {
+      return 1;
+    }
+    value = *end ? end + 1 : end;
+  }
+
+  return 0;
+}
+
 int
 process_websocket_request(DESC *d, const char *command)
 {
   static const char *const KEY_HEADER = "Sec-WebSocket-Key:";
+  static const char *const EXT_HEADER = "Sec-WebSocket-Extensions:";
 
   static size_t KEY_HEADER_LEN = 0;
+  static size_t EXT_HEADER_LEN = 0;
 
   if (!KEY_HEADER_LEN) {
     KEY_HEADER_LEN = strlen(KEY_HEADER);
+    EXT_HEADER_LEN = strlen(EXT_HEADER);
   }
 
   /* TODO: Full implementation should verify entire request. */
@@ -220,6 +290,57 @@ process_websocket_request(DESC *d, const char *command)
     if (value && strlen(value) == WEBSOCKET_KEY_LEN) {
       memcpy(d->checksum, value, WEBSOCKET_KEY_LEN + 1);
     }
+  } else if (strncasecmp(command, EXT_HEADER, EXT_HEADER_LEN) == 0) {
+    if (deflate_offered(command + EXT_HEADER_LEN)) {
+      d->conn_flags |= CONN_WEBSOCKETS_DEFLATE;
+    }
+  }
+
+  return 1;
+}
+
+/* Inflate a run of compressed payload, and pass the text that comes out
+ * on to the input handling, dropping the channel byte as for plain
+ * frames. Plain text already framed in tbuf1 goes first, to keep the
+ * input in order. */
+static int
+inflate_payload(DESC *d, char *tbuf1, char **wp, const char *zin, int zlen,
+                unsigned char *first)
+{
+  char out[BUFFER_LEN];
+  char *op;
+  const char *ip;
+  int got;
+
+  if (*wp != tbuf1) {
+    process_input_text(d, tbuf1, *wp - tbuf1);
+    *wp = tbuf1;
+  }
+
+  while (zlen > 0) {
+    got = mccp_ws_inflate(d, &zin, &zlen, out, sizeof(out));
+    if (got < 0) {
+      return 0;
+    }
+
+    for (ip = op = out; ip != out + got; ++ip) {
+      switch (*first) {
+      case 0:
+        *op++ = *ip;
+        break;
+
+      case 1:
+        *first = (*ip == WEBSOCKET_CHANNEL_TEXT) ? 0 : 2;
+        break;
+
+      case 2:
+        break;
+      }
+    }
+
+    if (op != out) {
+      process_input_text(d, out, op - out);
+    }
   }
 
   return 1;
@@ -228,12 +349,14 @@ process_websocket_request(DESC *d, const char *command)
 int
 process_websocket_frame(DESC *d, char *tbuf1, int got)
 {
-  char mask[1 + 4 + 1 + 1];
-  unsigned char state, type, first, channel;
+  char mask[1 + 4 + 1 + 1 + 1];
+  char zin[BUFFER_LEN + 4];
+  unsigned char state, type, first, channel, zmsg;
   uint64_t len;
   char *wp;
   const char *cp, *end;
   enum WebSocketOp op;
+  int zlen = 0;
 
   wp = tbuf1;
 
@@ -242,6 +365,7 @@ process_websocket_frame(DESC *d, char *tbuf1, int got)
   state = mask[0];
   type = mask[5];
   first = mask[6];
+  zmsg = mask[7];
   len = d->ws_frame_len;
 
   /* Process buffer bytes. */
@@ -264,6 +388,13 @@ process_websocket_frame(DESC *d, char *tbuf1, int got)
       case WS_OP_TEXT:
         /* First frame of a new message. */
         first = 1;
+        zmsg = (ch & 0x40) != 0;
+        break;
+
+      case WS_OP_BINARY:
+        /* Ignored, but compressed ones have to be inflated anyway. */
+        first = 2;
+        zmsg = (ch & 0x40) != 0;
         break;
 
       default:
@@ -339,32 +470,45 @@ process_websocket_frame(DESC *d, char *tbuf1, int got)
         /* Empty payload. */
         state = 4;
 
-        /* TODO: Handle end of frame. */
+        if (zmsg && !(type & 0x08) && (type & 0x80)) {
+          /* End of a compressed message. */
+          memcpy(zin + zlen, WEBSOCKET_DEFLATE_TAIL, 4);
+          if (!inflate_payload(d, tbuf1, &wp, zin, zlen + 4, &first)) {
+            return -1;
+          }
+          zlen = 0;
+          zmsg = 0;
+        }
       }
       break;
 
     default:
       /* Payload data; handle according to opcode. */
-      switch (first) {
-      case 0:
-        /* Continue frame. */
-        *wp++ = ch ^ mask[state];
-        break;
-
-      case 1:
-        /* Channel byte. */
-        first = 0;
-        channel = ch ^ mask[state];
+      if (zmsg && !(type & 0x08)) {
+        /* Compressed; inflated at the end of the frame or buffer. */
+        zin[zlen++] = ch ^ mask[state];
+      } else {
+        switch (first) {
+        case 0:
+          /* Continue frame. */
+          *wp++ = ch ^ mask[state];
+          break;
+
+        case 1:
+          /* Channel byte. */
+          first = 0;
+          channel = ch ^ mask[state];
+
+          if (channel != WEBSOCKET_CHANNEL_TEXT) {
+            /* TODO: Support other channel types later. */
+            first = 2;
+          }
+          break;
 
-        if (channel != WEBSOCKET_CHANNEL_TEXT) {
-          /* TODO: Support other channel types later. */
-          first = 2;
+        case 2:
+          /* Ignore channel. */
+          break;
         }
-        break;
-
-      case 2:
-        /* Ignore channel. */
-        break;
       }
 
       if (--len) {
@@ -374,16 +518,39 @@ process_websocket_frame(DESC *d, char *tbuf1, int got)
         /* Last payload byte. */
         state = 4;
 
-        /* TODO: Handle end of frame. */
+        if (zmsg && !(type & 0x08)) {
+          if (type & 0x80) {
+            /* End of a compressed message. */
+            memcpy(zin + zlen, WEBSOCKET_DEFLATE_TAIL, 4);
+            zlen += 4;
+          }
+          if (!inflate_payload(d, tbuf1, &wp, zin, zlen, &first)) {
+            return -1;
+          }
+          zlen = 0;
+          zmsg = (type & 0x80) ? 0 : zmsg;
+        }
       }
       break;
     }
+
+    if (zlen == BUFFER_LEN) {
+      if (!inflate_payload(d, tbuf1, &wp, zin, zlen, &first)) {
+        return -1;
+      }
+      zlen = 0;
+    }
+  }
+
+  if (zlen && !inflate_payload(d, tbuf1, &wp, zin, zlen, &first)) {
+    return -1;
   }
 
   /* Preserve state. */
   mask[0] = state;
   mask[5] = type;
   mask[6] = first;
+  mask[7] = zmsg;
   memcpy(d->checksum, mask, sizeof(mask));
   d->ws_frame_len = len;
 
@@ -391,12 +558,14 @@ process_websocket_frame(DESC *d, char *tbuf1, int got)
 }
 
 static char *
-write_message(char *dst, char *const dstend, const char *src,
+write_message(DESC *d, char *dst, char *const dstend, const char *src,
               const char *const srcend, char channel)
 {
+  char *const start = dst;
   size_t dstlen = dstend - dst;
   size_t srclen = srcend - src;
   enum WebSocketOp op;
+  int zlen = -1;
 
   /* Check bounds. */
   dstlen = dstend - dst;
@@ -416,10 +585,17 @@ write_message(char *dst, char *const dstend, const char *src,
     srclen = dstlen;
   }
 
-  /* Write frame header. */
+  if (d && WSDeflate(d)) {
+    /* Compress channel and text together, past the room for the largest
+     * header; it's moved up once the header's written. */
+    zlen = mccp_ws_deflate(d, channel, src, srclen, start + 10,
+                           dstend - start - 10);
+  }
+
+  /* Write frame header. RSV1 marks a compressed message. */
   op = WS_OP_TEXT;
-  dstlen = 1 + srclen;
-  *dst++ = 0x80 | op;
+  dstlen = zlen < 0 ? 1 + srclen : (size_t) zlen;
+  *dst++ = (zlen < 0 ? 0x80 : 0xC0) | op;
 
   if (dstlen < 126) {
     *dst++ = dstlen;
@@ -439,6 +615,11 @@ write_message(char *dst, char *const dstend, const char *src,
     }
   }
 
+  if (zlen >= 0) {
+    memmove(dst, start + 10, zlen);
+    return dst + zlen;
+  }
+
   /* Write frame payload. Note server doesn't mask. */
   if (op == WS_OP_TEXT) {
     *dst++ = channel;
@@ -450,8 +631,26 @@ write_message(char *dst, char *const dstend, const char *src,
   return dst;
 }
 
+/** Queue a close frame, past the output limit, ending the connection
+ * from the server's side. Control frames are never compressed.
+ * \param d the descriptor.
+ * \param status the close status.
+ */
+void
+queue_websocket_close(DESC *d, int status)
+{
+  char frame[4];
+
+  frame[0] = 0x80 | WS_OP_CLOSE;
+  frame[1] = 2;
+  frame[2] = (status >> 8) & 0xFF;
+  frame[3] = status & 0xFF;
+  add_to_queue(&d->output, frame, sizeof frame);
+  d->output_size += sizeof frame;
+}
+
 void
-to_websocket_frame(const char **bp, int *np, char channel)
+to_websocket_frame(DESC *d, const char **bp, int *np, char channel)
 {
   /* TODO: Not sure what the largest possible buffer is yet. */
   static char buf[4 * BUFFER_LEN];
@@ -478,7 +677,8 @@ to_websocket_frame(const char **bp, int *np, char channel)
         }
 
         if (!suppress && start != end) {
-          dst = write_message(dst, dstend, start, end, WEBSOCKET_CHANNEL_TEXT);
+          dst = write_message(d, dst, dstend, start, end,
+                              WEBSOCKET_CHANNEL_TEXT);
         }
 
         tag = end + 1;
@@ -516,7 +716,7 @@ to_websocket_frame(const char **bp, int *np, char channel)
 
           default:
             /* Unencoded tag. */
-            dst = write_message(dst, dstend, tag, end, channel);
+            dst = write_message(d, dst, dstend, tag, end, channel);
             break;
           }
 
@@ -530,11 +730,12 @@ to_websocket_frame(const char **bp, int *np, char channel)
 
     /* Send tail. */
     if (!suppress && start != end && !tag) {
-      dst = write_message(dst, dstend, start, end, WEBSOCKET_CHANNEL_TEXT);
+      dst =
+        write_message(d, dst, dstend, start, end, WEBSOCKET_CHANNEL_TEXT);
     }
   } else {
     /* Send entire buffer on specified channel. */
-    dst = write_message(dst, dstend, *bp, *bp + *np, channel);
+    dst = write_message(d, dst, dstend, *bp, *bp + *np, channel);
   }
 
   /* Replace old arguments. */
@@ -639,8 +840,8 @@ send_websocket_object(DESC *d, const char *header, cJSON *data)
   }
 
   if (!error) {
+    /* Sent with the rest of this pass's output, by process_output(). */
     queue_newwrite(d, buff, strlen(buff));
-    process_output(d);
     return;
   }
 }
@@ -685,3 +886,88 @@ FUNCTION(fun_websocket_html)
   do_fun_markup_websocket(buff, bp, nargs, args, arglens, executor,
                           WEBSOCKET_CHANNEL_HTML);
 }
+
+TEST_GROUP(websocket)
+{
+  DESC d;
+  const char *b;
+  int n;
+
+  TEST("websocket.1",
+       deflate_offered(" permessage-deflate; client_max_window_bits"));
+  TEST("websocket.2",
+       deflate_offered("x-webkit-deflate-frame, permessage-deflate"));
+  TEST("websocket.3",
+       !deflate_offered("permessage-deflate; server_no_context_takeover") &&
+         !deflate_offered("permessage-deflate-x") && !deflate_offered(""));
+
+  memset(&d, 0, sizeof d);
+  d.conn_flags = CONN_WEBSOCKETS;
+  b = "hello";
+  n = 5;
+  to_websocket_frame(&d, &b, &n, WEBSOCKET_CHANNEL_TEXT);
+  TEST("websocket.4", n == 8 && !memcmp(b, "\x81\x06thello", 8));
+
+#ifdef HAVE_LIBZ
+  {
+    static const char *const TEXT =
+      "Guest has connected. The room is quiet. Guest has connected.";
+    char zbuf[BUFFER_LEN], out[BUFFER_LEN];
+    const char *in;
+    z_stream z;
+    int len[2], ii, inlen, got, ok = 1;
+
+    TEST("websocket.5", mccp_start_websocket(&d) && WSDeflate(&d));
+
+    /* What a browser would read back, with context carried over. */
+    memset(&z, 0, sizeof z);
+    inflateInit2(&z, -MAX_WBITS);
+    for (ii = 0; ii < 2; ++ii) {
+      b = TEXT;
+      n = strlen(TEXT);
+      to_websocket_frame(&d, &b, &n, WEBSOCKET_CHANNEL_TEXT);
+      len[ii] = n - 2;
+      ok = ok && n < 126 && (unsigned char) b[0] == 0xC1 && b[1] == len[ii];
+      memcpy(zbuf, b + 2, len[ii]);
+      memcpy(zbuf + len[ii], WEBSOCKET_DEFLATE_TAIL, 4);
+      z.next_in = (Bytef *) zbuf;
+      z.avail_in = len[ii] + 4;
+      z.next_out = (Bytef *) out;
+      z.avail_out = sizeof out;
+      ok = ok && inflate(&z, Z_SYNC_FLUSH) == Z_OK;
+      ok = ok && (char *) z.next_out - out == (int) strlen(TEXT) + 1 &&
+           out[0] == WEBSOCKET_CHANNEL_TEXT && !memcmp(out + 1, TEXT, strlen(TEXT));
+    }
+    inflateEnd(&z);
+    TEST("websocket.6", ok && len[1] < len[0] / 2);
+
+    /* And what a browser would send. */
+    memset(&z, 0, sizeof z);
+    deflateInit2(&z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8,
+                 Z_DEFAULT_STRATEGY);
+    z.next_in = (Bytef *) "tlook";
+    z.avail_in = 5;
+    z.next_out = (Bytef *) zbuf;
+    z.avail_out = sizeof zbuf;
+    deflate(&z, Z_SYNC_FLUSH);
+    inlen = sizeof zbuf - z.avail_out;
+    deflateEnd(&z);
+    in = zbuf;
+    got = mccp_ws_inflate(&d, &in, &inlen, out, sizeof out);
+    TEST("websocket.7", got == 5 && !memcmp(out, "tlook", 5) && !inlen);
+
+    /* Output past the limit can't be flushed without breaking the
+     * stream, so the connection is closed instead. */
+    d.source = CS_OPENSSL_SOCKET;
+    d.output_size = MAX_OUTPUT;
+    queue_newwrite_channel(&d, TEXT, strlen(TEXT), WEBSOCKET_CHANNEL_TEXT);
+    TEST("websocket.8", (d.conn_flags & CONN_SHUTDOWN) && d.output.head &&
+                          d.output.head == d.output.tail &&
+                          d.output.head->nchars == 4 &&
+                          !memcmp(d.output.head->start, "\x88\x02\x03\xf1", 4));
+    freeqs(&d);
+
+    mccp_free(&d);
+  }
+#endif
+}
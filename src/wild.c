@@ -36,8 +36,10 @@
 #include "memcheck.h"
 #include "mymalloc.h"
 #include "mypcre.h"
+#include "notify.h"
 #include "parse.h"
 #include "strutil.h"
+#include "tests.h"
 
 /** Force a char to be lowercase */
 #define FIXCASE(a) (DOWNCASE(a))
@@ -425,6 +427,242 @@ wild_match_case_r(const char *restrict s, const char *restrict d, bool cs,
   return 0;
 }
 
+/* Cache of compiled regexps, keyed by their text and compile flags.
+ * Cached patterns are JIT compiled, and each keeps a match data block that
+ * is lent out with it to one borrower at a time. Since the pattern text is
+ * the key, nothing ever goes stale; unused patterns just age out. */
+struct re_cache_entry {
+  unsigned int hash;            /**< Hash of the pattern and flags */
+  uint32_t flags;               /**< Compile flags */
+  int refs;                     /**< Borrowers, plus one while cached */
+  bool md_lent;                 /**< Is md out on loan? */
+  pcre2_code *re;               /**< The compiled pattern */
+  pcre2_match_data *md;         /**< Match data lent with re */
+  struct re_cache_entry *next;  /**< Next entry in the hash chain */
+  struct re_cache_entry *newer; /**< Next more recently used entry */
+  struct re_cache_entry *older; /**< Next less recently used entry */
+  PCRE2_SIZE len;               /**< Length of pattern */
+  char pattern[];               /**< The pattern text */
+};
+
+static struct re_cache_entry **re_cache_buckets = NULL;
+static unsigned int re_cache_mask = 0;
+static int re_cache_alloced = 0; /**< regexp_cache_size it was built for */
+static int re_cache_used = 0;
+static struct re_cache_entry *re_cache_newest = NULL;
+static struct re_cache_entry *re_cache_oldest = NULL;
+static unsigned long re_cache_hits = 0;
+static unsigned long re_cache_misses = 0;
+static unsigned long re_cache_evictions = 0;
+
+static unsigned int
+re_cache_hash(const char *pattern, PCRE2_SIZE len, uint32_t flags)
+{
+  unsigned int h = 2166136261U; /* FNV-1a */
+  PCRE2_SIZE i;
+
+  for (i = 0; i < len; i++)
+    h = (h ^ (unsigned char) pattern[i]) * 16777619U;
+  h = (h ^ flags) * 16777619U;
+  return h;
+}
+
+static void
+re_cache_release(struct re_cache_entry *e)
+{
+  if (--e->refs > 0)
+    return;
+  pcre2_code_free(e->re);
+  if (e->md)
+    pcre2_match_data_free(e->md);
+  DEL_CHECK("pcre");
+  mush_free(e, "regexp_cache.entry");
+}
+
+static void
+re_cache_unlink(struct re_cache_entry *e)
+{
+  struct re_cache_entry **pp;
+
+  for (pp = &re_cache_buckets[e->hash & re_cache_mask]; *pp != e;
+       pp = &(*pp)->next)
+    ;
+  *pp = e->next;
+  if (e->newer)
+    e->newer->older = e->older;
+  else
+    re_cache_newest = e->older;
+  if (e->older)
+    e->older->newer = e->newer;
+  else
+    re_cache_oldest = e->newer;
+  re_cache_used--;
+  re_cache_release(e);
+}
+
+static void
+re_cache_push(struct re_cache_entry *e)
+{
+  e->newer = NULL;
+  e->older = re_cache_newest;
+  if (re_cache_newest)
+    re_cache_newest->newer = e;
+  else
+    re_cache_oldest = e;
+  re_cache_newest = e;
+}
+
+static void
+re_cache_resize(void)
+{
+  unsigned int buckets;
+
+  while (re_cache_oldest)
+    re_cache_unlink(re_cache_oldest);
+  if (re_cache_buckets)
+    mush_free(re_cache_buckets, "regexp_cache.buckets");
+  re_cache_buckets = NULL;
+  re_cache_alloced = REGEXP_CACHE_SIZE;
+  if (REGEXP_CACHE_SIZE <= 0)
+    return;
+  for (buckets = 16; buckets < (unsigned int) REGEXP_CACHE_SIZE * 2;
+       buckets <<= 1)
+    ;
+  re_cache_buckets =
+    mush_calloc(buckets, sizeof *re_cache_buckets, "regexp_cache.buckets");
+  re_cache_mask = buckets - 1;
+}
+
+/** Borrow a compiled regexp from the regexp cache, compiling it if needed.
+ * The pattern and match data handed back belong to the cache; give them
+ * back with re_cache_put() when done, even if the caller recurses into
+ * the parser in between. Nested borrowers of the same pattern get their
+ * own match data.
+ * \param cre where to store the compiled pattern and match data.
+ * \param pattern the regexp.
+ * \param len length of pattern, or PCRE2_ZERO_TERMINATED.
+ * \param flags pcre2 compile flags.
+ * \param errcode where to store the pcre2 error code on failure.
+ * \retval true the pattern compiled.
+ * \retval false it didn't; cre is empty.
+ */
+bool
+re_cache_get(struct cached_regexp *cre, const char *pattern, PCRE2_SIZE len,
+             uint32_t flags, int *errcode)
+{
+  struct re_cache_entry *e = NULL;
+  pcre2_code *re;
+  PCRE2_SIZE erroffset;
+  unsigned int h;
+
+  cre->re = NULL;
+  cre->md = NULL;
+  cre->entry = NULL;
+  if (len == PCRE2_ZERO_TERMINATED)
+    len = strlen(pattern);
+  if (re_cache_alloced != REGEXP_CACHE_SIZE)
+    re_cache_resize();
+  h = re_cache_hash(pattern, len, flags);
+  if (re_cache_buckets) {
+    for (e = re_cache_buckets[h & re_cache_mask]; e; e = e->next)
+      if (e->hash == h && e->len == len && e->flags == flags &&
+          !memcmp(e->pattern, pattern, len))
+        break;
+  }
+
+  if (e) {
+    re_cache_hits++;
+    if (e != re_cache_newest) {
+      e->newer->older = e->older;
+      if (e->older)
+        e->older->newer = e->newer;
+      else
+        re_cache_oldest = e->newer;
+      re_cache_push(e);
+    }
+  } else {
+    re_cache_misses++;
+    if ((re = pcre2_compile((const PCRE2_UCHAR *) pattern, len, flags,
+                            errcode, &erroffset, re_compile_ctx)) == NULL)
+      return false;
+    ADD_CHECK("pcre");
+    e = mush_malloc(sizeof *e + len + 1, "regexp_cache.entry");
+    e->hash = h;
+    e->flags = flags;
+    e->refs = 0;
+    e->md_lent = 0;
+    e->re = re;
+    e->md = NULL;
+    e->next = e->newer = e->older = NULL;
+    e->len = len;
+    memcpy(e->pattern, pattern, len);
+    e->pattern[len] = '\0';
+    if (re_cache_buckets) {
+      /* It's going to be used again, so it's worth JITting */
+      if (re_cache_used >= REGEXP_CACHE_SIZE) {
+        re_cache_unlink(re_cache_oldest);
+        re_cache_evictions++;
+      }
+      pcre2_jit_compile(re, PCRE2_JIT_COMPLETE);
+      e->next = re_cache_buckets[h & re_cache_mask];
+      re_cache_buckets[h & re_cache_mask] = e;
+      re_cache_push(e);
+      re_cache_used++;
+      e->refs = 1;
+    }
+  }
+
+  e->refs++;
+  cre->entry = e;
+  cre->re = e->re;
+  if (!e->md_lent) {
+    if (!e->md)
+      e->md = pcre2_match_data_create_from_pattern(e->re, NULL);
+    e->md_lent = 1;
+    cre->md = e->md;
+  } else {
+    cre->md = pcre2_match_data_create_from_pattern(e->re, NULL);
+  }
+  return true;
+}
+
+/** Give back a regexp borrowed with re_cache_get().
+ * \param cre the borrowed regexp. It's emptied.
+ */
+void
+re_cache_put(struct cached_regexp *cre)
+{
+  struct re_cache_entry *e = cre->entry;
+
+  if (!e)
+    return;
+  if (cre->md == e->md)
+    e->md_lent = 0;
+  else
+    pcre2_match_data_free(cre->md);
+  cre->re = NULL;
+  cre->md = NULL;
+  cre->entry = NULL;
+  re_cache_release(e);
+}
+
+/** Report regexp cache statistics.
+ * \param player the player to display it to.
+ */
+void
+regexp_cache_stats(dbref player)
+{
+  unsigned long lookups = re_cache_hits + re_cache_misses;
+
+  notify_format(player, "Regexps:   %10d compiled  (%10d max)", re_cache_used,
+                REGEXP_CACHE_SIZE);
+  notify_format(player,
+                "           %10lu hits      (%10lu misses, %3lu%% hit rate)",
+                re_cache_hits, re_cache_misses,
+                lookups ? re_cache_hits * 100 / lookups : 0);
+  notify_format(player, "           %10lu evicted", re_cache_evictions);
+}
+
 /** Regexp match, possibly case-sensitive, and remember matched subexpressions.
  *
  * This routine will cause crashes if fed NULLs instead of strings.
@@ -446,13 +684,13 @@ regexp_match_case_r(const char *restrict s, const char *restrict val, bool cs,
                     char **matches, size_t nmatches, char *data, ssize_t len,
                     PE_REGS *pe_regs, int pe_reg_flags)
 {
+  struct cached_regexp cre;
   pcre2_code *re;
   size_t i;
   int errcode;
   ansi_string *as = NULL;
   const char *d;
   size_t delenn;
-  PCRE2_SIZE erroffset;
   pcre2_match_data *md;
   int subpatterns;
   int totallen = 0;
@@ -461,9 +699,8 @@ regexp_match_case_r(const char *restrict s, const char *restrict val, bool cs,
     matches[i] = NULL;
   }
 
-  if ((re = pcre2_compile((const PCRE2_UCHAR *) s, PCRE2_ZERO_TERMINATED,
-                          (cs ? 0 : PCRE2_CASELESS) | re_compile_flags,
-                          &errcode, &erroffset, re_compile_ctx)) == NULL) {
+  if (!re_cache_get(&cre, s, PCRE2_ZERO_TERMINATED,
+                    (cs ? 0 : PCRE2_CASELESS) | re_compile_flags, &errcode)) {
     /*
      * This is a matching error. We have an error message in
      * errptr that we can ignore, since we're doing
@@ -471,7 +708,8 @@ regexp_match_case_r(const char *restrict s, const char *restrict val, bool cs,
      */
     return 0;
   }
-  ADD_CHECK("pcre");
+  re = cre.re;
+  md = cre.md;
 
   /* The ansi string */
   if (has_markup(val)) {
@@ -487,15 +725,12 @@ regexp_match_case_r(const char *restrict s, const char *restrict val, bool cs,
    * Now we try to match the pattern. The relevant fields will
    * automatically be filled in by this.
    */
-  md = pcre2_match_data_create_from_pattern(re, NULL);
   if ((subpatterns = pcre2_match(re, (const PCRE2_UCHAR *) d, delenn, 0,
                                  re_match_flags, md, re_match_ctx)) < 0) {
     if (as) {
       free_ansi_string(as);
     }
-    pcre2_code_free(re);
-    pcre2_match_data_free(md);
-    DEL_CHECK("pcre");
+    re_cache_put(&cre);
     return 0;
   }
 
@@ -543,9 +778,7 @@ regexp_match_case_r(const char *restrict s, const char *restrict val, bool cs,
   if (as) {
     free_ansi_string(as);
   }
-  pcre2_code_free(re);
-  pcre2_match_data_free(md);
-  DEL_CHECK("pcre");
+  re_cache_put(&cre);
   return 1;
 }
 
@@ -564,12 +797,10 @@ bool
 quick_regexp_match(const char *restrict s, const char *restrict d, bool cs,
                    const char **report_err)
 {
-  pcre2_code *re;
+  struct cached_regexp cre;
   const char *sptr;
   size_t slen;
   int errcode;
-  PCRE2_SIZE erroffset;
-  pcre2_match_data *md;
   int r;
   int flags =
     re_compile_flags; /* There's a PCRE_NO_AUTO_CAPTURE flag to turn all raw
@@ -585,8 +816,7 @@ quick_regexp_match(const char *restrict s, const char *restrict d, bool cs,
     *report_err = NULL;
   }
 
-  if ((re = pcre2_compile((const PCRE2_UCHAR *) s, PCRE2_ZERO_TERMINATED, flags,
-                          &errcode, &erroffset, re_compile_ctx)) == NULL) {
+  if (!re_cache_get(&cre, s, PCRE2_ZERO_TERMINATED, flags, &errcode)) {
     /*
      * This is a matching error. We have an error message in
      * errptr that we can ignore, since we're doing
@@ -599,19 +829,15 @@ quick_regexp_match(const char *restrict s, const char *restrict d, bool cs,
     }
     return 0;
   }
-  ADD_CHECK("pcre");
   sptr = remove_markup(d, &slen);
 
   /*
    * Now we try to match the pattern. The relevant fields will
    * automatically be filled in by this.
    */
-  md = pcre2_match_data_create_from_pattern(re, NULL);
-  r = pcre2_match(re, (const PCRE2_UCHAR *) sptr, slen - 1, 0, re_match_flags,
-                  md, re_match_ctx);
-  pcre2_code_free(re);
-  pcre2_match_data_free(md);
-  DEL_CHECK("pcre");
+  r = pcre2_match(cre.re, (const PCRE2_UCHAR *) sptr, slen - 1, 0,
+                  re_match_flags, cre.md, re_match_ctx);
+  re_cache_put(&cre);
 
   return r >= 0;
 }
@@ -750,3 +976,104 @@ wildcard_count(char *s, bool unescape)
     return 0;
   }
 }
+
+#define RE_CACHE_BENCH_PATTERN "^(\\w+)-(\\d+)\\s+is\\s+(?:here|there)$"
+
+TEST_GROUP(regexp_cache)
+{
+  struct cached_regexp a, b, c, d;
+  int errcode, size, i, n;
+  bool ok;
+
+  if (!REGEXP_CACHE_SIZE)
+    return;
+  size = REGEXP_CACHE_SIZE;
+
+  TEST("regexp_cache.1",
+       re_cache_get(&a, "^a(b+)c$", PCRE2_ZERO_TERMINATED, re_compile_flags,
+                    &errcode));
+  re_cache_put(&a);
+  TEST("regexp_cache.2", a.re == NULL && a.md == NULL);
+  n = re_cache_hits;
+  re_cache_get(&a, "^a(b+)c$", PCRE2_ZERO_TERMINATED, re_compile_flags,
+               &errcode);
+  TEST("regexp_cache.3", (int) re_cache_hits == n + 1);
+
+  /* Someone nested using the same pattern gets their own match data */
+  re_cache_get(&b, "^a(b+)c$", PCRE2_ZERO_TERMINATED, re_compile_flags,
+               &errcode);
+  TEST("regexp_cache.4", a.re == b.re && a.md != b.md);
+  pcre2_match(a.re, (const PCRE2_UCHAR *) "abbc", 4, 0, 0, a.md, re_match_ctx);
+  pcre2_match(b.re, (const PCRE2_UCHAR *) "abc", 3, 0, 0, b.md, re_match_ctx);
+  TEST("regexp_cache.5", pcre2_get_ovector_pointer(a.md)[3] == 3 &&
+                           pcre2_get_ovector_pointer(b.md)[3] == 2);
+  re_cache_put(&b);
+
+  /* Flags are part of the key */
+  re_cache_get(&c, "^a(b+)c$", PCRE2_ZERO_TERMINATED,
+               re_compile_flags | PCRE2_CASELESS, &errcode);
+  TEST("regexp_cache.6", c.re != a.re);
+  re_cache_put(&c);
+
+  /* Entries evicted while they're borrowed stay usable */
+  options.regexp_cache_size = 2;
+  re_cache_put(&a);
+  re_cache_get(&a, "^x+$", PCRE2_ZERO_TERMINATED, re_compile_flags, &errcode);
+  for (i = 0; i < 5; i++) {
+    char pat[20];
+    snprintf(pat, sizeof pat, "^evict%d$", i);
+    re_cache_get(&d, pat, PCRE2_ZERO_TERMINATED, re_compile_flags, &errcode);
+    re_cache_put(&d);
+  }
+  TEST("regexp_cache.7",
+       re_cache_used <= 2 && qcomp_regexp_match(a.re, a.md, "xxx", 3) &&
+         !qcomp_regexp_match(a.re, a.md, "xyx", 3));
+  re_cache_put(&a);
+
+  TEST("regexp_cache.8",
+       !re_cache_get(&a, "(unclosed", PCRE2_ZERO_TERMINATED, re_compile_flags,
+                     &errcode) &&
+         errcode == PCRE2_ERROR_MISSING_CLOSING_PARENTHESIS && !a.re);
+  TEST("regexp_cache.9", quick_regexp_match("^AB?c", "abc", 0, NULL) &&
+                           !quick_regexp_match("^AB?c", "abc", 1, NULL));
+
+  /* Turning the cache off and on again still matches */
+  options.regexp_cache_size = 0;
+  for (n = 0, ok = 1; n < 3; n++)
+    ok &= quick_regexp_match(RE_CACHE_BENCH_PATTERN, "widget-42 is there", 1,
+                             NULL);
+  options.regexp_cache_size = size;
+  for (n = 0; n < 3; n++)
+    ok &= quick_regexp_match(RE_CACHE_BENCH_PATTERN, "widget-42 is there", 1,
+                             NULL);
+  TEST("regexp_cache.10", ok && re_cache_alloced == size);
+}
+
+BENCHMARK(regexp_cache)
+{
+  struct timeval start, end;
+  double fresh_ms, cached_ms;
+  int size = REGEXP_CACHE_SIZE, n;
+  bool ok = 1;
+
+  options.regexp_cache_size = 0;
+  penn_gettimeofday(&start);
+  for (n = 0; n < 20000; n++)
+    ok &= quick_regexp_match(RE_CACHE_BENCH_PATTERN, "widget-42 is there", 1,
+                             NULL);
+  penn_gettimeofday(&end);
+  fresh_ms = (end.tv_sec - start.tv_sec) * 1000.0 +
+             (end.tv_usec - start.tv_usec) / 1000.0;
+  options.regexp_cache_size = size;
+  penn_gettimeofday(&start);
+  for (n = 0; n < 20000; n++)
+    ok &= quick_regexp_match(RE_CACHE_BENCH_PATTERN, "widget-42 is there", 1,
+                             NULL);
+  penn_gettimeofday(&end);
+  cached_ms = (end.tv_sec - start.tv_sec) * 1000.0 +
+              (end.tv_usec - start.tv_usec) / 1000.0;
+  do_rawlog(LT_TRACE,
+            "regexp_cache: 20000 matches took %.1fms compiling each time, "
+            "%.1fms cached%s",
+            fresh_ms, cached_ms, ok ? "" : " (match failed!)");
+}
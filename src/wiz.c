@@ -47,7 +47,9 @@
 #include "mushdb.h"
 #include "mymalloc.h"
 #include "parse.h"
+#include "sort.h"
 #include "strutil.h"
+#include "tests.h"
 #include "mushsql.h"
 
 dbref find_entrance(dbref door);
@@ -2485,6 +2487,268 @@ fill_search_spec(dbref player, const char *owner, int nargs, const char **args,
   return 0;
 }
 
+/* Secondary indexes for searches. Every object is filed under its owner,
+ * zone, parent and type, in unsorted member arrays, so a search limited by
+ * one of those only has to look at the objects filed there. Changing one
+ * of them just marks the object with search_index_touch(); it's refiled
+ * the next time something searches. Objects at or above si_top haven't
+ * been filed at all yet. */
+enum search_index_kind { SI_OWNER, SI_ZONE, SI_PARENT, SI_TYPE, SI_KINDS };
+
+#define SI_NTYPES 5 /**< Number of keys in the type index */
+
+/** The objects filed under one key of an index */
+struct search_index_set {
+  dbref *members; /**< Unsorted */
+  int count;      /**< Number of members */
+  int max;        /**< Allocated size of members */
+};
+
+static struct search_index_set *si_sets[SI_KINDS]; /**< Sets, by key */
+static int *si_key[SI_KINDS]; /**< Key each object is filed under, or -1 */
+static int *si_pos[SI_KINDS]; /**< Where in that set it's filed */
+static char *si_dirty;        /**< Is the object in si_touched? */
+static dbref *si_touched = NULL;
+static int si_ntouched = 0;
+static int si_maxtouched = 0;
+static dbref si_top = 0;     /**< Objects below this have been filed */
+static dbref si_alloced = 0; /**< Size of the per-object arrays */
+
+static int
+si_current_key(enum search_index_kind kind, dbref thing)
+{
+  dbref key;
+
+  switch (kind) {
+  case SI_OWNER:
+    key = Owner(thing);
+    break;
+  case SI_ZONE:
+    key = Zone(thing);
+    break;
+  case SI_PARENT:
+    key = Parent(thing);
+    break;
+  default:
+    switch (Typeof(thing)) {
+    case TYPE_ROOM:
+      return 0;
+    case TYPE_THING:
+      return 1;
+    case TYPE_EXIT:
+      return 2;
+    case TYPE_PLAYER:
+      return 3;
+    case TYPE_GARBAGE:
+      return 4;
+    default:
+      return -1;
+    }
+  }
+  return GoodObject(key) ? key : -1;
+}
+
+static void
+si_grow(dbref top)
+{
+  dbref size = si_alloced ? si_alloced : 1024;
+  int kind;
+  dbref n;
+
+  while (size < top)
+    size *= 2;
+  for (kind = 0; kind < SI_KINDS; kind++) {
+    si_key[kind] = mush_realloc(si_key[kind], size * sizeof(int),
+                                "search_index.keys");
+    si_pos[kind] = mush_realloc(si_pos[kind], size * sizeof(int),
+                                "search_index.keys");
+    for (n = si_alloced; n < size; n++)
+      si_key[kind][n] = -1;
+    if (kind == SI_TYPE) {
+      if (!si_sets[kind])
+        si_sets[kind] = mush_calloc(SI_NTYPES, sizeof(struct search_index_set),
+                                    "search_index.sets");
+      continue;
+    }
+    si_sets[kind] =
+      mush_realloc(si_sets[kind], size * sizeof(struct search_index_set),
+                   "search_index.sets");
+    memset(si_sets[kind] + si_alloced, 0,
+           (size - si_alloced) * sizeof(struct search_index_set));
+  }
+  si_dirty = mush_realloc(si_dirty, size, "search_index.dirty");
+  memset(si_dirty + si_alloced, 0, size - si_alloced);
+  si_alloced = size;
+}
+
+static void
+si_remove(enum search_index_kind kind, dbref thing)
+{
+  struct search_index_set *set;
+  int key = si_key[kind][thing];
+  int pos = si_pos[kind][thing];
+  dbref last;
+
+  if (key < 0)
+    return;
+  set = &si_sets[kind][key];
+  last = set->members[--set->count];
+  set->members[pos] = last;
+  si_pos[kind][last] = pos;
+  si_key[kind][thing] = -1;
+  if (!set->count) {
+    mush_free(set->members, "search_index.members");
+    set->members = NULL;
+    set->max = 0;
+  }
+}
+
+static void
+si_add(enum search_index_kind kind, dbref thing, int key)
+{
+  struct search_index_set *set;
+
+  if (key < 0)
+    return;
+  set = &si_sets[kind][key];
+  if (set->count >= set->max) {
+    set->max = set->max ? set->max * 2 : 8;
+    set->members = mush_realloc(set->members, set->max * sizeof(dbref),
+                                "search_index.members");
+  }
+  si_pos[kind][thing] = set->count;
+  set->members[set->count++] = thing;
+  si_key[kind][thing] = key;
+}
+
+static void
+si_file(dbref thing)
+{
+  int kind, key;
+
+  for (kind = 0; kind < SI_KINDS; kind++) {
+    key = si_current_key(kind, thing);
+    if (key != si_key[kind][thing]) {
+      si_remove(kind, thing);
+      si_add(kind, thing, key);
+    }
+  }
+}
+
+/* Refile everything that's changed since the last search. */
+static void
+si_update(void)
+{
+  int i;
+
+  if (si_alloced < db_top)
+    si_grow(db_top);
+  for (i = 0; i < si_ntouched; i++) {
+    si_dirty[si_touched[i]] = 0;
+    si_file(si_touched[i]);
+  }
+  si_ntouched = 0;
+  for (; si_top < db_top; si_top++)
+    si_file(si_top);
+}
+
+/** Note that an object's owner, zone, parent or type may have changed,
+ * so the search indexes need to refile it. Objects made by new_object()
+ * or read from a database don't need this.
+ * \param thing the object.
+ */
+void
+search_index_touch(dbref thing)
+{
+  if (thing < 0 || thing >= si_top || si_dirty[thing])
+    return;
+  if (si_ntouched >= si_maxtouched) {
+    si_maxtouched = si_maxtouched ? si_maxtouched * 2 : 64;
+    si_touched = mush_realloc(si_touched, si_maxtouched * sizeof(dbref),
+                              "search_index.touched");
+  }
+  si_dirty[thing] = 1;
+  si_touched[si_ntouched++] = thing;
+}
+
+/** Throw away the search indexes, for when the whole database is. */
+void
+search_index_reset(void)
+{
+  int kind;
+  dbref n;
+
+  for (kind = 0; kind < SI_KINDS; kind++) {
+    if (si_sets[kind]) {
+      for (n = 0; n < (kind == SI_TYPE ? SI_NTYPES : si_alloced); n++)
+        if (si_sets[kind][n].members)
+          mush_free(si_sets[kind][n].members, "search_index.members");
+      mush_free(si_sets[kind], "search_index.sets");
+      mush_free(si_key[kind], "search_index.keys");
+      mush_free(si_pos[kind], "search_index.keys");
+    }
+    si_sets[kind] = NULL;
+    si_key[kind] = si_pos[kind] = NULL;
+  }
+  if (si_dirty)
+    mush_free(si_dirty, "search_index.dirty");
+  if (si_touched)
+    mush_free(si_touched, "search_index.touched");
+  si_dirty = NULL;
+  si_touched = NULL;
+  si_ntouched = si_maxtouched = 0;
+  si_top = si_alloced = 0;
+}
+
+/* Find the objects a search has to look at: the smallest index set that
+ * all its matches must be in, in dbref order. Returns NULL if it's
+ * cheaper to look at everything from spec->low to spec->high. */
+static dbref *
+search_candidates(struct search_spec *spec, int *ncands)
+{
+  struct search_index_set *best = NULL, *set;
+  int limit = spec->high - spec->low + 1;
+  dbref *cands;
+  int i, n;
+
+  si_update();
+  if (GoodObject(spec->owner)) {
+    set = &si_sets[SI_OWNER][spec->owner];
+    if (set->count < limit)
+      best = set, limit = set->count;
+  }
+  if (GoodObject(spec->zone)) {
+    set = &si_sets[SI_ZONE][spec->zone];
+    if (set->count < limit)
+      best = set, limit = set->count;
+  }
+  if (GoodObject(spec->parent)) {
+    set = &si_sets[SI_PARENT][spec->parent];
+    if (set->count < limit)
+      best = set, limit = set->count;
+  }
+  if (spec->type != NOTYPE) {
+    for (i = 0; i < SI_NTYPES; i++)
+      if (spec->type == (1U << i))
+        break;
+    if (i < SI_NTYPES) {
+      set = &si_sets[SI_TYPE][i];
+      if (set->count < limit)
+        best = set, limit = set->count;
+    }
+  }
+  if (!best)
+    return NULL;
+
+  cands = mush_calloc(best->count + 1, sizeof(dbref), "search_index.cands");
+  for (i = n = 0; i < best->count; i++)
+    if (best->members[i] >= spec->low && best->members[i] <= spec->high)
+      cands[n++] = best->members[i];
+  qsort(cands, n, sizeof(dbref), dbref_comp);
+  *ncands = n;
+  return cands;
+}
+
 /* Does the actual searching */
 static int
 raw_search(dbref player, struct search_spec *spec, dbref **result,
@@ -2492,7 +2756,8 @@ raw_search(dbref player, struct search_spec *spec, dbref **result,
 {
   size_t result_size;
   size_t nresults = 0;
-  int n;
+  dbref *cands;
+  int i, n, ncands = 0;
   int is_wiz;
   int count = 0;
   int ret = 0;
@@ -2539,7 +2804,9 @@ raw_search(dbref player, struct search_spec *spec, dbref **result,
   }
   if (spec->high >= db_top)
     spec->high = db_top - 1;
-  for (n = spec->low; n <= spec->high && n < db_top; n++) {
+  cands = search_candidates(spec, &ncands);
+  for (i = 0; cands ? i < ncands : spec->low + i <= spec->high; i++) {
+    n = cands ? cands[i] : spec->low + i;
     if (IsGarbage(n) && spec->type != TYPE_GARBAGE)
       continue;
     if (spec->owner != ANY_OWNER && Owner(n) != spec->owner)
@@ -2635,7 +2902,221 @@ raw_search(dbref player, struct search_spec *spec, dbref **result,
   }
 
 exit_sequence:
+  if (cands)
+    mush_free(cands, "search_index.cands");
   if (spec->lock != TRUE_BOOLEXP)
     free_boolexp(spec->lock);
   return (int) nresults;
 }
+
+#ifndef WIN32
+/* Big enough that the range search still uses the parent index */
+#define SEARCH_TEST_OBJECTS 400
+#define SEARCH_TEST_STEP 5
+#define SEARCH_BENCH_OBJECTS 20000
+#define SEARCH_BENCH_STEP 50
+#define SEARCH_BENCH_PLAYERS 10
+#define SEARCH_BENCH_RUNS 200
+
+/* Size of a search index test run */
+struct search_bench_size {
+  int objects;
+  int step;
+  int runs;
+};
+
+/* Results of the search index tests, sent back from the child running
+ * them. */
+struct search_bench {
+  int owner;
+  int zone;
+  int parent;
+  int range;
+  int changed;
+  int garbage;
+  double owner_us;
+  double children_us;
+};
+
+/* Run a search, and check it finds what looking at every object does */
+static bool
+search_bench_check(struct search_spec *spec, int *found)
+{
+  dbref *results = NULL;
+  int nresults, i = 0;
+  bool ok;
+  dbref n;
+
+  nresults = raw_search(GOD, spec, &results, NULL);
+  ok = nresults >= 0;
+  for (n = spec->low; ok && n <= spec->high; n++) {
+    if (IsGarbage(n) && spec->type != TYPE_GARBAGE)
+      continue;
+    if ((spec->owner != ANY_OWNER && Owner(n) != spec->owner) ||
+        (spec->type != NOTYPE && Typeof(n) != spec->type) ||
+        (spec->zone != ANY_OWNER && Zone(n) != spec->zone) ||
+        (spec->parent != ANY_OWNER && Parent(n) != spec->parent))
+      continue;
+    ok = i < nresults && results[i++] == n;
+  }
+  ok = ok && i == nresults;
+  if (found)
+    *found = nresults;
+  if (results)
+    mush_free(results, "search_results");
+  return ok;
+}
+
+static double
+search_bench_us(struct search_spec *spec, int runs)
+{
+  struct timeval start, end;
+  dbref *results;
+  int i;
+
+  if (!runs)
+    return 0;
+  penn_gettimeofday(&start);
+  for (i = 0; i < runs; i++) {
+    results = NULL;
+    raw_search(GOD, spec, &results, NULL);
+    if (results)
+      mush_free(results, "search_results");
+  }
+  penn_gettimeofday(&end);
+  return ((end.tv_sec - start.tv_sec) * 1000000.0 +
+          (end.tv_usec - start.tv_usec)) /
+         runs;
+}
+
+/* Every step'th object has the parent, every 2 * step'th the zone, and
+ * player 0 owns every 40 * step'th. */
+static void
+search_bench_run(void *arg, void *result)
+{
+  const struct search_bench_size *size = arg;
+  struct search_bench *r = result;
+  int objects = size->objects, step = size->step, runs = size->runs;
+  struct search_spec spec;
+  dbref players[SEARCH_BENCH_PLAYERS], zone, parent, o, first = NOTHING;
+  int i, found, owned = 40 * step;
+
+  for (i = 0; i < SEARCH_BENCH_PLAYERS; i++) {
+    players[i] = new_object();
+    set_name(players[i], tprintf("Search_Bench_%d", i));
+    db[players[i]].type = TYPE_PLAYER;
+    db[players[i]].flags = string_to_bits("FLAG", "");
+    db[players[i]].powers = string_to_bits("POWER", "");
+    db[players[i]].owner = players[i];
+  }
+  zone = new_object();
+  parent = new_object();
+  for (o = zone; o <= parent; o++) {
+    set_name(o, "Search_Bench");
+    db[o].type = TYPE_THING;
+    db[o].flags = string_to_bits("FLAG", "");
+    db[o].owner = players[1];
+  }
+  /* Player 0 owns itself and a handful of objects, the rest share the
+   * others */
+  for (i = 0; i < objects; i++) {
+    o = new_object();
+    if (first == NOTHING)
+      first = o;
+    set_name(o, "Search_Bench");
+    db[o].type = (i % 3) ? TYPE_THING : TYPE_ROOM;
+    db[o].flags = string_to_bits("FLAG", "");
+    db[o].owner = (i % owned) ? players[1 + i % (SEARCH_BENCH_PLAYERS - 1)]
+                              : players[0];
+    db[o].zone = (i % (2 * step)) ? NOTHING : zone;
+    db[o].parent = (i % step == 1) ? parent : NOTHING;
+  }
+
+  init_search_spec(&spec);
+  spec.owner = players[0];
+  r->owner = search_bench_check(&spec, &found) && found == objects / owned + 1;
+  r->owner_us = search_bench_us(&spec, runs);
+  init_search_spec(&spec);
+  spec.zone = zone;
+  spec.type = TYPE_ROOM;
+  r->zone = search_bench_check(&spec, &found) && found > 0;
+  init_search_spec(&spec);
+  spec.parent = parent;
+  r->parent = search_bench_check(&spec, &found) && found == objects / step;
+  r->children_us = search_bench_us(&spec, runs);
+  init_search_spec(&spec);
+  spec.parent = parent;
+  spec.low = first + 20 * step;
+  spec.high = first + 40 * step;
+  r->range = search_bench_check(&spec, &found) && found == 20;
+
+  /* Changes are seen by the next search */
+  chown_object(GOD, first + 1, players[0], 1);
+  db[first + step + 1].parent = NOTHING;
+  search_index_touch(first + step + 1);
+  init_search_spec(&spec);
+  spec.owner = players[0];
+  r->changed =
+    search_bench_check(&spec, &found) && found == objects / owned + 2;
+  init_search_spec(&spec);
+  spec.parent = parent;
+  r->changed = r->changed && search_bench_check(&spec, &found) &&
+               found == objects / step - 1;
+
+  db[first + owned].type = TYPE_GARBAGE;
+  search_index_touch(first + owned);
+  init_search_spec(&spec);
+  spec.owner = players[0];
+  r->garbage =
+    search_bench_check(&spec, &found) && found == objects / owned + 1;
+  init_search_spec(&spec);
+  spec.type = TYPE_GARBAGE;
+  r->garbage = r->garbage && search_bench_check(&spec, NULL);
+}
+/* Run the search index tests in a child, so the objects they make go
+ * away. */
+static bool
+search_bench_fork(struct search_bench *r, int objects, int step, int runs)
+{
+  struct search_bench_size size;
+
+  size.objects = objects;
+  size.step = step;
+  size.runs = runs;
+  memset(r, 0, sizeof *r);
+  return run_in_child(search_bench_run, &size, r, sizeof *r);
+}
+#endif
+
+TEST_GROUP(search_index)
+{
+#ifndef WIN32
+  struct search_bench r;
+  bool ok;
+
+  ok = search_bench_fork(&r, SEARCH_TEST_OBJECTS, SEARCH_TEST_STEP, 0);
+  TEST("search_index.1", ok && r.owner);
+  TEST("search_index.2", r.zone);
+  TEST("search_index.3", r.parent);
+  TEST("search_index.4", r.range);
+  TEST("search_index.5", r.changed);
+  TEST("search_index.6", r.garbage);
+#endif
+}
+
+BENCHMARK(search_index)
+{
+#ifndef WIN32
+  struct search_bench r;
+
+  if (!search_bench_fork(&r, SEARCH_BENCH_OBJECTS, SEARCH_BENCH_STEP,
+                         SEARCH_BENCH_RUNS))
+    return;
+  do_rawlog(LT_TRACE,
+            "search_index: in %d objects, found a player's %d objects in "
+            "%.1fus, and %d children in %.1fus.",
+            SEARCH_BENCH_OBJECTS,
+            SEARCH_BENCH_OBJECTS / (40 * SEARCH_BENCH_STEP) + 1, r.owner_us,
+            SEARCH_BENCH_OBJECTS / SEARCH_BENCH_STEP, r.children_us);
+#endif
+}
@@ -0,0 +1,45 @@
+login mortal
+run tests:
+test('cmdmatch.setup.1', $mortal, '@create cmdobj', 'Created');
+test('cmdmatch.setup.2', $mortal, 'drop cmdobj', 'drop');
+test('cmdmatch.setup.3', $mortal, '@set cmdobj=!no_command', 'reset');
+test('cmdmatch.setup.4', $mortal, '&cmd cmdobj=$frobnicate *:@pemit %#=Frob %0.', 'Set');
+test('cmdmatch.basic.1', $mortal, 'frobnicate widget', 'Frob widget\.');
+test('cmdmatch.basic.2', $mortal, 'FROBNICATE loudly', 'Frob loudly\.');
+test('cmdmatch.basic.3', $mortal, 'frobnicat widget', 'Huh\?');
+# Rewriting the attribute replaces the old command
+test('cmdmatch.rewrite.1', $mortal, '&cmd cmdobj=$twiddle *:@pemit %#=Twiddle %0.', 'Set');
+test('cmdmatch.rewrite.2', $mortal, 'twiddle knob', 'Twiddle knob\.');
+test('cmdmatch.rewrite.3', $mortal, 'frobnicate widget', 'Huh\?');
+# Escaped colons and leading wildcards
+test('cmdmatch.escape.1', $mortal, '&cmd2 cmdobj=$time\:*:@pemit %#=Time %0.', 'Set');
+test('cmdmatch.escape.2', $mortal, 'time:now', 'Time now\.');
+test('cmdmatch.escape.3', $mortal, '&cmd3 cmdobj=$*zap:@pemit %#=Zapped %0.', 'Set');
+test('cmdmatch.escape.4', $mortal, 'big zap', 'Zapped big \.');
+# Attribute flags take effect straight away
+test('cmdmatch.flags.1', $mortal, '@set cmdobj/cmd=case', 'set');
+test('cmdmatch.flags.2', $mortal, 'TWIDDLE knob', 'Huh\?');
+test('cmdmatch.flags.3', $mortal, 'twiddle knob', 'Twiddle knob\.');
+test('cmdmatch.flags.4', $mortal, '&cmd cmdobj=$^tw(i+)ddle (.*)$:@pemit %#=Regexp %1 %2.', 'Set');
+test('cmdmatch.flags.5', $mortal, 'twiiiddle knob', 'Huh\?');
+test('cmdmatch.flags.6', $mortal, '@set cmdobj/cmd=regexp', 'set');
+test('cmdmatch.flags.7', $mortal, 'twiiiddle knob', 'Regexp iii knob\.');
+test('cmdmatch.flags.8', $mortal, '@set cmdobj/cmd=no_command', 'set');
+test('cmdmatch.flags.9', $mortal, 'twiiiddle knob', 'Huh\?');
+# Commands on parents, and changing parents
+test('cmdmatch.parent.1', $mortal, '@create cmdparent', 'Created');
+test('cmdmatch.parent.2', $mortal, '&pcmd cmdparent=$inherited:@pemit %#=From parent.', 'Set');
+test('cmdmatch.parent.3', $mortal, 'inherited', 'Huh\?');
+test('cmdmatch.parent.4', $mortal, '@parent cmdobj=cmdparent', 'Parent changed');
+test('cmdmatch.parent.5', $mortal, 'inherited', 'From parent\.');
+test('cmdmatch.parent.6', $mortal, '&pcmd cmdobj=$other:@pemit %#=Masked.', 'Set');
+test('cmdmatch.parent.7', $mortal, 'inherited', 'Huh\?');
+test('cmdmatch.parent.8', $mortal, '&pcmd cmdobj', 'Cleared');
+test('cmdmatch.parent.9', $mortal, 'inherited', 'From parent\.');
+test('cmdmatch.parent.10', $mortal, '@parent cmdobj', 'Parent changed');
+test('cmdmatch.parent.11', $mortal, 'inherited', 'Huh\?');
+# ^-listen patterns
+test('cmdmatch.listen.1', $mortal, '&lis cmdobj=^*ping*:@pemit %#=Pong.', 'Set');
+test('cmdmatch.listen.2', $mortal, '@set cmdobj=monitor', 'set');
+test('cmdmatch.listen.3', $mortal, 'say ping', 'You say');
+test('cmdmatch.listen.4', $mortal, undef, 'Pong\.');
@@ -0,0 +1,20 @@
+login mortal
+run tests:
+test('profile.perm.1', $mortal, '@profile/start', 'Permission denied');
+test('profile.perm.2', $mortal, 'think profile()', '^#-1 PERMISSION DENIED');
+test('profile.setup.1', $god, '&fn me=[add(%0,1)][strlen(abc)]', 'Set');
+test('profile.setup.2', $god, '&outer me=[u(fn,1)][u(fn,2)]', 'Set');
+test('profile.start.1', $god, '@profile/start', 'Profiler started');
+test('profile.start.2', $god, '@profile', 'has been running');
+test('profile.run.1', $god, 'think u(outer)', '^2333$');
+test('profile.run.2', $god, 'think first(profile(#1/FN))', '^2$');
+test('profile.run.3', $god, 'think first(profile(#1/OUTER))', '^1$');
+test('profile.run.4', $god, 'think first(profile(add))', '^2$');
+test('profile.run.5', $god, 'think first(profile(strlen))', '^2$');
+test('profile.run.6', $god, 'think profile(#1/NOPE)', '^#-1 NOT PROFILED');
+test('profile.run.7', $god, 'think words(profile(#1/FN))', '^6$');
+test('profile.stop.1', $god, '@profile/stop', 'Call stacks written to .*profile.folded');
+test('profile.stop.2', $god, '@profile', "isn't running");
+test('profile.stop.3', $god, '@profile/report 2', 'Calls +Total ms');
+test('profile.stop.4', $god, 'think first(profile(#1/FN))', '^2$');
+test('profile.stop.5', $god, 'think u(outer)[first(profile(#1/FN))]', '^23332$');
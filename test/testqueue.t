@@ -0,0 +1,53 @@
+login mortal
+run tests:
+test('queue.setup.1', $mortal, '&log me=', 'Set');
+# Semaphores run in the order they were queued, per attribute
+test('queue.sem.1', $mortal, '@wait me=&log me=[v(log)] one', '^$');
+test('queue.sem.2', $mortal, '@wait me/other=&log me=[v(log)] other', '^$');
+test('queue.sem.3', $mortal, '@wait me=&log me=[v(log)] two', '^$');
+test('queue.sem.4', $mortal, '@wait me=&log me=[v(log)] three', '^$');
+test('queue.sem.5', $mortal, 'think words(getpids(me))/[get(me/semaphore)]/[words(getpids(me/other))]', '^4/3/1$');
+test('queue.sem.6', $mortal, '@notify me=2', 'Notified');
+test('queue.sem.7', $mortal, 'think trim(v(log))', '^one two$');
+test('queue.sem.8', $mortal, 'think words(getpids(me))/[get(me/semaphore)]', '^2/1$');
+# @notify/any takes the oldest entry on any attribute
+test('queue.sem.9', $mortal, '@notify/any me', 'Notified');
+test('queue.sem.10', $mortal, 'think trim(v(log))', '^one two other$');
+test('queue.sem.11', $mortal, '@drain me', 'Drained');
+test('queue.sem.12', $mortal, 'think words(getpids(me))/[get(me/semaphore)]', '^0/$');
+test('queue.sem.13', $mortal, 'think trim(v(log))', '^one two other$');
+# Notifying ahead of time lets later waits through
+test('queue.sem.14', $mortal, '@notify me', 'Notified');
+test('queue.sem.15', $mortal, '@wait me=&log me=[v(log)] early', '^$');
+sleep(1);
+test('queue.sem.16', $mortal, 'think trim(v(log))', '^one two other early$');
+# Halting a waiting entry by pid
+test('queue.halt.1', $mortal, '@wait me/halted=&log me=[v(log)] halted', '^$');
+test('queue.halt.2', $mortal, '@halt/pid [getpids(me/halted)]', 'halted');
+test('queue.halt.3', $mortal, 'think words(getpids(me))/[get(me/halted)]', '^0/$');
+test('queue.halt.4', $mortal, '@notify me/halted', 'Notified');
+test('queue.halt.5', $mortal, 'think trim(v(log))', '^one two other early$');
+# Timed waits run in time order, ties in the order they were queued
+test('queue.wait.1', $mortal, '&log me=', 'Set');
+test('queue.wait.2', $mortal, '@wait 3=&log me=[v(log)] c', '^$');
+test('queue.wait.3', $mortal, '@wait 1=&log me=[v(log)] a1', '^$');
+test('queue.wait.4', $mortal, '@wait 2=&log me=[v(log)] b', '^$');
+test('queue.wait.5', $mortal, '@wait 1=&log me=[v(log)] a2', '^$');
+test('queue.wait.6', $mortal, '@ps', '(?s)Wait Queue:.* a1\s.* a2\s.* b\s.* c\s.*Semaphore Queue');
+test('queue.wait.7', $mortal, 'think words(lpids(me,wait))', '^4$');
+sleep(4);
+test('queue.wait.8', $mortal, 'think trim(v(log))', '^a1 a2 b c$');
+# Semaphore timeouts
+test('queue.wait.9', $mortal, '&log me=', 'Set');
+test('queue.wait.10', $mortal, '@wait me/timed/1=&log me=[v(log)] timedout', '^$');
+test('queue.wait.11', $mortal, '@wait me/timed=&log me=[v(log)] forever', '^$');
+sleep(2);
+test('queue.wait.12', $mortal, 'think trim(v(log))/[words(getpids(me/timed))]/[get(me/timed)]', '^timedout/1/1$');
+test('queue.wait.13', $mortal, '@drain me/timed', 'Drained');
+# Moving a wait with @waitpid
+test('queue.waitpid.1', $mortal, '&log me=', 'Set');
+test('queue.waitpid.2', $mortal, '@wait 1000=&log me=[v(log)] moved', '^$');
+test('queue.waitpid.3', $mortal, '@wait 2=&log me=[v(log)] second', '^$');
+test('queue.waitpid.4', $mortal, '@wait/pid [last(lpids(me,wait))]=1', 'updated');
+sleep(3);
+test('queue.waitpid.5', $mortal, 'think trim(v(log))/[words(lpids(me,wait))]', '^moved second/0$');
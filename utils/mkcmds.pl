@@ -181,6 +181,8 @@ EOH
 
 sub make_tests {
     my @tests = scan_files_for_pattern("src/*.c", qr/TEST_GROUP\((\w+)\)/);
+    my @benchmarks =
+        scan_files_for_pattern("src/*.c", qr/^BENCHMARK\((\w+)\)/);
     my %depends;
     for my $dep (scan_files_for_pattern("src/*.c", qr#// TEST (\w+ REQUIRES .*)#)) {
         my @bits = split/\s+/, $dep;
@@ -206,6 +208,7 @@ sub make_tests {
     push @tmpfiles, $tmpfile;
     print $HDR "/* Auto-generated file. DO NOT EDIT */\n";
     print $HDR "void test_$_(int *, int *);\n" for @tests;
+    print $HDR "void bench_$_(void);\n" for @benchmarks;
     print $HDR <<EOF;
 struct test_record {
     const char *name;
@@ -232,6 +235,20 @@ EOF
     print $HDR <<EOF;
 {NULL, NULL, NULL, TEST_NOT_RUN}
 };
+
+struct bench_record {
+    const char *name;
+    void (*fun)(void);
+};
+
+static struct bench_record benchmarks[] = {
+EOF
+
+    print $HDR "{\"$_\", bench_$_},\n" for @benchmarks;
+
+    print $HDR <<EOF;
+{NULL, NULL}
+};
 EOF
 
     close $HDR;